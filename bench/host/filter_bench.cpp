@@ -0,0 +1,372 @@
+/*
+ * Host microbenchmark for Filter::matchesDevice.
+ *
+ * Replays an advertisement corpus through a set of filter criteria mixes and
+ * reports ns/report, match counts and heap allocations per mix. The corpus is
+ * either generated (deterministic, --seed), read from a file holding one
+ * hex encoded AD payload per line (--corpus) or replayed from a binary scan
+ * capture log (--capture).
+ */
+#include "central/capture_format.hpp"
+#include "central/filter.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+// Heap accounting through the linker's --wrap for the libc allocator, and
+// the replaced global operator new below for C++ allocations
+static size_t allocationCount = 0;
+
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+  allocationCount++;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+  allocationCount++;
+  return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  allocationCount++;
+  return __real_realloc(ptr, size);
+}
+}
+
+// libstdc++ allocates through its own malloc reference, which --wrap does
+// not reach, so new and delete are replaced here and counted once
+void *operator new(size_t size) {
+  allocationCount++;
+  void *ptr = __real_malloc(size ? size : 1);
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  allocationCount++;
+  return __real_malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept {
+  return operator new(size, tag);
+}
+
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete[](void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { free(ptr); }
+
+namespace {
+
+constexpr size_t kMaxAdLength = CAPTURE_MAX_AD_LENGTH;
+
+struct Report {
+  bt_addr_le_t addr;
+  int8_t rssi;
+  uint8_t adv_type;
+  uint8_t length;
+  uint8_t data[kMaxAdLength];
+};
+
+struct CriteriaMix {
+  const char *name;
+  void (*build)(Filter &filter);
+};
+
+// Small deterministic generator so corpora are reproducible across hosts
+struct Lcg {
+  uint32_t state;
+  uint32_t next() {
+    state = state * 1664525u + 1013904223u;
+    return state >> 8;
+  }
+  uint32_t below(uint32_t bound) { return next() % bound; }
+};
+
+bool appendField(Report &report, uint8_t type, const void *value,
+                 uint8_t length) {
+  if ((size_t)report.length + 2 + length > kMaxAdLength) {
+    return false;
+  }
+  report.data[report.length++] = length + 1;
+  report.data[report.length++] = type;
+  memcpy(&report.data[report.length], value, length);
+  report.length += length;
+  return true;
+}
+
+std::vector<Report> generateCorpus(size_t count, uint32_t seed) {
+  static const char *const names[] = {"Mikael1", "Mikael2", "BenchP3_1",
+                                      "Sensor-42", "TV", "Headphones X",
+                                      "Tag 0017", "Mikael15"};
+  std::vector<Report> corpus(count);
+  Lcg rng{seed};
+
+  for (Report &report : corpus) {
+    memset(&report, 0, sizeof(report));
+    report.addr.type = rng.below(2);
+    for (uint8_t &byte : report.addr.a.val) {
+      byte = rng.next();
+    }
+    report.rssi = -30 - (int8_t)rng.below(70);
+    report.adv_type = rng.below(4) ? BT_GAP_ADV_TYPE_ADV_IND
+                                   : BT_GAP_ADV_TYPE_ADV_NONCONN_IND;
+
+    uint8_t flags = 0x06;
+    appendField(report, BT_DATA_FLAGS, &flags, 1);
+
+    // Mix of field layouts seen in crowded environments
+    uint32_t shape = rng.below(4);
+    if (shape == 0 || shape == 1) {
+      const char *name = names[rng.below(ARRAY_SIZE(names))];
+      appendField(report, BT_DATA_NAME_COMPLETE, name, strlen(name));
+    }
+    if (shape == 1 || shape == 2) {
+      uint8_t mfg[8];
+      for (uint8_t &byte : mfg) {
+        byte = rng.next();
+      }
+      appendField(report, BT_DATA_MANUFACTURER_DATA, mfg,
+                  2 + rng.below(sizeof(mfg) - 1));
+    }
+    if (shape == 2) {
+      uint8_t uuid16[2] = {0x0d, 0x18};
+      appendField(report, BT_DATA_UUID16_ALL, uuid16, sizeof(uuid16));
+    }
+    if (shape == 3) {
+      uint8_t uuid128[16];
+      for (uint8_t &byte : uuid128) {
+        byte = rng.next();
+      }
+      appendField(report, BT_DATA_UUID128_ALL, uuid128, sizeof(uuid128));
+    }
+  }
+
+  return corpus;
+}
+
+int hexValue(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+bool loadCorpus(const char *path, std::vector<Report> &corpus) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+
+  char line[256];
+  while (fgets(line, sizeof(line), file)) {
+    Report report = {};
+    report.rssi = -60;
+    report.adv_type = BT_GAP_ADV_TYPE_ADV_IND;
+    for (size_t i = 0; line[i] && line[i + 1] && report.length < kMaxAdLength;
+         i += 2) {
+      int high = hexValue(line[i]);
+      int low = hexValue(line[i + 1]);
+      if (high < 0 || low < 0) {
+        break;
+      }
+      report.data[report.length++] = (high << 4) | low;
+    }
+    if (report.length > 0) {
+      corpus.push_back(report);
+    }
+  }
+
+  fclose(file);
+  return !corpus.empty();
+}
+
+bool loadCapture(const char *path, std::vector<Report> &corpus) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+
+  std::vector<uint8_t> log;
+  uint8_t chunk[4096];
+  size_t read;
+  while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    log.insert(log.end(), chunk, chunk + read);
+  }
+  fclose(file);
+
+  if (log.size() < CAPTURE_HEADER_SIZE ||
+      !CaptureFormat::checkHeader(log.data())) {
+    fprintf(stderr, "%s: not a scan capture log\n", path);
+    return false;
+  }
+
+  // Timing is ignored, the benchmark replays as fast as possible
+  size_t offset = CAPTURE_HEADER_SIZE;
+  while (offset < log.size()) {
+    struct capture_record record;
+    int consumed = CaptureFormat::decode(&log[offset], log.size() - offset,
+                                         record);
+    if (consumed <= 0) {
+      break;
+    }
+    offset += consumed;
+
+    if (!record.ad) {
+      continue; // Padding
+    }
+
+    Report report = {};
+    report.addr = record.addr;
+    report.rssi = record.rssi;
+    report.adv_type = record.adv_type;
+    report.length = record.ad_length;
+    memcpy(report.data, record.ad, record.ad_length);
+    corpus.push_back(report);
+  }
+
+  return !corpus.empty();
+}
+
+const CriteriaMix kMixes[] = {
+    {"match_all", [](Filter &) {}},
+    {"name_exact",
+     [](Filter &f) {
+       f.addGroup();
+       f.addCriterion(FilterCriterionType::LOCAL_NAME, "Mikael1");
+     }},
+    {"name_wildcard",
+     [](Filter &f) {
+       f.addGroup();
+       f.addCriterion(FilterCriterionType::LOCAL_NAME, "Mikael*");
+     }},
+    {"manufacturer_data",
+     [](Filter &f) {
+       f.addGroup();
+       f.addCriterion(FilterCriterionType::MANUFACTURER_DATA, "59*");
+     }},
+    {"service_uuid",
+     [](Filter &f) {
+       f.addGroup();
+       f.addCriterion(FilterCriterionType::SERVICE_UUID, "0D18*");
+     }},
+    {"and_group",
+     [](Filter &f) {
+       f.addGroup();
+       f.addCriterion(FilterCriterionType::LOCAL_NAME, "Sensor*");
+       f.addCriterion(FilterCriterionType::MANUFACTURER_DATA, "*");
+     }},
+    {"or_groups",
+     [](Filter &f) {
+       for (const char *name : {"Mikael1", "Mikael2", "BenchP*", "Tag*"}) {
+         f.addGroup();
+         f.addCriterion(FilterCriterionType::LOCAL_NAME, name);
+       }
+     }},
+};
+
+void usage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [--reports N] [--passes N] [--seed N] [--corpus FILE]\n"
+          "       [--capture FILE]\n",
+          program);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  size_t reports = 4096;
+  size_t passes = 200;
+  uint32_t seed = 1;
+  const char *corpusPath = nullptr;
+  const char *capturePath = nullptr;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--reports") && i + 1 < argc) {
+      reports = strtoul(argv[++i], nullptr, 0);
+    } else if (!strcmp(argv[i], "--passes") && i + 1 < argc) {
+      passes = strtoul(argv[++i], nullptr, 0);
+    } else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+      seed = strtoul(argv[++i], nullptr, 0);
+    } else if (!strcmp(argv[i], "--corpus") && i + 1 < argc) {
+      corpusPath = argv[++i];
+    } else if (!strcmp(argv[i], "--capture") && i + 1 < argc) {
+      capturePath = argv[++i];
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  std::vector<Report> corpus;
+  if (capturePath) {
+    if (!loadCapture(capturePath, corpus)) {
+      return 1;
+    }
+  } else if (corpusPath) {
+    if (!loadCorpus(corpusPath, corpus)) {
+      return 1;
+    }
+  } else {
+    corpus = generateCorpus(reports, seed);
+  }
+
+  std::vector<net_buf_simple> buffers(corpus.size());
+  for (size_t i = 0; i < corpus.size(); i++) {
+    net_buf_simple_init_with_data(&buffers[i], corpus[i].data,
+                                  corpus[i].length);
+  }
+
+  for (const CriteriaMix &mix : kMixes) {
+    Filter filter;
+    mix.build(filter);
+
+    // Warm up caches and branch predictors
+    size_t matches = 0;
+    for (size_t i = 0; i < corpus.size(); i++) {
+      matches += filter.matchesDevice(&corpus[i].addr, corpus[i].rssi,
+                                      corpus[i].adv_type, &buffers[i]);
+    }
+
+    size_t allocationsBefore = allocationCount;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t pass = 0; pass < passes; pass++) {
+      for (size_t i = 0; i < corpus.size(); i++) {
+        filter.matchesDevice(&corpus[i].addr, corpus[i].rssi,
+                             corpus[i].adv_type, &buffers[i]);
+      }
+    }
+    auto stop = std::chrono::steady_clock::now();
+    size_t allocations = allocationCount - allocationsBefore;
+
+    double totalNs =
+        std::chrono::duration<double, std::nano>(stop - start).count();
+    double evaluated = (double)passes * corpus.size();
+
+    printf("BENCH {\"suite\":\"filter\",\"mix\":\"%s\",\"reports\":%zu,"
+           "\"passes\":%zu,\"ns_per_report\":%.1f,\"matches\":%zu,"
+           "\"allocs_per_report\":%.3f}\n",
+           mix.name, corpus.size(), passes, totalNs / evaluated, matches,
+           allocations / evaluated);
+  }
+
+  return 0;
+}
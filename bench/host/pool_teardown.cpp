@@ -0,0 +1,124 @@
+/*
+ * Host test for ObjectPool::destroy, the teardown path of every role object.
+ *
+ * Owners stand in for Central and Peripheral: they register in a registry on
+ * construction and claim links in an owner table the way ConnectionBus::bind
+ * does, and their destructors undo both like the real ones. After a destroy
+ * nothing may point into the freed slot, stale handles must resolve to
+ * nullptr and the slot must come back with a new generation. Exits non-zero
+ * on the first violation.
+ */
+#include "common/object_pool.hpp"
+
+#include <cstdio>
+
+namespace {
+
+constexpr uint8_t kOwners = 3;
+constexpr uint8_t kLinks = 8;
+
+struct Owner;
+Owner *registry[kOwners] = {nullptr};
+Owner *links[kLinks] = {nullptr};
+int destructed = 0;
+
+struct Owner {
+  uint8_t index = 0;
+
+  Owner() {
+    for (uint8_t i = 0; i < kOwners; i++) {
+      if (!registry[i]) {
+        index = i;
+        registry[i] = this;
+        return;
+      }
+    }
+  }
+
+  ~Owner() {
+    // What ConnectionBus::unbind does for Central and Peripheral
+    for (Owner *&link : links) {
+      if (link == this) {
+        link = nullptr;
+      }
+    }
+    registry[index] = nullptr;
+    destructed++;
+  }
+
+  void bind(uint8_t link) { links[link] = this; }
+};
+
+ObjectPool<Owner, kOwners> owners("owners");
+
+int failures = 0;
+
+void check(bool condition, const char *what) {
+  if (!condition) {
+    fprintf(stderr, "FAIL: %s\n", what);
+    failures++;
+  }
+}
+
+bool pointsInto(const Owner *owner) {
+  for (const Owner *link : links) {
+    if (link == owner) {
+      return true;
+    }
+  }
+  for (const Owner *entry : registry) {
+    if (entry == owner) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+int main() {
+  struct pool_handle handles[kOwners];
+  for (uint8_t i = 0; i < kOwners; i++) {
+    handles[i] = owners.create();
+    check(handles[i].isValid(), "create within capacity");
+  }
+  check(!owners.create().isValid(), "create past capacity fails");
+  check(owners.used() == kOwners, "used counts every live object");
+
+  Owner *middle = owners.get(handles[1]);
+  middle->bind(2);
+  middle->bind(5);
+  owners.get(handles[0])->bind(0);
+
+  check(owners.destroy(handles[1]) == 0, "destroy a live object");
+  check(destructed == 1, "destroy runs the destructor once");
+  check(!pointsInto(middle), "no registry entry or link left on the slot");
+  check(links[0] == owners.get(handles[0]), "other owners keep their links");
+  check(owners.get(handles[1]) == nullptr, "stale handle resolves to nullptr");
+  check(!owners.handleOf(middle).isValid(), "freed slot has no handle");
+  check(owners.used() == kOwners - 1, "used drops on destroy");
+
+  check(owners.destroy(handles[1]) == -ENOENT, "double destroy is refused");
+  check(owners.destroy(POOL_HANDLE_INVALID) == -ENOENT,
+        "invalid handle is refused");
+  check(destructed == 1, "refused destroys run no destructor");
+
+  struct pool_handle reused = owners.create();
+  check(reused.index == handles[1].index, "freed slot is reused");
+  check(reused.generation != handles[1].generation,
+        "reused slot gets a new generation");
+  check(owners.get(handles[1]) == nullptr, "old handle stays stale");
+  check(owners.highWater() == kOwners, "high water survives teardown");
+
+  handles[1] = reused;
+  for (struct pool_handle handle : handles) {
+    check(owners.destroy(handle) == 0, "destroy every object");
+  }
+  check(owners.used() == 0, "pool is empty after teardown");
+  for (const Owner *link : links) {
+    check(link == nullptr, "no link outlives its owner");
+  }
+
+  printf("pool_teardown: %s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * Host shim: Bluetooth address and advertising data types used by Filter.
+ */
+#pragma once
+
+#include <stdio.h>
+#include <zephyr/kernel.h>
+
+typedef struct {
+  uint8_t val[6];
+} bt_addr_t;
+
+typedef struct {
+  uint8_t type;
+  bt_addr_t a;
+} bt_addr_le_t;
+
+#define BT_ADDR_LE_PUBLIC 0x00
+#define BT_ADDR_LE_RANDOM 0x01
+
+static inline int bt_addr_le_cmp(const bt_addr_le_t *a, const bt_addr_le_t *b) {
+  return memcmp(a, b, sizeof(*a));
+}
+
+static inline void bt_addr_le_copy(bt_addr_le_t *dst, const bt_addr_le_t *src) {
+  memcpy(dst, src, sizeof(*dst));
+}
+
+#define BT_ADDR_STR_LEN 18
+
+static inline int bt_addr_to_str(const bt_addr_t *addr, char *str,
+                                 size_t len) {
+  return snprintf(str, len, "%02X:%02X:%02X:%02X:%02X:%02X", addr->val[5],
+                  addr->val[4], addr->val[3], addr->val[2], addr->val[1],
+                  addr->val[0]);
+}
+
+struct net_buf_simple {
+  uint8_t *data;
+  uint16_t len;
+  uint16_t size;
+  uint8_t *__buf;
+};
+
+static inline void net_buf_simple_init_with_data(struct net_buf_simple *buf,
+                                                 void *data, size_t size) {
+  buf->__buf = (uint8_t *)data;
+  buf->data = (uint8_t *)data;
+  buf->size = (uint16_t)size;
+  buf->len = (uint16_t)size;
+}
+
+#define BT_DATA_FLAGS 0x01
+#define BT_DATA_UUID16_SOME 0x02
+#define BT_DATA_UUID16_ALL 0x03
+#define BT_DATA_UUID32_SOME 0x04
+#define BT_DATA_UUID32_ALL 0x05
+#define BT_DATA_UUID128_SOME 0x06
+#define BT_DATA_UUID128_ALL 0x07
+#define BT_DATA_NAME_SHORTENED 0x08
+#define BT_DATA_NAME_COMPLETE 0x09
+#define BT_DATA_TX_POWER 0x0a
+#define BT_DATA_SVC_DATA16 0x16
+#define BT_DATA_MANUFACTURER_DATA 0xff
+
+#define BT_GAP_ADV_TYPE_ADV_IND 0x00
+#define BT_GAP_ADV_TYPE_ADV_NONCONN_IND 0x03
+#define BT_GAP_ADV_TYPE_SCAN_RSP 0x04
+#define BT_GAP_ADV_TYPE_EXT_ADV 0x05
@@ -0,0 +1,6 @@
+/*
+ * Host shim: nothing from <zephyr/bluetooth/hci.h> is needed on the host.
+ */
+#pragma once
+
+#include <zephyr/bluetooth/bluetooth.h>
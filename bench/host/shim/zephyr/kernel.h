@@ -0,0 +1,18 @@
+/*
+ * Host shim: the minimum of <zephyr/kernel.h> needed to build BlueSim
+ * sources that do not touch kernel objects.
+ */
+#pragma once
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#define __ASSERT(test, fmt, ...) ((void)(test))
+#define ARG_UNUSED(x) (void)(x)
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
@@ -0,0 +1,28 @@
+/*
+ * Host shim: logging compiles out so benchmarks measure the code under test
+ * only. Arguments are still type-checked.
+ */
+#pragma once
+
+#include <stdio.h>
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERR 1
+#define LOG_LEVEL_WRN 2
+#define LOG_LEVEL_INF 3
+#define LOG_LEVEL_DBG 4
+
+#define LOG_MODULE_REGISTER(...)
+#define LOG_MODULE_DECLARE(...)
+
+#define Z_LOG_DISCARD(...)                                                     \
+  do {                                                                         \
+    if (0) {                                                                   \
+      printf(__VA_ARGS__);                                                     \
+    }                                                                          \
+  } while (0)
+
+#define LOG_ERR(...) Z_LOG_DISCARD(__VA_ARGS__)
+#define LOG_WRN(...) Z_LOG_DISCARD(__VA_ARGS__)
+#define LOG_INF(...) Z_LOG_DISCARD(__VA_ARGS__)
+#define LOG_DBG(...) Z_LOG_DISCARD(__VA_ARGS__)
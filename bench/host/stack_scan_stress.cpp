@@ -0,0 +1,212 @@
+/*
+ * Host stress test for StackScan, the controller scanning state machine.
+ *
+ * Threads stand in for the Bluetooth RX thread and the work queues: each one
+ * flips its own scanner's demand and settles, and now and then holds the
+ * controller off as its connection attempt would. The stack is replaced by a
+ * fake controller that counts overlapping calls and redundant transitions.
+ * After every round, with all threads joined and no further settle, the
+ * controller must match the demand left behind. Exits non-zero on the first
+ * violation.
+ */
+#include "central/stack_scan.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct FakeController {
+  std::atomic<int> inFlight{0};
+  std::atomic<bool> scanning{false};
+  std::atomic<uint32_t> starts{0};
+  std::atomic<uint32_t> stops{0};
+  std::atomic<uint32_t> overlaps{0};  // Calls while another was in flight
+  std::atomic<uint32_t> redundant{0}; // Start while scanning, stop while not
+};
+
+FakeController controller;
+
+// Threads meet here before their last change of the round, so the final
+// settles race each other instead of the last one running alone
+std::atomic<size_t> arrived{0};
+size_t threadCount = 0;
+
+// Keeps the call in flight long enough for other threads to pile up on it
+void slowCall(bool scanning) {
+  if (controller.inFlight.fetch_add(1) != 0) {
+    controller.overlaps++;
+  }
+  if (controller.scanning.load() == scanning) {
+    controller.redundant++;
+  }
+  std::this_thread::yield();
+  controller.scanning.store(scanning);
+  controller.inFlight.fetch_sub(1);
+}
+
+int fakeStart() {
+  slowCall(true);
+  controller.starts++;
+  return 0;
+}
+
+int fakeStop() {
+  slowCall(false);
+  controller.stops++;
+  return 0;
+}
+
+// Small deterministic generator so runs are reproducible across hosts
+uint32_t nextRandom(uint32_t &state) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+void worker(uint8_t index, size_t iterations, uint32_t seed) {
+  uint32_t random = seed * 2654435761U + index + 1;
+  for (size_t i = 0; i < iterations; i++) {
+    uint32_t roll = nextRandom(random) % 8;
+    if (roll == 0) {
+      // A connection attempt: off while it runs, back after it resolves
+      StackScan::release(index);
+      StackScan::hold(index);
+      StackScan::settle();
+      std::this_thread::yield();
+      StackScan::want(index);
+      StackScan::unhold(index);
+      StackScan::settle();
+    } else if (roll < 4) {
+      StackScan::want(index);
+      StackScan::settle();
+    } else {
+      StackScan::release(index);
+      StackScan::settle();
+    }
+  }
+
+  arrived++;
+  while (arrived.load() < threadCount) {
+    std::this_thread::yield();
+  }
+
+  // Leave a random demand behind for the round's check
+  if (nextRandom(random) & 1) {
+    StackScan::want(index);
+  } else {
+    StackScan::release(index);
+  }
+  StackScan::settle();
+}
+
+// Overlapping connection attempts: one scanner resolving its own must not
+// give the controller back while another is still creating
+bool holdsAreScoped() {
+  StackScan::hold(0);
+  StackScan::hold(1);
+  StackScan::want(2);
+  StackScan::settle();
+  bool ok = !controller.scanning.load();
+
+  StackScan::unhold(0);
+  StackScan::settle();
+  ok &= !controller.scanning.load();
+
+  StackScan::unhold(1);
+  StackScan::settle();
+  ok &= controller.scanning.load();
+
+  StackScan::release(2);
+  StackScan::settle();
+  return ok && !controller.scanning.load();
+}
+
+void usage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [--threads N] [--iterations N] [--rounds N] "
+          "[--seed N]\n",
+          program);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  size_t threads = 4;
+  size_t iterations = 20000;
+  size_t rounds = 50;
+  uint32_t seed = 1;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+      threads = strtoul(argv[++i], nullptr, 0);
+    } else if (!strcmp(argv[i], "--iterations") && i + 1 < argc) {
+      iterations = strtoul(argv[++i], nullptr, 0);
+    } else if (!strcmp(argv[i], "--rounds") && i + 1 < argc) {
+      rounds = strtoul(argv[++i], nullptr, 0);
+    } else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+      seed = strtoul(argv[++i], nullptr, 0);
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (threads == 0 || threads > ATOMIC_BITS) {
+    fprintf(stderr, "--threads must be 1 to %zu\n", (size_t)ATOMIC_BITS);
+    return 1;
+  }
+
+  StackScan::init(fakeStart, fakeStop);
+  if (!holdsAreScoped()) {
+    fprintf(stderr, "A scanner lifted another scanner's hold\n");
+    return 1;
+  }
+
+  auto begin = std::chrono::steady_clock::now();
+  for (size_t round = 0; round < rounds; round++) {
+    std::vector<std::thread> pool;
+    arrived = 0;
+    threadCount = threads;
+    for (size_t t = 0; t < threads; t++) {
+      pool.emplace_back(worker, (uint8_t)t, iterations, seed + round);
+    }
+    for (std::thread &thread : pool) {
+      thread.join();
+    }
+
+    bool wanted = false;
+    for (size_t t = 0; t < threads; t++) {
+      wanted |= StackScan::wants((uint8_t)t);
+    }
+
+    if (controller.overlaps || controller.redundant ||
+        StackScan::rejectedTransitions() ||
+        StackScan::isScanning() != wanted ||
+        controller.scanning.load() != wanted) {
+      fprintf(stderr,
+              "Round %zu: wanted %d, state %d, controller %d, overlaps %u, "
+              "redundant %u, rejected %u\n",
+              round, wanted, (int)StackScan::state(),
+              controller.scanning.load(), controller.overlaps.load(),
+              controller.redundant.load(), StackScan::rejectedTransitions());
+      return 1;
+    }
+  }
+  auto elapsed = std::chrono::steady_clock::now() - begin;
+
+  size_t operations = threads * iterations * rounds;
+  double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+  printf("BENCH {\"suite\":\"stack_scan\",\"threads\":%zu,\"rounds\":%zu,"
+         "\"operations\":%zu,\"starts\":%u,\"stops\":%u,"
+         "\"ns_per_op\":%.1f}\n",
+         threads, rounds, operations, controller.starts.load(),
+         controller.stops.load(), ns / (double)operations);
+  return 0;
+}
@@ -0,0 +1,407 @@
+#!/usr/bin/env python3
+"""Host client for the BlueSim RPC control plane.
+
+Talks to a device built with CONFIG_BLUESIM_RPC over the stream UART (uart1
+on the DK, the second PTY on native_sim). Usable as a library from a test
+runner or from the command line:
+
+    ./scripts/bluesim_rpc.py /dev/ttyUSB0 ping --count 1000
+    ./scripts/bluesim_rpc.py /dev/pts/5 filter 0 "LOCAL_NAME=Mikael*"
+    ./scripts/bluesim_rpc.py /dev/pts/5 set-value 0 0 1 00ff
+    ./scripts/bluesim_rpc.py /dev/pts/5 adv-status 0
+    ./scripts/bluesim_rpc.py /dev/pts/5 trace-dump | ./scripts/trace_decode.py
+
+Every call records its round trip time and the device's service time (from
+the request's delimiter to the response being queued), the difference is the
+link and host side.
+"""
+
+import argparse
+import errno
+import os
+import select
+import struct
+import sys
+import time
+
+from stream_decode import cobs_decode, configure_tty
+
+# Mirrors StreamFrame in src/common/uart_stream.hpp
+RPC_RESPONSE = 4
+RPC_REQUEST = 0x80
+
+# Mirrors RpcOp in src/rpc/rpc.hpp
+PING = 0x00
+STATS = 0x01
+WORKQ_STATS = 0x02
+TRACE_DUMP = 0x03
+TRACE_CLEAR = 0x04
+CENTRAL_SCAN_START = 0x10
+CENTRAL_SCAN_STOP = 0x11
+CENTRAL_STATUS = 0x12
+SCANNER_STATUS = 0x20
+SCANNER_POLICY = 0x21
+FILTER_SET = 0x30
+ADV_START = 0x40
+ADV_STOP = 0x41
+ADV_STATUS = 0x42
+PERIPHERAL_STATUS = 0x43
+CHAR_SET_VALUE = 0x50
+STREAM_REPORTS = 0x60
+RPA_ADD = 0x70
+
+# Mirrors FilterCriterionType and FilterOperator in src/central/filter.hpp
+CRITERIA = {"LOCAL_NAME": 0, "MANUFACTURER_DATA": 1, "SERVICE_UUID": 2,
+            "CHARACTERISTIC_UUID": 3, "IDENTITY": 4}
+OPERATORS = {"AND": 0, "OR": 1}
+
+# WORKQ_STATS queue argument, WorkQueue::radio and WorkQueue::data
+WORK_QUEUES = ["radio", "data"]
+
+# RPA_ADD identity address types, BT_ADDR_LE_PUBLIC and BT_ADDR_LE_RANDOM
+ADDRESS_TYPES = ["public", "random"]
+
+# Mirrors SelectionPolicy in src/central/device_table.hpp
+SELECTION_POLICIES = ["strongest", "least_recently_connected", "round_robin"]
+
+# Mirrors AdvState in src/peripheral/advertisement.hpp
+ADV_STATES = ["IDLE", "ADVERTISING", "SUSPENDED", "WAITING_FOR_SLOT"]
+
+RESPONSE_HEADER = struct.Struct("<HBhI")
+# TRACE_DUMP result ahead of the records: cpus, hz, head, first
+TRACE_PAGE = struct.Struct("<BIII")
+TRACE_RECORD_SIZE = 12
+
+
+def cobs_encode(data):
+    out = bytearray()
+    block = bytearray()
+    for byte in data:
+        if byte == 0:
+            out += bytes([len(block) + 1]) + block
+            block = bytearray()
+            continue
+        block.append(byte)
+        if len(block) == 0xFE:
+            out += b"\xff" + block
+            block = bytearray()
+    out += bytes([len(block) + 1]) + block
+    return bytes(out)
+
+
+def unpack_advertising_stats(result, offset):
+    fields = struct.unpack_from("<3IQ3I", result, offset)
+    return dict(zip(("gap_count", "last_gap_us", "max_gap_us",
+                     "total_gap_us", "connected_events", "sent_events",
+                     "scanned_events"), fields))
+
+
+class RpcError(Exception):
+    def __init__(self, op, status):
+        super().__init__("op 0x%02x failed: %s" % (
+            op, os.strerror(-status) if -status in errno.errorcode
+            else status))
+        self.op = op
+        self.status = status
+
+
+class BlueSimRpc:
+    def __init__(self, port, baud=1000000, timeout=1.0):
+        self.fd = os.open(port, os.O_RDWR | os.O_NOCTTY)
+        if os.isatty(self.fd):
+            configure_tty(self.fd, baud)
+        self.timeout = timeout
+        self.next_id = 0
+        self.pending = bytearray()
+        # (op, round trip us, device service us) per completed call
+        self.latencies = []
+
+    def close(self):
+        os.close(self.fd)
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def call(self, op, args=b""):
+        request_id = self.next_id
+        self.next_id = (self.next_id + 1) & 0xFFFF
+        frame = bytes([RPC_REQUEST, request_id & 0xFF]) + \
+            struct.pack("<HB", request_id, op) + bytes(args)
+
+        start = time.perf_counter()
+        os.write(self.fd, cobs_encode(frame) + b"\0")
+        while True:
+            payload = self._next_response(start + self.timeout)
+            response_id, response_op, status, service_us = \
+                RESPONSE_HEADER.unpack_from(payload)
+            if response_id == request_id:
+                break
+
+        rtt_us = (time.perf_counter() - start) * 1e6
+        self.latencies.append((op, rtt_us, service_us))
+        if status < 0:
+            raise RpcError(op, status)
+        return payload[RESPONSE_HEADER.size:]
+
+    def _next_response(self, deadline):
+        while True:
+            while b"\0" in self.pending:
+                raw, _, rest = self.pending.partition(b"\0")
+                self.pending = bytearray(rest)
+                try:
+                    frame = cobs_decode(bytes(raw)) if raw else b""
+                except ValueError:
+                    continue
+                # Scan reports and stats share the link, skip them
+                if len(frame) >= 2 + RESPONSE_HEADER.size and \
+                        frame[0] == RPC_RESPONSE:
+                    return frame[2:]
+
+            remaining = deadline - time.perf_counter()
+            if remaining <= 0:
+                raise TimeoutError("no RPC response")
+            ready, _, _ = select.select([self.fd], [], [], remaining)
+            if ready:
+                self.pending += os.read(self.fd, 65536)
+
+    def ping(self, payload=b""):
+        return self.call(PING, payload)
+
+    def stats(self):
+        fields = struct.unpack("<6IQ", self.call(STATS))
+        return dict(zip(("calls", "errors", "bad_frames", "rx_dropped",
+                         "last_service_us", "max_service_us",
+                         "total_service_us"), fields))
+
+    def workq_stats(self, queue):
+        fields = struct.unpack("<5IQ", self.call(WORKQ_STATS, [queue]))
+        return dict(zip(("executed", "backlog", "max_backlog",
+                         "last_latency_us", "max_latency_us",
+                         "total_latency_us"), fields))
+
+    def trace_dump(self, clear=False):
+        """Page every CPU's trace ring out and return the TRACE_BEGIN, TRACE
+        and TRACE_END lines trace_decode.py reads. Stops at each ring's head
+        as of its first page, so a busy device cannot keep it going."""
+        lines = []
+        cpu = 0
+        cpus = 1
+        while cpu < cpus:
+            records = []
+            start = 0
+            end = None
+            while end is None or start < end:
+                result = self.call(TRACE_DUMP, struct.pack("<BI", cpu, start))
+                cpus, hz, head, first = TRACE_PAGE.unpack_from(result)
+                if end is None:
+                    end = head
+                    overwritten = first
+                page = result[TRACE_PAGE.size:]
+                count = min(len(page) // TRACE_RECORD_SIZE, end - first)
+                if count <= 0:
+                    break
+                for i in range(count):
+                    offset = i * TRACE_RECORD_SIZE
+                    records.append(page[offset:offset + TRACE_RECORD_SIZE])
+                start = first + count
+
+            lines.append("TRACE_BEGIN cpu=%u hz=%u count=%u overwritten=%u"
+                         % (cpu, hz, len(records), overwritten))
+            lines.extend("TRACE " + record.hex() for record in records)
+            lines.append("TRACE_END cpu=%u" % cpu)
+            cpu += 1
+
+        if clear:
+            self.call(TRACE_CLEAR)
+        return lines
+
+    def scan_start(self, central):
+        self.call(CENTRAL_SCAN_START, [central])
+
+    def scan_stop(self, central):
+        self.call(CENTRAL_SCAN_STOP, [central])
+
+    def central_status(self, central):
+        connections, maximum, scanning = self.call(CENTRAL_STATUS, [central])
+        return {"connections": connections, "max_connections": maximum,
+                "scanning": bool(scanning)}
+
+    def scanner_status(self, scanner):
+        scanning, stack_scanning, syncs, policy = self.call(SCANNER_STATUS,
+                                                            [scanner])
+        return {"scanning": bool(scanning),
+                "stack_scanning": bool(stack_scanning),
+                "periodic_syncs": syncs,
+                "policy": SELECTION_POLICIES[policy]}
+
+    def set_policy(self, scanner, policy):
+        self.call(SCANNER_POLICY, [scanner, SELECTION_POLICIES.index(policy)])
+
+    def set_filter(self, central, groups):
+        """groups: list of (operator, [(criterion, pattern), ...]), empty
+        matches everything."""
+        args = bytearray([central])
+        for operator, criteria in groups:
+            args += bytes([OPERATORS[operator], len(criteria)])
+            for criterion, pattern in criteria:
+                encoded = pattern.encode()
+                args += bytes([CRITERIA[criterion], len(encoded)]) + encoded
+        self.call(FILTER_SET, args)
+
+    def adv_start(self, advertisement):
+        self.call(ADV_START, [advertisement])
+
+    def adv_stop(self, advertisement):
+        self.call(ADV_STOP, [advertisement])
+
+    def adv_status(self, advertisement):
+        result = self.call(ADV_STATUS, [advertisement])
+        status = unpack_advertising_stats(result, 1)
+        status["state"] = ADV_STATES[result[0]]
+        return status
+
+    def peripheral_status(self, peripheral):
+        result = self.call(PERIPHERAL_STATUS, [peripheral])
+        status = unpack_advertising_stats(result, 2)
+        status["connections"] = result[0]
+        status["max_connections"] = result[1]
+        return status
+
+    def set_value(self, peripheral, service, characteristic, value):
+        self.call(CHAR_SET_VALUE,
+                  bytes([peripheral, service, characteristic]) + value)
+
+    def stream_reports(self, enabled):
+        self.call(STREAM_REPORTS, [1 if enabled else 0])
+
+    def rpa_add(self, identity, address_type, irk):
+        """identity as AA:BB:CC:DD:EE:FF, irk as 32 hex digits, both most
+        significant byte first like the "rpa add" shell command."""
+        address = bytes.fromhex(identity.replace(":", ""))
+        key = bytes.fromhex(irk)
+        if len(address) != 6 or len(key) != 16:
+            raise ValueError("identity needs 6 bytes and the IRK 16")
+        self.call(RPA_ADD, bytes([ADDRESS_TYPES.index(address_type)]) +
+                  address[::-1] + key[::-1])
+
+
+def percentile(values, fraction):
+    ordered = sorted(values)
+    return ordered[min(int(len(ordered) * fraction), len(ordered) - 1)]
+
+
+def print_latency(latencies):
+    rtt = [entry[1] for entry in latencies]
+    service = [entry[2] for entry in latencies]
+    print("calls=%u rtt_us p50=%.0f p99=%.0f max=%.0f | "
+          "device_us p50=%u p99=%u max=%u"
+          % (len(rtt), percentile(rtt, 0.5), percentile(rtt, 0.99), max(rtt),
+             percentile(service, 0.5), percentile(service, 0.99),
+             max(service)))
+
+
+def parse_group(text):
+    """"[AND|OR:]TYPE=pattern,TYPE=pattern" into a set_filter group."""
+    operator = "AND"
+    if ":" in text and text.split(":", 1)[0] in OPERATORS:
+        operator, text = text.split(":", 1)
+    criteria = []
+    for item in text.split(","):
+        criterion, pattern = item.split("=", 1)
+        criteria.append((criterion, pattern))
+    return operator, criteria
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("port", help="serial device or PTY")
+    parser.add_argument("--baud", type=int, default=1000000)
+    parser.add_argument("--timeout", type=float, default=1.0)
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    ping = sub.add_parser("ping", help="measure round trip latency")
+    ping.add_argument("--count", type=int, default=100)
+    ping.add_argument("--size", type=int, default=0, help="payload bytes")
+    sub.add_parser("stats")
+    sub.add_parser("workq").add_argument("queue", choices=WORK_QUEUES)
+    sub.add_parser("trace-dump").add_argument("--clear", action="store_true")
+    for name in ("scan-start", "scan-stop", "central"):
+        sub.add_parser(name).add_argument("central", type=int)
+    sub.add_parser("scanner").add_argument("scanner", type=int)
+    policy = sub.add_parser("policy", help="set a scanner's selection policy")
+    policy.add_argument("scanner", type=int)
+    policy.add_argument("policy", choices=SELECTION_POLICIES)
+    filt = sub.add_parser("filter", help="replace a central's filter")
+    filt.add_argument("central", type=int)
+    filt.add_argument("groups", nargs="*",
+                      help="[AND|OR:]TYPE=pattern[,TYPE=pattern...]")
+    for name in ("adv-start", "adv-stop", "adv-status"):
+        sub.add_parser(name).add_argument("advertisement", type=int)
+    sub.add_parser("peripheral").add_argument("peripheral", type=int)
+    value = sub.add_parser("set-value")
+    value.add_argument("peripheral", type=int)
+    value.add_argument("service", type=int)
+    value.add_argument("characteristic", type=int)
+    value.add_argument("value", help="hex")
+    reports = sub.add_parser("reports", help="mute or unmute scan reports")
+    reports.add_argument("state", choices=("on", "off"))
+    rpa = sub.add_parser("rpa-add", help="load an IRK for IDENTITY filters")
+    rpa.add_argument("identity", help="AA:BB:CC:DD:EE:FF")
+    rpa.add_argument("type", choices=ADDRESS_TYPES)
+    rpa.add_argument("irk", help="32 hex digits, most significant first")
+    args = parser.parse_args()
+
+    with BlueSimRpc(args.port, args.baud, args.timeout) as rpc:
+        try:
+            if args.command == "ping":
+                payload = bytes(range(args.size))
+                for _ in range(args.count):
+                    if rpc.ping(payload) != payload[:64]:
+                        sys.exit("ping payload mismatch")
+                print_latency(rpc.latencies)
+            elif args.command == "stats":
+                print(rpc.stats())
+            elif args.command == "workq":
+                print(rpc.workq_stats(WORK_QUEUES.index(args.queue)))
+            elif args.command == "trace-dump":
+                print("\n".join(rpc.trace_dump(args.clear)))
+            elif args.command == "scan-start":
+                rpc.scan_start(args.central)
+            elif args.command == "scan-stop":
+                rpc.scan_stop(args.central)
+            elif args.command == "central":
+                print(rpc.central_status(args.central))
+            elif args.command == "scanner":
+                print(rpc.scanner_status(args.scanner))
+            elif args.command == "policy":
+                rpc.set_policy(args.scanner, args.policy)
+            elif args.command == "filter":
+                rpc.set_filter(args.central,
+                               [parse_group(group) for group in args.groups])
+            elif args.command == "adv-start":
+                rpc.adv_start(args.advertisement)
+            elif args.command == "adv-stop":
+                rpc.adv_stop(args.advertisement)
+            elif args.command == "adv-status":
+                print(rpc.adv_status(args.advertisement))
+            elif args.command == "peripheral":
+                print(rpc.peripheral_status(args.peripheral))
+            elif args.command == "set-value":
+                rpc.set_value(args.peripheral, args.service,
+                              args.characteristic, bytes.fromhex(args.value))
+            elif args.command == "reports":
+                rpc.stream_reports(args.state == "on")
+            elif args.command == "rpa-add":
+                rpc.rpa_add(args.identity, args.type, args.irk)
+        except (RpcError, TimeoutError) as err:
+            sys.exit(str(err))
+
+        if args.command != "ping":
+            print_latency(rpc.latencies)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,39 @@
+#!/bin/bash
+# Launch N BlueSim instances on a simulated 2.4 GHz PHY.
+#
+# Usage: run_bsim.sh <zephyr.exe> <devices> [sim_id] [sim_length_us]
+set -e
+
+EXE=$1
+DEVICES=${2:-2}
+SIM_ID=${3:-bluesim}
+SIM_LENGTH_US=${4:-60000000}
+
+if [ -z "${BSIM_OUT_PATH}" ]; then
+  echo "BSIM_OUT_PATH is not set, source the BabbleSim environment first" >&2
+  exit 1
+fi
+
+if [ ! -x "${EXE}" ]; then
+  echo "Simulated image ${EXE} not found, run 'make sim-build' first" >&2
+  exit 1
+fi
+
+PIDS=()
+cleanup() {
+  kill "${PIDS[@]}" 2>/dev/null || true
+}
+trap cleanup EXIT INT TERM
+
+cd "${BSIM_OUT_PATH}/bin"
+
+for ((i = 0; i < DEVICES; i++)); do
+  "${EXE}" -s="${SIM_ID}" -d="${i}" -rs="$((i + 1))" \
+    > "${SIM_ID}_device${i}.log" 2>&1 &
+  PIDS+=($!)
+done
+
+./bs_2G4_phy_v1 -s="${SIM_ID}" -D="${DEVICES}" -sim_length="${SIM_LENGTH_US}"
+
+wait "${PIDS[@]}"
+echo "Device logs: ${BSIM_OUT_PATH}/bin/${SIM_ID}_device*.log"
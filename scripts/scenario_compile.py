@@ -0,0 +1,187 @@
+#!/usr/bin/env python3
+"""Compile a BlueSim scenario description (JSON) into a binary image.
+
+The image layout is documented in src/scenario/scenario_format.hpp. Write it
+as raw binary, or as Intel HEX placed at the scenario partition so it can be
+flashed on its own in seconds without rebuilding the application:
+
+    ./scripts/scenario_compile.py scenarios/default.json -o scenario.hex \\
+        --hex-address 0x82000
+    nrfjprog --program scenario.hex --sectorerase --verify --reset
+"""
+
+import argparse
+import json
+import struct
+import sys
+import uuid
+import zlib
+
+VERSION = 1
+
+# Mirrors ScenarioRecord in src/scenario/scenario_format.hpp
+END, PERIPHERAL, SERVICE, CHARACTERISTIC, CENTRAL, FILTER_GROUP, \
+    FILTER_CRITERION = range(7)
+
+PERIPHERAL_CONNECTABLE = 0x01
+GENERATORS = {"static": 0, "counter": 1}
+
+# BT_GATT_CHRC_* and BT_GATT_PERM_*
+PROPERTIES = {"broadcast": 0x01, "read": 0x02, "write_without_resp": 0x04,
+              "write": 0x08, "notify": 0x10, "indicate": 0x20, "auth": 0x40}
+PERMISSIONS = {"read": 0x01, "write": 0x02, "read_encrypt": 0x04,
+               "write_encrypt": 0x08, "read_authen": 0x10,
+               "write_authen": 0x20}
+
+# FilterOperator and FilterCriterionType in src/central/filter.hpp
+OPERATORS = {"and": 0, "or": 1}
+CRITERIA = {"local_name": 0, "manufacturer_data": 1, "service_uuid": 2,
+            "characteristic_uuid": 3, "identity": 4}
+
+BT_UUID_TYPE_128 = 2
+
+
+class ScenarioError(Exception):
+    pass
+
+
+def record(kind, payload):
+    if len(payload) > 255:
+        raise ScenarioError("record %d is %d bytes, at most 255 fit"
+                            % (kind, len(payload)))
+    return bytes([kind, len(payload)]) + payload
+
+
+def text(value, limit=31):
+    raw = value.encode("utf-8")
+    if len(raw) > limit:
+        raise ScenarioError("'%s' is longer than %d bytes" % (value, limit))
+    return raw + b"\0"
+
+
+def uuid128(value):
+    # struct bt_uuid_128: type, then the value little endian
+    return bytes([BT_UUID_TYPE_128]) + uuid.UUID(value).bytes[::-1]
+
+
+def flags(names, table, what):
+    result = 0
+    for name in names:
+        if name not in table:
+            raise ScenarioError("unknown %s '%s'" % (what, name))
+        result |= table[name]
+    return result
+
+
+def value_bytes(chrc):
+    if "value_hex" in chrc:
+        return bytes.fromhex(chrc["value_hex"])
+    if "value" in chrc:
+        value = chrc["value"]
+        if isinstance(value, int):
+            return struct.pack("<I", value)
+        return value.encode("utf-8")
+    return b""
+
+
+def compile_body(scenario):
+    body = bytearray()
+
+    for peripheral in scenario.get("peripherals", []):
+        connectable = peripheral.get("connectable", True)
+        body += record(PERIPHERAL,
+                       bytes([PERIPHERAL_CONNECTABLE if connectable else 0])
+                       + text(peripheral["name"]))
+
+        for service in peripheral.get("services", []):
+            body += record(SERVICE, uuid128(service["uuid"])
+                           + text(service.get("name", "")))
+
+            for chrc in service.get("characteristics", []):
+                value = value_bytes(chrc)
+                generator = chrc.get("generator", "static")
+                if generator not in GENERATORS:
+                    raise ScenarioError("unknown generator '%s'" % generator)
+                body += record(CHARACTERISTIC, uuid128(chrc["uuid"])
+                               + struct.pack(
+                                   "<BHBB",
+                                   flags(chrc.get("properties", ["read"]),
+                                         PROPERTIES, "property"),
+                                   flags(chrc.get("permissions", ["read"]),
+                                         PERMISSIONS, "permission"),
+                                   GENERATORS[generator], len(value))
+                               + value + text(chrc.get("name", "")))
+
+    for central in scenario.get("centrals", []):
+        body += record(CENTRAL, bytes([central.get("max_connections", 0)]))
+
+        for group in central.get("filter", []):
+            operator = group.get("operator", "and")
+            if operator not in OPERATORS:
+                raise ScenarioError("unknown operator '%s'" % operator)
+            body += record(FILTER_GROUP, bytes([OPERATORS[operator]]))
+
+            for criterion in group.get("criteria", []):
+                kind = criterion.get("type", "local_name")
+                if kind not in CRITERIA:
+                    raise ScenarioError("unknown criterion '%s'" % kind)
+                body += record(FILTER_CRITERION, bytes([CRITERIA[kind]])
+                               + text(criterion["pattern"], 63))
+
+    body += record(END, b"")
+    return bytes(body)
+
+
+def compile_image(scenario):
+    body = compile_body(scenario)
+    if len(body) > 0xFFFF:
+        raise ScenarioError("scenario body is %d bytes" % len(body))
+    header = b"BSSC" + struct.pack("<BBHI", VERSION, 0, len(body),
+                                   zlib.crc32(body) & 0xFFFFFFFF)
+    return header + body
+
+
+def intel_hex(data, address):
+    lines = []
+    upper = None
+    for offset in range(0, len(data), 16):
+        current = address + offset
+        if current >> 16 != upper:
+            upper = current >> 16
+            lines.append(hex_line(0, 4, struct.pack(">H", upper)))
+        lines.append(hex_line(current & 0xFFFF, 0, data[offset:offset + 16]))
+    lines.append(":00000001FF")
+    return "\n".join(lines) + "\n"
+
+
+def hex_line(address, kind, payload):
+    raw = bytes([len(payload), address >> 8, address & 0xFF, kind]) + payload
+    checksum = (-sum(raw)) & 0xFF
+    return ":" + raw.hex().upper() + "%02X" % checksum
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("scenario", type=argparse.FileType("r"))
+    parser.add_argument("-o", "--output", required=True)
+    parser.add_argument("--hex-address", type=lambda v: int(v, 0),
+                        help="write Intel HEX at this flash address")
+    args = parser.parse_args()
+
+    try:
+        image = compile_image(json.load(args.scenario))
+    except (ScenarioError, KeyError, ValueError) as err:
+        sys.exit("%s: %s" % (args.scenario.name, err))
+
+    if args.hex_address is not None:
+        with open(args.output, "w") as out:
+            out.write(intel_hex(image, args.hex_address))
+    else:
+        with open(args.output, "wb") as out:
+            out.write(image)
+
+    print("%s: %d bytes" % (args.output, len(image)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+"""Decode the BlueSim binary scan report stream.
+
+Reads COBS framed, 0x00 delimited frames from the stream UART (uart1 on the
+DK, the second PTY on native_sim) or from a file, and prints reports and the
+device's periodic drop counters.
+
+    ./scripts/stream_decode.py /dev/ttyUSB0 --baud 1000000
+    ./scripts/stream_decode.py /dev/pts/5 --quiet
+"""
+
+import argparse
+import os
+import struct
+import sys
+import termios
+import time
+
+# Mirrors StreamFrame in src/common/uart_stream.hpp
+SCAN_REPORT = 1
+GATT_NOTIFICATION = 2
+STATS = 3
+RPC_RESPONSE = 4
+
+# Record layout from src/central/capture_format.hpp
+RECORD_FIXED = struct.Struct("<BIB6sbB")
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data):
+            raise ValueError("bad COBS block")
+        out += data[i + 1:i + code]
+        i += code
+        if code < 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def configure_tty(fd, baud):
+    speed = getattr(termios, "B%d" % baud, None)
+    if speed is None:
+        sys.exit("unsupported baud rate %d" % baud)
+    attrs = termios.tcgetattr(fd)
+    attrs[0] = 0                                   # iflag
+    attrs[1] = 0                                   # oflag
+    attrs[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+    attrs[3] = 0                                   # lflag, raw
+    attrs[4] = attrs[5] = speed
+    termios.tcsetattr(fd, termios.TCSANOW, attrs)
+
+
+class Decoder:
+    def __init__(self, quiet):
+        self.quiet = quiet
+        self.sequence = None
+        self.lost = 0
+        self.reports = 0
+        self.bad = 0
+        self.elapsed_us = 0
+        self.window_start = time.monotonic()
+        self.window_reports = 0
+
+    def frame(self, raw):
+        try:
+            frame = cobs_decode(raw)
+        except ValueError:
+            self.bad += 1
+            return
+        if len(frame) < 2:
+            self.bad += 1
+            return
+
+        kind, sequence, payload = frame[0], frame[1], frame[2:]
+        if self.sequence is not None:
+            self.lost += (sequence - self.sequence - 1) & 0xFF
+        self.sequence = sequence
+
+        if kind == SCAN_REPORT:
+            self.report(payload)
+        elif kind == GATT_NOTIFICATION and len(payload) >= 4:
+            conn, handle = struct.unpack_from("<HH", payload)
+            if not self.quiet:
+                print("notify conn=0x%04x handle=0x%04x %s"
+                      % (conn, handle, payload[4:].hex()))
+        elif kind == STATS and len(payload) >= 20:
+            frames, sent, dropped, batches, errors = struct.unpack_from(
+                "<5I", payload)
+            now = time.monotonic()
+            rate = self.window_reports / max(now - self.window_start, 1e-6)
+            self.window_start, self.window_reports = now, 0
+            print("# device frames=%u bytes=%u dropped=%u batches=%u "
+                  "tx_errors=%u | host %.0f reports/s, %u lost, %u bad"
+                  % (frames, sent, dropped, batches, errors, rate, self.lost,
+                     self.bad))
+        elif kind != RPC_RESPONSE:
+            self.bad += 1
+
+    def report(self, payload):
+        if len(payload) < RECORD_FIXED.size:
+            self.bad += 1
+            return
+        length, delta, addr_type, addr, rssi, adv_type = \
+            RECORD_FIXED.unpack_from(payload)
+        ad = payload[RECORD_FIXED.size:1 + length]
+        self.elapsed_us += delta
+        self.reports += 1
+        self.window_reports += 1
+        if not self.quiet:
+            print("%12.6f %s/%u rssi=%d type=%u ad=%s"
+                  % (self.elapsed_us / 1e6,
+                     ":".join("%02X" % b for b in reversed(addr)), addr_type,
+                     rssi, adv_type, ad.hex()))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("port", help="serial device, PTY or captured file")
+    parser.add_argument("--baud", type=int, default=1000000)
+    parser.add_argument("--quiet", action="store_true",
+                        help="only print the periodic stats lines")
+    args = parser.parse_args()
+
+    fd = os.open(args.port, os.O_RDONLY | os.O_NOCTTY)
+    if os.isatty(fd):
+        configure_tty(fd, args.baud)
+
+    decoder = Decoder(args.quiet)
+    pending = bytearray()
+    try:
+        while True:
+            chunk = os.read(fd, 65536)
+            if not chunk:
+                break
+            pending += chunk
+            *frames, pending = pending.split(b"\0")
+            pending = bytearray(pending)
+            for raw in frames:
+                if raw:
+                    decoder.frame(bytes(raw))
+    except KeyboardInterrupt:
+        pass
+    finally:
+        os.close(fd)
+
+
+if __name__ == "__main__":
+    main()
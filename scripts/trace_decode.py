@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+"""Decode a BlueSim binary trace dump into a timeline.
+
+Reads the TRACE_BEGIN/TRACE/TRACE_END lines printed by "trace dump" on the
+console or by "bluesim_rpc.py trace-dump", which pages the rings out over
+RPC, and prints one line per record with the time relative to the first
+record of its CPU. Log prefixes in front of the lines are skipped.
+
+    ./scripts/trace_decode.py console.log
+    cat /dev/ttyACM0 | ./scripts/trace_decode.py
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+RECORD = struct.Struct("<IBBHI")
+
+# Mirrors TraceReject in src/common/trace.hpp
+REJECT_REASONS = {
+    1: "null pattern",
+    2: "pattern too long",
+    3: "invalid pattern",
+    4: "no group",
+    5: "group full",
+}
+
+# Mirrors StackScanState in src/central/stack_scan.hpp
+SCAN_STATES = {0: "IDLE", 1: "STARTING", 2: "SCANNING", 3: "STOPPING"}
+
+
+def addr_low(value):
+    return ":".join("%02X" % ((value >> (8 * i)) & 0xFF) for i in (3, 2, 1, 0))
+
+
+def pattern_prefix(value):
+    raw = struct.pack("<I", value).split(b"\0")[0]
+    return raw.decode("ascii", "replace")
+
+
+def rssi(arg1):
+    return arg1 - 0x10000 if arg1 & 0x8000 else arg1
+
+
+# Mirrors TraceEvent in src/common/trace.hpp
+EVENTS = {
+    1: ("SCAN_MATCH", lambda a0, a1, a2: "central=%u rssi=%d addr=..:%s"
+        % (a0, rssi(a1), addr_low(a2))),
+    2: ("SCAN_ALREADY_CONNECTED", lambda a0, a1, a2: "central=%u" % a0),
+    3: ("STACK_SCAN_STARTED", None),
+    4: ("STACK_SCAN_STOPPED", None),
+    5: ("STACK_SCAN_ALREADY_ACTIVE", None),
+    6: ("STACK_SCAN_NOT_ACTIVE", None),
+    7: ("FILTER_GROUP_ADDED", lambda a0, a1, a2: "group=%u" % a0),
+    8: ("FILTER_CRITERION_ADDED", lambda a0, a1, a2: "group=%u type=%u "
+        "pattern='%s...'" % (a0, a1, pattern_prefix(a2))),
+    9: ("FILTER_CRITERION_REJECTED", lambda a0, a1, a2: "reason=%s"
+        % REJECT_REASONS.get(a0, a0)),
+    10: ("CONNECTION_ADDED", lambda a0, a1, a2: "central=%u slot=%u total=%u/%u"
+         % (a0, a1, a2 & 0xFF, (a2 >> 8) & 0xFF)),
+    11: ("CONNECTION_REMOVED", lambda a0, a1, a2: "central=%u slot=%u "
+         "total=%u/%u" % (a0, a1, a2 & 0xFF, (a2 >> 8) & 0xFF)),
+    12: ("CONNECTION_SLOT_FULL", lambda a0, a1, a2: "central=%u" % a0),
+    13: ("CONNECTION_NOT_FOUND", lambda a0, a1, a2: "central=%u" % a0),
+    14: ("GATT_READ_DEFAULT", lambda a0, a1, a2: "handle=0x%04x len=%u "
+         "offset=%u" % (a1, a2 & 0xFFFF, a2 >> 16)),
+    15: ("GATT_WRITE_DEFAULT", lambda a0, a1, a2: "handle=0x%04x len=%u "
+         "offset=%u" % (a1, a2 & 0xFFFF, a2 >> 16)),
+    16: ("CONN_PARAM_UPDATED", lambda a0, a1, a2: "conn=%u interval=%.2fms "
+         "latency=%u timeout=%ums" % (a0, a1 * 1.25, a2 & 0xFFFF,
+                                      (a2 >> 16) * 10)),
+    17: ("CONN_PHY_UPDATED", lambda a0, a1, a2: "conn=%u tx_phy=%u rx_phy=%u"
+         % (a0, a1 & 0xFF, a1 >> 8)),
+    18: ("CONN_DATA_LEN_UPDATED", lambda a0, a1, a2: "conn=%u tx=%u rx=%u"
+         % (a0, a1, a2)),
+    19: ("CONN_SECURITY_CHANGED", lambda a0, a1, a2: "conn=%u level=%u err=%u"
+         % (a0, a1, a2)),
+    20: ("STACK_SCAN_REJECTED", lambda a0, a1, a2: "state=%s requested=%s"
+         % (SCAN_STATES.get(a0, a0), SCAN_STATES.get(a1, a1))),
+}
+
+BEGIN = re.compile(r"TRACE_BEGIN cpu=(\d+) hz=(\d+) count=(\d+) "
+                   r"overwritten=(\d+)")
+LINE = re.compile(r"TRACE ([0-9a-fA-F]{%d})" % (RECORD.size * 2))
+
+
+def decode(lines, out):
+    cpu = None
+    hz = 1
+    first = None
+    previous = None
+
+    for line in lines:
+        match = BEGIN.search(line)
+        if match:
+            cpu, hz = int(match.group(1)), int(match.group(2))
+            first = previous = None
+            out.write("# cpu %d: %s records, %s overwritten, %d Hz\n"
+                      % (cpu, match.group(3), match.group(4), hz))
+            continue
+
+        match = LINE.search(line)
+        if not match or cpu is None:
+            continue
+
+        cycles, event, a0, a1, a2 = RECORD.unpack(bytes.fromhex(match.group(1)))
+        if first is None:
+            first = previous = cycles
+
+        # The cycle counter is 32 bits wide, deltas survive one wrap
+        elapsed = ((cycles - first) & 0xFFFFFFFF) * 1000.0 / hz
+        delta = ((cycles - previous) & 0xFFFFFFFF) * 1e6 / hz
+        previous = cycles
+
+        name, describe = EVENTS.get(event, ("EVENT_%u" % event, None))
+        detail = describe(a0, a1, a2) if describe else ""
+        out.write("%12.3f ms %+10.1f us  cpu%d  %-26s %s\n"
+                  % (elapsed, delta, cpu, name, detail))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("dump", nargs="?", type=argparse.FileType("r"),
+                        default=sys.stdin,
+                        help="console log with a trace dump (default stdin)")
+    args = parser.parse_args()
+    decode(args.dump, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,21 @@
+#pragma once
+
+extern "C" {
+#include <stdint.h>
+}
+
+#if defined(CONFIG_BOARD_NRF52_BSIM)
+// Provided by the nrf_bsim board, the -d=<n> argument of the device
+extern "C" unsigned int get_device_nbr(void);
+#endif
+
+// Role of this device in a multi-device benchmark: 0 runs the centrals, any
+// other index the peripherals. On nrf52_bsim the index comes from the
+// simulator, on hardware from CONFIG_BLUESIM_BENCH_DEVICE_INDEX.
+static inline uint32_t benchDeviceIndex() {
+#if defined(CONFIG_BOARD_NRF52_BSIM)
+  return get_device_nbr();
+#else
+  return CONFIG_BLUESIM_BENCH_DEVICE_INDEX;
+#endif
+}
@@ -0,0 +1,704 @@
+#include "gatt_bench.hpp"
+#include "bench_device.hpp"
+#include "../common/memory_budget.hpp"
+#include "../peripheral/advertisement.hpp"
+#include "../peripheral/characteristic.hpp"
+#include "../peripheral/peripheral.hpp"
+#include "../peripheral/service.hpp"
+#include "../roles/role_pools.hpp"
+#include <stdio.h>
+#include <zephyr/logging/log.h>
+
+extern "C" {
+#include <string.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/printk.h>
+}
+
+LOG_MODULE_REGISTER(GATT_BENCH, LOG_LEVEL_INF);
+
+// Benchmark service and characteristics, both sides match on these
+namespace {
+const struct bt_uuid_128 uuid_bench_service{
+    {BT_UUID_TYPE_128},
+    {BT_UUID_128_ENCODE(0x5b1e0000, 0xbe4c, 0x4a1e, 0x9d2e, 0x00b1e5b1e5b1)}};
+const struct bt_uuid_128 uuid_bench_source{
+    {BT_UUID_TYPE_128},
+    {BT_UUID_128_ENCODE(0x5b1e0001, 0xbe4c, 0x4a1e, 0x9d2e, 0x00b1e5b1e5b1)}};
+const struct bt_uuid_128 uuid_bench_sink{
+    {BT_UUID_TYPE_128},
+    {BT_UUID_128_ENCODE(0x5b1e0002, 0xbe4c, 0x4a1e, 0x9d2e, 0x00b1e5b1e5b1)}};
+const struct bt_uuid_128 uuid_bench_echo{
+    {BT_UUID_TYPE_128},
+    {BT_UUID_128_ENCODE(0x5b1e0003, 0xbe4c, 0x4a1e, 0x9d2e, 0x00b1e5b1e5b1)}};
+} // namespace
+
+// Slow and small, the default long range link, and the fastest link the
+// controller supports
+static const struct gatt_bench_profile profiles[] = {
+    {"1m_50ms", 40, BT_GAP_LE_PHY_1M, 27},
+    {"1m_15ms", 12, BT_GAP_LE_PHY_1M, 251},
+    {"2m_7_5ms", 6, BT_GAP_LE_PHY_2M, 251},
+};
+
+struct bt_conn *GattBench::_conn = nullptr;
+struct k_sem GattBench::_connected;
+struct k_sem GattBench::_step;
+struct k_sem GattBench::_credits;
+struct k_sem GattBench::_echo;
+int GattBench::_stepErr = 0;
+bool GattBench::_linkLost = false;
+
+uint16_t GattBench::_sourceHandle = 0;
+uint16_t GattBench::_sinkHandle = 0;
+uint16_t GattBench::_echoHandle = 0;
+struct bt_gatt_exchange_params GattBench::_mtuParams = {};
+struct bt_gatt_discover_params GattBench::_discoverParams = {};
+struct bt_gatt_read_params GattBench::_readParams = {};
+struct bt_gatt_subscribe_params GattBench::_sourceSub = {};
+struct bt_gatt_subscribe_params GattBench::_echoSub = {};
+struct gatt_bench_sink GattBench::_readSink = {};
+uint16_t GattBench::_discovered = 0;
+
+uint32_t GattBench::_notifyPackets = 0;
+uint32_t GattBench::_notifyBytes = 0;
+uint32_t GattBench::_notifyGaps = 0;
+uint32_t GattBench::_notifyNextSeq = 0;
+int64_t GattBench::_notifyFirstTicks = 0;
+int64_t GattBench::_notifyLastTicks = 0;
+
+uint32_t GattBench::_writeSeq = 0;
+uint32_t GattBench::_pingSeq = 0;
+uint32_t GattBench::_pingCycles = 0;
+uint32_t GattBench::_rttCycles = 0;
+uint8_t GattBench::_payload[GATT_BENCH_MAX_PAYLOAD] = {};
+SampleSet GattBench::_rtt("echo_rtt");
+
+Peripheral *GattBench::_peripheral = nullptr;
+Characteristic *GattBench::_source = nullptr;
+Characteristic *GattBench::_echoValue = nullptr;
+struct queued_work GattBench::_sourceWork = {};
+atomic_t GattBench::_sourceInflight = ATOMIC_INIT(0);
+bool GattBench::_sourcing = false;
+uint32_t GattBench::_sourceSeq = 0;
+uint32_t GattBench::_sinkNextSeq = 0;
+struct gatt_bench_sink GattBench::_sink = {};
+
+int GattBench::run() {
+  k_sem_init(&_connected, 0, 1);
+  k_sem_init(&_step, 0, 1);
+  k_sem_init(&_credits, GATT_BENCH_WINDOW, GATT_BENCH_WINDOW);
+  k_sem_init(&_echo, 0, 1);
+
+  uint32_t device = benchDeviceIndex();
+  LOG_INF("GATT benchmark device %u", device);
+  if (device == 0) {
+    return runCentral();
+  }
+  return runPeripheral(device);
+}
+
+void GattBench::onConnected(Central *central, struct bt_conn *conn) {
+  ARG_UNUSED(central);
+
+  // Only the first link is measured
+  if (_conn) {
+    return;
+  }
+
+  _conn = bt_conn_ref(conn);
+  k_sem_give(&_connected);
+}
+
+void GattBench::onDisconnected(struct bt_conn *conn) {
+  if (conn != _conn) {
+    return;
+  }
+
+  // Wake whatever the main thread waits on, it checks _linkLost after
+  _linkLost = true;
+  _stepErr = -ENOTCONN;
+  k_sem_give(&_step);
+  k_sem_give(&_echo);
+  for (uint8_t i = 0; i < GATT_BENCH_WINDOW; i++) {
+    k_sem_give(&_credits);
+  }
+}
+
+int GattBench::runCentral() {
+  Filter filter;
+  filter.addGroup();
+  filter.addCriterion(FilterCriterionType::LOCAL_NAME, "BenchT*");
+
+  Central *central = RolePools::centrals.emplace((uint8_t)1);
+  if (!central) {
+    return -ENOMEM;
+  }
+  central->addFilter(filter);
+  central->scheduleScanningStart();
+  MemoryBudget::printReport();
+
+  if (k_sem_take(&_connected, K_SECONDS(GATT_BENCH_CONNECT_TIMEOUT_S)) != 0) {
+    printk("BENCH {\"suite\":\"gatt\",\"connected\":false}\n");
+    return -ETIMEDOUT;
+  }
+
+  int err = prepare();
+  if (err < 0) {
+    LOG_ERR("Benchmark service not usable (err %d)", err);
+    return err;
+  }
+
+  printk("BENCH {\"suite\":\"gatt\",\"profiles\":%zu,\"phase_s\":%u,"
+         "\"window\":%u,\"mtu\":%u}\n",
+         ARRAY_SIZE(profiles), GATT_BENCH_PHASE_S, GATT_BENCH_WINDOW,
+         bt_gatt_get_mtu(_conn));
+  for (const struct gatt_bench_profile &profile : profiles) {
+    if (_linkLost) {
+      printk("BENCH {\"suite\":\"gatt\",\"link_lost\":true}\n");
+      break;
+    }
+    runProfile(profile);
+  }
+
+  bt_conn_unref(_conn);
+  while (true) {
+    k_sleep(K_SECONDS(1));
+  }
+  return 0;
+}
+
+void GattBench::mtuExchanged(struct bt_conn *conn, uint8_t err,
+                             struct bt_gatt_exchange_params *params) {
+  ARG_UNUSED(params);
+
+  if (err) {
+    LOG_WRN("MTU exchange failed (err %u), using %u", err,
+            bt_gatt_get_mtu(conn));
+  }
+  k_sem_give(&_step);
+}
+
+int GattBench::prepare() {
+  _mtuParams.func = mtuExchanged;
+  int err = bt_gatt_exchange_mtu(_conn, &_mtuParams);
+  if (err == 0) {
+    k_sem_take(&_step, K_SECONDS(5));
+  } else if (err != -EALREADY) {
+    LOG_WRN("MTU exchange failed (err %d)", err);
+  }
+
+  err = discover(&uuid_bench_source.uuid, &_sourceHandle);
+  if (err < 0) {
+    return err;
+  }
+  err = discover(&uuid_bench_sink.uuid, &_sinkHandle);
+  if (err < 0) {
+    return err;
+  }
+  err = discover(&uuid_bench_echo.uuid, &_echoHandle);
+  if (err < 0) {
+    return err;
+  }
+
+  // Service lays out the CCC right after the value
+  _echoSub.notify = notifyCallback;
+  _echoSub.value_handle = _echoHandle;
+  _echoSub.ccc_handle = _echoHandle + 1;
+  _echoSub.value = BT_GATT_CCC_NOTIFY;
+  return bt_gatt_subscribe(_conn, &_echoSub);
+}
+
+uint8_t GattBench::discoverCallback(struct bt_conn *conn,
+                                    const struct bt_gatt_attr *attr,
+                                    struct bt_gatt_discover_params *params) {
+  ARG_UNUSED(conn);
+  ARG_UNUSED(params);
+
+  if (attr) {
+    const struct bt_gatt_chrc *chrc =
+        static_cast<const struct bt_gatt_chrc *>(attr->user_data);
+    _discovered = chrc->value_handle;
+    _stepErr = 0;
+  }
+  k_sem_give(&_step);
+  return BT_GATT_ITER_STOP;
+}
+
+int GattBench::discover(const struct bt_uuid *uuid, uint16_t *value_handle) {
+  _discoverParams = {};
+  _discoverParams.uuid = uuid;
+  _discoverParams.func = discoverCallback;
+  _discoverParams.start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE;
+  _discoverParams.end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
+  _discoverParams.type = BT_GATT_DISCOVER_CHARACTERISTIC;
+  _stepErr = -ENOENT;
+
+  int err = bt_gatt_discover(_conn, &_discoverParams);
+  if (err < 0) {
+    return err;
+  }
+  if (k_sem_take(&_step, K_SECONDS(5)) != 0) {
+    return -ETIMEDOUT;
+  }
+  if (_stepErr < 0) {
+    return _stepErr;
+  }
+
+  *value_handle = _discovered;
+  return 0;
+}
+
+uint8_t GattBench::readCallback(struct bt_conn *conn, uint8_t err,
+                                struct bt_gatt_read_params *params,
+                                const void *data, uint16_t length) {
+  ARG_UNUSED(conn);
+  ARG_UNUSED(params);
+
+  if (err) {
+    _stepErr = -EIO;
+  } else if (data && length >= sizeof(struct gatt_bench_sink)) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    _readSink.writes = sys_get_le32(bytes);
+    _readSink.bytes = sys_get_le32(bytes + 4);
+    _readSink.gaps = sys_get_le32(bytes + 8);
+    _stepErr = 0;
+  }
+
+  // Called once more without data when the read is complete
+  if (err || !data) {
+    k_sem_give(&_step);
+    return BT_GATT_ITER_STOP;
+  }
+  return BT_GATT_ITER_CONTINUE;
+}
+
+int GattBench::readSink(struct gatt_bench_sink *out) {
+  _readParams = {};
+  _readParams.func = readCallback;
+  _readParams.handle_count = 1;
+  _readParams.single.handle = _sinkHandle;
+  _stepErr = -ENODATA;
+
+  int err = bt_gatt_read(_conn, &_readParams);
+  if (err < 0) {
+    return err;
+  }
+  if (k_sem_take(&_step, K_SECONDS(5)) != 0) {
+    return -ETIMEDOUT;
+  }
+  if (_stepErr < 0) {
+    return _stepErr;
+  }
+
+  *out = _readSink;
+  return 0;
+}
+
+void GattBench::applyProfile(const struct gatt_bench_profile &profile) {
+  struct bt_le_conn_param param = {};
+  param.interval_min = profile.interval;
+  param.interval_max = profile.interval;
+  param.latency = 0;
+  param.timeout = 400;
+  int err = bt_conn_le_param_update(_conn, &param);
+  if (err < 0 && err != -EALREADY) {
+    LOG_WRN("Profile %s: Interval request failed (err %d)", profile.name,
+            err);
+  }
+
+#ifdef CONFIG_BT_USER_PHY_UPDATE
+  struct bt_conn_le_phy_param phy = {};
+  phy.options = BT_CONN_LE_PHY_OPT_NONE;
+  phy.pref_tx_phy = profile.phy;
+  phy.pref_rx_phy = profile.phy;
+  err = bt_conn_le_phy_update(_conn, &phy);
+  if (err < 0) {
+    LOG_WRN("Profile %s: PHY request failed (err %d)", profile.name, err);
+  }
+#endif
+#ifdef CONFIG_BT_USER_DATA_LEN_UPDATE
+  struct bt_conn_le_data_len_param len = {};
+  len.tx_max_len = profile.data_len;
+  len.tx_max_time = BT_GAP_DATA_TIME_MAX;
+  err = bt_conn_le_data_len_update(_conn, &len);
+  if (err < 0) {
+    LOG_WRN("Profile %s: Data length request failed (err %d)", profile.name,
+            err);
+  }
+#endif
+
+  // The peer may settle on something else, the profile line reports what
+  // the link actually runs with
+  k_sleep(K_MSEC(GATT_BENCH_SETTLE_MS));
+}
+
+void GattBench::runProfile(const struct gatt_bench_profile &profile) {
+  applyProfile(profile);
+
+  const struct conn_link &link = ConnectionBus::link(_conn);
+  printk("BENCH {\"suite\":\"gatt\",\"profile\":\"%s\",\"interval\":%u,"
+         "\"phy\":%u,\"data_len\":%u,\"mtu\":%u}\n",
+         profile.name, link.interval, link.tx_phy, link.tx_max_len,
+         bt_gatt_get_mtu(_conn));
+
+  struct gatt_bench_phase phase;
+  int err = measureNotify(&phase);
+  if (err == 0) {
+    reportPhase("notify", phase);
+  } else {
+    LOG_ERR("Profile %s: Notify phase failed (err %d)", profile.name, err);
+  }
+
+  err = measureWrite(&phase);
+  if (err == 0) {
+    reportPhase("write", phase);
+  } else {
+    LOG_ERR("Profile %s: Write phase failed (err %d)", profile.name, err);
+  }
+
+  err = measureEcho(&phase);
+  if (err == 0) {
+    reportPhase("echo", phase);
+    _rtt.report();
+  } else {
+    LOG_ERR("Profile %s: Echo phase failed (err %d)", profile.name, err);
+  }
+}
+
+void GattBench::reportPhase(const char *metric,
+                            const struct gatt_bench_phase &phase) {
+  uint32_t kbps = phase.elapsed_us ? (uint32_t)((uint64_t)phase.bytes *
+                                                8000U / phase.elapsed_us)
+                                   : 0;
+  printk("BENCH {\"metric\":\"%s\",\"unit\":\"kbps\",\"value\":%u,"
+         "\"packets\":%u,\"bytes\":%u,\"lost\":%u,\"us\":%u}\n",
+         metric, kbps, phase.packets, phase.bytes, phase.lost,
+         phase.elapsed_us);
+}
+
+uint8_t GattBench::notifyCallback(struct bt_conn *conn,
+                                  struct bt_gatt_subscribe_params *params,
+                                  const void *data, uint16_t length) {
+  ARG_UNUSED(conn);
+
+  // Unsubscribed
+  if (!data) {
+    return BT_GATT_ITER_STOP;
+  }
+
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  if (params == &_echoSub) {
+    if (length >= sizeof(uint32_t) && sys_get_le32(bytes) == _pingSeq) {
+      _rttCycles = k_cycle_get_32() - _pingCycles;
+      k_sem_give(&_echo);
+    }
+    return BT_GATT_ITER_CONTINUE;
+  }
+
+  int64_t now = k_uptime_ticks();
+  if (!_notifyPackets) {
+    _notifyFirstTicks = now;
+  }
+  _notifyLastTicks = now;
+  _notifyPackets++;
+  _notifyBytes += length;
+
+  if (length >= sizeof(uint32_t)) {
+    uint32_t seq = sys_get_le32(bytes);
+    if (_notifyPackets > 1 && seq > _notifyNextSeq) {
+      _notifyGaps += seq - _notifyNextSeq;
+    }
+    _notifyNextSeq = seq + 1;
+  }
+  return BT_GATT_ITER_CONTINUE;
+}
+
+int GattBench::measureNotify(struct gatt_bench_phase *out) {
+  _notifyPackets = 0;
+  _notifyBytes = 0;
+  _notifyGaps = 0;
+  _notifyNextSeq = 0;
+
+  // The peripheral streams for as long as the CCC is set
+  _sourceSub.notify = notifyCallback;
+  _sourceSub.value_handle = _sourceHandle;
+  _sourceSub.ccc_handle = _sourceHandle + 1;
+  _sourceSub.value = BT_GATT_CCC_NOTIFY;
+  int err = bt_gatt_subscribe(_conn, &_sourceSub);
+  if (err < 0) {
+    return err;
+  }
+
+  k_sleep(K_SECONDS(GATT_BENCH_PHASE_S));
+  out->packets = _notifyPackets;
+  out->bytes = _notifyBytes;
+  out->lost = _notifyGaps;
+  out->elapsed_us = (uint32_t)k_ticks_to_us_floor64(_notifyLastTicks -
+                                                    _notifyFirstTicks);
+
+  bt_gatt_unsubscribe(_conn, &_sourceSub);
+  return _linkLost ? -ENOTCONN : 0;
+}
+
+void GattBench::writeComplete(struct bt_conn *conn, void *user_data) {
+  ARG_UNUSED(conn);
+  ARG_UNUSED(user_data);
+
+  k_sem_give(&_credits);
+}
+
+int GattBench::measureWrite(struct gatt_bench_phase *out) {
+  struct gatt_bench_sink before;
+  int err = readSink(&before);
+  if (err < 0) {
+    return err;
+  }
+
+  uint16_t len = MIN(bt_gatt_get_mtu(_conn) - 3, GATT_BENCH_MAX_PAYLOAD);
+  uint32_t sent = 0;
+  int64_t start = k_uptime_ticks();
+  int64_t deadline = start + k_ms_to_ticks_ceil64(GATT_BENCH_PHASE_S * 1000);
+
+  // Up to GATT_BENCH_WINDOW writes in flight, completions return credits
+  while (k_uptime_ticks() < deadline && !_linkLost) {
+    if (k_sem_take(&_credits, K_MSEC(100)) != 0) {
+      continue;
+    }
+
+    sys_put_le32(_writeSeq, _payload);
+    err = bt_gatt_write_without_response_cb(_conn, _sinkHandle, _payload, len,
+                                            false, writeComplete, nullptr);
+    if (err == -ENOMEM || err == -ENOBUFS) {
+      k_sem_give(&_credits);
+      k_sleep(K_MSEC(1));
+      continue;
+    }
+    if (err < 0) {
+      k_sem_give(&_credits);
+      return err;
+    }
+
+    _writeSeq++;
+    sent++;
+  }
+
+  // Let the last writes reach the peer before reading its counters
+  for (uint32_t waited = 0; k_sem_count_get(&_credits) < GATT_BENCH_WINDOW &&
+                            waited < GATT_BENCH_ECHO_TIMEOUT_MS;
+       waited++) {
+    k_sleep(K_MSEC(1));
+  }
+  int64_t end = k_uptime_ticks();
+
+  struct gatt_bench_sink after;
+  err = readSink(&after);
+  if (err < 0) {
+    return err;
+  }
+
+  uint32_t received = after.writes - before.writes;
+  out->packets = sent;
+  out->bytes = after.bytes - before.bytes;
+  out->lost = sent > received ? sent - received : 0;
+  out->elapsed_us = (uint32_t)k_ticks_to_us_floor64(end - start);
+  return 0;
+}
+
+int GattBench::measureEcho(struct gatt_bench_phase *out) {
+  _rtt.reset();
+  memset(_payload, 0, GATT_BENCH_ECHO_PAYLOAD);
+
+  uint32_t sent = 0;
+  uint32_t lost = 0;
+  int64_t start = k_uptime_ticks();
+  int64_t deadline = start + k_ms_to_ticks_ceil64(GATT_BENCH_PHASE_S * 1000);
+
+  // One ping at a time, an echo that misses the timeout counts as lost
+  while (k_uptime_ticks() < deadline && !_linkLost) {
+    _pingSeq++;
+    sys_put_le32(_pingSeq, _payload);
+    k_sem_reset(&_echo);
+    _pingCycles = k_cycle_get_32();
+
+    int err = bt_gatt_write_without_response_cb(
+        _conn, _echoHandle, _payload, GATT_BENCH_ECHO_PAYLOAD, false, nullptr,
+        nullptr);
+    if (err < 0) {
+      return err;
+    }
+    sent++;
+
+    if (k_sem_take(&_echo, K_MSEC(GATT_BENCH_ECHO_TIMEOUT_MS)) != 0 ||
+        _linkLost) {
+      lost++;
+      continue;
+    }
+    _rtt.add(k_cyc_to_us_floor32(_rttCycles));
+  }
+
+  out->packets = sent;
+  out->bytes = (sent - lost) * GATT_BENCH_ECHO_PAYLOAD;
+  out->lost = lost;
+  out->elapsed_us = (uint32_t)k_ticks_to_us_floor64(k_uptime_ticks() - start);
+  return _linkLost ? -ENOTCONN : 0;
+}
+
+int GattBench::runPeripheral(uint32_t device) {
+  char name[MAX_LOCAL_NAME_LENGTH];
+  snprintf(name, sizeof(name), "BenchT%u", device);
+
+  Advertisement *advertisement = RolePools::advertisements.emplace();
+  Peripheral *peripheral = RolePools::peripherals.emplace();
+  Service *service = RolePools::services.emplace();
+  Characteristic *source = RolePools::characteristics.emplace();
+  Characteristic *sink = RolePools::characteristics.emplace();
+  Characteristic *echo = RolePools::characteristics.emplace();
+  if (!advertisement || !peripheral || !service || !source || !sink ||
+      !echo) {
+    return -ENOMEM;
+  }
+
+  service->init(&uuid_bench_service.uuid, "GATT bench");
+  source->init(&uuid_bench_source.uuid, NOTIFY, PERM_READ, "Bench source");
+  source->_cccCallback = sourceCccChanged;
+  sink->init(&uuid_bench_sink.uuid, READ | WRITE_WITHOUT_RESP,
+             PERM_READ | PERM_WRITE, "Bench sink");
+  sink->_readCallback = sinkRead;
+  sink->_writeCallback = sinkWrite;
+  echo->init(&uuid_bench_echo.uuid, WRITE_WITHOUT_RESP | NOTIFY,
+             PERM_READ | PERM_WRITE, "Bench echo");
+  echo->_writeCallback = echoWrite;
+
+  service->addCharacteristic(source);
+  service->addCharacteristic(sink);
+  service->addCharacteristic(echo);
+  service->buildService();
+  peripheral->addService(service);
+  peripheral->registerServices();
+
+  _peripheral = peripheral;
+  _source = source;
+  _echoValue = echo;
+  WorkQueue::data.initWork(&_sourceWork, sourceAction);
+
+  int err = advertisement->init(name);
+  if (err < 0) {
+    return err;
+  }
+  peripheral->addAdvertisement(advertisement);
+  advertisement->startAdvertising();
+  MemoryBudget::printReport();
+
+  while (true) {
+    k_sleep(K_SECONDS(1));
+  }
+  return 0;
+}
+
+void GattBench::sourceCccChanged(const struct bt_gatt_attr *attr,
+                                 uint16_t value) {
+  ARG_UNUSED(attr);
+
+  _sourcing = value & BT_GATT_CCC_NOTIFY;
+  if (_sourcing) {
+    _sourceSeq = 0;
+    WorkQueue::data.schedule(&_sourceWork, K_NO_WAIT);
+  }
+}
+
+void GattBench::sourceSent(struct bt_conn *conn, void *user_data) {
+  ARG_UNUSED(conn);
+  ARG_UNUSED(user_data);
+
+  atomic_dec(&_sourceInflight);
+  if (_sourcing) {
+    WorkQueue::data.scheduleIfIdle(&_sourceWork, K_NO_WAIT);
+  }
+}
+
+void GattBench::sourceAction(struct k_work *work) {
+  ARG_UNUSED(work);
+
+  struct bt_conn *conn = _peripheral->_connections[0];
+  if (!_sourcing || !conn) {
+    return;
+  }
+
+  uint16_t len = MIN(bt_gatt_get_mtu(conn) - 3, GATT_BENCH_MAX_PAYLOAD);
+  while (atomic_get(&_sourceInflight) < GATT_BENCH_WINDOW) {
+    // The stack copies the payload before returning
+    sys_put_le32(_sourceSeq, _payload);
+
+    struct bt_gatt_notify_params params = {};
+    params.attr = _source->_valueAttr;
+    params.data = _payload;
+    params.len = len;
+    params.func = sourceSent;
+
+    atomic_inc(&_sourceInflight);
+    int err = bt_gatt_notify_cb(conn, &params);
+    if (err == -ENOMEM || err == -ENOBUFS) {
+      // With nothing in flight no completion will come, retry on a timer
+      atomic_dec(&_sourceInflight);
+      if (atomic_get(&_sourceInflight) == 0) {
+        WorkQueue::data.schedule(&_sourceWork, K_MSEC(5));
+      }
+      return;
+    }
+    if (err < 0) {
+      atomic_dec(&_sourceInflight);
+      LOG_WRN("Notification source stopped (err %d)", err);
+      _sourcing = false;
+      return;
+    }
+
+    _sourceSeq++;
+  }
+}
+
+ssize_t GattBench::sinkWrite(struct bt_conn *conn,
+                             const struct bt_gatt_attr *attr, const void *buf,
+                             uint16_t len, uint16_t offset, uint8_t flags) {
+  ARG_UNUSED(conn);
+  ARG_UNUSED(attr);
+  ARG_UNUSED(offset);
+  ARG_UNUSED(flags);
+
+  if (len >= sizeof(uint32_t)) {
+    uint32_t seq = sys_get_le32(static_cast<const uint8_t *>(buf));
+    if (_sink.writes && seq > _sinkNextSeq) {
+      _sink.gaps += seq - _sinkNextSeq;
+    }
+    _sinkNextSeq = seq + 1;
+  }
+
+  _sink.writes++;
+  _sink.bytes += len;
+  return len;
+}
+
+ssize_t GattBench::sinkRead(struct bt_conn *conn,
+                            const struct bt_gatt_attr *attr, void *buf,
+                            uint16_t len, uint16_t offset) {
+  uint8_t value[sizeof(struct gatt_bench_sink)];
+  sys_put_le32(_sink.writes, value);
+  sys_put_le32(_sink.bytes, value + 4);
+  sys_put_le32(_sink.gaps, value + 8);
+  return bt_gatt_attr_read(conn, attr, buf, len, offset, value, sizeof(value));
+}
+
+ssize_t GattBench::echoWrite(struct bt_conn *conn,
+                             const struct bt_gatt_attr *attr, const void *buf,
+                             uint16_t len, uint16_t offset, uint8_t flags) {
+  ARG_UNUSED(attr);
+  ARG_UNUSED(offset);
+  ARG_UNUSED(flags);
+
+  // Straight back from the RX thread, the round trip includes no queueing
+  int err = bt_gatt_notify(conn, _echoValue->_valueAttr, buf, len);
+  if (err < 0) {
+    LOG_DBG("Echo dropped (err %d)", err);
+  }
+  return len;
+}
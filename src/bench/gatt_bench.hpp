@@ -0,0 +1,159 @@
+#pragma once
+
+#include "../central/central.hpp"
+#include "sample_set.hpp"
+
+extern "C" {
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/kernel.h>
+}
+
+#ifdef CONFIG_BLUESIM_BENCH_GATT_PHASE_S
+#define GATT_BENCH_PHASE_S CONFIG_BLUESIM_BENCH_GATT_PHASE_S
+#else
+#define GATT_BENCH_PHASE_S 5
+#endif
+
+#ifdef CONFIG_BLUESIM_BENCH_GATT_WINDOW
+#define GATT_BENCH_WINDOW CONFIG_BLUESIM_BENCH_GATT_WINDOW
+#else
+#define GATT_BENCH_WINDOW 8
+#endif
+
+// Largest ATT payload with a 247 byte MTU
+#define GATT_BENCH_MAX_PAYLOAD 244
+#define GATT_BENCH_ECHO_PAYLOAD 20
+#define GATT_BENCH_ECHO_TIMEOUT_MS 1000
+// Time for a profile change to reach the link before measuring
+#define GATT_BENCH_SETTLE_MS 1000
+#define GATT_BENCH_CONNECT_TIMEOUT_S 30
+
+// Link parameters a profile asks for. The values the peer settled on are
+// taken from the connection bus and printed with the results.
+struct gatt_bench_profile {
+  const char *name;
+  uint16_t interval; // 1.25 ms units
+  uint8_t phy;       // BT_GAP_LE_PHY_*
+  uint16_t data_len; // Link layer payload octets
+};
+
+// Write sink counters, served little endian by a read of the sink value
+struct gatt_bench_sink {
+  uint32_t writes;
+  uint32_t bytes;
+  uint32_t gaps; // Sequence numbers skipped between writes
+};
+
+struct gatt_bench_phase {
+  uint32_t packets;
+  uint32_t bytes;
+  uint32_t lost;
+  uint32_t elapsed_us;
+};
+
+class Characteristic;
+class Peripheral;
+
+// GATT benchmark: device 0 runs one central that connects to "BenchT*",
+// every other device runs a peripheral with the throughput service (notify
+// source, write sink, echo). For each link profile the central measures
+// notification and write throughput and echo round-trip time for
+// CONFIG_BLUESIM_BENCH_GATT_PHASE_S seconds each. Results are printed as
+// BENCH lines, every profile line is followed by the metrics measured
+// under it.
+class GattBench {
+public:
+  static int run();
+
+  // Hooks called by Central when the benchmark is enabled
+  static void onConnected(Central *central, struct bt_conn *conn);
+  static void onDisconnected(struct bt_conn *conn);
+
+private:
+  // Central side, runs on the main thread
+  static int runCentral();
+  static int prepare();
+  static int discover(const struct bt_uuid *uuid, uint16_t *value_handle);
+  static int readSink(struct gatt_bench_sink *out);
+  static void applyProfile(const struct gatt_bench_profile &profile);
+  static void runProfile(const struct gatt_bench_profile &profile);
+  static int measureNotify(struct gatt_bench_phase *out);
+  static int measureWrite(struct gatt_bench_phase *out);
+  static int measureEcho(struct gatt_bench_phase *out);
+  static void reportPhase(const char *metric,
+                          const struct gatt_bench_phase &phase);
+
+  static uint8_t discoverCallback(struct bt_conn *conn,
+                                  const struct bt_gatt_attr *attr,
+                                  struct bt_gatt_discover_params *params);
+  static uint8_t readCallback(struct bt_conn *conn, uint8_t err,
+                              struct bt_gatt_read_params *params,
+                              const void *data, uint16_t length);
+  static void mtuExchanged(struct bt_conn *conn, uint8_t err,
+                           struct bt_gatt_exchange_params *params);
+  static uint8_t notifyCallback(struct bt_conn *conn,
+                                struct bt_gatt_subscribe_params *params,
+                                const void *data, uint16_t length);
+  static void writeComplete(struct bt_conn *conn, void *user_data);
+
+  // Peripheral side, runs from the GATT callbacks and WorkQueue::data
+  static int runPeripheral(uint32_t device);
+  static void sourceCccChanged(const struct bt_gatt_attr *attr,
+                               uint16_t value);
+  static void sourceAction(struct k_work *work);
+  static void sourceSent(struct bt_conn *conn, void *user_data);
+  static ssize_t sinkWrite(struct bt_conn *conn,
+                           const struct bt_gatt_attr *attr, const void *buf,
+                           uint16_t len, uint16_t offset, uint8_t flags);
+  static ssize_t sinkRead(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                          void *buf, uint16_t len, uint16_t offset);
+  static ssize_t echoWrite(struct bt_conn *conn,
+                           const struct bt_gatt_attr *attr, const void *buf,
+                           uint16_t len, uint16_t offset, uint8_t flags);
+
+  static struct bt_conn *_conn;
+  static struct k_sem _connected;
+  static struct k_sem _step; // MTU exchange, discovery and reads
+  static struct k_sem _credits;
+  static struct k_sem _echo;
+  static int _stepErr;
+  static bool _linkLost;
+
+  static uint16_t _sourceHandle;
+  static uint16_t _sinkHandle;
+  static uint16_t _echoHandle;
+  static struct bt_gatt_exchange_params _mtuParams;
+  static struct bt_gatt_discover_params _discoverParams;
+  static struct bt_gatt_read_params _readParams;
+  static struct bt_gatt_subscribe_params _sourceSub;
+  static struct bt_gatt_subscribe_params _echoSub;
+  static struct gatt_bench_sink _readSink;
+  static uint16_t _discovered;
+
+  // Notify phase, written by notifyCallback on the RX thread
+  static uint32_t _notifyPackets;
+  static uint32_t _notifyBytes;
+  static uint32_t _notifyGaps;
+  static uint32_t _notifyNextSeq;
+  static int64_t _notifyFirstTicks;
+  static int64_t _notifyLastTicks;
+
+  static uint32_t _writeSeq;
+  static uint32_t _pingSeq;
+  static uint32_t _pingCycles;
+  static uint32_t _rttCycles;
+  static uint8_t _payload[GATT_BENCH_MAX_PAYLOAD];
+  static SampleSet _rtt;
+
+  // Peripheral state
+  static Peripheral *_peripheral;
+  static Characteristic *_source;
+  static Characteristic *_echoValue;
+  static struct queued_work _sourceWork;
+  static atomic_t _sourceInflight;
+  static bool _sourcing;
+  static uint32_t _sourceSeq;
+  static uint32_t _sinkNextSeq;
+  static struct gatt_bench_sink _sink;
+};
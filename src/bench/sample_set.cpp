@@ -0,0 +1,57 @@
+#include "sample_set.hpp"
+
+extern "C" {
+#include <stdlib.h>
+#include <zephyr/sys/printk.h>
+}
+
+static int compareSamples(const void *a, const void *b) {
+  uint32_t lhs = *static_cast<const uint32_t *>(a);
+  uint32_t rhs = *static_cast<const uint32_t *>(b);
+  return (lhs > rhs) - (lhs < rhs);
+}
+
+SampleSet::SampleSet(const char *name)
+    : _name(name), _total(0), _stored(0), _sorted(true) {}
+
+void SampleSet::add(uint32_t value) {
+  _total++;
+  if (_stored >= MAX_BENCH_SAMPLES) {
+    return;
+  }
+
+  _values[_stored++] = value;
+  _sorted = false;
+}
+
+void SampleSet::reset() {
+  _total = 0;
+  _stored = 0;
+  _sorted = true;
+}
+
+void SampleSet::sort() {
+  if (!_sorted) {
+    qsort(_values, _stored, sizeof(_values[0]), compareSamples);
+    _sorted = true;
+  }
+}
+
+uint32_t SampleSet::percentile(uint8_t pct) {
+  if (_stored == 0) {
+    return 0;
+  }
+
+  sort();
+  // Nearest-rank percentile
+  uint32_t rank = (pct * _stored + 99) / 100;
+  return _values[rank > 0 ? rank - 1 : 0];
+}
+
+void SampleSet::report(const char *unit) {
+  sort();
+  printk("BENCH {\"metric\":\"%s\",\"unit\":\"%s\",\"n\":%u,\"min\":%u,"
+         "\"p50\":%u,\"p90\":%u,\"p99\":%u,\"max\":%u}\n",
+         _name, unit, _total, _stored ? _values[0] : 0, percentile(50),
+         percentile(90), percentile(99), _stored ? _values[_stored - 1] : 0);
+}
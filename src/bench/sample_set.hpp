@@ -0,0 +1,32 @@
+#pragma once
+
+extern "C" {
+#include <stdint.h>
+#include <zephyr/kernel.h>
+}
+
+#define MAX_BENCH_SAMPLES 128
+
+// Fixed-capacity set of latency samples reported as percentiles. Samples past
+// the capacity are counted but not kept.
+class SampleSet {
+public:
+  SampleSet(const char *name);
+
+  void add(uint32_t value);
+  void reset();
+  uint32_t percentile(uint8_t pct);
+  uint32_t count() const { return _total; }
+
+  // One machine-readable line: BENCH {"metric":...,"p50":...}
+  void report(const char *unit = "us");
+
+private:
+  void sort();
+
+  const char *_name;
+  uint32_t _values[MAX_BENCH_SAMPLES];
+  uint32_t _total;
+  uint16_t _stored;
+  bool _sorted;
+};
@@ -0,0 +1,176 @@
+#include "scale_bench.hpp"
+#include "bench_device.hpp"
+#include "../common/memory_budget.hpp"
+#include "../peripheral/advertisement.hpp"
+#include "../peripheral/peripheral.hpp"
+#include "../roles/role_pools.hpp"
+#include <stdio.h>
+#include <zephyr/logging/log.h>
+
+extern "C" {
+#include <zephyr/sys/printk.h>
+}
+
+LOG_MODULE_REGISTER(SCALE_BENCH, LOG_LEVEL_INF);
+
+BUILD_ASSERT(CONFIG_BLUESIM_BENCH_CENTRALS <= MAX_CENTRALS,
+             "More benchmark centrals than MAX_CENTRALS");
+
+int64_t ScaleBench::firstScanTicks[MAX_CENTRALS] = {0};
+int64_t ScaleBench::scanStartTicks[MAX_CENTRALS] = {0};
+int64_t ScaleBench::matchTicks[MAX_CENTRALS] = {0};
+bool ScaleBench::firstMatchSeen[MAX_CENTRALS] = {false};
+bool ScaleBench::filled[MAX_CENTRALS] = {false};
+uint8_t ScaleBench::filledCount = 0;
+struct k_sem ScaleBench::done;
+struct k_spinlock ScaleBench::lock = {};
+bool ScaleBench::closed = false;
+
+SampleSet ScaleBench::firstMatch("time_to_first_match");
+SampleSet ScaleBench::discovery("scan_start_to_match");
+SampleSet ScaleBench::matchToConnected("match_to_connected");
+SampleSet ScaleBench::fillSlots("time_to_fill_slots");
+
+int ScaleBench::run() {
+  k_sem_init(&ScaleBench::done, 0, 1);
+
+  uint32_t device = benchDeviceIndex();
+  LOG_INF("Scale benchmark device %u", device);
+  if (device == 0) {
+    return runCentrals();
+  }
+  return runPeripherals(device);
+}
+
+int ScaleBench::runCentrals() {
+  // All centrals compete for the same advertisers
+  Filter filter;
+  filter.addGroup();
+  filter.addCriterion(FilterCriterionType::LOCAL_NAME, "BenchP*");
+
+  for (uint8_t i = 0; i < CONFIG_BLUESIM_BENCH_CENTRALS; i++) {
+    Central *central = RolePools::centrals.emplace();
+    if (!central) {
+      return -ENOMEM;
+    }
+    central->addFilter(filter);
+    central->scheduleScanningStart();
+  }
+  MemoryBudget::printReport();
+
+  // Report once every central filled its slots, or at the deadline
+  k_sem_take(&ScaleBench::done, K_SECONDS(CONFIG_BLUESIM_BENCH_DURATION_S));
+  report();
+
+  while (true) {
+    k_sleep(K_SECONDS(1));
+  }
+  return 0;
+}
+
+int ScaleBench::runPeripherals(uint32_t device) {
+  // One advertising set per peripheral, as many as both pools allow
+  for (uint8_t i = 0; i < MIN(MAX_ADVERTISEMENTS, MAX_PERIPHERALS); i++) {
+    char name[MAX_LOCAL_NAME_LENGTH];
+    snprintf(name, sizeof(name), "BenchP%u_%u", device, i);
+
+    Advertisement *advertisement = RolePools::advertisements.emplace();
+    Peripheral *peripheral = RolePools::peripherals.emplace();
+    if (!advertisement || !peripheral) {
+      return -ENOMEM;
+    }
+
+    int err = advertisement->init(name);
+    if (err < 0) {
+      return err;
+    }
+
+    peripheral->addAdvertisement(advertisement);
+    advertisement->startAdvertising();
+  }
+  MemoryBudget::printReport();
+
+  while (true) {
+    k_sleep(K_SECONDS(1));
+  }
+  return 0;
+}
+
+uint32_t ScaleBench::elapsedUs(int64_t since) {
+  return (uint32_t)k_ticks_to_us_floor64(k_uptime_ticks() - since);
+}
+
+void ScaleBench::onScanStarted(Central *central) {
+  int64_t now = k_uptime_ticks();
+  k_spinlock_key_t key = k_spin_lock(&ScaleBench::lock);
+  if (!ScaleBench::firstScanTicks[central->_index]) {
+    ScaleBench::firstScanTicks[central->_index] = now;
+  }
+  ScaleBench::scanStartTicks[central->_index] = now;
+  k_spin_unlock(&ScaleBench::lock, key);
+}
+
+void ScaleBench::onMatch(Central *central) {
+  uint8_t index = central->_index;
+  k_spinlock_key_t key = k_spin_lock(&ScaleBench::lock);
+  if (ScaleBench::closed) {
+    k_spin_unlock(&ScaleBench::lock, key);
+    return;
+  }
+
+  if (!ScaleBench::firstMatchSeen[index]) {
+    ScaleBench::firstMatchSeen[index] = true;
+    ScaleBench::firstMatch.add(elapsedUs(ScaleBench::firstScanTicks[index]));
+  }
+
+  ScaleBench::discovery.add(elapsedUs(ScaleBench::scanStartTicks[index]));
+  ScaleBench::matchTicks[index] = k_uptime_ticks();
+  k_spin_unlock(&ScaleBench::lock, key);
+}
+
+void ScaleBench::onConnected(Central *central) {
+  uint8_t index = central->_index;
+  k_spinlock_key_t key = k_spin_lock(&ScaleBench::lock);
+  if (ScaleBench::closed) {
+    k_spin_unlock(&ScaleBench::lock, key);
+    return;
+  }
+
+  ScaleBench::matchToConnected.add(elapsedUs(ScaleBench::matchTicks[index]));
+
+  bool allFilled = false;
+  if (!ScaleBench::filled[index] &&
+      central->_connectionCount >= MAX_CENTRAL_CONNECTIONS) {
+    ScaleBench::filled[index] = true;
+    ScaleBench::fillSlots.add(elapsedUs(ScaleBench::firstScanTicks[index]));
+    allFilled = ++ScaleBench::filledCount == CONFIG_BLUESIM_BENCH_CENTRALS;
+  }
+  k_spin_unlock(&ScaleBench::lock, key);
+
+  if (allFilled) {
+    k_sem_give(&ScaleBench::done);
+  }
+}
+
+void ScaleBench::report() {
+  // The centrals keep scanning and connecting on the RX thread, freeze the
+  // samples before sorting them
+  k_spinlock_key_t key = k_spin_lock(&ScaleBench::lock);
+  ScaleBench::closed = true;
+  k_spin_unlock(&ScaleBench::lock, key);
+
+  for (Central *central : Central::registry) {
+    if (central) {
+      central->scheduleScanningStop();
+    }
+  }
+
+  printk("BENCH {\"suite\":\"scale\",\"centrals\":%u,\"slots\":%u,"
+         "\"filled\":%u}\n",
+         CONFIG_BLUESIM_BENCH_CENTRALS, MAX_CENTRAL_CONNECTIONS,
+         ScaleBench::filledCount);
+  ScaleBench::firstMatch.report();
+  ScaleBench::discovery.report();
+  ScaleBench::matchToConnected.report();
+  ScaleBench::fillSlots.report();
+}
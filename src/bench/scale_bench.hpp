@@ -0,0 +1,46 @@
+#pragma once
+
+#include "../central/central.hpp"
+#include "sample_set.hpp"
+
+extern "C" {
+#include <zephyr/kernel.h>
+}
+
+// Scale benchmark: device 0 runs the centrals, every other device runs
+// MAX_ADVERTISEMENTS advertising peripherals named "BenchP<device>_<n>".
+// On nrf52_bsim the device number comes from the simulator, on hardware from
+// CONFIG_BLUESIM_BENCH_DEVICE_INDEX. Results are printed as BENCH lines once,
+// the samples are frozen from then on.
+class ScaleBench {
+public:
+  static int run();
+
+  // Hooks called by Central and Scanner when the benchmark is enabled
+  static void onScanStarted(Central *central);
+  static void onMatch(Central *central);
+  static void onConnected(Central *central);
+
+  static void report();
+
+private:
+  static int runCentrals();
+  static int runPeripherals(uint32_t device);
+  static uint32_t elapsedUs(int64_t since);
+
+  static int64_t firstScanTicks[MAX_CENTRALS];
+  static int64_t scanStartTicks[MAX_CENTRALS];
+  static int64_t matchTicks[MAX_CENTRALS];
+  static bool firstMatchSeen[MAX_CENTRALS];
+  static bool filled[MAX_CENTRALS];
+  static uint8_t filledCount;
+  static struct k_sem done;
+  // Guards the samples against report(), hooks after it are dropped
+  static struct k_spinlock lock;
+  static bool closed;
+
+  static SampleSet firstMatch;
+  static SampleSet discovery;
+  static SampleSet matchToConnected;
+  static SampleSet fillSlots;
+};
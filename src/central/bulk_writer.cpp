@@ -0,0 +1,343 @@
+#include "bulk_writer.hpp"
+#include "../common/link_scheduler.hpp"
+#include "central.hpp"
+#include <zephyr/logging/log.h>
+
+extern "C" {
+#include <stdlib.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/printk.h>
+#ifdef CONFIG_SHELL
+#include <zephyr/shell/shell.h>
+#endif
+}
+
+LOG_MODULE_REGISTER(BULK_WRITER, LOG_LEVEL_INF);
+
+struct bulk_session BulkWriter::_sessions[MAX_BUS_CONNECTIONS] = {};
+uint8_t BulkWriter::_pattern[BULK_MAX_CHUNK] = {};
+
+// Completions carry the session index and run generation instead of a
+// pointer, so a late callback from a stopped run cannot count against the
+// next one on the same connection slot
+static void *encodeToken(uint8_t index, uint8_t generation) {
+  return (void *)(uintptr_t)(((uint32_t)generation << 8) | index);
+}
+
+int BulkWriter::start(struct bt_conn *conn, uint16_t handle, uint32_t bytes) {
+  if (!bytes) {
+    return -EINVAL;
+  }
+
+  uint8_t index = bt_conn_index(conn);
+  struct bulk_session &session = _sessions[index];
+  if (session.running) {
+    return -EBUSY;
+  }
+
+  if (!session.work.queue) {
+    WorkQueue::data.initWork(&session.work, workAction);
+  }
+
+  session.conn = bt_conn_ref(conn);
+  session.handle = handle;
+  session.bytes = bytes;
+  session.packets = 0;
+  session.queued = 0;
+  session.stalls = 0;
+  session.start_ticks = k_uptime_ticks();
+  // Wraps past 0, which result() keeps for "never ran"
+  session.generation = session.generation == UINT8_MAX
+                           ? 1
+                           : session.generation + 1;
+  atomic_set(&session.completed, 0);
+  atomic_set(&session.inflight, 0);
+  session.result = {};
+  session.stopping = false;
+  session.running = true;
+
+  // Ask for the fastest link the peer accepts, the outcome shows up on the
+  // connection bus and in the result line
+  const struct conn_link &link = ConnectionBus::link(conn);
+#ifdef CONFIG_BT_USER_PHY_UPDATE
+  if (link.tx_phy != BT_GAP_LE_PHY_2M) {
+    int err = bt_conn_le_phy_update(conn, BT_CONN_LE_PHY_PARAM_2M);
+    if (err < 0) {
+      LOG_WRN("Connection %u: 2M PHY request failed (err %d)", index, err);
+    }
+  }
+#endif
+#ifdef CONFIG_BT_USER_DATA_LEN_UPDATE
+  if (link.tx_max_len < BT_GAP_DATA_LEN_MAX) {
+    int err = bt_conn_le_data_len_update(conn, BT_LE_DATA_LEN_PARAM_MAX);
+    if (err < 0) {
+      LOG_WRN("Connection %u: Data length request failed (err %d)", index,
+              err);
+    }
+  }
+#endif
+  ARG_UNUSED(link);
+
+  // The transfer starts once the MTU is settled
+  session.mtu.func = mtuExchanged;
+  int err = bt_gatt_exchange_mtu(conn, &session.mtu);
+  if (err == -EALREADY) {
+    begin(session);
+  } else if (err < 0) {
+    LOG_WRN("Connection %u: MTU exchange failed (err %d), using %u", index,
+            err, bt_gatt_get_mtu(conn));
+    begin(session);
+  }
+
+  LOG_INF("Connection %u: Bulk write of %u bytes to handle 0x%04x", index,
+          bytes, handle);
+  return 0;
+}
+
+void BulkWriter::mtuExchanged(struct bt_conn *conn, uint8_t err,
+                              struct bt_gatt_exchange_params *params) {
+  struct bulk_session *session = CONTAINER_OF(params, struct bulk_session, mtu);
+  if (err) {
+    LOG_WRN("MTU exchange failed (err %u), using %u", err,
+            bt_gatt_get_mtu(conn));
+  }
+
+  if (session->running) {
+    begin(*session);
+  }
+}
+
+void BulkWriter::begin(struct bulk_session &session) {
+  session.chunk = MIN(bt_gatt_get_mtu(session.conn) - 3, BULK_MAX_CHUNK);
+  session.packets = DIV_ROUND_UP(session.bytes, session.chunk);
+  session.start_ticks = k_uptime_ticks();
+  WorkQueue::data.schedule(&session.work, K_NO_WAIT);
+}
+
+void BulkWriter::fill(struct bulk_session &session) {
+  uint8_t index = bt_conn_index(session.conn);
+  void *token = encodeToken(index, session.generation);
+
+  while (session.queued < session.packets &&
+         atomic_get(&session.inflight) < BULK_WINDOW) {
+    uint32_t offset = session.queued * session.chunk;
+    uint16_t len = (uint16_t)MIN(session.chunk, session.bytes - offset);
+
+    // The stack copies the payload, stamping the offset in the shared
+    // pattern lets the receiver spot gaps
+    sys_put_le32(offset, _pattern);
+
+    atomic_inc(&session.inflight);
+    int err = bt_gatt_write_without_response_cb(session.conn, session.handle,
+                                                _pattern, len, false,
+                                                writeComplete, token);
+    if (err == -ENOMEM || err == -ENOBUFS) {
+      // Out of TX buffers, the next completion refills. With nothing in
+      // flight no completion will come, so retry on a timer.
+      atomic_dec(&session.inflight);
+      session.stalls++;
+      if (atomic_get(&session.inflight) == 0) {
+        WorkQueue::data.schedule(&session.work, K_MSEC(BULK_RETRY_MS));
+      }
+      return;
+    }
+    if (err < 0) {
+      atomic_dec(&session.inflight);
+      LOG_ERR("Connection %u: Bulk write failed (err %d)", index, err);
+      finish(session);
+      return;
+    }
+
+    session.queued++;
+  }
+}
+
+void BulkWriter::writeComplete(struct bt_conn *conn, void *user_data) {
+  uint32_t token = (uint32_t)(uintptr_t)user_data;
+  struct bulk_session &session = _sessions[token & 0xFF];
+  if (!session.running || session.generation != (uint8_t)(token >> 8)) {
+    return;
+  }
+
+  atomic_dec(&session.inflight);
+  if (IS_ENABLED(CONFIG_BLUESIM_LINK_SCHEDULER)) {
+    LinkScheduler::account(conn, session.chunk);
+  }
+  uint32_t completed = (uint32_t)atomic_inc(&session.completed) + 1;
+  if (completed == session.packets) {
+    session.end_ticks = k_uptime_ticks();
+  }
+
+  // Refill from the data queue, completions run on a Bluetooth thread
+  WorkQueue::data.schedule(&session.work, K_NO_WAIT);
+}
+
+void BulkWriter::workAction(struct k_work *work) {
+  struct bulk_session *session =
+      CONTAINER_OF(work, struct bulk_session, work);
+  if (!session->running) {
+    return;
+  }
+
+  if (session->stopping ||
+      (session->packets &&
+       (uint32_t)atomic_get(&session->completed) >= session->packets)) {
+    finish(*session);
+    return;
+  }
+
+  fill(*session);
+}
+
+void BulkWriter::finish(struct bulk_session &session) {
+  uint8_t index = bt_conn_index(session.conn);
+  uint32_t completed = (uint32_t)atomic_get(&session.completed);
+  bool done = session.packets && completed >= session.packets;
+  int64_t end = done ? session.end_ticks : k_uptime_ticks();
+
+  struct bulk_result &result = session.result;
+  result.bytes = MIN(completed * session.chunk, session.bytes);
+  result.elapsed_us =
+      (uint32_t)k_ticks_to_us_floor64(end - session.start_ticks);
+  result.kbps = result.elapsed_us
+                    ? (uint32_t)((uint64_t)result.bytes * 8000U /
+                                 result.elapsed_us)
+                    : 0;
+  result.chunk = session.chunk;
+  result.stalls = session.stalls;
+  session.running = false;
+  session.stopping = false;
+
+  const struct conn_link &link = ConnectionBus::link(session.conn);
+  printk("BULK {\"conn\":%u,\"bytes\":%u,\"us\":%u,\"kbps\":%u,"
+         "\"chunk\":%u,\"window\":%u,\"stalls\":%u,\"phy\":%u,"
+         "\"data_len\":%u,\"interval\":%u}\n",
+         index, result.bytes, result.elapsed_us, result.kbps, result.chunk,
+         BULK_WINDOW, result.stalls, link.tx_phy, link.tx_max_len,
+         link.interval);
+
+  bt_conn_unref(session.conn);
+  session.conn = nullptr;
+}
+
+int BulkWriter::stop(struct bt_conn *conn) {
+  struct bulk_session &session = _sessions[bt_conn_index(conn)];
+  if (!session.running) {
+    return -EALREADY;
+  }
+
+  // fill() may be running on the data queue right now, so the session is
+  // torn down there rather than under its feet. The connection reference
+  // keeps the link object valid until then.
+  session.stopping = true;
+  WorkQueue::data.schedule(&session.work, K_NO_WAIT);
+  return 0;
+}
+
+void BulkWriter::onDisconnected(struct bt_conn *conn) {
+  struct bulk_session &session = _sessions[bt_conn_index(conn)];
+  if (!session.running || session.conn != conn) {
+    return;
+  }
+
+  LOG_WRN("Connection %u: Link lost during bulk write", bt_conn_index(conn));
+  stop(conn);
+}
+
+bool BulkWriter::isRunning(struct bt_conn *conn) {
+  return _sessions[bt_conn_index(conn)].running;
+}
+
+int BulkWriter::result(struct bt_conn *conn, struct bulk_result *out) {
+  const struct bulk_session &session = _sessions[bt_conn_index(conn)];
+  if (session.running) {
+    return -EINPROGRESS;
+  }
+  if (!session.generation) {
+    return -ENODATA;
+  }
+
+  *out = session.result;
+  return 0;
+}
+
+#ifdef CONFIG_SHELL
+static struct bt_conn *shellConnection(const struct shell *sh, char **argv) {
+  unsigned long central = strtoul(argv[1], nullptr, 0);
+  unsigned long slot = strtoul(argv[2], nullptr, 0);
+  struct bt_conn *conn = Central::connectionAt(central, slot);
+  if (!conn) {
+    shell_error(sh, "No connection in slot %lu of central %lu", slot,
+                central);
+  }
+  return conn;
+}
+
+static int cmdBulkStart(const struct shell *sh, size_t argc, char **argv) {
+  ARG_UNUSED(argc);
+
+  struct bt_conn *conn = shellConnection(sh, argv);
+  if (!conn) {
+    return -ENOENT;
+  }
+
+  uint16_t handle = (uint16_t)strtoul(argv[3], nullptr, 0);
+  uint32_t bytes = (uint32_t)strtoul(argv[4], nullptr, 0) * 1024U;
+  int err = BulkWriter::start(conn, handle, bytes);
+  if (err < 0) {
+    shell_error(sh, "Failed to start (err %d)", err);
+  }
+  return err;
+}
+
+static int cmdBulkStop(const struct shell *sh, size_t argc, char **argv) {
+  ARG_UNUSED(argc);
+
+  struct bt_conn *conn = shellConnection(sh, argv);
+  if (!conn) {
+    return -ENOENT;
+  }
+
+  int err = BulkWriter::stop(conn);
+  if (err < 0) {
+    shell_error(sh, "Not running");
+  }
+  return err;
+}
+
+static int cmdBulkShow(const struct shell *sh, size_t argc, char **argv) {
+  ARG_UNUSED(argc);
+
+  struct bt_conn *conn = shellConnection(sh, argv);
+  if (!conn) {
+    return -ENOENT;
+  }
+
+  struct bulk_result result;
+  int err = BulkWriter::result(conn, &result);
+  if (err == -EINPROGRESS) {
+    shell_print(sh, "Transfer running");
+    return 0;
+  }
+  if (err < 0) {
+    shell_print(sh, "No transfer yet");
+    return 0;
+  }
+
+  shell_print(sh, "%u bytes in %u us, %u kbps, chunk %u, %u stalls",
+              result.bytes, result.elapsed_us, result.kbps, result.chunk,
+              result.stalls);
+  return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+    bulk_cmds,
+    SHELL_CMD_ARG(start, NULL, "<central> <slot> <handle> <KiB>",
+                  cmdBulkStart, 5, 0),
+    SHELL_CMD_ARG(stop, NULL, "<central> <slot>", cmdBulkStop, 3, 0),
+    SHELL_CMD_ARG(show, NULL, "<central> <slot>", cmdBulkShow, 3, 0),
+    SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(bulk, &bulk_cmds, "Write-without-response bulk transfer",
+                   NULL);
+#endif
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "../common/connection_bus.hpp"
+#include "../common/work_queue.hpp"
+
+extern "C" {
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+}
+
+#ifdef CONFIG_BLUESIM_BULK_WINDOW
+#define BULK_WINDOW CONFIG_BLUESIM_BULK_WINDOW
+#else
+#define BULK_WINDOW 8
+#endif
+
+// Largest ATT payload with a 247 byte MTU, fills one 251 byte LL packet
+#define BULK_MAX_CHUNK 244
+// Retry delay when the stack refused a write with nothing in flight
+#define BULK_RETRY_MS 5
+
+struct bulk_result {
+  uint32_t bytes;
+  uint32_t elapsed_us; // First write queued to last write sent
+  uint32_t kbps;
+  uint16_t chunk;
+  uint32_t stalls; // Writes refused for lack of TX buffers
+};
+
+struct bulk_session {
+  struct bt_conn *conn;
+  uint16_t handle;
+  uint16_t chunk; // ATT payload per write, MTU - 3
+  uint8_t generation; // Run counter, tags completions, 0 before the first
+  uint32_t bytes;
+  uint32_t packets;
+  uint32_t queued; // Writes handed to the stack
+  atomic_t completed;
+  atomic_t inflight;
+  uint32_t stalls;
+  int64_t start_ticks;
+  int64_t end_ticks;
+  bool running;
+  bool stopping; // Teardown requested, done by the next work run
+  struct queued_work work;
+  struct bt_gatt_exchange_params mtu;
+  struct bulk_result result;
+};
+
+// Write-without-response bulk transfer for firmware upload style tests. Up
+// to BULK_WINDOW writes are kept in flight per connection, each completion
+// callback frees a window slot and the data work queue refills it, so the
+// controller has packets for every connection event instead of one.
+class BulkWriter {
+public:
+  static int start(struct bt_conn *conn, uint16_t handle, uint32_t bytes);
+  static int stop(struct bt_conn *conn);
+  static void onDisconnected(struct bt_conn *conn);
+  static bool isRunning(struct bt_conn *conn);
+  static int result(struct bt_conn *conn, struct bulk_result *out);
+
+private:
+  static void begin(struct bulk_session &session);
+  static void fill(struct bulk_session &session);
+  static void finish(struct bulk_session &session);
+  static void workAction(struct k_work *work);
+  static void writeComplete(struct bt_conn *conn, void *user_data);
+  static void mtuExchanged(struct bt_conn *conn, uint8_t err,
+                           struct bt_gatt_exchange_params *params);
+
+  static struct bulk_session _sessions[MAX_BUS_CONNECTIONS];
+  static uint8_t _pattern[BULK_MAX_CHUNK];
+};
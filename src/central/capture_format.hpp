@@ -0,0 +1,114 @@
+#pragma once
+
+// Binary scan report log shared by the on-target capture/replay and the host
+// tools, so it only depends on the Bluetooth address type.
+//
+// Layout (little endian):
+//   header:  "BSCP" | version (1) | 3 reserved bytes
+//   record:  length (1, bytes that follow) | delta_us (4) | addr type (1) |
+//            addr (6) | rssi (1) | adv type (1) | AD bytes (length - 13)
+// A length of 0x00 is padding and is skipped, 0xFF (erased flash) ends the
+// log.
+
+extern "C" {
+#include <stdint.h>
+#include <string.h>
+#include <zephyr/bluetooth/bluetooth.h>
+}
+
+#define CAPTURE_VERSION 1
+#define CAPTURE_HEADER_SIZE 8
+#define CAPTURE_RECORD_FIXED_SIZE 13
+#define CAPTURE_MAX_RECORD_SIZE 254
+#define CAPTURE_MAX_AD_LENGTH                                                  \
+  (CAPTURE_MAX_RECORD_SIZE - CAPTURE_RECORD_FIXED_SIZE)
+#define CAPTURE_RECORD_PADDING 0x00
+#define CAPTURE_RECORD_END 0xFF
+
+struct capture_record {
+  uint32_t delta_us; // Time since the previous record
+  bt_addr_le_t addr;
+  int8_t rssi;
+  uint8_t adv_type;
+  uint8_t ad_length;
+  const uint8_t *ad;
+};
+
+class CaptureFormat {
+public:
+  static void writeHeader(uint8_t *out) {
+    memcpy(out, "BSCP", 4);
+    out[4] = CAPTURE_VERSION;
+    out[5] = out[6] = out[7] = 0;
+  }
+
+  static bool checkHeader(const uint8_t *in) {
+    return memcmp(in, "BSCP", 4) == 0 && in[4] == CAPTURE_VERSION;
+  }
+
+  // Size of the encoded record including its length byte
+  static size_t encodedSize(uint8_t ad_length) {
+    return 1 + CAPTURE_RECORD_FIXED_SIZE + ad_length;
+  }
+
+  // Returns the number of bytes written, 0 if out is too small
+  static size_t encode(const struct capture_record &record, uint8_t *out,
+                       size_t out_size) {
+    uint8_t ad_length = record.ad_length > CAPTURE_MAX_AD_LENGTH
+                            ? CAPTURE_MAX_AD_LENGTH
+                            : record.ad_length;
+    size_t size = encodedSize(ad_length);
+    if (out_size < size) {
+      return 0;
+    }
+
+    out[0] = CAPTURE_RECORD_FIXED_SIZE + ad_length;
+    out[1] = record.delta_us & 0xff;
+    out[2] = (record.delta_us >> 8) & 0xff;
+    out[3] = (record.delta_us >> 16) & 0xff;
+    out[4] = (record.delta_us >> 24) & 0xff;
+    out[5] = record.addr.type;
+    memcpy(&out[6], record.addr.a.val, sizeof(record.addr.a.val));
+    out[12] = (uint8_t)record.rssi;
+    out[13] = record.adv_type;
+    memcpy(&out[14], record.ad, ad_length);
+    return size;
+  }
+
+  // Decodes the record at the start of in. Returns the bytes consumed, 0 if
+  // more input is needed and -1 at the end of the log. Padding decodes as a
+  // one byte record with ad == nullptr.
+  static int decode(const uint8_t *in, size_t len,
+                    struct capture_record &record) {
+    if (len == 0) {
+      return 0;
+    }
+
+    if (in[0] == CAPTURE_RECORD_END) {
+      return -1;
+    }
+
+    if (in[0] == CAPTURE_RECORD_PADDING) {
+      record.ad = nullptr;
+      return 1;
+    }
+
+    if (in[0] < CAPTURE_RECORD_FIXED_SIZE) {
+      return -1;
+    }
+
+    if (len < (size_t)in[0] + 1) {
+      return 0;
+    }
+
+    record.delta_us = (uint32_t)in[1] | ((uint32_t)in[2] << 8) |
+                      ((uint32_t)in[3] << 16) | ((uint32_t)in[4] << 24);
+    record.addr.type = in[5];
+    memcpy(record.addr.a.val, &in[6], sizeof(record.addr.a.val));
+    record.rssi = (int8_t)in[12];
+    record.adv_type = in[13];
+    record.ad_length = in[0] - CAPTURE_RECORD_FIXED_SIZE;
+    record.ad = &in[14];
+    return in[0] + 1;
+  }
+};
@@ -1,4 +1,11 @@
 #include "central.hpp"
+#include "../bench/gatt_bench.hpp"
+#include "../bench/scale_bench.hpp"
+#include "../common/link_scheduler.hpp"
+#include "../common/pairing.hpp"
+#include "../common/trace.hpp"
+#include "bulk_writer.hpp"
+#include "link_latency.hpp"
 #include <zephyr/logging/log.h>
 
 LOG_MODULE_REGISTER(CENTRAL, LOG_LEVEL_DBG);
@@ -8,9 +15,10 @@ Central *Central::registry[MAX_CENTRALS] = {nullptr};
 
 Central::Central()
     : _index(0), _connectionCount(0), _scanner(this),
-      _shouldStartScanning(false), _maxConnections(MAX_CENTRAL_CONNECTIONS) {
-  // Initialize the work item
-  k_work_init_delayable(&_scanWork, scanWorkAction);
+      _shouldStartScanning(false), _maxConnections(MAX_CENTRAL_CONNECTIONS),
+      _security(PAIRING_SECURITY_LEVEL) {
+  // Scan transitions run on the radio control queue
+  WorkQueue::radio.initWork(&_scanWork, scanWorkAction);
   for (uint8_t i = 0; i < MAX_CENTRAL_CONNECTIONS; i++) {
     _connections[i] = nullptr;
   }
@@ -30,9 +38,10 @@ Central::Central()
 
 Central::Central(uint8_t max_connections)
     : _index(0), _connectionCount(0), _scanner(this),
-      _shouldStartScanning(false), _maxConnections(max_connections) {
-  // Initialize the work item
-  k_work_init_delayable(&_scanWork, scanWorkAction);
+      _shouldStartScanning(false), _maxConnections(max_connections),
+      _security(PAIRING_SECURITY_LEVEL) {
+  // Scan transitions run on the radio control queue
+  WorkQueue::radio.initWork(&_scanWork, scanWorkAction);
   for (uint8_t i = 0; i < MAX_CENTRAL_CONNECTIONS; i++) {
     _connections[i] = nullptr;
   }
@@ -51,6 +60,9 @@ Central::Central(uint8_t max_connections)
 }
 
 Central::~Central() {
+  // Nothing may call back into this object once its slot is reused
+  WorkQueue::radio.cancelSync(&_scanWork);
+  ConnectionBus::unbind(this);
   Central::registry[_index] = nullptr;
   for (uint8_t i = 0; i < MAX_CENTRAL_CONNECTIONS; i++) {
     if (_connections[i]) {
@@ -105,6 +117,11 @@ int Central::connectToDevice(const bt_addr_le_t *addr) {
       .latency = 0,
       .timeout = 400,
   };
+  if (IS_ENABLED(CONFIG_BLUESIM_LINK_SCHEDULER)) {
+    // Start on the idle harmonic, the plan after connecting shortens it
+    conn_param.interval_min = LinkScheduler::initialInterval();
+    conn_param.interval_max = LinkScheduler::initialInterval();
+  }
 
   int err = bt_conn_le_create(addr, &create_param, &conn_param, &conn);
   if (err < 0) {
@@ -112,12 +129,32 @@ int Central::connectToDevice(const bt_addr_le_t *addr) {
     return err;
   }
 
+  if (IS_ENABLED(CONFIG_BLUESIM_LINK_LATENCY)) {
+    LinkLatency::mark(_index, LatencyStage::CONN_CREATE);
+  }
+
   addConnection(conn);
 
   LOG_INF("Central %d created connection stack connection object", _index);
   return 0;
 }
 
+int Central::subscribe(struct bt_conn *conn, uint16_t value_handle,
+                       uint16_t ccc_handle, NotificationHandler handler) {
+  if (!IS_ENABLED(CONFIG_BLUESIM_NOTIFY_SINK)) {
+    return -ENOTSUP;
+  }
+  return NotificationSink::subscribe(this, conn, value_handle, ccc_handle,
+                                     handler);
+}
+
+int Central::openCoc(struct bt_conn *conn, uint16_t psm, CocMode mode) {
+  if (!IS_ENABLED(CONFIG_BLUESIM_L2CAP_COC)) {
+    return -ENOTSUP;
+  }
+  return CocChannels::connect(conn, psm, mode);
+}
+
 int Central::disconnectFromDevice(const bt_addr_le_t *addr) {
   for (uint8_t i = 0; i < MAX_CENTRAL_CONNECTIONS; i++) {
     // Check if connection exists first
@@ -153,12 +190,13 @@ void Central::addConnection(struct bt_conn *conn) {
       bt_conn_ref(conn);
       _connections[i] = conn;
       _connectionCount++;
-      LOG_INF("Central %d: Added connection %p to slot %d (total: %d/%d)",
-              _index, conn, i, _connectionCount, _maxConnections);
+      ConnectionBus::bind(conn, this);
+      Trace::emit(TraceEvent::CONNECTION_ADDED, _index, i,
+                  _connectionCount | (_maxConnections << 8));
       return;
     }
   }
-  LOG_WRN("No available connection slot found for central %d", _index);
+  Trace::emit(TraceEvent::CONNECTION_SLOT_FULL, _index);
 }
 
 void Central::removeConnection(struct bt_conn *conn) {
@@ -167,15 +205,20 @@ void Central::removeConnection(struct bt_conn *conn) {
       bt_conn_unref(_connections[i]);
       _connections[i] = nullptr;
       _connectionCount--;
-      LOG_INF("Central %d: Removed connection %p from slot %d (total: %d/%d)",
-              _index, conn, i, _connectionCount, _maxConnections);
+      Trace::emit(TraceEvent::CONNECTION_REMOVED, _index, i,
+                  _connectionCount | (_maxConnections << 8));
       return;
     }
   }
-  LOG_WRN("No connection found for central %d", _index);
+  Trace::emit(TraceEvent::CONNECTION_NOT_FOUND, _index);
 }
 
 void Central::onConnected(struct bt_conn *conn, uint8_t err) {
+  // This central's attempt resolved, the scanning start or stop scheduled
+  // below lets the other scanners have the controller again unless one of
+  // them is connecting too
+  StackScan::unhold(_scanner._index);
+
   if (err) {
     LOG_ERR("Central %d connection failed (err %d)", _index, err);
     removeConnection(conn);
@@ -186,6 +229,23 @@ void Central::onConnected(struct bt_conn *conn, uint8_t err) {
 
   LOG_INF("Central %d connected! conn=%p, total connections: %d", _index, conn,
           _connectionCount);
+  DeviceTable::markConnected(bt_conn_get_dst(conn));
+
+  if (IS_ENABLED(CONFIG_BLUESIM_PAIRING)) {
+    Pairing::secure(conn, _security);
+  }
+
+  if (IS_ENABLED(CONFIG_BLUESIM_BENCH_SCALE)) {
+    ScaleBench::onConnected(this);
+  }
+
+  if (IS_ENABLED(CONFIG_BLUESIM_BENCH_GATT)) {
+    GattBench::onConnected(this, conn);
+  }
+
+  if (IS_ENABLED(CONFIG_BLUESIM_LINK_LATENCY)) {
+    LinkLatency::mark(_index, LatencyStage::CONNECTED);
+  }
 
   // Schedule scanning stop after successful connection if maximum number of
   // connections is reached
@@ -202,6 +262,12 @@ void Central::onConnected(struct bt_conn *conn, uint8_t err) {
 
 void Central::onDisconnected(struct bt_conn *conn, uint8_t reason) {
   LOG_DBG("Central %d disconnected (reason %u)\n", _index, reason);
+  if (IS_ENABLED(CONFIG_BLUESIM_BULK_WRITE)) {
+    BulkWriter::onDisconnected(conn);
+  }
+  if (IS_ENABLED(CONFIG_BLUESIM_BENCH_GATT)) {
+    GattBench::onDisconnected(conn);
+  }
   removeConnection(conn);
 
   // Schedule scanning start after disconnection
@@ -224,9 +290,17 @@ Central *Central::fromConn(struct bt_conn *conn) {
   return nullptr;
 }
 
+struct bt_conn *Central::connectionAt(size_t index, size_t slot) {
+  if (index >= MAX_CENTRALS || !registry[index] ||
+      slot >= MAX_CENTRAL_CONNECTIONS) {
+    return nullptr;
+  }
+  return registry[index]->_connections[slot];
+}
+
 void Central::scheduleScanningStart() {
   _shouldStartScanning = true;
-  int err = k_work_reschedule(&_scanWork, K_MSEC(200));
+  int err = WorkQueue::radio.schedule(&_scanWork, K_NO_WAIT);
   if (err < 0) {
     LOG_ERR("Central %d: Failed to schedule scanning start work item (err %d)",
             _index, err);
@@ -237,7 +311,7 @@ void Central::scheduleScanningStart() {
 
 void Central::scheduleScanningStop() {
   _shouldStartScanning = false;
-  int err = k_work_reschedule(&_scanWork, K_MSEC(200));
+  int err = WorkQueue::radio.schedule(&_scanWork, K_NO_WAIT);
   if (err < 0) {
     LOG_ERR("Central %d: Failed to schedule scanning stop work item (err %d)",
             _index, err);
@@ -258,6 +332,12 @@ void Central::scanWorkAction(struct k_work *work) {
               err);
     } else {
       LOG_INF("Central %d: Successfully started scanning", self->_index);
+      if (IS_ENABLED(CONFIG_BLUESIM_BENCH_SCALE)) {
+        ScaleBench::onScanStarted(self);
+      }
+      if (IS_ENABLED(CONFIG_BLUESIM_LINK_LATENCY)) {
+        LinkLatency::mark(self->_index, LatencyStage::SCAN_RESTARTED);
+      }
     }
   } else {
     LOG_INF("Central %d: Executing deferred scanning stop", self->_index);
@@ -1,5 +1,9 @@
 #pragma once
 
+#include "../common/coc_channel.hpp"
+#include "../common/connection_bus.hpp"
+#include "../common/work_queue.hpp"
+#include "notification_sink.hpp"
 #include "scanner.hpp"
 
 extern "C" {
@@ -9,11 +13,18 @@ extern "C" {
 }
 
 static constexpr int MAX_CENTRALS =
-    (CONFIG_BT_MAX_CONN - CONFIG_BT_CTLR_SDC_PERIPHERAL_COUNT) / 2;
+    (CONFIG_BT_MAX_CONN - CONFIG_BLUESIM_PERIPHERAL_CONNECTIONS) / 2;
+// Guarded so a bad link split fails on the assertions below instead of on a
+// division by zero
 static constexpr int MAX_CENTRAL_CONNECTIONS =
-    (CONFIG_BT_MAX_CONN / 2) / MAX_CENTRALS;
+    MAX_CENTRALS > 0 ? (CONFIG_BT_MAX_CONN / 2) / MAX_CENTRALS : 0;
 
-class Central {
+BUILD_ASSERT(MAX_CENTRALS >= 1,
+             "BLUESIM_PERIPHERAL_CONNECTIONS must leave at least two "
+             "CONFIG_BT_MAX_CONN links to the centrals");
+BUILD_ASSERT(MAX_CENTRAL_CONNECTIONS >= 1, "Centrals without a link");
+
+class Central : public ConnectionListener {
 public:
   Central();
   Central(uint8_t max_connections);
@@ -25,10 +36,25 @@ public:
   void addConnection(struct bt_conn *conn);
   void removeConnection(struct bt_conn *conn);
   void addFilter(Filter &filter) { _scanner.addFilter(filter); }
-  bool isScanning() const { return _scanner._isScanning; }
+  void setPeriodicDataCallback(PeriodicDataCallback callback) {
+    _scanner.setPeriodicDataCallback(callback);
+  }
+  void setSelectionPolicy(SelectionPolicy policy) {
+    _scanner.setSelectionPolicy(policy);
+  }
+  bool isScanning() const { return _scanner.isActive(); }
+  uint8_t maxConnections() const { return _maxConnections; }
+  // Level asked for on every new link when pairing is enabled
+  void setSecurity(bt_security_t level) { _security = level; }
+  // Returns the subscription index, payloads go to handler (or the stream
+  // when it is null) from the data work queue
+  int subscribe(struct bt_conn *conn, uint16_t value_handle,
+                uint16_t ccc_handle, NotificationHandler handler);
+  // Returns the L2CAP channel index once the request is sent
+  int openCoc(struct bt_conn *conn, uint16_t psm, CocMode mode);
 
-  virtual void onConnected(struct bt_conn *conn, uint8_t err);
-  virtual void onDisconnected(struct bt_conn *conn, uint8_t reason);
+  void onConnected(struct bt_conn *conn, uint8_t err) override;
+  void onDisconnected(struct bt_conn *conn, uint8_t reason) override;
 
   // Work item methods for deferred scanning operations
   static void scanWorkAction(struct k_work *work);
@@ -37,6 +63,8 @@ public:
 
   static Central *registry[MAX_CENTRALS];
   static Central *fromConn(struct bt_conn *conn);
+  // Connection in a slot of a registered central, nullptr if there is none
+  static struct bt_conn *connectionAt(size_t index, size_t slot);
 
   uint8_t _index;
   uint8_t _connectionCount;
@@ -47,7 +75,8 @@ private:
   int stopScanning() { return _scanner.stopScanning(); }
 
   Scanner _scanner;
-  struct k_work_delayable _scanWork;
+  struct queued_work _scanWork;
   bool _shouldStartScanning;
   uint8_t _maxConnections;
+  bt_security_t _security;
 };
\ No newline at end of file
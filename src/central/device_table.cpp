@@ -0,0 +1,355 @@
+#include "device_table.hpp"
+#include <zephyr/logging/log.h>
+
+extern "C" {
+#include <string.h>
+#ifdef CONFIG_SHELL
+#include <zephyr/shell/shell.h>
+#endif
+}
+
+LOG_MODULE_REGISTER(DEVICE_TABLE, LOG_LEVEL_INF);
+
+BUILD_ASSERT((DEVICE_TABLE_SIZE & (DEVICE_TABLE_SIZE - 1)) == 0,
+             "Device table size must be a power of two");
+BUILD_ASSERT(DEVICE_TABLE_SIZE < DEVICE_SLOT_INVALID,
+             "Device table too large for its slot numbers");
+
+#define SLOT_MASK (DEVICE_TABLE_SIZE - 1)
+
+struct k_spinlock DeviceTable::_lock = {};
+uint16_t DeviceTable::_window = 1;
+struct device_entry DeviceTable::_entries[DEVICE_TABLE_SIZE] = {};
+struct device_table_stats DeviceTable::_stats = {};
+
+uint16_t DeviceTable::hash(const bt_addr_le_t *addr) {
+  // FNV-1a over the address and its type
+  uint32_t hash = 2166136261U;
+  for (uint8_t byte : addr->a.val) {
+    hash = (hash ^ byte) * 16777619U;
+  }
+  hash = (hash ^ addr->type) * 16777619U;
+  return (uint16_t)(hash & SLOT_MASK);
+}
+
+uint16_t DeviceTable::find(const bt_addr_le_t *addr) {
+  uint16_t slot = hash(addr);
+  for (uint16_t probe = 0; probe < DEVICE_TABLE_SIZE; probe++) {
+    const struct device_entry &entry = _entries[slot];
+    if (!entry.used) {
+      break;
+    }
+    if (bt_addr_le_cmp(&entry.addr, addr) == 0) {
+      return slot;
+    }
+    slot = (slot + 1) & SLOT_MASK;
+  }
+  return DEVICE_SLOT_INVALID;
+}
+
+void DeviceTable::remove(uint16_t slot) {
+  // Backward shift deletion, entries after the hole move up when the hole
+  // lies between their home slot and where they sit now
+  uint16_t hole = slot;
+  uint16_t next = (hole + 1) & SLOT_MASK;
+  while (_entries[next].used) {
+    uint16_t home = hash(&_entries[next].addr);
+    if (((next - home) & SLOT_MASK) >= ((next - hole) & SLOT_MASK)) {
+      _entries[hole] = _entries[next];
+      hole = next;
+    }
+    next = (next + 1) & SLOT_MASK;
+  }
+
+  _entries[hole] = {};
+  _stats.entries--;
+}
+
+void DeviceTable::evictOldest() {
+  uint16_t oldest = DEVICE_SLOT_INVALID;
+  for (uint16_t slot = 0; slot < DEVICE_TABLE_SIZE; slot++) {
+    if (!_entries[slot].used) {
+      continue;
+    }
+    if (oldest == DEVICE_SLOT_INVALID ||
+        (int32_t)(_entries[slot].last_seen_ms -
+                  _entries[oldest].last_seen_ms) < 0) {
+      oldest = slot;
+    }
+  }
+
+  if (oldest != DEVICE_SLOT_INVALID) {
+    remove(oldest);
+    _stats.evicted++;
+  }
+}
+
+uint16_t DeviceTable::observe(const bt_addr_le_t *addr, int8_t rssi,
+                              uint32_t active, uint32_t *fresh) {
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  uint32_t now = k_uptime_get_32();
+
+  uint16_t slot = find(addr);
+  if (slot == DEVICE_SLOT_INVALID) {
+    if (_stats.entries >= DEVICE_TABLE_MAX_ENTRIES) {
+      evictOldest();
+    }
+
+    // Below the entry limit there is always a free slot
+    uint32_t probes = 0;
+    slot = hash(addr);
+    while (_entries[slot].used) {
+      slot = (slot + 1) & SLOT_MASK;
+      probes++;
+    }
+
+    struct device_entry &entry = _entries[slot];
+    entry = {};
+    bt_addr_le_copy(&entry.addr, addr);
+    entry.used = true;
+    entry.rssi_q4 = (int16_t)(rssi * 16);
+    entry.first_seen_ms = now;
+    entry.last_seen_ms = now;
+    entry.reports = 1;
+    entry.sighted_by = active;
+    entry.window = _window;
+    *fresh = active;
+    _stats.entries++;
+    _stats.inserted++;
+    _stats.max_probe = MAX(_stats.max_probe, probes);
+    k_spin_unlock(&_lock, key);
+    return slot;
+  }
+
+  struct device_entry &entry = _entries[slot];
+  uint32_t elapsed = MIN(now - entry.last_seen_ms, (uint32_t)UINT16_MAX);
+  if (entry.reports == 1) {
+    entry.interval_ms = (uint16_t)elapsed;
+  } else {
+    entry.interval_ms = (uint16_t)(entry.interval_ms +
+                                   ((int32_t)elapsed - entry.interval_ms) /
+                                       (1 << DEVICE_EWMA_SHIFT));
+  }
+  entry.rssi_q4 = (int16_t)(entry.rssi_q4 + (rssi * 16 - entry.rssi_q4) /
+                                                (1 << DEVICE_EWMA_SHIFT));
+  entry.last_seen_ms = now;
+  entry.reports++;
+
+  if (entry.window != _window) {
+    entry.window = _window;
+    entry.sighted_by = 0;
+  }
+  *fresh = active & ~entry.sighted_by;
+  entry.sighted_by |= active;
+
+  // A match holds for the window, a candidate that keeps advertising does
+  // not age out before the selection
+  if (entry.candidate_of) {
+    entry.last_match_ms = now;
+  }
+
+  k_spin_unlock(&_lock, key);
+  return slot;
+}
+
+void DeviceTable::newWindow() {
+  // Entries catch up lazily on their next report
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  _window++;
+  k_spin_unlock(&_lock, key);
+}
+
+void DeviceTable::newWindow(uint8_t scanner) {
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  for (struct device_entry &entry : _entries) {
+    entry.sighted_by &= ~BIT(scanner);
+  }
+  k_spin_unlock(&_lock, key);
+}
+
+void DeviceTable::markCandidate(uint16_t slot, uint8_t scanner) {
+  if (slot >= DEVICE_TABLE_SIZE) {
+    return;
+  }
+
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  struct device_entry &entry = _entries[slot];
+  if (entry.used) {
+    entry.candidate_of |= BIT(scanner);
+    entry.last_match_ms = k_uptime_get_32();
+  }
+  k_spin_unlock(&_lock, key);
+}
+
+void DeviceTable::markConnected(const bt_addr_le_t *addr) {
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  uint16_t slot = find(addr);
+  if (slot != DEVICE_SLOT_INVALID) {
+    // Never 0, that marks a device that was never connected
+    _entries[slot].last_connected_ms = k_uptime_get_32() | 1;
+  }
+  k_spin_unlock(&_lock, key);
+}
+
+// True when candidate a should be picked over the current best b
+static bool prefer(SelectionPolicy policy, const struct device_entry &a,
+                   const struct device_entry &b, uint16_t a_distance,
+                   uint16_t b_distance) {
+  switch (policy) {
+  case SelectionPolicy::LEAST_RECENTLY_CONNECTED:
+    if (a.last_connected_ms != b.last_connected_ms) {
+      if (!a.last_connected_ms || !b.last_connected_ms) {
+        return !a.last_connected_ms;
+      }
+      return (int32_t)(a.last_connected_ms - b.last_connected_ms) < 0;
+    }
+    return a.rssi_q4 > b.rssi_q4;
+  case SelectionPolicy::ROUND_ROBIN:
+    return a_distance < b_distance;
+  case SelectionPolicy::STRONGEST:
+  default:
+    return a.rssi_q4 > b.rssi_q4;
+  }
+}
+
+int DeviceTable::select(uint8_t scanner, SelectionPolicy policy,
+                        uint16_t *cursor, bt_addr_le_t *out) {
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  uint32_t now = k_uptime_get_32();
+  uint32_t bit = BIT(scanner);
+  uint16_t best = DEVICE_SLOT_INVALID;
+  uint16_t bestDistance = 0;
+
+  for (uint16_t slot = 0; slot < DEVICE_TABLE_SIZE; slot++) {
+    struct device_entry &entry = _entries[slot];
+    if (!entry.used || !(entry.candidate_of & bit)) {
+      continue;
+    }
+
+    // Candidates are consumed by every selection, picked or not
+    entry.candidate_of &= ~bit;
+    if (now - entry.last_match_ms > DEVICE_CANDIDATE_MAX_AGE_MS) {
+      continue;
+    }
+
+    // Slots after the previous pick come first for round robin
+    uint16_t distance = (slot - *cursor - 1) & SLOT_MASK;
+    if (best == DEVICE_SLOT_INVALID ||
+        prefer(policy, entry, _entries[best], distance, bestDistance)) {
+      best = slot;
+      bestDistance = distance;
+    }
+  }
+
+  if (best == DEVICE_SLOT_INVALID) {
+    k_spin_unlock(&_lock, key);
+    return -ENOENT;
+  }
+
+  bt_addr_le_copy(out, &_entries[best].addr);
+  *cursor = best;
+  k_spin_unlock(&_lock, key);
+  return 0;
+}
+
+void DeviceTable::clearCandidates(uint8_t scanner) {
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  for (struct device_entry &entry : _entries) {
+    entry.candidate_of &= ~BIT(scanner);
+  }
+  k_spin_unlock(&_lock, key);
+}
+
+bool DeviceTable::lookup(const bt_addr_le_t *addr, struct device_entry *out) {
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  uint16_t slot = find(addr);
+  if (slot != DEVICE_SLOT_INVALID) {
+    *out = _entries[slot];
+  }
+  k_spin_unlock(&_lock, key);
+  return slot != DEVICE_SLOT_INVALID;
+}
+
+bool DeviceTable::entryAt(uint16_t slot, struct device_entry *out) {
+  if (slot >= DEVICE_TABLE_SIZE) {
+    return false;
+  }
+
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  *out = _entries[slot];
+  k_spin_unlock(&_lock, key);
+  return out->used;
+}
+
+struct device_table_stats DeviceTable::stats() {
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  struct device_table_stats copy = _stats;
+  k_spin_unlock(&_lock, key);
+  return copy;
+}
+
+void DeviceTable::clear() {
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  memset(_entries, 0, sizeof(_entries));
+  _stats.entries = 0;
+  k_spin_unlock(&_lock, key);
+}
+
+const char *DeviceTable::policyName(SelectionPolicy policy) {
+  switch (policy) {
+  case SelectionPolicy::STRONGEST:
+    return "strongest";
+  case SelectionPolicy::LEAST_RECENTLY_CONNECTED:
+    return "least_recently_connected";
+  case SelectionPolicy::ROUND_ROBIN:
+    return "round_robin";
+  }
+  return "?";
+}
+
+#ifdef CONFIG_SHELL
+static int cmdDevicesList(const struct shell *sh, size_t argc, char **argv) {
+  ARG_UNUSED(argc);
+  ARG_UNUSED(argv);
+
+  uint32_t now = k_uptime_get_32();
+  struct device_table_stats stats = DeviceTable::stats();
+  shell_print(sh, "%u devices, %u inserted, %u evicted, max probe %u",
+              stats.entries, stats.inserted, stats.evicted, stats.max_probe);
+
+  for (uint16_t slot = 0; slot < DEVICE_TABLE_SIZE; slot++) {
+    struct device_entry entry;
+    if (!DeviceTable::entryAt(slot, &entry)) {
+      continue;
+    }
+
+    char addr[BT_ADDR_LE_STR_LEN];
+    bt_addr_le_to_str(&entry.addr, addr, sizeof(addr));
+    shell_print(sh,
+                "%-30s rssi %4d rate %3u Hz reports %6u seen %6u ms ago "
+                "candidate 0x%02x connected %s",
+                addr, DeviceTable::rssi(entry), DeviceTable::rateHz(entry),
+                entry.reports, now - entry.last_seen_ms, entry.candidate_of,
+                entry.last_connected_ms ? "yes" : "never");
+  }
+  return 0;
+}
+
+static int cmdDevicesClear(const struct shell *sh, size_t argc, char **argv) {
+  ARG_UNUSED(argc);
+  ARG_UNUSED(argv);
+
+  DeviceTable::clear();
+  shell_print(sh, "Device table cleared");
+  return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+    devices_cmds,
+    SHELL_CMD(list, NULL, "Observed devices with smoothed RSSI and rate",
+              cmdDevicesList),
+    SHELL_CMD(clear, NULL, "Forget all observed devices", cmdDevicesClear),
+    SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(devices, &devices_cmds, "Scanner device table", NULL);
+#endif
@@ -0,0 +1,100 @@
+#pragma once
+
+extern "C" {
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/kernel.h>
+}
+
+#ifdef CONFIG_BLUESIM_DEVICE_TABLE_SIZE
+#define DEVICE_TABLE_SIZE CONFIG_BLUESIM_DEVICE_TABLE_SIZE
+#else
+#define DEVICE_TABLE_SIZE 64
+#endif
+
+// Entries kept below the slot count so probe sequences stay short, the least
+// recently seen device is evicted past this
+#define DEVICE_TABLE_MAX_ENTRIES (DEVICE_TABLE_SIZE * 3 / 4)
+#define DEVICE_SLOT_INVALID 0xFFFF
+
+// Matches older than this are no longer connection candidates
+#define DEVICE_CANDIDATE_MAX_AGE_MS 1000
+
+// Weight of a new sample in the moving averages, 1 / 2^shift
+#define DEVICE_EWMA_SHIFT 3
+
+// How a Central picks among the devices its filter matched
+enum class SelectionPolicy : uint8_t {
+  STRONGEST,                // Highest smoothed RSSI
+  LEAST_RECENTLY_CONNECTED, // Never connected first, then oldest connection
+  ROUND_ROBIN,              // Next candidate after the previous pick
+};
+
+struct device_entry {
+  bt_addr_le_t addr;
+  bool used;
+  int16_t rssi_q4;        // EWMA of RSSI in 1/16 dBm
+  uint16_t interval_ms;   // EWMA of the time between reports
+  uint32_t first_seen_ms;
+  uint32_t last_seen_ms;
+  uint32_t last_match_ms;
+  uint32_t last_connected_ms; // 0 when never connected
+  uint32_t reports;
+  uint32_t candidate_of; // Bit per scanner index that matched it
+  uint32_t sighted_by;   // Bit per scanner that got it in this scan window
+  uint16_t window;       // Scan window sighted_by belongs to
+};
+
+struct device_table_stats {
+  uint32_t entries;
+  uint32_t inserted;
+  uint32_t evicted;
+  uint32_t max_probe;
+};
+
+// Every device heard by the shared scan callback, in a fixed open-addressed
+// table with linear probing. Updated on the Bluetooth RX thread and read by
+// the centrals' selection work, all accesses hold a spinlock.
+//
+// The controller delivers every report so the averages keep moving, but a
+// scanner only gets a device once per scan window, as the controller's
+// duplicate filter would have it. A window starts with each controller start
+// and, for one scanner, when that scanner starts.
+class DeviceTable {
+public:
+  // Returns the slot of the device, DEVICE_SLOT_INVALID when it was dropped.
+  // fresh gets the scanners in active that have not had the device in this
+  // window, they have it from now on.
+  static uint16_t observe(const bt_addr_le_t *addr, int8_t rssi,
+                          uint32_t active, uint32_t *fresh);
+  static void newWindow();
+  static void newWindow(uint8_t scanner);
+  static void markCandidate(uint16_t slot, uint8_t scanner);
+  static void markConnected(const bt_addr_le_t *addr);
+  static int select(uint8_t scanner, SelectionPolicy policy,
+                    uint16_t *cursor, bt_addr_le_t *out);
+  static void clearCandidates(uint8_t scanner);
+
+  static bool lookup(const bt_addr_le_t *addr, struct device_entry *out);
+  static bool entryAt(uint16_t slot, struct device_entry *out);
+  static struct device_table_stats stats();
+  static void clear();
+
+  static int8_t rssi(const struct device_entry &entry) {
+    return (int8_t)(entry.rssi_q4 / 16);
+  }
+  static uint16_t rateHz(const struct device_entry &entry) {
+    return entry.interval_ms ? 1000U / entry.interval_ms : 0;
+  }
+  static const char *policyName(SelectionPolicy policy);
+
+private:
+  static uint16_t hash(const bt_addr_le_t *addr);
+  static uint16_t find(const bt_addr_le_t *addr);
+  static void evictOldest();
+  static void remove(uint16_t slot);
+
+  static struct k_spinlock _lock;
+  static uint16_t _window;
+  static struct device_entry _entries[DEVICE_TABLE_SIZE];
+  static struct device_table_stats _stats;
+};
@@ -1,4 +1,8 @@
 #include "filter.hpp"
+#include "../common/trace.hpp"
+#ifdef CONFIG_BLUESIM_RPA_CACHE
+#include "rpa_cache.hpp"
+#endif
 #include <stdio.h>
 #include <string.h>
 #include <zephyr/logging/log.h>
@@ -28,33 +32,45 @@ void Filter::addGroup() {
 
   _current_group_index = _group_count;
   _group_count++;
-  LOG_INF("Added filter group %d", _current_group_index);
+  Trace::emit(TraceEvent::FILTER_GROUP_ADDED, _current_group_index);
 }
 
 void Filter::addCriterion(FilterCriterionType type, const char *pattern) {
+  // Configuration errors, rare enough to log, and a dropped criterion
+  // broadens the filter
   if (!pattern) {
     LOG_WRN("Pattern cannot be null");
+    Trace::emit(TraceEvent::FILTER_CRITERION_REJECTED,
+                (uint8_t)TraceReject::NULL_PATTERN);
     return;
   }
 
   if (strlen(pattern) >= MAX_PATTERN_LENGTH) {
     LOG_WRN("Pattern too long");
+    Trace::emit(TraceEvent::FILTER_CRITERION_REJECTED,
+                (uint8_t)TraceReject::PATTERN_TOO_LONG);
     return;
   }
 
   if (!validatePattern(pattern)) {
     LOG_WRN("Invalid pattern syntax");
+    Trace::emit(TraceEvent::FILTER_CRITERION_REJECTED,
+                (uint8_t)TraceReject::INVALID_PATTERN);
     return;
   }
 
   if (_current_group_index >= _group_count) {
     LOG_WRN("No active group. Call addGroup() first");
+    Trace::emit(TraceEvent::FILTER_CRITERION_REJECTED,
+                (uint8_t)TraceReject::NO_GROUP);
     return;
   }
 
   FilterGroup &current_group = _groups[_current_group_index];
   if (current_group.criteria_count >= MAX_CRITERIA_PER_GROUP) {
     LOG_WRN("Maximum criteria per group reached");
+    Trace::emit(TraceEvent::FILTER_CRITERION_REJECTED,
+                (uint8_t)TraceReject::GROUP_FULL);
     return;
   }
 
@@ -66,8 +82,11 @@ void Filter::addCriterion(FilterCriterionType type, const char *pattern) {
   current_group.criteria[index].pattern[MAX_PATTERN_LENGTH - 1] = '\0';
   current_group.criteria_count++;
 
-  LOG_INF("Added criterion type %d with pattern '%s' to group %d", (int)type,
-          pattern, _current_group_index);
+  // The first pattern characters are enough to tell criteria apart
+  uint32_t prefix = 0;
+  memcpy(&prefix, pattern, MIN(strlen(pattern), sizeof(prefix)));
+  Trace::emit(TraceEvent::FILTER_CRITERION_ADDED, _current_group_index,
+              (uint16_t)type, prefix);
 }
 
 void Filter::setGroupOperator(FilterOperator op) {
@@ -82,6 +101,9 @@ void Filter::setGroupOperator(FilterOperator op) {
 
 bool Filter::matchesDevice(const bt_addr_le_t *addr, int8_t rssi,
                            uint8_t adv_type, struct net_buf_simple *buf) const {
+  ARG_UNUSED(rssi);
+  ARG_UNUSED(adv_type);
+
   // If no groups are configured, match everything
   if (_group_count == 0) {
     return true;
@@ -90,7 +112,7 @@ bool Filter::matchesDevice(const bt_addr_le_t *addr, int8_t rssi,
   // Evaluate each group
   bool group_results[MAX_FILTER_GROUPS];
   for (uint8_t i = 0; i < _group_count; i++) {
-    group_results[i] = evaluateGroup(_groups[i], buf);
+    group_results[i] = evaluateGroup(_groups[i], addr, buf);
   }
 
   // At least one group must match
@@ -102,7 +124,7 @@ bool Filter::matchesDevice(const bt_addr_le_t *addr, int8_t rssi,
   return false;
 }
 
-bool Filter::evaluateGroup(const FilterGroup &group,
+bool Filter::evaluateGroup(const FilterGroup &group, const bt_addr_le_t *addr,
                            struct net_buf_simple *buf) const {
   if (!group.enabled || group.criteria_count == 0) {
     return false;
@@ -111,7 +133,7 @@ bool Filter::evaluateGroup(const FilterGroup &group,
   // Evaluate each criterion in the group
   bool criterion_results[MAX_CRITERIA_PER_GROUP];
   for (uint8_t i = 0; i < group.criteria_count; i++) {
-    criterion_results[i] = matchesCriterion(group.criteria[i], buf);
+    criterion_results[i] = matchesCriterion(group.criteria[i], addr, buf);
   }
 
   // Combine criterion results with the group's operator
@@ -135,6 +157,7 @@ bool Filter::evaluateGroup(const FilterGroup &group,
 }
 
 bool Filter::matchesCriterion(const FilterCriterion &criterion,
+                              const bt_addr_le_t *addr,
                               struct net_buf_simple *buf) const {
   if (!criterion.enabled) {
     return false;
@@ -187,11 +210,35 @@ bool Filter::matchesCriterion(const FilterCriterion &criterion,
     return false;
   }
 
+  case FilterCriterionType::IDENTITY:
+    return matchesIdentity(addr, criterion.pattern);
+
   default:
     return false;
   }
 }
 
+bool Filter::matchesIdentity(const bt_addr_le_t *addr,
+                             const char *pattern) const {
+  if (!addr) {
+    return false;
+  }
+
+  // Known RPAs cost a cache lookup, only new ones are resolved
+  bt_addr_le_t identity;
+#ifdef CONFIG_BLUESIM_RPA_CACHE
+  if (!RpaCache::identity(addr, &identity)) {
+    return false;
+  }
+#else
+  bt_addr_le_copy(&identity, addr);
+#endif
+
+  char identity_string[BT_ADDR_STR_LEN];
+  bt_addr_to_str(&identity.a, identity_string, sizeof(identity_string));
+  return matchesPattern(identity_string, strlen(identity_string), pattern);
+}
+
 bool Filter::matchesPattern(const char *data, size_t data_len,
                             const char *pattern) const {
   if (!data || !pattern) {
@@ -24,7 +24,8 @@ enum class FilterCriterionType {
   LOCAL_NAME,         // Match against device local name
   MANUFACTURER_DATA,  // Match against manufacturer data
   SERVICE_UUID,       // Match against service UUID in advertisement
-  CHARACTERISTIC_UUID // Match against characteristic UUID in advertisement
+  CHARACTERISTIC_UUID, // Match against characteristic UUID in advertisement
+  IDENTITY // Match against the identity address, resolved from an RPA
 };
 
 // Individual filter criterion (field check)
@@ -75,9 +76,11 @@ private:
 
   // Internal matching functions
   bool matchesCriterion(const FilterCriterion &criterion,
+                        const bt_addr_le_t *addr,
                         struct net_buf_simple *buf) const;
-  bool evaluateGroup(const FilterGroup &group,
+  bool evaluateGroup(const FilterGroup &group, const bt_addr_le_t *addr,
                      struct net_buf_simple *buf) const;
+  bool matchesIdentity(const bt_addr_le_t *addr, const char *pattern) const;
   bool matchesPattern(const char *data, size_t data_len,
                       const char *pattern) const;
 
@@ -0,0 +1,124 @@
+#include "link_latency.hpp"
+#include <zephyr/logging/log.h>
+
+extern "C" {
+#include <zephyr/shell/shell.h>
+}
+
+LOG_MODULE_REGISTER(LINK_LATENCY, LOG_LEVEL_INF);
+
+timing_t LinkLatency::_lastReport = 0;
+struct central_latency LinkLatency::_centrals[MAX_CENTRALS] = {};
+
+static const char *const histogramNames[LATENCY_HISTOGRAMS] = {
+    "filter", "stop", "create", "connect", "restart", "total",
+};
+
+void LinkLatency::init() {
+  timing_init();
+  timing_start();
+  LOG_INF("Link latency instrumentation enabled");
+}
+
+void LinkLatency::reset() {
+  for (struct central_latency &entry : _centrals) {
+    entry = {};
+  }
+}
+
+const char *LinkLatency::histogramName(uint8_t histogram) {
+  return histogram < LATENCY_HISTOGRAMS ? histogramNames[histogram] : "?";
+}
+
+void LinkLatency::mark(uint8_t central, LatencyStage stage) {
+  if (central >= MAX_CENTRALS) {
+    return;
+  }
+
+  timing_t now = timing_counter_get();
+  struct central_latency &entry = _centrals[central];
+  uint8_t index = (uint8_t)stage;
+
+  // Every verdict starts a new attempt from the report it was made on
+  if (stage == LatencyStage::FILTER_VERDICT) {
+    entry.stamps[(uint8_t)LatencyStage::SCAN_REPORT] = _lastReport;
+    entry.valid = BIT((uint8_t)LatencyStage::SCAN_REPORT);
+  }
+
+  // Only time a transition when the previous stage belongs to this attempt,
+  // a failed connection skips CONNECTED and records no restart
+  if (index > 0 && (entry.valid & BIT(index - 1))) {
+    record(entry.histograms[index - 1], entry.stamps[index - 1], now);
+  }
+
+  if (stage == LatencyStage::CONNECTED &&
+      (entry.valid & BIT((uint8_t)LatencyStage::SCAN_REPORT))) {
+    record(entry.histograms[LATENCY_TOTAL_HISTOGRAM],
+           entry.stamps[(uint8_t)LatencyStage::SCAN_REPORT], now);
+  }
+
+  entry.stamps[index] = now;
+  entry.valid |= BIT(index);
+}
+
+void LinkLatency::record(struct latency_histogram &histogram, timing_t start,
+                         timing_t end) {
+  uint64_t ns = timing_cycles_to_ns(timing_cycles_get(&start, &end));
+  uint8_t bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+
+  histogram.buckets[MIN(bucket, LATENCY_BUCKETS - 1)]++;
+  histogram.count++;
+  histogram.total_ns += ns;
+  histogram.max_ns = MAX(histogram.max_ns, (uint32_t)MIN(ns, UINT32_MAX));
+}
+
+static int cmdLatencyShow(const struct shell *sh, size_t argc, char **argv) {
+  ARG_UNUSED(argc);
+  ARG_UNUSED(argv);
+
+  for (Central *central : Central::registry) {
+    if (!central) {
+      continue;
+    }
+
+    shell_print(sh, "Central %u", central->_index);
+    const struct central_latency &entry = LinkLatency::get(central->_index);
+    for (uint8_t h = 0; h < LATENCY_HISTOGRAMS; h++) {
+      const struct latency_histogram &histogram = entry.histograms[h];
+      if (histogram.count == 0) {
+        continue;
+      }
+
+      shell_print(sh, "  %-8s n=%u avg=%u ns max=%u ns",
+                  LinkLatency::histogramName(h), histogram.count,
+                  (uint32_t)(histogram.total_ns / histogram.count),
+                  histogram.max_ns);
+      for (uint8_t i = 0; i < LATENCY_BUCKETS; i++) {
+        if (histogram.buckets[i]) {
+          shell_print(sh, "    >= %10u ns  %u", 1U << i,
+                      histogram.buckets[i]);
+        }
+      }
+    }
+  }
+
+  return 0;
+}
+
+static int cmdLatencyReset(const struct shell *sh, size_t argc, char **argv) {
+  ARG_UNUSED(argc);
+  ARG_UNUSED(argv);
+
+  LinkLatency::reset();
+  shell_print(sh, "Latency histograms cleared");
+  return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+    latency_cmds,
+    SHELL_CMD(show, NULL, "Per Central stage histograms", cmdLatencyShow),
+    SHELL_CMD(reset, NULL, "Clear all histograms", cmdLatencyReset),
+    SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(latency, &latency_cmds,
+                   "Scan report to connected link latency", NULL);
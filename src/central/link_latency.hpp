@@ -0,0 +1,65 @@
+#pragma once
+
+#include "central.hpp"
+
+extern "C" {
+#include <zephyr/kernel.h>
+#include <zephyr/timing/timing.h>
+}
+
+#define LATENCY_BUCKETS 32
+
+// Points on the way from an advertising report to a connected link. Each
+// stage is timed against the one before it for the same Central.
+enum class LatencyStage : uint8_t {
+  SCAN_REPORT,    // Scanner::scanCallback entry
+  FILTER_VERDICT, // Filter match that started a connection attempt
+  SCAN_STOPPED,   // Controller scanning stopped before connecting
+  CONN_CREATE,    // bt_conn_le_create returned
+  CONNECTED,      // Central::onConnected without error
+  SCAN_RESTARTED, // Scanning running again after the link
+  COUNT,
+};
+
+// One histogram per stage transition plus report to connected
+#define LATENCY_TOTAL_HISTOGRAM ((uint8_t)LatencyStage::COUNT - 1)
+#define LATENCY_HISTOGRAMS ((uint8_t)LatencyStage::COUNT)
+
+// Bucket i counts samples in [2^i, 2^(i+1)) ns
+struct latency_histogram {
+  uint32_t buckets[LATENCY_BUCKETS];
+  uint32_t count;
+  uint32_t max_ns;
+  uint64_t total_ns;
+};
+
+struct central_latency {
+  timing_t stamps[(uint8_t)LatencyStage::COUNT];
+  uint8_t valid; // Bit per stage stamped in the current attempt
+  struct latency_histogram histograms[LATENCY_HISTOGRAMS];
+};
+
+// Cycle counter instrumentation of the connect path, built only with
+// CONFIG_BLUESIM_LINK_LATENCY. Call sites are wrapped in IS_ENABLED so a
+// disabled build carries no code or data for it.
+class LinkLatency {
+public:
+  static void init();
+  static void reset();
+
+  // Stamps the report that the following FILTER_VERDICT marks belong to
+  static void onScanReport() { _lastReport = timing_counter_get(); }
+  static void mark(uint8_t central, LatencyStage stage);
+
+  static const struct central_latency &get(uint8_t central) {
+    return _centrals[central];
+  }
+  static const char *histogramName(uint8_t histogram);
+
+private:
+  static void record(struct latency_histogram &histogram, timing_t start,
+                     timing_t end);
+
+  static timing_t _lastReport;
+  static struct central_latency _centrals[MAX_CENTRALS];
+};
@@ -0,0 +1,273 @@
+#include "notification_sink.hpp"
+#include "../common/link_scheduler.hpp"
+#include "../common/uart_stream.hpp"
+#include "central.hpp"
+#include <zephyr/logging/log.h>
+
+extern "C" {
+#include <stdlib.h>
+#include <string.h>
+#ifdef CONFIG_SHELL
+#include <zephyr/shell/shell.h>
+#endif
+}
+
+LOG_MODULE_REGISTER(NOTIFICATION_SINK, LOG_LEVEL_INF);
+
+BUILD_ASSERT(MAX_NOTIFY_SUBSCRIPTIONS < UINT8_MAX,
+             "Subscription index must fit the record header");
+
+struct notify_subscription
+    NotificationSink::_subscriptions[MAX_NOTIFY_SUBSCRIPTIONS] = {};
+struct notify_ring NotificationSink::_rings[MAX_BUS_CONNECTIONS] = {};
+uint8_t NotificationSink::_scratch[NOTIFY_MAX_PAYLOAD] = {};
+struct queued_work NotificationSink::_drainWork = {};
+
+void NotificationSink::init() {
+  for (struct notify_ring &ring : _rings) {
+    ring_buf_init(&ring.ring, sizeof(ring.buffer), ring.buffer);
+  }
+  WorkQueue::data.initWork(&_drainWork, drainAction);
+}
+
+int NotificationSink::subscribe(Central *central, struct bt_conn *conn,
+                                uint16_t value_handle, uint16_t ccc_handle,
+                                NotificationHandler handler) {
+  struct notify_subscription *sub = nullptr;
+  uint8_t index = 0;
+  for (; index < MAX_NOTIFY_SUBSCRIPTIONS; index++) {
+    if (!_subscriptions[index].used) {
+      sub = &_subscriptions[index];
+      break;
+    }
+  }
+
+  if (!sub) {
+    return -ENOMEM;
+  }
+
+  *sub = {};
+  sub->central = central;
+  sub->conn = conn;
+  sub->handler = handler;
+  sub->window_start_ms = k_uptime_get_32();
+  sub->params.notify = notifyCallback;
+  sub->params.subscribe = subscribeCallback;
+  sub->params.value_handle = value_handle;
+  sub->params.ccc_handle = ccc_handle;
+  sub->params.value = BT_GATT_CCC_NOTIFY;
+  // Dropped by the stack on disconnect, also for bonded peers
+  atomic_set_bit(sub->params.flags, BT_GATT_SUBSCRIBE_FLAG_VOLATILE);
+  sub->used = true;
+
+  int err = bt_gatt_subscribe(conn, &sub->params);
+  if (err < 0) {
+    sub->used = false;
+    LOG_ERR("Failed to subscribe to handle 0x%04x (err %d)", value_handle,
+            err);
+    return err;
+  }
+
+  LOG_INF("Subscription %u: handle 0x%04x on connection %u", index,
+          value_handle, bt_conn_index(conn));
+  return index;
+}
+
+int NotificationSink::unsubscribe(uint8_t subscription) {
+  if (!isUsed(subscription)) {
+    return -ENOENT;
+  }
+
+  // The stack reports the removal through the notify callback
+  struct notify_subscription &sub = _subscriptions[subscription];
+  return bt_gatt_unsubscribe(sub.conn, &sub.params);
+}
+
+int NotificationSink::stats(uint8_t subscription, struct notify_stats *out) {
+  if (!isUsed(subscription)) {
+    return -ENOENT;
+  }
+
+  *out = _subscriptions[subscription].stats;
+  return 0;
+}
+
+void NotificationSink::subscribeCallback(
+    struct bt_conn *conn, uint8_t err,
+    struct bt_gatt_subscribe_params *params) {
+  if (err) {
+    LOG_ERR("Connection %u: CCC write for handle 0x%04x failed (err %u)",
+            bt_conn_index(conn), params->value_handle, err);
+  }
+}
+
+// Copies into claimed ring space, the caller checked there is enough
+static void putClaimed(struct ring_buf *ring, const uint8_t *data,
+                       uint32_t len) {
+  while (len) {
+    uint8_t *dst;
+    uint32_t claimed = ring_buf_put_claim(ring, &dst, len);
+    memcpy(dst, data, claimed);
+    data += claimed;
+    len -= claimed;
+  }
+}
+
+uint8_t NotificationSink::notifyCallback(
+    struct bt_conn *conn, struct bt_gatt_subscribe_params *params,
+    const void *data, uint16_t length) {
+  struct notify_subscription *sub =
+      CONTAINER_OF(params, struct notify_subscription, params);
+
+  // Unsubscribed, either on request or because the link went down. Records
+  // still in the ring for this slot are dropped by the drain.
+  if (!data) {
+    sub->used = false;
+    return BT_GATT_ITER_STOP;
+  }
+
+  uint32_t now = k_uptime_get_32();
+  uint32_t elapsed = now - sub->window_start_ms;
+  if (elapsed >= NOTIFY_RATE_WINDOW_MS) {
+    sub->stats.rate_hz = sub->window_count * 1000U / elapsed;
+    sub->window_start_ms = now;
+    sub->window_count = 0;
+  }
+  sub->window_count++;
+  sub->stats.notifications++;
+  sub->stats.bytes += length;
+  if (IS_ENABLED(CONFIG_BLUESIM_LINK_SCHEDULER)) {
+    LinkScheduler::account(conn, length);
+  }
+
+  struct ring_buf *ring = &_rings[bt_conn_index(conn)].ring;
+  if (length > NOTIFY_MAX_PAYLOAD ||
+      ring_buf_space_get(ring) < sizeof(struct notify_record) + length) {
+    sub->stats.overruns++;
+    return BT_GATT_ITER_CONTINUE;
+  }
+
+  // Header and payload become visible to the drain in one finish
+  struct notify_record record = {
+      .subscription = (uint8_t)(sub - _subscriptions),
+      .reserved = 0,
+      .len = length,
+  };
+  putClaimed(ring, (const uint8_t *)&record, sizeof(record));
+  putClaimed(ring, (const uint8_t *)data, length);
+  ring_buf_put_finish(ring, sizeof(record) + length);
+
+  WorkQueue::data.scheduleIfIdle(&_drainWork, K_NO_WAIT);
+  return BT_GATT_ITER_CONTINUE;
+}
+
+void NotificationSink::deliver(uint8_t subscription, const uint8_t *data,
+                               uint16_t len) {
+  struct notify_subscription &sub = _subscriptions[subscription];
+  if (!sub.used) {
+    return;
+  }
+
+  sub.stats.delivered++;
+  if (sub.handler) {
+    sub.handler(sub.central, subscription, data, len);
+  } else if (IS_ENABLED(CONFIG_BLUESIM_STREAM)) {
+    UartStream::sendNotification(bt_conn_index(sub.conn),
+                                 sub.params.value_handle, data, len);
+  }
+}
+
+void NotificationSink::drain(struct notify_ring &ring) {
+  struct notify_record record;
+  while (ring_buf_get(&ring.ring, (uint8_t *)&record, sizeof(record)) ==
+         sizeof(record)) {
+    // Handed out in place unless the payload wraps around the ring end
+    uint8_t *data;
+    uint32_t claimed = ring_buf_get_claim(&ring.ring, &data, record.len);
+    if (claimed == record.len) {
+      deliver(record.subscription, data, record.len);
+      ring_buf_get_finish(&ring.ring, claimed);
+      continue;
+    }
+
+    ring_buf_get_finish(&ring.ring, 0);
+    ring_buf_get(&ring.ring, _scratch, record.len);
+    deliver(record.subscription, _scratch, record.len);
+  }
+}
+
+void NotificationSink::drainAction(struct k_work *work) {
+  ARG_UNUSED(work);
+
+  for (struct notify_ring &ring : _rings) {
+    drain(ring);
+  }
+}
+
+#ifdef CONFIG_SHELL
+static int cmdNotifySubscribe(const struct shell *sh, size_t argc,
+                              char **argv) {
+  ARG_UNUSED(argc);
+
+  unsigned long central = strtoul(argv[1], nullptr, 0);
+  unsigned long slot = strtoul(argv[2], nullptr, 0);
+  struct bt_conn *conn = Central::connectionAt(central, slot);
+  if (!conn) {
+    shell_error(sh, "No connection in slot %lu of central %lu", slot,
+                central);
+    return -ENOENT;
+  }
+
+  int index = Central::registry[central]->subscribe(
+      conn, (uint16_t)strtoul(argv[3], nullptr, 0),
+      (uint16_t)strtoul(argv[4], nullptr, 0), nullptr);
+  if (index < 0) {
+    shell_error(sh, "Failed to subscribe (err %d)", index);
+    return index;
+  }
+
+  shell_print(sh, "Subscription %d", index);
+  return 0;
+}
+
+static int cmdNotifyUnsubscribe(const struct shell *sh, size_t argc,
+                                char **argv) {
+  ARG_UNUSED(argc);
+
+  int err = NotificationSink::unsubscribe(
+      (uint8_t)strtoul(argv[1], nullptr, 0));
+  if (err < 0) {
+    shell_error(sh, "Failed to unsubscribe (err %d)", err);
+  }
+  return err;
+}
+
+static int cmdNotifyStats(const struct shell *sh, size_t argc, char **argv) {
+  ARG_UNUSED(argc);
+  ARG_UNUSED(argv);
+
+  shell_print(sh, "%3s %10s %10s %8s %10s %7s", "sub", "received", "bytes",
+              "overrun", "delivered", "rate");
+  for (uint8_t i = 0; i < MAX_NOTIFY_SUBSCRIPTIONS; i++) {
+    struct notify_stats stats;
+    if (NotificationSink::stats(i, &stats) < 0) {
+      continue;
+    }
+    shell_print(sh, "%3u %10u %10u %8u %10u %4u Hz", i, stats.notifications,
+                stats.bytes, stats.overruns, stats.delivered, stats.rate_hz);
+  }
+  return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+    notify_cmds,
+    SHELL_CMD_ARG(subscribe, NULL,
+                  "<central> <slot> <value handle> <ccc handle>",
+                  cmdNotifySubscribe, 5, 0),
+    SHELL_CMD_ARG(unsubscribe, NULL, "<subscription>", cmdNotifyUnsubscribe,
+                  2, 0),
+    SHELL_CMD(stats, NULL, "Per subscription counters", cmdNotifyStats),
+    SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(notify, &notify_cmds, "Notification receive sink", NULL);
+#endif
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "../common/connection_bus.hpp"
+#include "../common/work_queue.hpp"
+
+extern "C" {
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/ring_buffer.h>
+}
+
+#ifdef CONFIG_BLUESIM_NOTIFY_RING_SIZE
+#define NOTIFY_RING_SIZE CONFIG_BLUESIM_NOTIFY_RING_SIZE
+#else
+#define NOTIFY_RING_SIZE 1024
+#endif
+
+#ifdef CONFIG_BLUESIM_NOTIFY_SUBSCRIPTIONS
+#define MAX_NOTIFY_SUBSCRIPTIONS CONFIG_BLUESIM_NOTIFY_SUBSCRIPTIONS
+#else
+#define MAX_NOTIFY_SUBSCRIPTIONS 16
+#endif
+
+// Largest notification payload with a 247 byte MTU
+#define NOTIFY_MAX_PAYLOAD 244
+#define NOTIFY_RATE_WINDOW_MS 1000
+
+class Central;
+
+// Runs on WorkQueue::data with the payload still in the ring, the pointer is
+// only valid for the duration of the call
+using NotificationHandler = void (*)(Central *central, uint8_t subscription,
+                                     const uint8_t *data, uint16_t len);
+
+// Ring framing, the payload follows directly
+struct notify_record {
+  uint8_t subscription;
+  uint8_t reserved;
+  uint16_t len;
+};
+
+struct notify_stats {
+  uint32_t notifications; // Received from the stack
+  uint32_t bytes;
+  uint32_t overruns; // Dropped, the connection's ring was full
+  uint32_t delivered;
+  uint32_t rate_hz; // Notifications over the last full window
+};
+
+struct notify_subscription {
+  struct bt_gatt_subscribe_params params;
+  Central *central;
+  struct bt_conn *conn;
+  NotificationHandler handler;
+  bool used;
+  uint32_t window_start_ms;
+  uint32_t window_count;
+  struct notify_stats stats;
+};
+
+struct notify_ring {
+  struct ring_buf ring;
+  uint8_t buffer[NOTIFY_RING_SIZE];
+};
+
+// Receive side for high rate notification streams. The GATT callback on the
+// Bluetooth RX thread only appends a framed record to the connection's ring,
+// a single drain on WorkQueue::data hands each payload to the subscription's
+// handler straight out of the ring. One producer and one consumer per ring,
+// so no lock is taken on either side.
+class NotificationSink {
+public:
+  static void init();
+  static int subscribe(Central *central, struct bt_conn *conn,
+                       uint16_t value_handle, uint16_t ccc_handle,
+                       NotificationHandler handler);
+  static int unsubscribe(uint8_t subscription);
+  static int stats(uint8_t subscription, struct notify_stats *out);
+  static bool isUsed(uint8_t subscription) {
+    return subscription < MAX_NOTIFY_SUBSCRIPTIONS &&
+           _subscriptions[subscription].used;
+  }
+
+private:
+  static uint8_t notifyCallback(struct bt_conn *conn,
+                                struct bt_gatt_subscribe_params *params,
+                                const void *data, uint16_t length);
+  static void subscribeCallback(struct bt_conn *conn, uint8_t err,
+                                struct bt_gatt_subscribe_params *params);
+  static void drainAction(struct k_work *work);
+  static void drain(struct notify_ring &ring);
+  static void deliver(uint8_t subscription, const uint8_t *data, uint16_t len);
+
+  static struct notify_subscription _subscriptions[MAX_NOTIFY_SUBSCRIPTIONS];
+  static struct notify_ring _rings[MAX_BUS_CONNECTIONS];
+  static uint8_t _scratch[NOTIFY_MAX_PAYLOAD]; // Payloads wrapping the ring
+  static struct queued_work _drainWork;
+};
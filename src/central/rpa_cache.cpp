@@ -0,0 +1,228 @@
+#include "rpa_cache.hpp"
+#include <zephyr/logging/log.h>
+
+extern "C" {
+#include <string.h>
+#include <zephyr/bluetooth/crypto.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
+#ifdef CONFIG_SHELL
+#include <zephyr/shell/shell.h>
+#endif
+}
+
+LOG_MODULE_REGISTER(RPA_CACHE, LOG_LEVEL_INF);
+
+BUILD_ASSERT(IS_POWER_OF_TWO(RPA_CACHE_SIZE),
+             "The RPA cache is indexed with a mask");
+BUILD_ASSERT(RPA_MAX_IRKS < RPA_UNRESOLVED, "IRK index collides");
+
+struct k_spinlock RpaCache::_lock = {};
+struct rpa_irk RpaCache::_irks[RPA_MAX_IRKS] = {};
+struct rpa_entry RpaCache::_entries[RPA_CACHE_SIZE] = {};
+uint32_t RpaCache::_generation = 0;
+struct rpa_cache_stats RpaCache::_stats = {};
+
+int RpaCache::addIrk(const bt_addr_le_t *identity, const uint8_t irk[16]) {
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  struct rpa_irk *free = nullptr;
+  for (struct rpa_irk &entry : _irks) {
+    if (entry.used && bt_addr_le_eq(&entry.identity, identity)) {
+      free = &entry;
+      break;
+    }
+    if (!entry.used && !free) {
+      free = &entry;
+    }
+  }
+  if (!free) {
+    k_spin_unlock(&_lock, key);
+    return -ENOMEM;
+  }
+
+  bt_addr_le_copy(&free->identity, identity);
+  memcpy(free->irk, irk, sizeof(free->irk));
+  free->used = true;
+
+  // Addresses cached as unresolved may belong to the new key
+  memset(_entries, 0, sizeof(_entries));
+  _generation++;
+  k_spin_unlock(&_lock, key);
+  return 0;
+}
+
+void RpaCache::clear() {
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  memset(_irks, 0, sizeof(_irks));
+  memset(_entries, 0, sizeof(_entries));
+  _generation++;
+  k_spin_unlock(&_lock, key);
+}
+
+uint32_t RpaCache::slot(const bt_addr_t *rpa) {
+  // The low three bytes are an AES output, uniform enough to index with
+  return sys_get_le24(rpa->val) & (RPA_CACHE_SIZE - 1);
+}
+
+bool RpaCache::expired(const struct rpa_entry &entry, int64_t now) {
+  return now - entry.resolved_ticks >
+         k_ms_to_ticks_ceil64(RPA_CACHE_TTL_S * MSEC_PER_SEC);
+}
+
+bool RpaCache::irkMatches(const uint8_t irk[16], const bt_addr_t *rpa) {
+  // ah(irk, prand) = e(irk, padding || prand), the hash is its low 24 bits
+  uint8_t block[16] = {};
+  memcpy(block, &rpa->val[3], 3);
+  if (bt_encrypt_le(irk, block, block) < 0) {
+    return false;
+  }
+  return memcmp(block, rpa->val, 3) == 0;
+}
+
+void RpaCache::store(const bt_addr_t *rpa, uint8_t irk, int64_t now) {
+  uint32_t home = slot(rpa);
+  struct rpa_entry *victim = nullptr;
+  for (uint32_t i = 0; i < RPA_CACHE_PROBES; i++) {
+    struct rpa_entry &entry = _entries[(home + i) & (RPA_CACHE_SIZE - 1)];
+    if (!entry.used || expired(entry, now)) {
+      victim = &entry;
+      break;
+    }
+    if (!victim || entry.resolved_ticks < victim->resolved_ticks) {
+      victim = &entry;
+    }
+  }
+
+  if (victim->used && !expired(*victim, now)) {
+    _stats.evictions++;
+  }
+  bt_addr_copy(&victim->rpa, rpa);
+  victim->irk = irk;
+  victim->used = true;
+  victim->resolved_ticks = now;
+}
+
+bool RpaCache::identity(const bt_addr_le_t *addr, bt_addr_le_t *out) {
+  if (addr->type != BT_ADDR_LE_RANDOM || !BT_ADDR_IS_RPA(&addr->a)) {
+    bt_addr_le_copy(out, addr);
+    return true;
+  }
+
+  int64_t now = k_uptime_ticks();
+  uint32_t home = slot(&addr->a);
+
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  for (uint32_t i = 0; i < RPA_CACHE_PROBES; i++) {
+    const struct rpa_entry &entry =
+        _entries[(home + i) & (RPA_CACHE_SIZE - 1)];
+    if (!entry.used || !bt_addr_eq(&entry.rpa, &addr->a) ||
+        expired(entry, now)) {
+      continue;
+    }
+
+    _stats.hits++;
+    bool found = entry.irk != RPA_UNRESOLVED;
+    if (found) {
+      bt_addr_le_copy(out, &_irks[entry.irk].identity);
+    }
+    k_spin_unlock(&_lock, key);
+    return found;
+  }
+
+  // Resolve on a copy of the keys, AES is too slow to run under the lock
+  struct rpa_irk irks[RPA_MAX_IRKS];
+  memcpy(irks, _irks, sizeof(irks));
+  uint32_t generation = _generation;
+  _stats.misses++;
+  k_spin_unlock(&_lock, key);
+
+  uint8_t match = RPA_UNRESOLVED;
+  uint32_t aes = 0;
+  for (uint8_t i = 0; i < RPA_MAX_IRKS; i++) {
+    if (!irks[i].used) {
+      continue;
+    }
+    aes++;
+    if (irkMatches(irks[i].irk, &addr->a)) {
+      match = i;
+      break;
+    }
+  }
+
+  key = k_spin_lock(&_lock);
+  _stats.aes += aes;
+  if (match != RPA_UNRESOLVED) {
+    _stats.resolved++;
+  } else {
+    _stats.unresolved++;
+  }
+  if (generation == _generation) {
+    store(&addr->a, match, now);
+  }
+  k_spin_unlock(&_lock, key);
+
+  if (match == RPA_UNRESOLVED) {
+    return false;
+  }
+  bt_addr_le_copy(out, &irks[match].identity);
+  return true;
+}
+
+#ifdef CONFIG_SHELL
+static int cmdRpaAdd(const struct shell *sh, size_t argc, char **argv) {
+  ARG_UNUSED(argc);
+
+  bt_addr_le_t identity;
+  if (bt_addr_le_from_str(argv[1], argv[2], &identity) < 0) {
+    shell_error(sh, "Invalid address %s %s", argv[1], argv[2]);
+    return -EINVAL;
+  }
+
+  // Keys are written most significant byte first, the stack keeps them
+  // little endian
+  uint8_t irk[16];
+  if (strlen(argv[3]) != 2 * sizeof(irk) ||
+      hex2bin(argv[3], strlen(argv[3]), irk, sizeof(irk)) != sizeof(irk)) {
+    shell_error(sh, "IRK must be 32 hex digits");
+    return -EINVAL;
+  }
+  sys_mem_swap(irk, sizeof(irk));
+
+  int err = RpaCache::addIrk(&identity, irk);
+  if (err < 0) {
+    shell_error(sh, "IRK table is full (%u keys)", RPA_MAX_IRKS);
+  }
+  return err;
+}
+
+static int cmdRpaShow(const struct shell *sh, size_t argc, char **argv) {
+  ARG_UNUSED(argc);
+  ARG_UNUSED(argv);
+
+  struct rpa_cache_stats stats = RpaCache::stats();
+  shell_print(sh, "hits %u, misses %u (resolved %u, unresolved %u)",
+              stats.hits, stats.misses, stats.resolved, stats.unresolved);
+  shell_print(sh, "evictions %u, aes %u", stats.evictions, stats.aes);
+  return 0;
+}
+
+static int cmdRpaClear(const struct shell *sh, size_t argc, char **argv) {
+  ARG_UNUSED(sh);
+  ARG_UNUSED(argc);
+  ARG_UNUSED(argv);
+
+  RpaCache::clear();
+  return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+    rpa_cmds,
+    SHELL_CMD_ARG(add, NULL, "<identity> <public|random> <irk, MSB first>",
+                  cmdRpaAdd, 4, 0),
+    SHELL_CMD(show, NULL, "Cache hit and resolution counts", cmdRpaShow),
+    SHELL_CMD(clear, NULL, "Drop every IRK and cached address", cmdRpaClear),
+    SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(rpa, &rpa_cmds, "RPA to identity cache for filtering",
+                   NULL);
+#endif
@@ -0,0 +1,80 @@
+#pragma once
+
+extern "C" {
+#include <zephyr/bluetooth/addr.h>
+#include <zephyr/kernel.h>
+#include <zephyr/spinlock.h>
+}
+
+#ifdef CONFIG_BLUESIM_RPA_CACHE_SIZE
+#define RPA_CACHE_SIZE CONFIG_BLUESIM_RPA_CACHE_SIZE
+#else
+#define RPA_CACHE_SIZE 64
+#endif
+
+#ifdef CONFIG_BLUESIM_RPA_CACHE_TTL_S
+#define RPA_CACHE_TTL_S CONFIG_BLUESIM_RPA_CACHE_TTL_S
+#else
+#define RPA_CACHE_TTL_S 900
+#endif
+
+#ifdef CONFIG_BLUESIM_RPA_MAX_IRKS
+#define RPA_MAX_IRKS CONFIG_BLUESIM_RPA_MAX_IRKS
+#else
+#define RPA_MAX_IRKS 8
+#endif
+
+// Slots an address may land in past its home slot
+#define RPA_CACHE_PROBES 4
+#define RPA_UNRESOLVED 0xFF
+
+struct rpa_irk {
+  bt_addr_le_t identity;
+  uint8_t irk[16]; // Little endian, as the stack keeps it
+  bool used;
+};
+
+struct rpa_entry {
+  bt_addr_t rpa;
+  uint8_t irk; // Index into the IRK table or RPA_UNRESOLVED
+  bool used;
+  int64_t resolved_ticks;
+};
+
+struct rpa_cache_stats {
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t resolved;   // Misses that matched an IRK
+  uint32_t unresolved; // Misses no IRK matched, cached as such
+  uint32_t evictions;  // Live entries pushed out by a new address
+  uint32_t aes;        // Block encryptions spent resolving
+};
+
+// Maps resolvable private addresses seen in scan reports to the identity
+// behind them. Bonded peers never get here: the stack hands their reports
+// over with the identity already resolved, by the controller resolving list
+// when it has one. IRKs added here belong to peers we are not bonded with,
+// each new RPA is checked against all of them once and the outcome, match or
+// no match, is kept until RPA_CACHE_TTL_S covers its rotation.
+class RpaCache {
+public:
+  static int addIrk(const bt_addr_le_t *identity, const uint8_t irk[16]);
+  static void clear();
+  // Writes the identity behind addr, addr itself when it is not a resolvable
+  // private address. False when no known IRK resolves it.
+  static bool identity(const bt_addr_le_t *addr, bt_addr_le_t *out);
+  static struct rpa_cache_stats stats() { return _stats; }
+
+private:
+  static uint32_t slot(const bt_addr_t *rpa);
+  static bool expired(const struct rpa_entry &entry, int64_t now);
+  static bool irkMatches(const uint8_t irk[16], const bt_addr_t *rpa);
+  static void store(const bt_addr_t *rpa, uint8_t irk, int64_t now);
+
+  static struct k_spinlock _lock;
+  static struct rpa_irk _irks[RPA_MAX_IRKS];
+  static struct rpa_entry _entries[RPA_CACHE_SIZE];
+  // Bumped on every IRK change so a resolution that raced it is not cached
+  static uint32_t _generation;
+  static struct rpa_cache_stats _stats;
+};
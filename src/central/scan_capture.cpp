@@ -0,0 +1,410 @@
+#include "scan_capture.hpp"
+#include "scanner.hpp"
+
+LOG_MODULE_REGISTER(SCAN_CAPTURE, LOG_LEVEL_INF);
+
+RING_BUF_DECLARE(capture_ring, CAPTURE_RING_SIZE);
+
+bool ScanCapture::_isCapturing = false;
+bool ScanCapture::_finalFlush = false;
+int64_t ScanCapture::_lastRecordUs = 0;
+struct capture_stats ScanCapture::_stats = {};
+struct queued_work ScanCapture::_flushWork = {};
+struct k_spinlock ScanCapture::_lock = {};
+const struct flash_area *ScanCapture::_area = nullptr;
+uint32_t ScanCapture::_writeOffset = 0;
+uint32_t ScanCapture::_erasedUntil = 0;
+uint8_t ScanCapture::_encodeBuffer[CAPTURE_MAX_RECORD_SIZE + 1];
+uint8_t ScanCapture::_flushBuffer[CAPTURE_FLUSH_CHUNK];
+
+bool ScanReplay::_isReplaying = false;
+bool ScanReplay::_hasPending = false;
+uint16_t ScanReplay::_speed = 1;
+const uint8_t *ScanReplay::_log = nullptr;
+size_t ScanReplay::_logLength = 0;
+const struct flash_area *ScanReplay::_area = nullptr;
+uint32_t ScanReplay::_offset = 0;
+int64_t ScanReplay::_startUs = 0;
+uint64_t ScanReplay::_logUs = 0;
+struct capture_record ScanReplay::_pending = {};
+struct replay_stats ScanReplay::_stats = {};
+struct queued_work ScanReplay::_replayWork = {};
+uint8_t ScanReplay::_recordBuffer[CAPTURE_MAX_RECORD_SIZE + 1];
+
+// Reports delivered per work item run before yielding the data queue
+constexpr uint8_t kReplayBurst = 16;
+
+static int64_t uptimeUs() { return k_ticks_to_us_floor64(k_uptime_ticks()); }
+
+int ScanCapture::start() {
+  if (_isCapturing || _finalFlush) {
+    return -EALREADY;
+  }
+
+  if (!_flushWork.handler) {
+    WorkQueue::data.initWork(&_flushWork, flushAction);
+  }
+
+  ring_buf_reset(&capture_ring);
+  _stats = {};
+
+  uint8_t header[CAPTURE_HEADER_SIZE];
+  CaptureFormat::writeHeader(header);
+
+#if CAPTURE_HAS_FLASH
+  if (!_area) {
+    int err = flash_area_open(FIXED_PARTITION_ID(capture_partition), &_area);
+    if (err < 0) {
+      LOG_ERR("Failed to open capture partition (err %d)", err);
+      return err;
+    }
+  }
+
+  _writeOffset = 0;
+  _erasedUntil = 0;
+  int err = eraseUpTo(CAPTURE_HEADER_SIZE);
+  if (err < 0) {
+    return err;
+  }
+
+  err = flash_area_write(_area, 0, header, sizeof(header));
+  if (err < 0) {
+    LOG_ERR("Failed to write capture header (err %d)", err);
+    return err;
+  }
+
+  _writeOffset = sizeof(header);
+  _stats.flushed_bytes = sizeof(header);
+#else
+  // RAM only, the ring holds the complete log
+  ring_buf_put(&capture_ring, header, sizeof(header));
+#endif
+
+  _lastRecordUs = uptimeUs();
+  _isCapturing = true;
+  LOG_INF("Scan capture started (%s)", CAPTURE_HAS_FLASH ? "flash" : "ram");
+  return 0;
+}
+
+int ScanCapture::stop() {
+  if (!_isCapturing) {
+    return -EALREADY;
+  }
+
+  _isCapturing = false;
+
+#if CAPTURE_HAS_FLASH
+  _finalFlush = true;
+  return WorkQueue::data.schedule(&_flushWork, K_NO_WAIT);
+#else
+  LOG_INF("Scan capture stopped (%u recorded, %u dropped)", _stats.recorded,
+          _stats.dropped);
+  return 0;
+#endif
+}
+
+size_t ScanCapture::drain(uint8_t *out, size_t len) {
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  size_t copied = ring_buf_get(&capture_ring, out, len);
+  k_spin_unlock(&_lock, key);
+  return copied;
+}
+
+void ScanCapture::record(const bt_addr_le_t *addr, int8_t rssi,
+                         uint8_t adv_type, const struct net_buf_simple *buf) {
+  // Replayed reports are already in a log
+  if (!_isCapturing || ScanReplay::isReplaying()) {
+    return;
+  }
+
+  int64_t now = uptimeUs();
+  struct capture_record record = {};
+  bt_addr_le_copy(&record.addr, addr);
+  record.rssi = rssi;
+  record.adv_type = adv_type;
+  record.ad_length = MIN(buf->len, CAPTURE_MAX_AD_LENGTH);
+  record.ad = buf->data;
+
+  // The encode buffer and the delta base are shared by every caller, so
+  // encoding happens under the ring lock
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  record.delta_us =
+      (uint32_t)CLAMP(now - _lastRecordUs, 0, (int64_t)UINT32_MAX);
+  size_t size = CaptureFormat::encode(record, _encodeBuffer,
+                                      sizeof(_encodeBuffer));
+  bool stored = ring_buf_space_get(&capture_ring) >= size;
+  if (stored) {
+    ring_buf_put(&capture_ring, _encodeBuffer, size);
+    // A dropped report's time is carried into the next record's delta
+    _lastRecordUs = now;
+    _stats.recorded++;
+  } else {
+    _stats.dropped++;
+  }
+  uint32_t used = ring_buf_size_get(&capture_ring);
+  k_spin_unlock(&_lock, key);
+
+  if (!stored) {
+    return;
+  }
+
+  if (CAPTURE_HAS_FLASH && used >= CAPTURE_FLUSH_CHUNK) {
+    WorkQueue::data.schedule(&_flushWork, K_NO_WAIT);
+  }
+}
+
+void ScanCapture::flushAction(struct k_work *work) {
+  ARG_UNUSED(work);
+
+  while (ring_buf_size_get(&capture_ring) >= CAPTURE_FLUSH_CHUNK) {
+    if (flushChunk(CAPTURE_FLUSH_CHUNK) < 0) {
+      break;
+    }
+  }
+
+  if (!_finalFlush) {
+    return;
+  }
+
+  uint32_t rest = ring_buf_size_get(&capture_ring);
+  if (rest > 0) {
+    flushChunk(rest);
+  }
+
+#if CAPTURE_HAS_FLASH
+  // The log ends at the first erased byte, make sure a stale sector from an
+  // older capture does not follow it
+  if (_writeOffset == _erasedUntil && _writeOffset < _area->fa_size) {
+    eraseUpTo(_writeOffset + 1);
+  }
+#endif
+
+  _finalFlush = false;
+  LOG_INF("Scan capture stopped (%u recorded, %u dropped, %u bytes)",
+          _stats.recorded, _stats.dropped, _stats.flushed_bytes);
+}
+
+int ScanCapture::flushChunk(size_t len) {
+#if CAPTURE_HAS_FLASH
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  len = ring_buf_get(&capture_ring, _flushBuffer, len);
+  k_spin_unlock(&_lock, key);
+
+  // QSPI writes are word sized, the padding bytes are skipped on replay
+  size_t padded = ROUND_UP(len, 4);
+  memset(&_flushBuffer[len], CAPTURE_RECORD_PADDING, padded - len);
+
+  if (_writeOffset + padded > _area->fa_size) {
+    _isCapturing = false;
+    _stats.dropped++;
+    LOG_WRN("Capture partition full, capture stopped");
+    return -ENOSPC;
+  }
+
+  int err = eraseUpTo(_writeOffset + padded);
+  if (err < 0) {
+    return err;
+  }
+
+  err = flash_area_write(_area, _writeOffset, _flushBuffer, padded);
+  if (err < 0) {
+    LOG_ERR("Failed to write capture log at 0x%x (err %d)", _writeOffset,
+            err);
+    return err;
+  }
+
+  _writeOffset += padded;
+  _stats.flushed_bytes += padded;
+  return 0;
+#else
+  ARG_UNUSED(len);
+  return -ENOTSUP;
+#endif
+}
+
+int ScanCapture::eraseUpTo(uint32_t end) {
+#if CAPTURE_HAS_FLASH
+  while (_erasedUntil < end) {
+    int err = flash_area_erase(_area, _erasedUntil, CAPTURE_FLASH_SECTOR_SIZE);
+    if (err < 0) {
+      LOG_ERR("Failed to erase capture sector 0x%x (err %d)", _erasedUntil,
+              err);
+      return err;
+    }
+    _erasedUntil += CAPTURE_FLASH_SECTOR_SIZE;
+  }
+  return 0;
+#else
+  ARG_UNUSED(end);
+  return -ENOTSUP;
+#endif
+}
+
+int ScanReplay::start(uint16_t speed) {
+#if CAPTURE_HAS_FLASH
+  if (!_area) {
+    int err = flash_area_open(FIXED_PARTITION_ID(capture_partition), &_area);
+    if (err < 0) {
+      LOG_ERR("Failed to open capture partition (err %d)", err);
+      return err;
+    }
+  }
+
+  _log = nullptr;
+  _logLength = 0;
+  return begin(speed);
+#else
+  ARG_UNUSED(speed);
+  return -ENOTSUP;
+#endif
+}
+
+int ScanReplay::start(const uint8_t *log, size_t len, uint16_t speed) {
+  if (!log) {
+    return -EINVAL;
+  }
+
+  _log = log;
+  _logLength = len;
+  return begin(speed);
+}
+
+int ScanReplay::begin(uint16_t speed) {
+  if (_isReplaying) {
+    return -EALREADY;
+  }
+
+  uint8_t header[CAPTURE_HEADER_SIZE];
+  int err = read(0, header, sizeof(header));
+  if (err < 0 || !CaptureFormat::checkHeader(header)) {
+    LOG_ERR("No scan capture log to replay");
+    return -EINVAL;
+  }
+
+  if (!_replayWork.handler) {
+    WorkQueue::data.initWork(&_replayWork, replayAction);
+  }
+
+  _speed = speed;
+  _offset = CAPTURE_HEADER_SIZE;
+  _logUs = 0;
+  _hasPending = false;
+  _stats = {};
+  _startUs = uptimeUs();
+  _isReplaying = true;
+  LOG_INF("Scan replay started (speed %u)", speed);
+  return WorkQueue::data.schedule(&_replayWork, K_NO_WAIT);
+}
+
+int ScanReplay::stop() {
+  if (!_isReplaying) {
+    return -EALREADY;
+  }
+
+  WorkQueue::data.cancel(&_replayWork);
+  finish();
+  return 0;
+}
+
+void ScanReplay::finish() {
+  _isReplaying = false;
+
+  // Hand scanning back to the controller
+  StackScan::restart();
+
+  LOG_INF("Scan replay finished (%u delivered, max lag %u us)",
+          _stats.delivered, _stats.max_lag_us);
+}
+
+int ScanReplay::read(uint32_t offset, uint8_t *out, size_t len) {
+  if (_log) {
+    if (offset + len > _logLength) {
+      return -ENODATA;
+    }
+    memcpy(out, &_log[offset], len);
+    return 0;
+  }
+
+#if CAPTURE_HAS_FLASH
+  if (offset + len > _area->fa_size) {
+    return -ENODATA;
+  }
+  return flash_area_read(_area, offset, out, len);
+#else
+  return -ENODATA;
+#endif
+}
+
+int ScanReplay::nextRecord() {
+  while (true) {
+    uint8_t length;
+    int err = read(_offset, &length, 1);
+    if (err < 0) {
+      return err;
+    }
+
+    if (length == CAPTURE_RECORD_PADDING) {
+      _offset++;
+      continue;
+    }
+
+    if (length == CAPTURE_RECORD_END) {
+      return -ENODATA;
+    }
+
+    err = read(_offset, _recordBuffer, length + 1);
+    if (err < 0) {
+      return err;
+    }
+
+    int consumed = CaptureFormat::decode(_recordBuffer, length + 1, _pending);
+    if (consumed <= 0) {
+      LOG_WRN("Corrupt capture record at 0x%x", _offset);
+      return -EINVAL;
+    }
+
+    _offset += consumed;
+    return 0;
+  }
+}
+
+void ScanReplay::replayAction(struct k_work *work) {
+  ARG_UNUSED(work);
+
+  if (!_isReplaying) {
+    return;
+  }
+
+  for (uint8_t i = 0; i < kReplayBurst; i++) {
+    if (!_hasPending) {
+      if (nextRecord() < 0) {
+        finish();
+        return;
+      }
+      _hasPending = true;
+      _logUs += _pending.delta_us;
+    }
+
+    // Deadlines are absolute so scheduling jitter does not accumulate
+    if (_speed > 0) {
+      int64_t due = _startUs + (int64_t)(_logUs / _speed);
+      int64_t now = uptimeUs();
+      if (due > now) {
+        WorkQueue::data.schedule(&_replayWork, K_USEC(due - now));
+        return;
+      }
+      _stats.max_lag_us = MAX(_stats.max_lag_us, (uint32_t)(now - due));
+    }
+
+    struct net_buf_simple buf;
+    net_buf_simple_init_with_data(&buf, (void *)_pending.ad,
+                                  _pending.ad_length);
+    Scanner::scanCallback(&_pending.addr, _pending.rssi, _pending.adv_type,
+                          &buf);
+    _stats.delivered++;
+    _hasPending = false;
+  }
+
+  // Let other data work run between bursts
+  WorkQueue::data.schedule(&_replayWork, K_NO_WAIT);
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "../common/work_queue.hpp"
+#include "capture_format.hpp"
+#include <zephyr/logging/log.h>
+
+extern "C" {
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/kernel.h>
+#include <zephyr/net/buf.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/sys/ring_buffer.h>
+}
+
+#ifdef CONFIG_BLUESIM_SCAN_CAPTURE_RING_SIZE
+#define CAPTURE_RING_SIZE CONFIG_BLUESIM_SCAN_CAPTURE_RING_SIZE
+#else
+#define CAPTURE_RING_SIZE 4096
+#endif
+
+#ifdef CONFIG_BLUESIM_SCAN_REPLAY_SPEED
+#define CAPTURE_REPLAY_SPEED CONFIG_BLUESIM_SCAN_REPLAY_SPEED
+#else
+#define CAPTURE_REPLAY_SPEED 1
+#endif
+
+// Ring bytes moved to flash per write, a multiple of the QSPI word size
+#define CAPTURE_FLUSH_CHUNK 256
+// MX25R64 erase granularity
+#define CAPTURE_FLASH_SECTOR_SIZE 4096
+
+// The log is kept on the external flash when the board defines a
+// capture_partition, otherwise only in the RAM ring
+#if FIXED_PARTITION_EXISTS(capture_partition)
+#define CAPTURE_HAS_FLASH 1
+#else
+#define CAPTURE_HAS_FLASH 0
+#endif
+
+struct capture_stats {
+  uint32_t recorded;
+  uint32_t dropped;       // Ring full or flash exhausted
+  uint32_t flushed_bytes; // Written to flash, header included
+};
+
+struct replay_stats {
+  uint32_t delivered;
+  uint32_t max_lag_us; // Worst delivery delay behind the scaled log time
+};
+
+// Records every scan report into the binary log described in
+// capture_format.hpp. Producer is the Bluetooth RX thread, the flash writer
+// runs on WorkQueue::data.
+class ScanCapture {
+public:
+  static int start();
+  static int stop();
+  static bool isCapturing() { return _isCapturing; }
+  static const struct capture_stats &stats() { return _stats; }
+  // Moves buffered log bytes out of the RAM ring, the only way to read a
+  // capture on boards without a capture partition
+  static size_t drain(uint8_t *out, size_t len);
+
+  static void record(const bt_addr_le_t *addr, int8_t rssi, uint8_t adv_type,
+                     const struct net_buf_simple *buf);
+  static void flushAction(struct k_work *work);
+
+private:
+  static int flushChunk(size_t len);
+  static int eraseUpTo(uint32_t end);
+
+  static bool _isCapturing;
+  static bool _finalFlush;
+  static int64_t _lastRecordUs;
+  static struct capture_stats _stats;
+  static struct queued_work _flushWork;
+  static struct k_spinlock _lock;
+  static const struct flash_area *_area;
+  static uint32_t _writeOffset;
+  static uint32_t _erasedUntil;
+  static uint8_t _encodeBuffer[CAPTURE_MAX_RECORD_SIZE + 1]; // Under _lock
+  static uint8_t _flushBuffer[CAPTURE_FLUSH_CHUNK];
+};
+
+// Feeds a captured log back into Scanner::scanCallback, either from the
+// capture partition or from a buffer in memory. While replaying, the scanner
+// does not touch the controller so only logged reports reach the filters.
+class ScanReplay {
+public:
+  // speed 1 keeps the original timing, N runs N times faster and 0 delivers
+  // as fast as the data work queue allows
+  static int start(uint16_t speed);
+  static int start(const uint8_t *log, size_t len, uint16_t speed);
+  static int stop();
+  static bool isReplaying() { return _isReplaying; }
+  static const struct replay_stats &stats() { return _stats; }
+
+  static void replayAction(struct k_work *work);
+
+private:
+  static int begin(uint16_t speed);
+  static int read(uint32_t offset, uint8_t *out, size_t len);
+  static int nextRecord();
+  static void finish();
+
+  static bool _isReplaying;
+  static bool _hasPending;
+  static uint16_t _speed;
+  static const uint8_t *_log;
+  static size_t _logLength;
+  static const struct flash_area *_area;
+  static uint32_t _offset;
+  static int64_t _startUs;
+  static uint64_t _logUs;
+  static struct capture_record _pending;
+  static struct replay_stats _stats;
+  static struct queued_work _replayWork;
+  static uint8_t _recordBuffer[CAPTURE_MAX_RECORD_SIZE + 1];
+};
@@ -1,16 +1,56 @@
 #include "scanner.hpp"
+#include "../bench/scale_bench.hpp"
+#include "../common/startup.hpp"
+#include "../common/trace.hpp"
+#include "../common/uart_stream.hpp"
 #include "central.hpp"
+#include "link_latency.hpp"
+#include "scan_capture.hpp"
 
 LOG_MODULE_REGISTER(SCANNER, LOG_LEVEL_DBG);
 
 Scanner *Scanner::registry[MAX_SCANNERS] = {nullptr};
+// Every report is delivered: the device table smooths RSSI and measures the
+// report rate per advertiser, which the controller's duplicate filter would
+// freeze after the first report. The table does the duplicate filtering for
+// the scanners instead.
 struct bt_le_scan_param Scanner::scanParameters = BT_LE_SCAN_PARAM_INIT(
-    BT_LE_SCAN_TYPE_ACTIVE, BT_LE_SCAN_OPT_FILTER_DUPLICATE,
-    BT_GAP_SCAN_FAST_INTERVAL, BT_GAP_SCAN_FAST_WINDOW);
-bool Scanner::isStackScanning = false;
+    BT_LE_SCAN_TYPE_ACTIVE, BT_LE_SCAN_OPT_NONE, BT_GAP_SCAN_FAST_INTERVAL,
+    BT_GAP_SCAN_FAST_WINDOW);
+struct periodic_sync_info Scanner::periodicSyncs[MAX_PERIODIC_SYNCS] = {};
+struct bt_le_scan_cb Scanner::scanRecvCallbacks = {};
+struct bt_le_per_adv_sync_cb Scanner::perAdvSyncCallbacks = {};
+bool Scanner::callbacksRegistered = false;
+
+BUILD_ASSERT(MAX_SCANNERS <= sizeof(atomic_val_t) * 8,
+             "Scanner demand must fit in one atomic word");
+
+// Number of periodic events that may be missed before the sync is lost
+constexpr uint32_t kPerAdvSyncRetryCount = 5;
 
 Scanner::Scanner(Central *owner)
-    : _index(0), _isScanning(false), _owner(owner) {
+    : _index(0), _filterActive(ATOMIC_INIT(0)), _filterReaders(),
+      _owner(owner), _periodicDataCallback(nullptr),
+      _policy(SelectionPolicy::STRONGEST), _selectCursor(0) {
+  k_mutex_init(&_filterWriteLock);
+  WorkQueue::radio.initWork(&_selectWork, selectWorkAction);
+  Startup::expect(StartupPhase::FIRST_SCANNING);
+
+  // Extended scan and periodic sync listeners are shared by all scanners
+  if (!Scanner::callbacksRegistered) {
+    Scanner::scanRecvCallbacks.recv = scanRecvCallback;
+    bt_le_scan_cb_register(&Scanner::scanRecvCallbacks);
+
+    Scanner::perAdvSyncCallbacks.synced = perAdvSyncedCallback;
+    Scanner::perAdvSyncCallbacks.term = perAdvTermCallback;
+    Scanner::perAdvSyncCallbacks.recv = perAdvRecvCallback;
+    bt_le_per_adv_sync_cb_register(&Scanner::perAdvSyncCallbacks);
+
+    StackScan::init(controllerStart, controllerStop);
+
+    Scanner::callbacksRegistered = true;
+  }
+
   for (uint8_t i = 0; i < MAX_SCANNERS; ++i) {
     if (!Scanner::registry[i]) {
       Scanner::registry[i] = this;
@@ -23,150 +63,385 @@ Scanner::Scanner(Central *owner)
   __ASSERT(false, "Failed to register Scanner");
 }
 
-Scanner::~Scanner() { Scanner::registry[_index] = nullptr; }
+Scanner::~Scanner() {
+  WorkQueue::radio.cancelSync(&_selectWork);
+  for (struct periodic_sync_info &entry : Scanner::periodicSyncs) {
+    if (entry.owner == this && entry.sync) {
+      bt_le_per_adv_sync_delete(entry.sync);
+      entry = {};
+    }
+  }
+
+  StackScan::release(_index);
+  StackScan::unhold(_index);
+  StackScan::settle();
+  Scanner::registry[_index] = nullptr;
+}
 
 void Scanner::addFilter(const Filter &filter) {
-  _filter = filter;
+  k_mutex_lock(&_filterWriteLock, K_FOREVER);
+  uint8_t standby = !atomic_get(&_filterActive);
+
+  // A match that started before the previous swap may still read it
+  while (atomic_get(&_filterReaders[standby])) {
+    k_sleep(K_MSEC(1));
+  }
+
+  _filters[standby] = filter;
+  atomic_set(&_filterActive, standby);
+  k_mutex_unlock(&_filterWriteLock);
   LOG_INF("Filter added");
 }
 
-int Scanner::startScanning() {
-  uint8_t numberOfActiveScanners = 0;
-  for (uint8_t i = 0; i < MAX_SCANNERS; i++) {
-    Scanner *scanner = Scanner::registry[i];
-    if (!scanner) {
+bool Scanner::matchesFilter(const bt_addr_le_t *addr, int8_t rssi,
+                            uint8_t adv_type, struct net_buf_simple *buf) {
+  // Pin the active copy, then check it is still active: a writer either
+  // waits for the pin or has swapped already and the match retries
+  uint8_t copy;
+  while (true) {
+    copy = (uint8_t)atomic_get(&_filterActive);
+    atomic_inc(&_filterReaders[copy]);
+    if (atomic_get(&_filterActive) == copy) {
+      break;
+    }
+    atomic_dec(&_filterReaders[copy]);
+  }
+
+  bool matched = _filters[copy].matchesDevice(addr, rssi, adv_type, buf);
+  atomic_dec(&_filterReaders[copy]);
+  return matched;
+}
+
+void Scanner::setPeriodicDataCallback(PeriodicDataCallback callback) {
+  _periodicDataCallback = callback;
+  LOG_INF("Scanner %d: Periodic sync %s", _index,
+          callback ? "enabled" : "disabled");
+}
+
+void Scanner::setSelectionPolicy(SelectionPolicy policy) {
+  _policy = policy;
+  LOG_INF("Scanner %d: Selection policy %s", _index,
+          DeviceTable::policyName(policy));
+}
+
+int Scanner::connectToCandidate() {
+  bt_addr_le_t addr;
+  int err = DeviceTable::select(_index, _policy, &_selectCursor, &addr);
+  if (err < 0) {
+    return err;
+  }
+
+  // The controller stays off until the attempt resolves, other active
+  // scanners stay marked and get it back once no scanner holds it
+  StackScan::release(_index);
+  StackScan::hold(_index);
+  err = StackScan::settle();
+  if (err == 0 && StackScan::state() != StackScanState::IDLE) {
+    // Another context is still settling, the next match tries again
+    err = -EBUSY;
+  }
+  if (err < 0) {
+    LOG_ERR("Failed to stop scanning for connection (err %d)", err);
+    resumeAfterConnect();
+    return err;
+  }
+
+  if (IS_ENABLED(CONFIG_BLUESIM_LINK_LATENCY)) {
+    LinkLatency::mark(_owner->_index, LatencyStage::SCAN_STOPPED);
+  }
+
+  // Scanning restart is handled by Central's deferred work items, through
+  // onConnected() when the connection fails or succeeds
+  err = _owner->connectToDevice(&addr);
+  if (err < 0) {
+    // No connected event follows a create that never started
+    LOG_ERR("Connection attempt failed (err %d)", err);
+    resumeAfterConnect();
+  }
+  return err;
+}
+
+void Scanner::resumeAfterConnect() {
+  StackScan::want(_index);
+  StackScan::unhold(_index);
+  StackScan::settle();
+}
+
+void Scanner::selectWorkAction(struct k_work *work) {
+  Scanner *self = CONTAINER_OF(work, Scanner, _selectWork);
+
+  // Stopped or already connecting since the window opened
+  if (!self->isActive()) {
+    DeviceTable::clearCandidates(self->_index);
+    return;
+  }
+
+  self->connectToCandidate();
+}
+
+int Scanner::createPeriodicSync(const struct bt_le_scan_recv_info *info) {
+  struct periodic_sync_info *slot = nullptr;
+  for (struct periodic_sync_info &entry : Scanner::periodicSyncs) {
+    if (entry.sync) {
+      // Already synced (or syncing) to this train
+      if (entry.sid == info->sid &&
+          bt_addr_le_cmp(&entry.addr, info->addr) == 0) {
+        return 0;
+      }
+
+      // The controller only accepts one pending sync creation at a time
+      if (!entry.synced) {
+        return -EBUSY;
+      }
       continue;
     }
 
-    if (scanner->_isScanning) {
-      ++numberOfActiveScanners;
+    if (!slot) {
+      slot = &entry;
     }
   }
 
-  // Start stack scanning if this is the first active scanner
-  if (numberOfActiveScanners == 0) {
-    int err = Scanner::startStackScanning();
-    if (err < 0) {
-      LOG_ERR("Scanner %d: Failed to start stack scanning (err %d)", _index,
-              err);
-      return err;
-    }
+  if (!slot) {
+    return -ENOMEM;
   }
 
-  // This case might happen with multiple Centrals when connecting
-  if (numberOfActiveScanners > 0 && !Scanner::isStackScanning) {
-    int err = Scanner::startStackScanning();
-    if (err < 0) {
-      LOG_ERR("Scanner %d: Failed to start stack scanning (err %d)", _index,
-              err);
-      return err;
-    }
+  // Supervision timeout in 10 ms units, covering a few missed events
+  uint32_t timeout =
+      (info->interval * 125U * kPerAdvSyncRetryCount) / (10U * 100U);
+  timeout = CLAMP(timeout, BT_GAP_PER_ADV_MIN_TIMEOUT,
+                  BT_GAP_PER_ADV_MAX_TIMEOUT);
+
+  struct bt_le_per_adv_sync_param param = {};
+  bt_addr_le_copy(&param.addr, info->addr);
+  param.sid = info->sid;
+  param.options = BT_LE_PER_ADV_SYNC_OPT_NONE;
+  param.skip = 0;
+  param.timeout = timeout;
+
+  int err = bt_le_per_adv_sync_create(&param, &slot->sync);
+  if (err < 0) {
+    slot->sync = nullptr;
+    return err;
+  }
+
+  bt_addr_le_copy(&slot->addr, info->addr);
+  slot->sid = info->sid;
+  slot->synced = false;
+  slot->owner = this;
+  LOG_INF("Scanner %d: Creating periodic sync (sid %u)", _index, info->sid);
+  return 0;
+}
+
+int Scanner::startScanning() {
+  // Devices the controller already reported count as new for this scanner
+  DeviceTable::newWindow(_index);
+  StackScan::want(_index);
+
+  // Also restarts the controller when it was stopped for a connection
+  // attempt while this scanner stayed active
+  int err = StackScan::settle();
+  if (err < 0) {
+    StackScan::release(_index);
+    LOG_ERR("Scanner %d: Failed to start stack scanning (err %d)", _index,
+            err);
+    return err;
   }
 
-  // Start scanning for the specific instance
-  _isScanning = true;
   LOG_INF("Scanner %d: Scanning started", _index);
   return 0;
 }
 
 int Scanner::stopScanning() {
-  uint8_t numberOfActiveScanners = 0;
-  for (Scanner *scanner : Scanner::registry) {
-    if (scanner && scanner->_isScanning) {
-      ++numberOfActiveScanners;
-    }
-  }
+  StackScan::release(_index);
+  WorkQueue::radio.cancel(&_selectWork);
+  DeviceTable::clearCandidates(_index);
 
-  // Stop stack scanning if there is only one active scanner left
-  if (numberOfActiveScanners == 1) {
-    int err = Scanner::stopStackScanning();
-    if (err < 0) {
-      LOG_ERR("Scanner %d: Failed to stop stack scanning (err %d)", _index,
-              err);
-      return err;
-    }
+  int err = StackScan::settle();
+  if (err < 0) {
+    LOG_ERR("Scanner %d: Failed to stop stack scanning (err %d)", _index,
+            err);
+    return err;
   }
 
-  // Stop scanning for the specific instance
-  _isScanning = false;
   LOG_INF("Scanner %d: Scanning stopped", _index);
   return 0;
 }
 
 void Scanner::scanCallback(const bt_addr_le_t *addr, int8_t rssi,
                            uint8_t adv_type, struct net_buf_simple *buf) {
-  // Check each active scanner for filter matches
+  if (IS_ENABLED(CONFIG_BLUESIM_SCAN_CAPTURE)) {
+    ScanCapture::record(addr, rssi, adv_type, buf);
+  }
+
+  if (IS_ENABLED(CONFIG_BLUESIM_STREAM) && UartStream::scanReports()) {
+    UartStream::sendScanReport(addr, rssi, adv_type, buf);
+  }
+
+  // Periodic receivers sync to trains in scanRecvCallback instead of
+  // connecting
+  uint32_t active = 0;
   for (Scanner *scanner : Scanner::registry) {
-    if (!scanner || !scanner->_isScanning) {
+    if (scanner && scanner->isActive() && !scanner->_periodicDataCallback) {
+      active |= BIT(scanner->_index);
+    }
+  }
+
+  // Duplicates only feed the table, the rest runs once per scan window
+  uint32_t fresh = 0;
+  uint16_t slot = DeviceTable::observe(addr, rssi, active, &fresh);
+  if (!fresh) {
+    return;
+  }
+
+  if (IS_ENABLED(CONFIG_BLUESIM_LINK_LATENCY)) {
+    LinkLatency::onScanReport();
+  }
+
+  // Check each scanner that has not had this device yet for filter matches
+  for (Scanner *scanner : Scanner::registry) {
+    if (!scanner || !(fresh & BIT(scanner->_index))) {
       continue;
     }
 
     // Check if filter matches
-    bool filterMatched = false;
-    filterMatched = scanner->_filter.matchesDevice(addr, rssi, adv_type, buf);
+    bool filterMatched = scanner->matchesFilter(addr, rssi, adv_type, buf);
 
     if (filterMatched && scanner->_owner) {
-      LOG_INF("Filter matched for Central %d, initiating connection",
-              scanner->_owner->_index);
+      uint32_t addrLow;
+      memcpy(&addrLow, addr->a.val, sizeof(addrLow));
+      Trace::emit(TraceEvent::SCAN_MATCH, scanner->_owner->_index,
+                  (uint16_t)rssi, addrLow);
 
       // check if the matched device is already connected
       if (scanner->_owner->isConnectedTo(addr)) {
+        Trace::emit(TraceEvent::SCAN_ALREADY_CONNECTED,
+                    scanner->_owner->_index);
         continue;
       }
 
-      // Stop scanning before connection attempt
-      int stop_err = Scanner::stopStackScanning();
-      if (stop_err < 0) {
-        LOG_ERR("Failed to stop scanning for connection (err %d)", stop_err);
-        return;
+      if (IS_ENABLED(CONFIG_BLUESIM_BENCH_SCALE)) {
+        ScaleBench::onMatch(scanner->_owner);
       }
 
-      // Must reflect what is happening to later turn scanning on if needed
-      scanner->_isScanning = false;
+      DeviceTable::markCandidate(slot, scanner->_index);
 
-      // Attempt connection
-      int conn_err = scanner->_owner->connectToDevice(addr);
-      if (conn_err < 0) {
-        LOG_ERR("Connection attempt failed (err %d)", conn_err);
+      // Without a window the first match is taken right away. An attempt
+      // is timed from the match that starts it, later matches in the same
+      // window only add candidates.
+      if (SELECT_WINDOW_MS == 0) {
+        scanner->markVerdict();
+        scanner->connectToCandidate();
+      } else if (WorkQueue::radio.scheduleIfIdle(
+                     &scanner->_selectWork, K_MSEC(SELECT_WINDOW_MS)) > 0) {
+        // The window opens with the first match and is not pushed out
+        scanner->markVerdict();
       }
+    }
+  }
+}
+
+void Scanner::markVerdict() {
+  if (IS_ENABLED(CONFIG_BLUESIM_LINK_LATENCY)) {
+    LinkLatency::mark(_owner->_index, LatencyStage::FILTER_VERDICT);
+  }
+}
+
+void Scanner::scanRecvCallback(const struct bt_le_scan_recv_info *info,
+                               struct net_buf_simple *buf) {
+  // Only reports that advertise a periodic train are of interest here
+  if (info->interval == 0) {
+    return;
+  }
+
+  for (Scanner *scanner : Scanner::registry) {
+    if (!scanner || !scanner->isActive() || !scanner->_periodicDataCallback) {
+      continue;
+    }
+
+    if (!scanner->matchesFilter(info->addr, info->rssi, info->adv_type,
+                                buf)) {
+      continue;
+    }
 
-      // Note: Scanning restart is handled by Central's deferred work items
-      // The Central class will automatically restart scanning via onConnected()
-      // callback if the connection fails, or stop scanning if it succeeds
+    int err = scanner->createPeriodicSync(info);
+    if (err < 0 && err != -EBUSY) {
+      LOG_ERR("Scanner %d: Failed to create periodic sync (err %d)",
+              scanner->_index, err);
     }
+    return;
   }
 }
 
-int Scanner::startStackScanning() {
-  if (Scanner::isStackScanning) {
-    LOG_WRN("Stack scanning already active");
-    return 0; // Already scanning, not an error
+void Scanner::perAdvSyncedCallback(
+    struct bt_le_per_adv_sync *sync,
+    struct bt_le_per_adv_sync_synced_info *info) {
+  struct periodic_sync_info *entry = Scanner::syncFromHandle(sync);
+  if (!entry) {
+    return;
   }
 
-  int err = bt_le_scan_start(&Scanner::scanParameters, &Scanner::scanCallback);
-  if (err < 0) {
-    LOG_WRN("Failed to start stack scanning (err %d)", err);
-    return err;
+  entry->synced = true;
+  LOG_INF("Scanner %d: Periodic sync established (sid %u, interval %u)",
+          entry->owner->_index, info->sid, info->interval);
+}
+
+void Scanner::perAdvTermCallback(
+    struct bt_le_per_adv_sync *sync,
+    const struct bt_le_per_adv_sync_term_info *info) {
+  struct periodic_sync_info *entry = Scanner::syncFromHandle(sync);
+  if (!entry) {
+    return;
   }
 
-  Scanner::isStackScanning = true;
-  LOG_WRN("Stack scanning started successfully");
-  return 0;
+  // Free the slot so the next matching report re-creates the sync
+  LOG_INF("Scanner %d: Periodic sync terminated (sid %u, reason %u)",
+          entry->owner->_index, info->sid, info->reason);
+  *entry = {};
+}
+
+void Scanner::perAdvRecvCallback(
+    struct bt_le_per_adv_sync *sync,
+    const struct bt_le_per_adv_sync_recv_info *info,
+    struct net_buf_simple *buf) {
+  struct periodic_sync_info *entry = Scanner::syncFromHandle(sync);
+  if (!entry || !entry->owner->_periodicDataCallback) {
+    return;
+  }
+
+  entry->owner->_periodicDataCallback(entry->owner->_owner, info->addr,
+                                      info->sid, info->rssi, buf);
+}
+
+struct periodic_sync_info *
+Scanner::syncFromHandle(struct bt_le_per_adv_sync *sync) {
+  for (struct periodic_sync_info &entry : Scanner::periodicSyncs) {
+    if (entry.sync == sync) {
+      return &entry;
+    }
+  }
+
+  LOG_WRN("Failed to find periodic sync %p", sync);
+  return nullptr;
 }
 
-int Scanner::stopStackScanning() {
-  if (!Scanner::isStackScanning) {
-    LOG_WRN("Stack scanning not active");
+// A replayed log stands in for the controller while it plays
+int Scanner::controllerStart() {
+  // Every start, real or replayed, reports each device afresh
+  DeviceTable::newWindow();
+  if (IS_ENABLED(CONFIG_BLUESIM_SCAN_CAPTURE) && ScanReplay::isReplaying()) {
     return 0;
   }
 
-  int err = bt_le_scan_stop();
-  if (err < 0) {
-    LOG_WRN("Failed to stop stack scanning (err %d)", err);
-    return err;
+  int err = bt_le_scan_start(&Scanner::scanParameters, &Scanner::scanCallback);
+  if (err == 0) {
+    Startup::markPhase(StartupPhase::FIRST_SCANNING);
   }
+  return err;
+}
 
-  Scanner::isStackScanning = false;
-  LOG_WRN("Stack scanning stopped successfully");
-  return 0;
+int Scanner::controllerStop() {
+  if (IS_ENABLED(CONFIG_BLUESIM_SCAN_CAPTURE) && ScanReplay::isReplaying()) {
+    return 0;
+  }
+  return bt_le_scan_stop();
 }
@@ -1,7 +1,10 @@
 
 #pragma once
 
+#include "../common/work_queue.hpp"
+#include "device_table.hpp"
 #include "filter.hpp"
+#include "stack_scan.hpp"
 #include <zephyr/logging/log.h>
 
 extern "C" {
@@ -9,6 +12,7 @@ extern "C" {
 #include <zephyr/bluetooth/bluetooth.h>
 #include <zephyr/bluetooth/conn.h>
 #include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
 }
 
 // Forward declaration to avoid circular include
@@ -16,12 +20,30 @@ class Central;
 
 // Same as MAX_CENTRALS, but trying to avoid circular includes
 #define MAX_SCANNERS                                                           \
-  (CONFIG_BT_MAX_CONN - CONFIG_BT_CTLR_SDC_PERIPHERAL_COUNT) / 2
+  (CONFIG_BT_MAX_CONN - CONFIG_BLUESIM_PERIPHERAL_CONNECTIONS) / 2
 
-struct connection_info {
-  struct k_work_delayable work;
-  bt_addr_le_t target_addr;
-  bool connection_attempted;
+#define MAX_PERIODIC_SYNCS CONFIG_BT_PER_ADV_SYNC_MAX
+
+#ifdef CONFIG_BLUESIM_SELECT_WINDOW_MS
+#define SELECT_WINDOW_MS CONFIG_BLUESIM_SELECT_WINDOW_MS
+#else
+#define SELECT_WINDOW_MS 50
+#endif
+
+class Scanner;
+
+// Receives the payload of every periodic advertising report on a sync owned
+// by the given Central
+using PeriodicDataCallback = void (*)(Central *central,
+                                      const bt_addr_le_t *addr, uint8_t sid,
+                                      int8_t rssi, struct net_buf_simple *buf);
+
+struct periodic_sync_info {
+  struct bt_le_per_adv_sync *sync;
+  bt_addr_le_t addr;
+  uint8_t sid;
+  bool synced;
+  Scanner *owner;
 };
 
 class Scanner {
@@ -31,19 +53,60 @@ public:
 
   int startScanning();
   int stopScanning();
+  // Safe from any thread. Reports are matched without a lock, so a slow
+  // criterion (IDENTITY runs AES) never holds interrupts off.
   void addFilter(const Filter &filter);
+  bool matchesFilter(const bt_addr_le_t *addr, int8_t rssi, uint8_t adv_type,
+                     struct net_buf_simple *buf);
+  void setPeriodicDataCallback(PeriodicDataCallback callback);
+  int createPeriodicSync(const struct bt_le_scan_recv_info *info);
+  void setSelectionPolicy(SelectionPolicy policy);
+  SelectionPolicy selectionPolicy() const { return _policy; }
+  int connectToCandidate();
+  static void selectWorkAction(struct k_work *work);
 
   static void scanCallback(const bt_addr_le_t *addr, int8_t rssi,
                            uint8_t adv_type, struct net_buf_simple *buf);
+  static void scanRecvCallback(const struct bt_le_scan_recv_info *info,
+                               struct net_buf_simple *buf);
+  static void perAdvSyncedCallback(struct bt_le_per_adv_sync *sync,
+                                   struct bt_le_per_adv_sync_synced_info *info);
+  static void perAdvTermCallback(
+      struct bt_le_per_adv_sync *sync,
+      const struct bt_le_per_adv_sync_term_info *info);
+  static void perAdvRecvCallback(
+      struct bt_le_per_adv_sync *sync,
+      const struct bt_le_per_adv_sync_recv_info *info,
+      struct net_buf_simple *buf);
+  static struct periodic_sync_info *syncFromHandle(
+      struct bt_le_per_adv_sync *sync);
   static struct bt_le_scan_param scanParameters;
-  static bool isStackScanning;
-  static int startStackScanning();
-  static int stopStackScanning();
+
+  bool isActive() const { return StackScan::wants(_index); }
 
   uint8_t _index;
-  bool _isScanning;
-  Filter _filter;
+  // Double buffered: addFilter() fills the standby copy and flips
+  // _filterActive, a match pins the copy it reads in _filterReaders
+  Filter _filters[2];
+  atomic_t _filterActive;
+  atomic_t _filterReaders[2];
+  struct k_mutex _filterWriteLock; // Serializes addFilter()
   Central *_owner;
-  struct connection_info _connection;
+  PeriodicDataCallback _periodicDataCallback;
+  SelectionPolicy _policy;
+  uint16_t _selectCursor; // Device table slot of the previous pick
+  // Collects matches for SELECT_WINDOW_MS before picking one
+  struct queued_work _selectWork;
   static Scanner *registry[MAX_SCANNERS];
+  static struct periodic_sync_info periodicSyncs[MAX_PERIODIC_SYNCS];
+  static struct bt_le_scan_cb scanRecvCallbacks;
+  static struct bt_le_per_adv_sync_cb perAdvSyncCallbacks;
+  static bool callbacksRegistered;
+
+private:
+  void resumeAfterConnect();
+  // Starts a connect latency attempt from the current report
+  void markVerdict();
+  static int controllerStart();
+  static int controllerStop();
 };
\ No newline at end of file
@@ -0,0 +1,110 @@
+#include "stack_scan.hpp"
+#include "../common/trace.hpp"
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(STACK_SCAN, LOG_LEVEL_INF);
+
+StackScanCall StackScan::_start = nullptr;
+StackScanCall StackScan::_stop = nullptr;
+atomic_t StackScan::_demand = ATOMIC_INIT(0);
+atomic_t StackScan::_held = ATOMIC_INIT(0);
+atomic_t StackScan::_state = ATOMIC_INIT((atomic_val_t)StackScanState::IDLE);
+atomic_t StackScan::_requests = ATOMIC_INIT(0);
+atomic_t StackScan::_token = ATOMIC_INIT(0);
+atomic_t StackScan::_rejected = ATOMIC_INIT(0);
+
+void StackScan::init(StackScanCall start, StackScanCall stop) {
+  _start = start;
+  _stop = stop;
+}
+
+bool StackScan::wanted() {
+  return atomic_get(&_demand) != 0 && !atomic_get(&_held);
+}
+
+int StackScan::settle() {
+  // The request is left before looking at the token, so a holder that is
+  // about to let go still sees it
+  atomic_set(&_requests, 1);
+
+  int err = 0;
+  while (atomic_get(&_requests) && atomic_cas(&_token, 0, 1)) {
+    atomic_clear(&_requests);
+    err = drive();
+    atomic_clear(&_token);
+  }
+  return err;
+}
+
+int StackScan::restart() {
+  if (!claimTransition(StackScanState::SCANNING, StackScanState::IDLE)) {
+    return 0;
+  }
+  return settle();
+}
+
+// Runs with the token held: only this context moves the state, so it is
+// IDLE or SCANNING between transitions
+int StackScan::drive() {
+  bool first = true;
+  while (true) {
+    bool scanning = isScanning();
+    if (wanted() == scanning) {
+      if (first) {
+        Trace::emit(scanning ? TraceEvent::STACK_SCAN_ALREADY_ACTIVE
+                             : TraceEvent::STACK_SCAN_NOT_ACTIVE);
+      }
+      return 0;
+    }
+    first = false;
+
+    int err = scanning ? stop() : start();
+    if (err < 0) {
+      return err;
+    }
+  }
+}
+
+int StackScan::start() {
+  if (!claimTransition(StackScanState::IDLE, StackScanState::STARTING)) {
+    atomic_inc(&_rejected);
+    Trace::emit(TraceEvent::STACK_SCAN_REJECTED, (uint8_t)state(),
+                (uint16_t)StackScanState::STARTING);
+    return -EBUSY;
+  }
+
+  int err = _start();
+  if (err < 0) {
+    atomic_set(&_state, (atomic_val_t)StackScanState::IDLE);
+    LOG_WRN("Failed to start stack scanning (err %d)", err);
+    return err;
+  }
+
+  atomic_set(&_state, (atomic_val_t)StackScanState::SCANNING);
+  Trace::emit(TraceEvent::STACK_SCAN_STARTED);
+  return 0;
+}
+
+int StackScan::stop() {
+  if (!claimTransition(StackScanState::SCANNING, StackScanState::STOPPING)) {
+    atomic_inc(&_rejected);
+    Trace::emit(TraceEvent::STACK_SCAN_REJECTED, (uint8_t)state(),
+                (uint16_t)StackScanState::STOPPING);
+    return -EBUSY;
+  }
+
+  int err = _stop();
+  if (err < 0) {
+    atomic_set(&_state, (atomic_val_t)StackScanState::SCANNING);
+    LOG_WRN("Failed to stop stack scanning (err %d)", err);
+    return err;
+  }
+
+  atomic_set(&_state, (atomic_val_t)StackScanState::IDLE);
+  Trace::emit(TraceEvent::STACK_SCAN_STOPPED);
+  return 0;
+}
+
+bool StackScan::claimTransition(StackScanState from, StackScanState to) {
+  return atomic_cas(&_state, (atomic_val_t)from, (atomic_val_t)to);
+}
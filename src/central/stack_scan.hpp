@@ -0,0 +1,66 @@
+#pragma once
+
+extern "C" {
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+}
+
+// Controller scanning, shared by all scanners. STARTING and STOPPING are held
+// by the one context that claimed the transition while it talks to the stack.
+enum class StackScanState : uint8_t {
+  IDLE,
+  STARTING,
+  SCANNING,
+  STOPPING,
+};
+
+// Issues the stack call behind a transition, 0 or a negative errno
+using StackScanCall = int (*)();
+
+// Keeps controller scanning on while any scanner wants reports and no
+// connection attempt holds it off. Demand and holds are bitmasks of scanner
+// indexes, every change is followed by settle(). The first context to settle takes a
+// token and drives the controller; a context that finds the token taken
+// leaves a request and returns, and the holder settles again before it lets
+// go. No request is lost and the stack is never called from two contexts at
+// once, so all entry points are O(1) and safe from any thread.
+class StackScan {
+public:
+  static void init(StackScanCall start, StackScanCall stop);
+
+  static void want(uint8_t index) { atomic_set_bit(&_demand, index); }
+  static void release(uint8_t index) { atomic_clear_bit(&_demand, index); }
+  static bool wants(uint8_t index) { return atomic_test_bit(&_demand, index); }
+  // Keeps the controller off while this scanner's connection is being
+  // created, until the same scanner lets go
+  static void hold(uint8_t index) { atomic_set_bit(&_held, index); }
+  static void unhold(uint8_t index) { atomic_clear_bit(&_held, index); }
+
+  static int settle();
+  // Scanning was emulated (a replay), forget it and settle for real
+  static int restart();
+
+  static StackScanState state() {
+    return (StackScanState)atomic_get(&_state);
+  }
+  static bool isScanning() { return state() == StackScanState::SCANNING; }
+  static uint32_t rejectedTransitions() {
+    return (uint32_t)atomic_get(&_rejected);
+  }
+
+private:
+  static bool wanted();
+  static int drive();
+  static int start();
+  static int stop();
+  static bool claimTransition(StackScanState from, StackScanState to);
+
+  static StackScanCall _start;
+  static StackScanCall _stop;
+  static atomic_t _demand;
+  static atomic_t _held;
+  static atomic_t _state;
+  static atomic_t _requests;
+  static atomic_t _token;
+  static atomic_t _rejected;
+};
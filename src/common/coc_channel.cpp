@@ -0,0 +1,452 @@
+#include "coc_channel.hpp"
+#include "../central/central.hpp"
+#include "link_scheduler.hpp"
+#include <zephyr/logging/log.h>
+
+extern "C" {
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/printk.h>
+#ifdef CONFIG_SHELL
+#include <zephyr/shell/shell.h>
+#endif
+}
+
+LOG_MODULE_REGISTER(COC_CHANNEL, LOG_LEVEL_INF);
+
+NET_BUF_POOL_FIXED_DEFINE(coc_tx_pool, COC_TX_BUFS,
+                          BT_L2CAP_SDU_BUF_SIZE(COC_SDU_SIZE),
+                          CONFIG_BT_CONN_TX_USER_DATA_SIZE, NULL);
+NET_BUF_POOL_FIXED_DEFINE(coc_rx_pool, COC_RX_BUFS,
+                          BT_L2CAP_SDU_BUF_SIZE(COC_SDU_SIZE), 8, NULL);
+
+struct k_spinlock CocChannels::_lock = {};
+struct coc_channel CocChannels::_channels[MAX_COC_CHANNELS] = {};
+struct bt_l2cap_server CocChannels::_server = {};
+CocMode CocChannels::_serverMode = CocMode::SINK;
+struct bt_l2cap_chan_ops CocChannels::_ops = {};
+
+void CocChannels::init() {
+  // Assigned one by one, the member set depends on the Bluetooth Kconfig
+  _ops.connected = connected;
+  _ops.disconnected = disconnected;
+  _ops.alloc_buf = allocBuf;
+  _ops.recv = recv;
+  _ops.sent = sent;
+  _ops.status = status;
+
+  for (struct coc_channel &channel : _channels) {
+    WorkQueue::data.initWork(&channel.work, workAction);
+  }
+}
+
+static struct coc_channel *fromChan(struct bt_l2cap_chan *chan) {
+  struct bt_l2cap_le_chan *le = CONTAINER_OF(chan, struct bt_l2cap_le_chan,
+                                             chan);
+  return CONTAINER_OF(le, struct coc_channel, le);
+}
+
+struct coc_channel *CocChannels::allocate(CocMode mode) {
+  for (struct coc_channel &channel : _channels) {
+    if (channel.used) {
+      continue;
+    }
+
+    // The work item stays initialized across uses
+    channel.le = {};
+    channel.stats = {};
+    channel.sourcing = false;
+    channel.stopping = false;
+    channel.connected = false;
+    channel.tx_remaining = 0;
+    channel.tx_seq = 0;
+    channel.rx_seq = 0;
+    channel.stamp_head = 0;
+    channel.inflight = 0;
+
+    channel.used = true;
+    channel.mode = mode;
+    channel.le.chan.ops = &_ops;
+    channel.le.rx.mtu = COC_SDU_SIZE;
+    return &channel;
+  }
+  return nullptr;
+}
+
+int CocChannels::listen(uint16_t psm, CocMode mode) {
+  if (_server.psm) {
+    return -EALREADY;
+  }
+
+  _server.psm = psm;
+  _server.sec_level = BT_SECURITY_L1;
+  _server.accept = accept;
+  _serverMode = mode;
+
+  int err = bt_l2cap_server_register(&_server);
+  if (err < 0) {
+    _server.psm = 0;
+    LOG_ERR("Failed to register L2CAP server on PSM 0x%04x (err %d)", psm,
+            err);
+    return err;
+  }
+
+  LOG_INF("L2CAP server on PSM 0x%04x, SDU %u", psm, COC_SDU_SIZE);
+  return 0;
+}
+
+int CocChannels::accept(struct bt_conn *conn, struct bt_l2cap_server *server,
+                        struct bt_l2cap_chan **chan) {
+  ARG_UNUSED(server);
+
+  struct coc_channel *channel = allocate(_serverMode);
+  if (!channel) {
+    LOG_WRN("Connection %u: No free L2CAP channel", bt_conn_index(conn));
+    return -ENOMEM;
+  }
+
+  *chan = &channel->le.chan;
+  return 0;
+}
+
+int CocChannels::connect(struct bt_conn *conn, uint16_t psm, CocMode mode) {
+  struct coc_channel *channel = allocate(mode);
+  if (!channel) {
+    return -ENOMEM;
+  }
+
+  int err = bt_l2cap_chan_connect(conn, &channel->le.chan, psm);
+  if (err < 0) {
+    channel->used = false;
+    LOG_ERR("Connection %u: L2CAP connect to PSM 0x%04x failed (err %d)",
+            bt_conn_index(conn), psm, err);
+    return err;
+  }
+
+  return (int)(channel - _channels);
+}
+
+int CocChannels::disconnect(uint8_t channel) {
+  if (!isConnected(channel)) {
+    return -ENOTCONN;
+  }
+  return bt_l2cap_chan_disconnect(&_channels[channel].le.chan);
+}
+
+void CocChannels::connected(struct bt_l2cap_chan *chan) {
+  struct coc_channel *channel = fromChan(chan);
+  channel->connected = true;
+  LOG_INF("Channel %u: Connected, tx mtu %u mps %u, rx mtu %u mps %u",
+          (unsigned int)(channel - _channels), channel->le.tx.mtu,
+          channel->le.tx.mps, channel->le.rx.mtu, channel->le.rx.mps);
+
+  if (channel->mode == CocMode::SOURCE) {
+    startSource((uint8_t)(channel - _channels), COC_SOURCE_BYTES);
+  }
+}
+
+void CocChannels::disconnected(struct bt_l2cap_chan *chan) {
+  struct coc_channel *channel = fromChan(chan);
+  channel->connected = false;
+  LOG_INF("Channel %u: Disconnected", (unsigned int)(channel - _channels));
+
+  // fill() may be running on the data queue right now, the slot is released
+  // there once it is done with it
+  WorkQueue::data.schedule(&channel->work, K_NO_WAIT);
+}
+
+struct net_buf *CocChannels::allocBuf(struct bt_l2cap_chan *chan) {
+  ARG_UNUSED(chan);
+
+  // Reassembly target for segmented SDUs
+  return net_buf_alloc(&coc_rx_pool, K_NO_WAIT);
+}
+
+int CocChannels::recv(struct bt_l2cap_chan *chan, struct net_buf *buf) {
+  struct coc_channel *channel = fromChan(chan);
+  channel->stats.rx_sdus++;
+  channel->stats.rx_bytes += buf->len;
+  if (IS_ENABLED(CONFIG_BLUESIM_LINK_SCHEDULER)) {
+    LinkScheduler::account(chan->conn, buf->len);
+  }
+
+  if (buf->len >= sizeof(uint32_t)) {
+    uint32_t seq = sys_get_le32(buf->data);
+    if (seq != channel->rx_seq && channel->stats.rx_sdus > 1) {
+      channel->stats.rx_gaps += seq - channel->rx_seq;
+    }
+    channel->rx_seq = seq + 1;
+  }
+
+  // Returning 0 hands the buffer back and the stack returns the credits
+  return 0;
+}
+
+void CocChannels::sent(struct bt_l2cap_chan *chan) {
+  struct coc_channel *channel = fromChan(chan);
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  if (!channel->inflight) {
+    k_spin_unlock(&_lock, key);
+    return;
+  }
+
+  uint32_t stamp = channel->stamps[channel->stamp_head];
+  channel->stamp_head = (channel->stamp_head + 1) % COC_TX_BUFS;
+  channel->inflight--;
+  k_spin_unlock(&_lock, key);
+
+  uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - stamp);
+  channel->stats.last_latency_us = us;
+  channel->stats.max_latency_us = MAX(channel->stats.max_latency_us, us);
+  channel->stats.total_latency_us += us;
+
+  WorkQueue::data.schedule(&channel->work, K_NO_WAIT);
+}
+
+void CocChannels::status(struct bt_l2cap_chan *chan, atomic_t *status) {
+  // Credits came back, resume a stalled source
+  if (atomic_test_bit(status, BT_L2CAP_STATUS_OUT)) {
+    struct coc_channel *channel = fromChan(chan);
+    if (channel->sourcing) {
+      WorkQueue::data.schedule(&channel->work, K_NO_WAIT);
+    }
+  }
+}
+
+int CocChannels::startSource(uint8_t index, uint32_t bytes) {
+  if (!isConnected(index)) {
+    return -ENOTCONN;
+  }
+
+  struct coc_channel &channel = _channels[index];
+  if (channel.sourcing) {
+    return -EBUSY;
+  }
+
+  channel.tx_remaining = bytes;
+  channel.tx_run_bytes = bytes;
+  channel.run_start_ticks = k_uptime_ticks();
+  channel.stopping = false;
+  channel.sourcing = true;
+  return WorkQueue::data.schedule(&channel.work, K_NO_WAIT);
+}
+
+int CocChannels::stop(uint8_t index) {
+  if (index >= MAX_COC_CHANNELS || !_channels[index].sourcing) {
+    return -EALREADY;
+  }
+
+  // Finished on the data queue, as a running fill() still owns the run
+  struct coc_channel &channel = _channels[index];
+  channel.stopping = true;
+  WorkQueue::data.schedule(&channel.work, K_NO_WAIT);
+  return 0;
+}
+
+void CocChannels::fill(struct coc_channel &channel) {
+  uint16_t sdu = MIN(channel.le.tx.mtu, COC_SDU_SIZE);
+
+  while (channel.tx_remaining && channel.inflight < COC_TX_BUFS) {
+    struct net_buf *buf = net_buf_alloc(&coc_tx_pool, K_NO_WAIT);
+    if (!buf) {
+      channel.stats.stalls++;
+      break;
+    }
+
+    net_buf_reserve(buf, BT_L2CAP_SDU_CHAN_SEND_RESERVE);
+    uint16_t len = (uint16_t)MIN(sdu, channel.tx_remaining);
+    uint8_t *data = (uint8_t *)net_buf_add(buf, len);
+    memset(data, (uint8_t)channel.tx_seq, len);
+    if (len >= sizeof(uint32_t)) {
+      sys_put_le32(channel.tx_seq, data);
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&_lock);
+    uint8_t slot = (channel.stamp_head + channel.inflight) % COC_TX_BUFS;
+    channel.stamps[slot] = k_cycle_get_32();
+    channel.inflight++;
+    k_spin_unlock(&_lock, key);
+
+    int err = bt_l2cap_chan_send(&channel.le.chan, buf);
+    if (err < 0) {
+      // Still the newest stamp, completions only take from the head
+      key = k_spin_lock(&_lock);
+      channel.inflight--;
+      k_spin_unlock(&_lock, key);
+      net_buf_unref(buf);
+      if (err == -EAGAIN || err == -ENOMEM) {
+        channel.stats.stalls++;
+        break;
+      }
+
+      LOG_ERR("Channel %u: Send failed (err %d)",
+              (unsigned int)(&channel - _channels), err);
+      finishRun(channel);
+      return;
+    }
+
+    channel.tx_seq++;
+    channel.tx_remaining -= len;
+    channel.stats.tx_sdus++;
+    channel.stats.tx_bytes += len;
+    if (IS_ENABLED(CONFIG_BLUESIM_LINK_SCHEDULER)) {
+      LinkScheduler::account(channel.le.chan.conn, len);
+    }
+  }
+
+  // Nothing in flight means no sent callback to wake us up
+  if (channel.tx_remaining && !channel.inflight) {
+    WorkQueue::data.schedule(&channel.work, K_MSEC(COC_RETRY_MS));
+  }
+}
+
+void CocChannels::workAction(struct k_work *work) {
+  struct coc_channel *channel = CONTAINER_OF(work, struct coc_channel, work);
+  if (!channel->connected) {
+    if (channel->sourcing) {
+      finishRun(*channel);
+    }
+    channel->used = false;
+    return;
+  }
+
+  if (!channel->sourcing) {
+    return;
+  }
+
+  if (channel->stopping || (!channel->tx_remaining && !channel->inflight)) {
+    finishRun(*channel);
+    return;
+  }
+
+  fill(*channel);
+}
+
+void CocChannels::finishRun(struct coc_channel &channel) {
+  channel.sourcing = false;
+  channel.stopping = false;
+
+  uint32_t bytes = channel.tx_run_bytes - channel.tx_remaining;
+  uint32_t us = (uint32_t)k_ticks_to_us_floor64(k_uptime_ticks() -
+                                                 channel.run_start_ticks);
+  channel.stats.kbps = us ? (uint32_t)((uint64_t)bytes * 8000U / us) : 0;
+
+  struct bt_conn *conn = channel.le.chan.conn;
+  struct conn_link link = conn ? ConnectionBus::link(conn) : conn_link{};
+  uint32_t avg = channel.stats.tx_sdus
+                     ? (uint32_t)(channel.stats.total_latency_us /
+                                  channel.stats.tx_sdus)
+                     : 0;
+  printk("COC {\"chan\":%u,\"bytes\":%u,\"us\":%u,\"kbps\":%u,\"sdu\":%u,"
+         "\"mps\":%u,\"stalls\":%u,\"latency_avg_us\":%u,"
+         "\"latency_max_us\":%u,\"phy\":%u,\"data_len\":%u,\"interval\":%u}\n",
+         (unsigned int)(&channel - _channels), bytes, us, channel.stats.kbps,
+         channel.le.tx.mtu, channel.le.tx.mps, channel.stats.stalls, avg,
+         channel.stats.max_latency_us, link.tx_phy, link.tx_max_len,
+         link.interval);
+}
+
+int CocChannels::stats(uint8_t channel, struct coc_stats *out) {
+  if (channel >= MAX_COC_CHANNELS || !_channels[channel].used) {
+    return -ENOENT;
+  }
+
+  *out = _channels[channel].stats;
+  return 0;
+}
+
+#ifdef CONFIG_SHELL
+static int cmdCocConnect(const struct shell *sh, size_t argc, char **argv) {
+  unsigned long central = strtoul(argv[1], nullptr, 0);
+  unsigned long slot = strtoul(argv[2], nullptr, 0);
+  struct bt_conn *conn = Central::connectionAt(central, slot);
+  if (!conn) {
+    shell_error(sh, "No connection in slot %lu of central %lu", slot,
+                central);
+    return -ENOENT;
+  }
+
+  CocMode mode = argc > 4 && strcmp(argv[4], "source") == 0 ? CocMode::SOURCE
+                                                              : CocMode::SINK;
+  int channel = Central::registry[central]->openCoc(
+      conn, (uint16_t)strtoul(argv[3], nullptr, 0), mode);
+  if (channel < 0) {
+    shell_error(sh, "Failed to connect (err %d)", channel);
+    return channel;
+  }
+
+  shell_print(sh, "Channel %d", channel);
+  return 0;
+}
+
+static int cmdCocStart(const struct shell *sh, size_t argc, char **argv) {
+  ARG_UNUSED(argc);
+
+  uint8_t channel = (uint8_t)strtoul(argv[1], nullptr, 0);
+  uint32_t bytes = (uint32_t)strtoul(argv[2], nullptr, 0) * 1024U;
+  int err = CocChannels::startSource(channel, bytes);
+  if (err < 0) {
+    shell_error(sh, "Failed to start (err %d)", err);
+  }
+  return err;
+}
+
+static int cmdCocStop(const struct shell *sh, size_t argc, char **argv) {
+  ARG_UNUSED(argc);
+
+  int err = CocChannels::stop((uint8_t)strtoul(argv[1], nullptr, 0));
+  if (err < 0) {
+    shell_error(sh, "Not sourcing");
+  }
+  return err;
+}
+
+static int cmdCocDisconnect(const struct shell *sh, size_t argc,
+                            char **argv) {
+  ARG_UNUSED(argc);
+
+  int err = CocChannels::disconnect((uint8_t)strtoul(argv[1], nullptr, 0));
+  if (err < 0) {
+    shell_error(sh, "Failed to disconnect (err %d)", err);
+  }
+  return err;
+}
+
+static int cmdCocStats(const struct shell *sh, size_t argc, char **argv) {
+  ARG_UNUSED(argc);
+  ARG_UNUSED(argv);
+
+  for (uint8_t i = 0; i < MAX_COC_CHANNELS; i++) {
+    struct coc_stats stats;
+    if (CocChannels::stats(i, &stats) < 0) {
+      continue;
+    }
+
+    uint32_t avg = stats.tx_sdus
+                       ? (uint32_t)(stats.total_latency_us / stats.tx_sdus)
+                       : 0;
+    shell_print(sh,
+                "chan %u: tx %u SDUs %u B, rx %u SDUs %u B (%u gaps), "
+                "%u stalls, latency avg %u max %u us, last run %u kbps",
+                i, stats.tx_sdus, stats.tx_bytes, stats.rx_sdus,
+                stats.rx_bytes, stats.rx_gaps, stats.stalls, avg,
+                stats.max_latency_us, stats.kbps);
+  }
+  return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+    coc_cmds,
+    SHELL_CMD_ARG(connect, NULL, "<central> <slot> <psm> [sink|source]",
+                  cmdCocConnect, 4, 1),
+    SHELL_CMD_ARG(start, NULL, "<channel> <KiB>", cmdCocStart, 3, 0),
+    SHELL_CMD_ARG(stop, NULL, "<channel>", cmdCocStop, 2, 0),
+    SHELL_CMD_ARG(disconnect, NULL, "<channel>", cmdCocDisconnect, 2, 0),
+    SHELL_CMD(stats, NULL, "Per channel throughput and latency",
+              cmdCocStats),
+    SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(coc, &coc_cmds, "L2CAP connection-oriented channels",
+                   NULL);
+#endif
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "connection_bus.hpp"
+#include "work_queue.hpp"
+
+extern "C" {
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/l2cap.h>
+#include <zephyr/kernel.h>
+#include <zephyr/net/buf.h>
+}
+
+#ifdef CONFIG_BLUESIM_L2CAP_PSM
+#define COC_PSM CONFIG_BLUESIM_L2CAP_PSM
+#else
+#define COC_PSM 0x0080
+#endif
+
+#ifdef CONFIG_BLUESIM_L2CAP_SDU_SIZE
+#define COC_SDU_SIZE CONFIG_BLUESIM_L2CAP_SDU_SIZE
+#else
+#define COC_SDU_SIZE 1024
+#endif
+
+#ifdef CONFIG_BLUESIM_L2CAP_TX_BUFS
+#define COC_TX_BUFS CONFIG_BLUESIM_L2CAP_TX_BUFS
+#else
+#define COC_TX_BUFS 4
+#endif
+
+#ifdef CONFIG_BLUESIM_L2CAP_SOURCE_BYTES
+#define COC_SOURCE_BYTES CONFIG_BLUESIM_L2CAP_SOURCE_BYTES
+#else
+#define COC_SOURCE_BYTES (1024 * 1024)
+#endif
+
+#define MAX_COC_CHANNELS MAX_BUS_CONNECTIONS
+#define COC_RX_BUFS MAX_COC_CHANNELS
+// Retry delay when no TX buffer or credit was free and nothing is in flight
+#define COC_RETRY_MS 5
+
+enum class CocMode : uint8_t {
+  SINK,   // Counts what arrives, checks the sequence stamped in each SDU
+  SOURCE, // Streams COC_SOURCE_BYTES as soon as the channel is up
+};
+
+struct coc_stats {
+  uint32_t tx_sdus;
+  uint32_t tx_bytes;
+  uint32_t rx_sdus;
+  uint32_t rx_bytes;
+  uint32_t rx_gaps;  // Sequence numbers skipped by the peer's SDUs
+  uint32_t stalls;   // Sends deferred for lack of buffers or credits
+  uint32_t last_latency_us; // Send to sent callback, per SDU
+  uint32_t max_latency_us;
+  uint64_t total_latency_us;
+  uint32_t kbps; // Last finished source run
+};
+
+struct coc_channel {
+  struct bt_l2cap_le_chan le;
+  CocMode mode;
+  bool used;
+  bool connected;
+  bool sourcing;
+  bool stopping; // Run teardown requested, done by the next work run
+  uint32_t tx_remaining; // Bytes of the source run not yet queued
+  uint32_t tx_run_bytes;
+  uint32_t tx_seq;
+  uint32_t rx_seq; // Next expected from the peer
+  int64_t run_start_ticks;
+  // Send stamps of SDUs in flight, completed in order by the sent callback
+  uint32_t stamps[COC_TX_BUFS];
+  uint8_t stamp_head;
+  uint8_t inflight;
+  struct coc_stats stats;
+  struct queued_work work;
+};
+
+// L2CAP connection-oriented channels for bulk traffic without ATT overhead.
+// SDUs up to COC_SDU_SIZE are segmented and reassembled by the stack with
+// credit based flow control, TX and RX buffers come from fixed net_buf
+// pools. The server side is registered once for all peripherals, centrals
+// open channels on their own connections.
+class CocChannels {
+public:
+  static void init();
+  static int listen(uint16_t psm, CocMode mode);
+  static int connect(struct bt_conn *conn, uint16_t psm, CocMode mode);
+  static int startSource(uint8_t channel, uint32_t bytes);
+  static int stop(uint8_t channel);
+  static int disconnect(uint8_t channel);
+  static bool isConnected(uint8_t channel) {
+    return channel < MAX_COC_CHANNELS && _channels[channel].connected;
+  }
+  static int stats(uint8_t channel, struct coc_stats *out);
+
+private:
+  static struct coc_channel *allocate(CocMode mode);
+  static int accept(struct bt_conn *conn, struct bt_l2cap_server *server,
+                    struct bt_l2cap_chan **chan);
+  static void fill(struct coc_channel &channel);
+  static void finishRun(struct coc_channel &channel);
+  static void workAction(struct k_work *work);
+
+  static void connected(struct bt_l2cap_chan *chan);
+  static void disconnected(struct bt_l2cap_chan *chan);
+  static struct net_buf *allocBuf(struct bt_l2cap_chan *chan);
+  static int recv(struct bt_l2cap_chan *chan, struct net_buf *buf);
+  static void sent(struct bt_l2cap_chan *chan);
+  static void status(struct bt_l2cap_chan *chan, atomic_t *status);
+
+  static struct k_spinlock _lock; // Send stamps, shared with sent()
+  static struct coc_channel _channels[MAX_COC_CHANNELS];
+  static struct bt_l2cap_server _server;
+  static CocMode _serverMode;
+  static struct bt_l2cap_chan_ops _ops;
+};
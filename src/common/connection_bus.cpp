@@ -0,0 +1,293 @@
+#include "connection_bus.hpp"
+#include "../peripheral/advertisement.hpp"
+#include "link_scheduler.hpp"
+#include "pairing.hpp"
+#include "trace.hpp"
+#include <zephyr/logging/log.h>
+
+extern "C" {
+#ifdef CONFIG_SHELL
+#include <zephyr/shell/shell.h>
+#endif
+}
+
+LOG_MODULE_REGISTER(CONNECTION_BUS, LOG_LEVEL_INF);
+
+struct conn_link ConnectionBus::_links[MAX_BUS_CONNECTIONS] = {};
+struct conn_event_stats ConnectionBus::_stats[(uint8_t)ConnEvent::COUNT] = {};
+struct bt_conn_cb ConnectionBus::_callbacks = {};
+
+// Link defaults until the first update, 1M PHY and the minimum data length
+static void resetLink(struct conn_link &link) {
+  link = {};
+  link.tx_phy = BT_GAP_LE_PHY_1M;
+  link.rx_phy = BT_GAP_LE_PHY_1M;
+  link.tx_max_len = BT_GAP_DATA_LEN_DEFAULT;
+  link.rx_max_len = BT_GAP_DATA_LEN_DEFAULT;
+  link.security = BT_SECURITY_L1;
+}
+
+void ConnectionBus::init() {
+  for (struct conn_link &link : _links) {
+    resetLink(link);
+  }
+
+  // Assigned one by one, the member set depends on the Bluetooth Kconfig
+  _callbacks.connected = connected;
+  _callbacks.disconnected = disconnected;
+  _callbacks.recycled = recycled;
+  _callbacks.le_param_updated = paramUpdated;
+#ifdef CONFIG_BT_USER_PHY_UPDATE
+  _callbacks.le_phy_updated = phyUpdated;
+#endif
+#ifdef CONFIG_BT_USER_DATA_LEN_UPDATE
+  _callbacks.le_data_len_updated = dataLenUpdated;
+#endif
+#ifdef CONFIG_BT_SMP
+  _callbacks.security_changed = securityChanged;
+#endif
+  bt_conn_cb_register(&_callbacks);
+}
+
+void ConnectionBus::bind(struct bt_conn *conn, ConnectionListener *owner) {
+  _links[bt_conn_index(conn)].owner = owner;
+}
+
+void ConnectionBus::unbind(ConnectionListener *owner) {
+  for (struct conn_link &link : _links) {
+    if (link.owner == owner) {
+      link.owner = nullptr;
+    }
+  }
+}
+
+void ConnectionBus::account(ConnEvent event, bool owned,
+                            uint32_t start_cycles) {
+  struct conn_event_stats &stats = _stats[(uint8_t)event];
+  if (!owned) {
+    stats.unowned++;
+    return;
+  }
+
+  uint32_t elapsed = k_cycle_get_32() - start_cycles;
+  uint32_t ns = (uint32_t)k_cyc_to_ns_floor64(elapsed);
+  stats.dispatched++;
+  stats.last_ns = ns;
+  stats.max_ns = MAX(stats.max_ns, ns);
+  stats.total_ns += ns;
+}
+
+void ConnectionBus::connected(struct bt_conn *conn, uint8_t err) {
+  uint8_t index = bt_conn_index(conn);
+  struct conn_link &link = _links[index];
+
+  struct bt_conn_info info;
+  if (!err && bt_conn_get_info(conn, &info) == 0) {
+    link.interval = info.le.interval;
+    link.latency = info.le.latency;
+    link.timeout = info.le.timeout;
+
+    // The set's own connected callback comes after this event, so links
+    // taken by an advertisement are claimed through its local identity
+    if (!link.owner && info.role == BT_CONN_ROLE_PERIPHERAL) {
+      Advertisement *advertisement = Advertisement::fromId(info.id);
+      link.owner = advertisement ? advertisement->_owner : nullptr;
+    }
+  }
+
+  // Stamped before the owner can ask for security on the link
+  if (!err && IS_ENABLED(CONFIG_BLUESIM_PAIRING)) {
+    Pairing::onConnected(conn);
+  }
+
+  uint32_t start = k_cycle_get_32();
+  if (link.owner) {
+    link.owner->onConnected(conn, err);
+  } else {
+    LOG_WRN("Connection %u has no owner", index);
+  }
+  account(ConnEvent::CONNECTED, link.owner != nullptr, start);
+
+  if (err) {
+    resetLink(link);
+  } else if (IS_ENABLED(CONFIG_BLUESIM_LINK_SCHEDULER)) {
+    LinkScheduler::onConnected(conn);
+  }
+}
+
+void ConnectionBus::disconnected(struct bt_conn *conn, uint8_t reason) {
+  struct conn_link &link = _links[bt_conn_index(conn)];
+
+  uint32_t start = k_cycle_get_32();
+  if (link.owner) {
+    link.owner->onDisconnected(conn, reason);
+  }
+  account(ConnEvent::DISCONNECTED, link.owner != nullptr, start);
+  if (IS_ENABLED(CONFIG_BLUESIM_LINK_SCHEDULER)) {
+    LinkScheduler::onDisconnected(conn);
+  }
+  resetLink(link);
+}
+
+void ConnectionBus::recycled() {
+  // A connection object is free again, advertising sets can resume
+  uint32_t start = k_cycle_get_32();
+  Advertisement::onConnectionRecycled();
+  account(ConnEvent::RECYCLED, true, start);
+}
+
+void ConnectionBus::paramUpdated(struct bt_conn *conn, uint16_t interval,
+                                 uint16_t latency, uint16_t timeout) {
+  uint8_t index = bt_conn_index(conn);
+  struct conn_link &link = _links[index];
+  link.interval = interval;
+  link.latency = latency;
+  link.timeout = timeout;
+  Trace::emit(TraceEvent::CONN_PARAM_UPDATED, index, interval,
+              latency | ((uint32_t)timeout << 16));
+
+  uint32_t start = k_cycle_get_32();
+  if (link.owner) {
+    link.owner->onParamUpdated(conn, interval, latency, timeout);
+  }
+  account(ConnEvent::PARAM_UPDATED, link.owner != nullptr, start);
+
+  if (IS_ENABLED(CONFIG_BLUESIM_LINK_SCHEDULER)) {
+    LinkScheduler::onLinkChanged(conn, ConnEvent::PARAM_UPDATED);
+  }
+}
+
+#ifdef CONFIG_BT_USER_PHY_UPDATE
+void ConnectionBus::phyUpdated(struct bt_conn *conn,
+                               struct bt_conn_le_phy_info *info) {
+  uint8_t index = bt_conn_index(conn);
+  struct conn_link &link = _links[index];
+  link.tx_phy = info->tx_phy;
+  link.rx_phy = info->rx_phy;
+  Trace::emit(TraceEvent::CONN_PHY_UPDATED, index,
+              info->tx_phy | (info->rx_phy << 8));
+
+  uint32_t start = k_cycle_get_32();
+  if (link.owner) {
+    link.owner->onPhyUpdated(conn, info->tx_phy, info->rx_phy);
+  }
+  account(ConnEvent::PHY_UPDATED, link.owner != nullptr, start);
+
+  if (IS_ENABLED(CONFIG_BLUESIM_LINK_SCHEDULER)) {
+    LinkScheduler::onLinkChanged(conn, ConnEvent::PHY_UPDATED);
+  }
+}
+#endif
+
+#ifdef CONFIG_BT_USER_DATA_LEN_UPDATE
+void ConnectionBus::dataLenUpdated(struct bt_conn *conn,
+                                   struct bt_conn_le_data_len_info *info) {
+  uint8_t index = bt_conn_index(conn);
+  struct conn_link &link = _links[index];
+  link.tx_max_len = info->tx_max_len;
+  link.rx_max_len = info->rx_max_len;
+  Trace::emit(TraceEvent::CONN_DATA_LEN_UPDATED, index, info->tx_max_len,
+              info->rx_max_len);
+
+  uint32_t start = k_cycle_get_32();
+  if (link.owner) {
+    link.owner->onDataLenUpdated(conn, info->tx_max_len, info->rx_max_len);
+  }
+  account(ConnEvent::DATA_LEN_UPDATED, link.owner != nullptr, start);
+
+  if (IS_ENABLED(CONFIG_BLUESIM_LINK_SCHEDULER)) {
+    LinkScheduler::onLinkChanged(conn, ConnEvent::DATA_LEN_UPDATED);
+  }
+}
+#endif
+
+#ifdef CONFIG_BT_SMP
+void ConnectionBus::securityChanged(struct bt_conn *conn, bt_security_t level,
+                                    enum bt_security_err err) {
+  uint8_t index = bt_conn_index(conn);
+  struct conn_link &link = _links[index];
+  if (!err) {
+    link.security = level;
+  }
+  Trace::emit(TraceEvent::CONN_SECURITY_CHANGED, index, level, err);
+
+  uint32_t start = k_cycle_get_32();
+  if (link.owner) {
+    link.owner->onSecurityChanged(conn, level, err);
+  }
+  account(ConnEvent::SECURITY_CHANGED, link.owner != nullptr, start);
+  if (IS_ENABLED(CONFIG_BLUESIM_PAIRING)) {
+    Pairing::onSecurityChanged(conn, level, err);
+  }
+}
+#endif
+
+struct conn_event_stats ConnectionBus::stats(ConnEvent event) {
+  // Written from the Bluetooth RX thread only, a torn read is harmless here
+  return _stats[(uint8_t)event];
+}
+
+const char *ConnectionBus::eventName(ConnEvent event) {
+  static const char *const names[] = {
+      "connected",       "disconnected",     "recycled", "param_updated",
+      "phy_updated",     "data_len_updated", "security_changed",
+  };
+  BUILD_ASSERT(ARRAY_SIZE(names) == (size_t)ConnEvent::COUNT,
+               "One name per connection event");
+  return (uint8_t)event < ARRAY_SIZE(names) ? names[(uint8_t)event] : "?";
+}
+
+void ConnectionBus::logStats() {
+  for (uint8_t i = 0; i < (uint8_t)ConnEvent::COUNT; i++) {
+    struct conn_event_stats s = stats((ConnEvent)i);
+    uint32_t avg = s.dispatched ? (uint32_t)(s.total_ns / s.dispatched) : 0;
+    LOG_INF("%s: dispatched %u, unowned %u, hook avg %u ns, max %u ns",
+            eventName((ConnEvent)i), s.dispatched, s.unowned, avg, s.max_ns);
+  }
+}
+
+#ifdef CONFIG_SHELL
+static int cmdConnStats(const struct shell *sh, size_t argc, char **argv) {
+  ARG_UNUSED(argc);
+  ARG_UNUSED(argv);
+
+  shell_print(sh, "%-17s %10s %8s %10s %10s", "event", "dispatched",
+              "unowned", "avg_ns", "max_ns");
+  for (uint8_t i = 0; i < (uint8_t)ConnEvent::COUNT; i++) {
+    struct conn_event_stats s = ConnectionBus::stats((ConnEvent)i);
+    uint32_t avg = s.dispatched ? (uint32_t)(s.total_ns / s.dispatched) : 0;
+    shell_print(sh, "%-17s %10u %8u %10u %10u",
+                ConnectionBus::eventName((ConnEvent)i), s.dispatched,
+                s.unowned, avg, s.max_ns);
+  }
+  return 0;
+}
+
+static int cmdConnLinks(const struct shell *sh, size_t argc, char **argv) {
+  ARG_UNUSED(argc);
+  ARG_UNUSED(argv);
+
+  for (uint8_t i = 0; i < MAX_BUS_CONNECTIONS; i++) {
+    const struct conn_link &link = ConnectionBus::link(i);
+    if (!link.owner) {
+      continue;
+    }
+    shell_print(sh,
+                "conn %u: interval %u x 1.25 ms, latency %u, timeout %u0 ms, "
+                "phy %u/%u, data len %u/%u, security %u",
+                i, link.interval, link.latency, link.timeout, link.tx_phy,
+                link.rx_phy, link.tx_max_len, link.rx_max_len, link.security);
+  }
+  return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+    conn_cmds,
+    SHELL_CMD(stats, NULL, "Per event dispatch counts and hook time",
+              cmdConnStats),
+    SHELL_CMD(links, NULL, "Negotiated parameters of owned links",
+              cmdConnLinks),
+    SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(conn, &conn_cmds, "Connection event bus", NULL);
+#endif
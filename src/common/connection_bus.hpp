@@ -0,0 +1,105 @@
+#pragma once
+
+extern "C" {
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/kernel.h>
+}
+
+#define MAX_BUS_CONNECTIONS CONFIG_BT_MAX_CONN
+
+enum class ConnEvent : uint8_t {
+  CONNECTED,
+  DISCONNECTED,
+  RECYCLED,
+  PARAM_UPDATED,
+  PHY_UPDATED,
+  DATA_LEN_UPDATED,
+  SECURITY_CHANGED,
+  COUNT,
+};
+
+// Typed hooks for every connection event, owners override what they need.
+// Hooks run on the Bluetooth RX thread.
+class ConnectionListener {
+public:
+  virtual ~ConnectionListener() = default;
+
+  virtual void onConnected(struct bt_conn *conn, uint8_t err) {}
+  virtual void onDisconnected(struct bt_conn *conn, uint8_t reason) {}
+  virtual void onParamUpdated(struct bt_conn *conn, uint16_t interval,
+                              uint16_t latency, uint16_t timeout) {}
+  virtual void onPhyUpdated(struct bt_conn *conn, uint8_t tx_phy,
+                            uint8_t rx_phy) {}
+  virtual void onDataLenUpdated(struct bt_conn *conn, uint16_t tx_max_len,
+                                uint16_t rx_max_len) {}
+  virtual void onSecurityChanged(struct bt_conn *conn, bt_security_t level,
+                                 int err) {}
+};
+
+// Latest negotiated parameters of a link, kept for throughput decisions
+struct conn_link {
+  ConnectionListener *owner;
+  uint16_t interval; // 1.25 ms units
+  uint16_t latency;
+  uint16_t timeout; // 10 ms units
+  uint8_t tx_phy;   // BT_GAP_LE_PHY_*
+  uint8_t rx_phy;
+  uint16_t tx_max_len; // Link layer payload octets
+  uint16_t rx_max_len;
+  uint8_t security; // bt_security_t
+};
+
+struct conn_event_stats {
+  uint32_t dispatched;
+  uint32_t unowned; // Events on a connection nobody claimed
+  uint32_t last_ns; // Time spent in the owner's hook
+  uint32_t max_ns;
+  uint64_t total_ns;
+};
+
+// Single bt_conn_cb for the whole application. Centrals claim a connection
+// with bind() when creating it, peripheral links are claimed in the connected
+// event by the owner of the advertisement on the link's local identity. Every
+// later event is routed through a table indexed by bt_conn_index(). The slot
+// is released after the disconnected event or a failed connection attempt.
+class ConnectionBus {
+public:
+  static void init();
+  static void bind(struct bt_conn *conn, ConnectionListener *owner);
+  // Drops every link claimed by an owner that is going away, their later
+  // events count as unowned
+  static void unbind(ConnectionListener *owner);
+  static const struct conn_link &link(struct bt_conn *conn) {
+    return _links[bt_conn_index(conn)];
+  }
+  static const struct conn_link &link(uint8_t index) { return _links[index]; }
+
+  static struct conn_event_stats stats(ConnEvent event);
+  static const char *eventName(ConnEvent event);
+  static void logStats();
+
+private:
+  static void connected(struct bt_conn *conn, uint8_t err);
+  static void disconnected(struct bt_conn *conn, uint8_t reason);
+  static void recycled();
+  static void paramUpdated(struct bt_conn *conn, uint16_t interval,
+                           uint16_t latency, uint16_t timeout);
+#ifdef CONFIG_BT_USER_PHY_UPDATE
+  static void phyUpdated(struct bt_conn *conn,
+                         struct bt_conn_le_phy_info *info);
+#endif
+#ifdef CONFIG_BT_USER_DATA_LEN_UPDATE
+  static void dataLenUpdated(struct bt_conn *conn,
+                             struct bt_conn_le_data_len_info *info);
+#endif
+#ifdef CONFIG_BT_SMP
+  static void securityChanged(struct bt_conn *conn, bt_security_t level,
+                              enum bt_security_err err);
+#endif
+  static void account(ConnEvent event, bool owned, uint32_t start_cycles);
+
+  static struct conn_link _links[MAX_BUS_CONNECTIONS];
+  static struct conn_event_stats _stats[(uint8_t)ConnEvent::COUNT];
+  static struct bt_conn_cb _callbacks;
+};
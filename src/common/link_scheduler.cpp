@@ -0,0 +1,316 @@
+#include "link_scheduler.hpp"
+#include <zephyr/logging/log.h>
+
+extern "C" {
+#include <stdlib.h>
+#ifdef CONFIG_SHELL
+#include <zephyr/shell/shell.h>
+#endif
+}
+
+LOG_MODULE_REGISTER(LINK_SCHEDULER, LOG_LEVEL_INF);
+
+BUILD_ASSERT((SCHED_BASE_INTERVAL << SCHED_MAX_SHIFT) <= 3200,
+             "Longest harmonic exceeds the 4 s connection interval limit");
+
+struct k_spinlock LinkScheduler::_lock = {};
+struct sched_link LinkScheduler::_links[MAX_BUS_CONNECTIONS] = {};
+struct queued_work LinkScheduler::_planWork = {};
+uint16_t LinkScheduler::_plannedPermille = 0;
+
+// Link layer framing around the payload: access address, header and CRC.
+// The preamble is one byte per Mbit/s of the PHY.
+#define LL_OVERHEAD_BYTES 9
+#define LL_IFS_US 150
+// L2CAP header inside the link layer payload
+#define L2CAP_HDR_BYTES 4
+
+void LinkScheduler::init() {
+  WorkQueue::radio.initWork(&_planWork, planAction);
+  LOG_INF("Link scheduler: base interval %u x 1.25 ms, up to %u harmonics, "
+          "%u%% reserved",
+          SCHED_BASE_INTERVAL, SCHED_MAX_SHIFT, SCHED_RESERVE_PERCENT);
+}
+
+uint32_t LinkScheduler::exchangeUs(uint8_t phy, uint16_t payload) {
+  uint32_t tx;
+  uint32_t rx;
+  switch (phy) {
+  case BT_GAP_LE_PHY_2M:
+    tx = (LL_OVERHEAD_BYTES + 2 + payload) * 8 / 2;
+    rx = (LL_OVERHEAD_BYTES + 2) * 8 / 2;
+    break;
+  case BT_GAP_LE_PHY_CODED:
+    // S=8 coding, eight times the 1M air time is close enough to plan with
+    tx = (LL_OVERHEAD_BYTES + 1 + payload) * 8 * 8;
+    rx = (LL_OVERHEAD_BYTES + 1) * 8 * 8;
+    break;
+  default:
+    tx = (LL_OVERHEAD_BYTES + 1 + payload) * 8;
+    rx = (LL_OVERHEAD_BYTES + 1) * 8;
+    break;
+  }
+
+  // Full packet one way, empty acknowledgement back
+  return tx + LL_IFS_US + rx + LL_IFS_US;
+}
+
+uint32_t LinkScheduler::eventUs(const struct conn_link &link, uint32_t bytes,
+                                uint32_t events) {
+  uint16_t payload = link.tx_max_len - L2CAP_HDR_BYTES;
+  uint32_t packets = DIV_ROUND_UP(bytes, payload);
+  uint32_t empty = exchangeUs(link.tx_phy, 0);
+  uint32_t full = exchangeUs(link.tx_phy, link.tx_max_len);
+
+  // Every event costs at least an empty exchange, data packets replace them
+  return events * SCHED_MIN_EXCHANGES * empty + packets * (full - empty);
+}
+
+uint32_t LinkScheduler::budgetUs() {
+  return SCHED_BASE_INTERVAL * SCHED_UNIT_US * (100 - SCHED_RESERVE_PERCENT) /
+         100;
+}
+
+// Longest harmonic whose single event still fits the base period
+uint8_t LinkScheduler::fit(const struct conn_link &link, uint32_t rate,
+                           uint32_t *event_us) {
+  uint8_t shift = SCHED_MAX_SHIFT;
+  for (;; shift--) {
+    uint32_t interval_us = (SCHED_BASE_INTERVAL << shift) * SCHED_UNIT_US;
+    uint32_t bytes = (uint32_t)((uint64_t)rate * interval_us / USEC_PER_SEC);
+    *event_us = eventUs(link, bytes, 1);
+    if (*event_us <= budgetUs() || shift == 0) {
+      return shift;
+    }
+  }
+}
+
+void LinkScheduler::resetWindow(struct sched_link &entry) {
+  atomic_set(&entry.bytes, 0);
+  entry.window_ticks = k_uptime_ticks();
+}
+
+void LinkScheduler::onConnected(struct bt_conn *conn) {
+  struct sched_link &entry = _links[bt_conn_index(conn)];
+
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  entry = {};
+  entry.conn = conn;
+  entry.used = true;
+  k_spin_unlock(&_lock, key);
+
+  resetWindow(entry);
+  WorkQueue::radio.schedule(&_planWork, K_NO_WAIT);
+}
+
+void LinkScheduler::onDisconnected(struct bt_conn *conn) {
+  struct sched_link &entry = _links[bt_conn_index(conn)];
+
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  entry.used = false;
+  entry.conn = nullptr;
+  k_spin_unlock(&_lock, key);
+
+  // The freed time goes to the remaining links
+  WorkQueue::radio.schedule(&_planWork, K_NO_WAIT);
+}
+
+void LinkScheduler::onLinkChanged(struct bt_conn *conn, ConnEvent event) {
+  struct sched_link &entry = _links[bt_conn_index(conn)];
+  if (!entry.used) {
+    return;
+  }
+
+  if (event == ConnEvent::PARAM_UPDATED) {
+    // Achieved utilization is measured against the interval in force. A
+    // peer that settles elsewhere is not asked again until the next plan,
+    // so a disagreement cannot turn into an update loop.
+    resetWindow(entry);
+    return;
+  }
+
+  // PHY or data length moved, the event time of the link changed with it
+  WorkQueue::radio.schedule(&_planWork, K_NO_WAIT);
+}
+
+int LinkScheduler::declare(uint8_t index, uint32_t bytes_per_s) {
+  if (index >= MAX_BUS_CONNECTIONS) {
+    return -ENOTCONN;
+  }
+
+  // Shorter intervals only add empty exchanges, so a rate the links cannot
+  // carry together at their best harmonics is refused rather than planned
+  uint32_t event_us;
+  uint8_t shift = fit(ConnectionBus::link(index), bytes_per_s, &event_us);
+
+  // Admitted load is reserved before the lock is dropped, so back to back
+  // declarations see each other instead of waiting for the next plan
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  struct sched_link &entry = _links[index];
+  if (!entry.used) {
+    k_spin_unlock(&_lock, key);
+    return -ENOTCONN;
+  }
+
+  uint32_t load_us = event_us >> shift;
+  for (uint8_t i = 0; i < MAX_BUS_CONNECTIONS; i++) {
+    if (i != index && _links[i].used) {
+      load_us += _links[i].event_us >> _links[i].shift;
+    }
+  }
+  if (load_us > budgetUs()) {
+    k_spin_unlock(&_lock, key);
+    LOG_WRN("Connection %u: %u B/s needs %u of %u us per base period", index,
+            bytes_per_s, load_us, budgetUs());
+    return -ENOSPC;
+  }
+
+  entry.rate = bytes_per_s;
+  entry.shift = shift;
+  entry.event_us = event_us;
+  k_spin_unlock(&_lock, key);
+
+  WorkQueue::radio.schedule(&_planWork, K_NO_WAIT);
+  return 0;
+}
+
+void LinkScheduler::plan() {
+  const uint32_t base_us = SCHED_BASE_INTERVAL * SCHED_UNIT_US;
+  uint32_t load_us = 0;
+
+  for (struct sched_link &entry : _links) {
+    k_spinlock_key_t key = k_spin_lock(&_lock);
+    struct bt_conn *conn = entry.used ? bt_conn_ref(entry.conn) : nullptr;
+    uint32_t rate = entry.rate;
+    k_spin_unlock(&_lock, key);
+    if (!conn) {
+      continue;
+    }
+
+    const struct conn_link &link = ConnectionBus::link(conn);
+    uint32_t event_us;
+    uint8_t shift = fit(link, rate, &event_us);
+    uint16_t interval = SCHED_BASE_INTERVAL << shift;
+
+    // declare() sums these under the lock. A declaration that came in since
+    // the rate was read already reserved its own and planned another pass.
+    key = k_spin_lock(&_lock);
+    if (entry.rate == rate) {
+      entry.shift = shift;
+      entry.interval = interval;
+      entry.event_us = event_us;
+    }
+    k_spin_unlock(&_lock, key);
+    // Events of a link on the 2^shift harmonic take every 2^shift-th period
+    load_us += event_us >> shift;
+
+    if (link.interval != interval) {
+      struct bt_le_conn_param param = {};
+      param.interval_min = interval;
+      param.interval_max = interval;
+      param.latency = 0;
+      param.timeout = SCHED_TIMEOUT;
+
+      entry.requests++;
+      int err = bt_conn_le_param_update(conn, &param);
+      if (err < 0 && err != -EALREADY) {
+        entry.failures++;
+        LOG_WRN("Connection %u: Interval %u request failed (err %d)",
+                bt_conn_index(conn), entry.interval, err);
+      }
+    }
+    bt_conn_unref(conn);
+  }
+
+  _plannedPermille = (uint16_t)MIN(load_us * 1000U / base_us, UINT16_MAX);
+  if (load_us > budgetUs()) {
+    // Declarations were admitted, a slower PHY or shorter data length since
+    // then can still overcommit the links
+    LOG_WRN("Links need %u of %u us per base period, events will be skipped",
+            load_us, budgetUs());
+  }
+}
+
+void LinkScheduler::planAction(struct k_work *work) {
+  ARG_UNUSED(work);
+  plan();
+}
+
+int LinkScheduler::report(uint8_t index, struct sched_report *out) {
+  if (index >= MAX_BUS_CONNECTIONS || !_links[index].used) {
+    return -ENOENT;
+  }
+
+  const struct sched_link &entry = _links[index];
+  const struct conn_link &link = ConnectionBus::link(index);
+  uint32_t elapsed_us =
+      (uint32_t)k_ticks_to_us_floor64(k_uptime_ticks() - entry.window_ticks);
+  uint32_t bytes = (uint32_t)atomic_get(&entry.bytes);
+  uint32_t interval_us = link.interval * SCHED_UNIT_US;
+  uint32_t events = interval_us ? elapsed_us / interval_us : 0;
+
+  *out = {};
+  out->planned_interval = entry.interval;
+  out->interval = link.interval;
+  out->rate = entry.rate;
+  out->requests = entry.requests;
+  out->failures = entry.failures;
+  if (entry.interval) {
+    out->planned_permille = (uint16_t)MIN(
+        entry.event_us * 1000U / (entry.interval * SCHED_UNIT_US), 1000U);
+  }
+  if (elapsed_us) {
+    out->achieved_rate =
+        (uint32_t)((uint64_t)bytes * USEC_PER_SEC / elapsed_us);
+    out->achieved_permille = (uint16_t)MIN(
+        (uint64_t)eventUs(link, bytes, events) * 1000U / elapsed_us, 1000U);
+  }
+  return 0;
+}
+
+#ifdef CONFIG_SHELL
+static int cmdSchedShow(const struct shell *sh, size_t argc, char **argv) {
+  ARG_UNUSED(argc);
+  ARG_UNUSED(argv);
+
+  shell_print(sh, "base %u x 1.25 ms, planned load %u permille",
+              SCHED_BASE_INTERVAL, LinkScheduler::plannedPermille());
+  shell_print(sh, "%4s %8s %8s %10s %10s %8s %8s %6s", "conn", "planned",
+              "interval", "rate", "achieved", "plan_pm", "used_pm", "fails");
+  for (uint8_t i = 0; i < MAX_BUS_CONNECTIONS; i++) {
+    struct sched_report report;
+    if (LinkScheduler::report(i, &report) < 0) {
+      continue;
+    }
+    shell_print(sh, "%4u %8u %8u %10u %10u %8u %8u %3u/%u", i,
+                report.planned_interval, report.interval, report.rate,
+                report.achieved_rate, report.planned_permille,
+                report.achieved_permille, report.failures, report.requests);
+  }
+  return 0;
+}
+
+static int cmdSchedDeclare(const struct shell *sh, size_t argc, char **argv) {
+  ARG_UNUSED(argc);
+
+  unsigned long index = strtoul(argv[1], nullptr, 0);
+  int err = LinkScheduler::declare((uint8_t)MIN(index, UINT8_MAX),
+                                   (uint32_t)strtoul(argv[2], nullptr, 0));
+  if (err == -ENOSPC) {
+    shell_error(sh, "Rate does not fit next to the other links");
+  } else if (err < 0) {
+    shell_error(sh, "No scheduled link %lu", index);
+  }
+  return err;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+    sched_cmds,
+    SHELL_CMD(show, NULL, "Planned and achieved utilization per link",
+              cmdSchedShow),
+    SHELL_CMD_ARG(declare, NULL, "<conn> <bytes per second>", cmdSchedDeclare,
+                  3, 0),
+    SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(sched, &sched_cmds, "Connection interval scheduler", NULL);
+#endif
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "connection_bus.hpp"
+#include "work_queue.hpp"
+
+extern "C" {
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+}
+
+#ifdef CONFIG_BLUESIM_SCHED_BASE_INTERVAL
+#define SCHED_BASE_INTERVAL CONFIG_BLUESIM_SCHED_BASE_INTERVAL
+#else
+#define SCHED_BASE_INTERVAL 24
+#endif
+
+#ifdef CONFIG_BLUESIM_SCHED_MAX_SHIFT
+#define SCHED_MAX_SHIFT CONFIG_BLUESIM_SCHED_MAX_SHIFT
+#else
+#define SCHED_MAX_SHIFT 3
+#endif
+
+#ifdef CONFIG_BLUESIM_SCHED_RESERVE_PERCENT
+#define SCHED_RESERVE_PERCENT CONFIG_BLUESIM_SCHED_RESERVE_PERCENT
+#else
+#define SCHED_RESERVE_PERCENT 25
+#endif
+
+// Connection interval units and the supervision timeout asked for with
+// every planned interval
+#define SCHED_UNIT_US 1250
+#define SCHED_TIMEOUT 400
+// Packet exchanges an idle link still spends per event
+#define SCHED_MIN_EXCHANGES 1
+
+struct sched_link {
+  struct bt_conn *conn; // Valid from the connected to the disconnected event
+  bool used;
+  uint32_t rate;     // Declared throughput, bytes per second
+  uint8_t shift;     // Planned interval is SCHED_BASE_INTERVAL << shift
+  uint16_t interval; // Planned, 1.25 ms units
+  uint32_t event_us; // Radio time one event needs at the declared rate
+  atomic_t bytes;    // Moved since window_ticks, both directions
+  int64_t window_ticks;
+  uint32_t requests; // Parameter updates asked for
+  uint32_t failures; // Requests the stack refused
+};
+
+struct sched_report {
+  uint16_t planned_interval;
+  uint16_t interval; // What the link runs with
+  uint32_t rate;
+  uint32_t achieved_rate; // Bytes per second over the current window
+  uint16_t planned_permille; // Event time over interval
+  uint16_t achieved_permille;
+  uint32_t requests;
+  uint32_t failures;
+};
+
+// Places every link on a harmonic of SCHED_BASE_INTERVAL so the controller
+// can tile their events on one timeline instead of letting unrelated
+// intervals drift into each other. A link gets the longest harmonic whose
+// event, sized for its declared throughput on its PHY and data length, still
+// fits the share of the base period left after SCHED_RESERVE_PERCENT for
+// scanning and advertising. A declaration that would push the links together
+// past that share is refused with -ENOSPC. Plans run on WorkQueue::radio
+// after every connect, disconnect and declaration.
+class LinkScheduler {
+public:
+  static void init();
+  static uint16_t initialInterval() {
+    return SCHED_BASE_INTERVAL << SCHED_MAX_SHIFT;
+  }
+  static int declare(uint8_t index, uint32_t bytes_per_s);
+  static int declare(struct bt_conn *conn, uint32_t bytes_per_s) {
+    return declare(bt_conn_index(conn), bytes_per_s);
+  }
+  // Data paths report what they moved for the achieved utilization
+  static void account(struct bt_conn *conn, uint32_t bytes) {
+    atomic_add(&_links[bt_conn_index(conn)].bytes, (atomic_val_t)bytes);
+  }
+  static int report(uint8_t index, struct sched_report *out);
+  static uint16_t plannedPermille() { return _plannedPermille; }
+
+  // Hooks called by ConnectionBus when the scheduler is enabled
+  static void onConnected(struct bt_conn *conn);
+  static void onDisconnected(struct bt_conn *conn);
+  static void onLinkChanged(struct bt_conn *conn, ConnEvent event);
+
+private:
+  static uint32_t exchangeUs(uint8_t phy, uint16_t payload);
+  static uint32_t eventUs(const struct conn_link &link, uint32_t bytes,
+                          uint32_t events);
+  static uint8_t fit(const struct conn_link &link, uint32_t rate,
+                     uint32_t *event_us);
+  static uint32_t budgetUs();
+  static void plan();
+  static void planAction(struct k_work *work);
+  static void resetWindow(struct sched_link &entry);
+
+  static struct k_spinlock _lock; // Entry ownership and reserved load
+  static struct sched_link _links[MAX_BUS_CONNECTIONS];
+  static struct queued_work _planWork;
+  static uint16_t _plannedPermille; // Sum over links, of the base period
+};
@@ -0,0 +1,142 @@
+#include "memory_budget.hpp"
+#include "../central/bulk_writer.hpp"
+#include "../central/central.hpp"
+#include "../central/link_latency.hpp"
+#include "../central/notification_sink.hpp"
+#include "../central/rpa_cache.hpp"
+#include "../central/scan_capture.hpp"
+#include "../peripheral/advertisement.hpp"
+#include "../peripheral/peripheral.hpp"
+#include "../rpc/rpc.hpp"
+#include "coc_channel.hpp"
+#include "link_scheduler.hpp"
+#include "object_pool.hpp"
+#include "pairing.hpp"
+#include "trace.hpp"
+#include "uart_stream.hpp"
+#include "work_queue.hpp"
+
+extern "C" {
+#include <zephyr/linker/linker-defs.h>
+#include <zephyr/sys/printk.h>
+#ifdef CONFIG_SHELL
+#include <zephyr/shell/shell.h>
+#endif
+}
+
+struct budget_entry {
+  const char *subsystem;
+  const char *item;
+  size_t bytes; // 0 when the subsystem is compiled out
+};
+
+// Fixed buffers outside the pools, keep in step with the modules
+static const struct budget_entry entries[] = {
+    {"work queues", "radio stack", RADIO_WORKQ_STACK_SIZE},
+    {"work queues", "data stack", DATA_WORKQ_STACK_SIZE},
+    {"registries", "role pointers",
+     sizeof(Central::registry) + sizeof(Scanner::registry) +
+         sizeof(Peripheral::registry) + sizeof(Advertisement::registry)},
+    {"scanner", "periodic syncs", sizeof(Scanner::periodicSyncs)},
+    {"scanner", "device table",
+     DEVICE_TABLE_SIZE * sizeof(struct device_entry)},
+    {"trace", "rings", TRACE_CPUS * sizeof(struct trace_ring)},
+    {"stream", "batch buffers",
+     IS_ENABLED(CONFIG_BLUESIM_STREAM) ? 2 * STREAM_BUFFER_SIZE : 0},
+    {"capture", "ring and flush chunk",
+     IS_ENABLED(CONFIG_BLUESIM_SCAN_CAPTURE)
+         ? CAPTURE_RING_SIZE + CAPTURE_FLUSH_CHUNK
+         : 0},
+    {"rpc", "receive ring",
+     IS_ENABLED(CONFIG_BLUESIM_RPC) ? RPC_RX_RING_SIZE : 0},
+    {"bulk", "sessions and pattern",
+     IS_ENABLED(CONFIG_BLUESIM_BULK_WRITE)
+         ? MAX_BUS_CONNECTIONS * sizeof(struct bulk_session) + BULK_MAX_CHUNK
+         : 0},
+    {"notify", "rings and subscriptions",
+     IS_ENABLED(CONFIG_BLUESIM_NOTIFY_SINK)
+         ? MAX_BUS_CONNECTIONS * sizeof(struct notify_ring) +
+               MAX_NOTIFY_SUBSCRIPTIONS * sizeof(struct notify_subscription)
+         : 0},
+    {"l2cap", "channels and SDU pools",
+     IS_ENABLED(CONFIG_BLUESIM_L2CAP_COC)
+         ? MAX_COC_CHANNELS * sizeof(struct coc_channel) +
+               (COC_TX_BUFS + COC_RX_BUFS) * BT_L2CAP_SDU_BUF_SIZE(COC_SDU_SIZE)
+         : 0},
+    {"scheduler", "link plan",
+     IS_ENABLED(CONFIG_BLUESIM_LINK_SCHEDULER)
+         ? MAX_BUS_CONNECTIONS * sizeof(struct sched_link)
+         : 0},
+    {"pairing", "link timing",
+     IS_ENABLED(CONFIG_BLUESIM_PAIRING)
+         ? MAX_BUS_CONNECTIONS * sizeof(struct pairing_link) +
+               2 * sizeof(SampleSet)
+         : 0},
+    {"rpa", "cache and IRKs",
+     IS_ENABLED(CONFIG_BLUESIM_RPA_CACHE)
+         ? RPA_CACHE_SIZE * sizeof(struct rpa_entry) +
+               RPA_MAX_IRKS * sizeof(struct rpa_irk)
+         : 0},
+    {"latency", "histograms",
+     IS_ENABLED(CONFIG_BLUESIM_LINK_LATENCY)
+         ? MAX_CENTRALS * sizeof(struct central_latency)
+         : 0},
+};
+
+void MemoryBudget::report(BudgetPrinter printer, void *context) {
+  char line[96];
+  size_t accounted = 0;
+
+  for (const ObjectPoolBase *pool : ObjectPoolBase::registry) {
+    if (!pool) {
+      continue;
+    }
+    snprintk(line, sizeof(line),
+             "pool %-15s %3u x %5u = %6u B, used %u peak %u", pool->name(),
+             pool->capacity(), (unsigned int)pool->objectSize(),
+             (unsigned int)pool->bytes(), pool->used(), pool->highWater());
+    printer(context, line);
+    accounted += pool->bytes();
+  }
+
+  for (const struct budget_entry &entry : entries) {
+    if (!entry.bytes) {
+      continue;
+    }
+    snprintk(line, sizeof(line), "%-11s %-22s %6u B", entry.subsystem,
+             entry.item, (unsigned int)entry.bytes);
+    printer(context, line);
+    accounted += entry.bytes;
+  }
+
+  size_t image = _image_ram_end - _image_ram_start;
+  snprintk(line, sizeof(line),
+           "accounted %u B of %u B static RAM, %u B of SRAM left",
+           (unsigned int)accounted, (unsigned int)image,
+           (unsigned int)(CONFIG_SRAM_SIZE * 1024 - image));
+  printer(context, line);
+}
+
+static void printkLine(void *context, const char *line) {
+  ARG_UNUSED(context);
+  printk("BUDGET %s\n", line);
+}
+
+void MemoryBudget::printReport() { report(printkLine, nullptr); }
+
+#ifdef CONFIG_SHELL
+static void shellLine(void *context, const char *line) {
+  shell_print(static_cast<const struct shell *>(context), "%s", line);
+}
+
+static int cmdBudget(const struct shell *sh, size_t argc, char **argv) {
+  ARG_UNUSED(argc);
+  ARG_UNUSED(argv);
+
+  MemoryBudget::report(shellLine, (void *)sh);
+  return 0;
+}
+
+SHELL_CMD_REGISTER(budget, NULL, "Static RAM used per subsystem and pool",
+                   cmdBudget);
+#endif
@@ -0,0 +1,17 @@
+#pragma once
+
+extern "C" {
+#include <zephyr/kernel.h>
+}
+
+// Receives one formatted report line, without a trailing newline
+using BudgetPrinter = void (*)(void *context, const char *line);
+
+// Where static RAM goes: every object pool with its occupancy, plus the large
+// fixed buffers of each enabled subsystem, against the image's total RAM
+// footprint. Printed once at boot and by the "budget" shell command.
+class MemoryBudget {
+public:
+  static void report(BudgetPrinter printer, void *context);
+  static void printReport();
+};
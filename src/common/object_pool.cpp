@@ -0,0 +1,31 @@
+#include "object_pool.hpp"
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(OBJECT_POOL, LOG_LEVEL_INF);
+
+ObjectPoolBase *ObjectPoolBase::registry[MAX_OBJECT_POOLS] = {nullptr};
+
+ObjectPoolBase::ObjectPoolBase(const char *name, size_t object_size,
+                               uint8_t capacity)
+    : _name(name), _objectSize(object_size), _capacity(capacity) {
+  atomic_set(&_used, 0);
+  atomic_set(&_highWater, 0);
+
+  for (uint8_t i = 0; i < MAX_OBJECT_POOLS; i++) {
+    if (!registry[i]) {
+      registry[i] = this;
+      return;
+    }
+  }
+
+  // Runs before logging is up, the budget report will miss this pool
+  __ASSERT(false, "Object pool registry full");
+}
+
+void ObjectPoolBase::onAcquire() {
+  atomic_val_t used = atomic_inc(&_used) + 1;
+  atomic_val_t highWater = atomic_get(&_highWater);
+  while (used > highWater && !atomic_cas(&_highWater, highWater, used)) {
+    highWater = atomic_get(&_highWater);
+  }
+}
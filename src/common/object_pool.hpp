@@ -0,0 +1,119 @@
+#pragma once
+
+#include <new>
+
+extern "C" {
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+}
+
+#define MAX_OBJECT_POOLS 8
+#define POOL_INDEX_INVALID 0xFF
+
+// Stable reference to a pooled object. The slot generation moves on with
+// every destroy, so a stale handle resolves to nullptr instead of the slot's
+// next occupant.
+struct pool_handle {
+  uint8_t index;
+  uint8_t generation;
+
+  bool isValid() const { return index != POOL_INDEX_INVALID; }
+};
+
+static constexpr struct pool_handle POOL_HANDLE_INVALID = {POOL_INDEX_INVALID,
+                                                           0};
+
+// Type independent part of a pool, registered for the memory budget report
+class ObjectPoolBase {
+public:
+  ObjectPoolBase(const char *name, size_t object_size, uint8_t capacity);
+
+  const char *name() const { return _name; }
+  size_t objectSize() const { return _objectSize; }
+  uint8_t capacity() const { return _capacity; }
+  uint8_t used() const { return (uint8_t)atomic_get(&_used); }
+  uint8_t highWater() const { return (uint8_t)atomic_get(&_highWater); }
+  size_t bytes() const { return _objectSize * _capacity; }
+
+  static ObjectPoolBase *registry[MAX_OBJECT_POOLS];
+
+protected:
+  void onAcquire();
+  void onRelease() { atomic_dec(&_used); }
+
+private:
+  const char *_name;
+  size_t _objectSize;
+  uint8_t _capacity;
+  atomic_t _used;
+  atomic_t _highWater;
+};
+
+// Fixed storage for N objects of type T, no heap involved. Slots are claimed
+// with an atomic bitmap, constructors and destructors run in the caller's
+// context.
+template <typename T, size_t N> class ObjectPool : public ObjectPoolBase {
+  static_assert(N < POOL_INDEX_INVALID, "Pool too large for its handles");
+
+public:
+  explicit ObjectPool(const char *name) : ObjectPoolBase(name, sizeof(T), N) {
+    memset(_generations, 0, sizeof(_generations));
+    memset(_inUse, 0, sizeof(_inUse));
+  }
+
+  template <typename... Args> struct pool_handle create(Args... args) {
+    for (uint8_t i = 0; i < N; i++) {
+      if (!atomic_test_and_set_bit(_inUse, i)) {
+        new (&_slots[i]) T(args...);
+        onAcquire();
+        return {i, _generations[i]};
+      }
+    }
+    return POOL_HANDLE_INVALID;
+  }
+
+  // For objects that live until reboot and are never looked up by handle
+  template <typename... Args> T *emplace(Args... args) {
+    return get(create(args...));
+  }
+
+  T *get(struct pool_handle handle) {
+    if (handle.index >= N || !atomic_test_bit(_inUse, handle.index) ||
+        _generations[handle.index] != handle.generation) {
+      return nullptr;
+    }
+    return reinterpret_cast<T *>(&_slots[handle.index]);
+  }
+
+  int destroy(struct pool_handle handle) {
+    T *object = get(handle);
+    if (!object) {
+      return -ENOENT;
+    }
+
+    object->~T();
+    _generations[handle.index]++;
+    atomic_clear_bit(_inUse, handle.index);
+    onRelease();
+    return 0;
+  }
+
+  struct pool_handle handleOf(const T *object) const {
+    for (uint8_t i = 0; i < N; i++) {
+      if (object == reinterpret_cast<const T *>(&_slots[i]) &&
+          atomic_test_bit(_inUse, i)) {
+        return {i, _generations[i]};
+      }
+    }
+    return POOL_HANDLE_INVALID;
+  }
+
+private:
+  struct alignas(T) Slot {
+    uint8_t bytes[sizeof(T)];
+  };
+  Slot _slots[N];
+  uint8_t _generations[N];
+  ATOMIC_DEFINE(_inUse, N);
+};
@@ -0,0 +1,178 @@
+#include "pairing.hpp"
+#include <zephyr/logging/log.h>
+
+extern "C" {
+#include <zephyr/sys/printk.h>
+#ifdef CONFIG_SHELL
+#include <zephyr/shell/shell.h>
+#endif
+}
+
+LOG_MODULE_REGISTER(PAIRING, LOG_LEVEL_INF);
+
+struct pairing_link Pairing::_links[MAX_BUS_CONNECTIONS] = {};
+struct pairing_stats Pairing::_stats = {};
+struct bt_conn_auth_info_cb Pairing::_infoCallbacks = {};
+SampleSet Pairing::_bondedLatency("connect_to_encrypted_bonded");
+SampleSet Pairing::_pairedLatency("connect_to_encrypted_paired");
+
+void Pairing::init() {
+  // No auth_cb is registered, every pairing runs as Just Works
+  _infoCallbacks.pairing_complete = pairingComplete;
+  _infoCallbacks.pairing_failed = pairingFailed;
+  int err = bt_conn_auth_info_cb_register(&_infoCallbacks);
+  if (err < 0) {
+    LOG_ERR("Failed to register pairing callbacks (err %d)", err);
+  }
+}
+
+struct bond_lookup {
+  const bt_addr_le_t *addr;
+  bool found;
+};
+
+static void matchBond(const struct bt_bond_info *info, void *user_data) {
+  struct bond_lookup *lookup = static_cast<struct bond_lookup *>(user_data);
+  if (bt_addr_le_cmp(&info->addr, lookup->addr) == 0) {
+    lookup->found = true;
+  }
+}
+
+bool Pairing::hasBond(struct bt_conn *conn) {
+  struct bt_conn_info info;
+  if (bt_conn_get_info(conn, &info) < 0) {
+    return false;
+  }
+
+  // Bonds belong to the local identity the link runs on
+  struct bond_lookup lookup = {bt_conn_get_dst(conn), false};
+  bt_foreach_bond(info.id, matchBond, &lookup);
+  return lookup.found;
+}
+
+void Pairing::onConnected(struct bt_conn *conn) {
+  struct pairing_link &link = _links[bt_conn_index(conn)];
+  link.connected_ticks = k_uptime_ticks();
+  link.bonded = hasBond(conn);
+  link.measured = false;
+}
+
+int Pairing::secure(struct bt_conn *conn, bt_security_t level) {
+  if (level < BT_SECURITY_L2) {
+    return 0;
+  }
+
+  // With a bond this goes straight to encryption with the stored LTK
+  int err = bt_conn_set_security(conn, level);
+  if (err < 0) {
+    LOG_ERR("Connection %u: Security level %d request failed (err %d)",
+            bt_conn_index(conn), level, err);
+  }
+  return err;
+}
+
+void Pairing::onSecurityChanged(struct bt_conn *conn, bt_security_t level,
+                                enum bt_security_err err) {
+  uint8_t index = bt_conn_index(conn);
+  struct pairing_link &link = _links[index];
+
+  if (err) {
+    _stats.failures++;
+    if (err == BT_SECURITY_ERR_PIN_OR_KEY_MISSING) {
+      // Our bond is stale, "pair clear" on this side lets the next link
+      // pair again
+      _stats.key_missing++;
+      LOG_WRN("Connection %u: Peer lost the bond", index);
+    } else {
+      LOG_WRN("Connection %u: Security failed (err %d)", index, err);
+    }
+    return;
+  }
+
+  if (level < BT_SECURITY_L2 || link.measured) {
+    return;
+  }
+
+  link.measured = true;
+  uint32_t us =
+      (uint32_t)k_ticks_to_us_floor64(k_uptime_ticks() - link.connected_ticks);
+  if (link.bonded) {
+    _stats.reencrypted++;
+    _bondedLatency.add(us);
+  } else {
+    _pairedLatency.add(us);
+  }
+  LOG_INF("Connection %u: Encrypted at level %d after %u us (%s)", index,
+          level, us, link.bonded ? "bonded" : "paired");
+}
+
+void Pairing::pairingComplete(struct bt_conn *conn, bool bonded) {
+  if (bonded) {
+    _stats.paired++;
+  } else {
+    _stats.unbonded++;
+  }
+  LOG_INF("Connection %u: Pairing complete%s", bt_conn_index(conn),
+          bonded ? ", bond stored" : "");
+}
+
+void Pairing::pairingFailed(struct bt_conn *conn,
+                            enum bt_security_err reason) {
+  // The failed security change that follows counts in failures
+  _stats.pairing_failures++;
+  LOG_WRN("Connection %u: Pairing failed (reason %d)", bt_conn_index(conn),
+          reason);
+}
+
+int Pairing::clearBonds() {
+  // Also drops the links to bonded peers
+  for (uint8_t id = 0; id < CONFIG_BT_ID_MAX; id++) {
+    int err = bt_unpair(id, nullptr);
+    if (err < 0 && err != -EINVAL) {
+      LOG_ERR("Failed to clear bonds of identity %u (err %d)", id, err);
+      return err;
+    }
+  }
+  return 0;
+}
+
+void Pairing::report() {
+  printk("BENCH {\"suite\":\"pairing\",\"paired\":%u,\"unbonded\":%u,"
+         "\"reencrypted\":%u,\"failures\":%u,\"pairing_failures\":%u,"
+         "\"key_missing\":%u}\n",
+         _stats.paired, _stats.unbonded, _stats.reencrypted, _stats.failures,
+         _stats.pairing_failures, _stats.key_missing);
+  _bondedLatency.report();
+  _pairedLatency.report();
+}
+
+#ifdef CONFIG_SHELL
+static int cmdPairShow(const struct shell *sh, size_t argc, char **argv) {
+  ARG_UNUSED(argc);
+  ARG_UNUSED(argv);
+
+  // Results go to the console as BENCH lines
+  Pairing::report();
+  return 0;
+}
+
+static int cmdPairClear(const struct shell *sh, size_t argc, char **argv) {
+  ARG_UNUSED(argc);
+  ARG_UNUSED(argv);
+
+  int err = Pairing::clearBonds();
+  if (err < 0) {
+    shell_error(sh, "Failed to clear bonds (err %d)", err);
+  }
+  return err;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+    pair_cmds,
+    SHELL_CMD(show, NULL, "Pairing counts and connect to encrypted times",
+              cmdPairShow),
+    SHELL_CMD(clear, NULL, "Delete every stored bond", cmdPairClear),
+    SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(pair, &pair_cmds, "LE Secure Connections bonding", NULL);
+#endif
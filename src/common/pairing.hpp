@@ -0,0 +1,63 @@
+#pragma once
+
+#include "../bench/sample_set.hpp"
+#include "connection_bus.hpp"
+
+extern "C" {
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/kernel.h>
+}
+
+#ifdef CONFIG_BLUESIM_SECURITY_LEVEL
+#define PAIRING_SECURITY_LEVEL ((bt_security_t)CONFIG_BLUESIM_SECURITY_LEVEL)
+#else
+#define PAIRING_SECURITY_LEVEL BT_SECURITY_L1
+#endif
+
+struct pairing_link {
+  int64_t connected_ticks;
+  bool bonded;   // A stored LTK existed for the peer when the link came up
+  bool measured; // First encryption of the link already sampled
+};
+
+struct pairing_stats {
+  uint32_t paired;           // Fresh pairings, new bond stored
+  uint32_t unbonded;         // Pairings that completed without a bond
+  uint32_t reencrypted;      // Links encrypted straight from a stored bond
+  uint32_t failures;         // Security changes that failed, pairing included
+  uint32_t pairing_failures; // Pairings aborted by SMP
+  uint32_t key_missing;      // Peer forgot the bond we still hold
+};
+
+// LE Secure Connections pairing and bonding for both roles. Bonds are kept
+// by the stack in settings, so a reconnect to a bonded peer skips pairing
+// and starts encryption with the stored LTK. The time from the connected
+// event to the first encrypted level is sampled per link, split by whether
+// a bond existed when the link came up.
+class Pairing {
+public:
+  static void init();
+  // Asks for level on the link, a no-op below BT_SECURITY_L2
+  static int secure(struct bt_conn *conn, bt_security_t level);
+  static int clearBonds();
+
+  // Hooks called by ConnectionBus when pairing is enabled
+  static void onConnected(struct bt_conn *conn);
+  static void onSecurityChanged(struct bt_conn *conn, bt_security_t level,
+                                enum bt_security_err err);
+
+  static struct pairing_stats stats() { return _stats; }
+  static void report();
+
+private:
+  static bool hasBond(struct bt_conn *conn);
+  static void pairingComplete(struct bt_conn *conn, bool bonded);
+  static void pairingFailed(struct bt_conn *conn,
+                            enum bt_security_err reason);
+
+  static struct pairing_link _links[MAX_BUS_CONNECTIONS];
+  static struct pairing_stats _stats;
+  static struct bt_conn_auth_info_cb _infoCallbacks;
+  static SampleSet _bondedLatency;
+  static SampleSet _pairedLatency;
+};
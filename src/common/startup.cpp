@@ -0,0 +1,110 @@
+#include "startup.hpp"
+#include <zephyr/logging/log.h>
+
+extern "C" {
+#include <zephyr/bluetooth/bluetooth.h>
+}
+
+LOG_MODULE_REGISTER(STARTUP, LOG_LEVEL_INF);
+
+struct k_event Startup::events;
+uint64_t Startup::timestamps[(size_t)StartupPhase::COUNT] = {0};
+int Startup::btError = 0;
+atomic_t Startup::expected = ATOMIC_INIT(0);
+atomic_t Startup::logged = ATOMIC_INIT(0);
+
+static const char *const phaseNames[] = {
+    "main started",      "bluetooth ready", "settings loaded",
+    "roles ready",       "first advertising", "first scanning",
+};
+static_assert(ARRAY_SIZE(phaseNames) == (size_t)StartupPhase::COUNT,
+              "Missing startup phase name");
+
+int Startup::begin() {
+  k_event_init(&Startup::events);
+  markPhase(StartupPhase::MAIN_STARTED);
+
+  // Returns right away, btReady() runs once the controller is up
+  int err = bt_enable(Startup::btReady);
+  if (err < 0) {
+    LOG_ERR("Bluetooth init failed (err %d)", err);
+  }
+  return err;
+}
+
+int Startup::waitFor(StartupPhase phase, k_timeout_t timeout) {
+  uint32_t bit = BIT((uint32_t)phase);
+  if (!k_event_wait(&Startup::events, bit, false, timeout)) {
+    return -EAGAIN;
+  }
+
+  if (phase == StartupPhase::BT_READY) {
+    return Startup::btError;
+  }
+  return 0;
+}
+
+void Startup::markPhase(StartupPhase phase) {
+  uint32_t bit = BIT((uint32_t)phase);
+  if (k_event_test(&Startup::events, bit)) {
+    return;
+  }
+
+  uint64_t now = k_ticks_to_us_floor64(k_uptime_ticks());
+  Startup::timestamps[(size_t)phase] = now;
+  k_event_post(&Startup::events, bit);
+
+  LOG_INF("Startup: %s at %u us", phaseNames[(size_t)phase], (uint32_t)now);
+
+  if (phase == StartupPhase::FIRST_ADVERTISING) {
+    LOG_INF("Startup: boot to discoverable %u us",
+            (uint32_t)bootToDiscoverableUs());
+  }
+  logIfComplete();
+}
+
+void Startup::expect(StartupPhase phase) {
+  atomic_or(&Startup::expected, (atomic_val_t)BIT((uint32_t)phase));
+  logIfComplete();
+}
+
+// A central-only topology never advertises and a peripheral-only one never
+// scans, so completion is whatever the created roles declared
+void Startup::logIfComplete() {
+  uint32_t wanted = BIT((uint32_t)StartupPhase::ROLES_READY) |
+                    (uint32_t)atomic_get(&Startup::expected);
+  if (k_event_test(&Startup::events, wanted) != wanted ||
+      !atomic_cas(&Startup::logged, 0, 1)) {
+    return;
+  }
+  logTimeline();
+}
+
+bool Startup::reached(StartupPhase phase) {
+  return k_event_test(&Startup::events, BIT((uint32_t)phase)) != 0;
+}
+
+uint64_t Startup::phaseUs(StartupPhase phase) {
+  return Startup::timestamps[(size_t)phase];
+}
+
+void Startup::logTimeline() {
+  for (size_t i = 0; i < (size_t)StartupPhase::COUNT; i++) {
+    if (!reached((StartupPhase)i)) {
+      LOG_INF("Startup: %-18s not reached", phaseNames[i]);
+      continue;
+    }
+    LOG_INF("Startup: %-18s %u us", phaseNames[i],
+            (uint32_t)Startup::timestamps[i]);
+  }
+}
+
+void Startup::btReady(int err) {
+  if (err) {
+    LOG_ERR("Bluetooth init failed (err %d)", err);
+    Startup::btError = err;
+  }
+
+  // Posted on failure too, so waiters can report the error
+  Startup::markPhase(StartupPhase::BT_READY);
+}
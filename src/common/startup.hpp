@@ -0,0 +1,46 @@
+#pragma once
+
+extern "C" {
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+}
+
+// Startup phases in dependency order, each recorded once
+enum class StartupPhase : uint8_t {
+  MAIN_STARTED,
+  BT_READY,
+  SETTINGS_LOADED,
+  ROLES_READY,
+  FIRST_ADVERTISING, // Boot to discoverable
+  FIRST_SCANNING,
+  COUNT
+};
+
+// Event-driven bring-up: bt_enable() reports readiness through its callback
+// and role objects mark their first advertising/scanning, so nothing waits on
+// a fixed delay. Timestamps are microseconds since boot. Role objects also
+// declare the phase they will reach when created, the timeline is logged
+// once the roles are ready and every declared phase was reached.
+class Startup {
+public:
+  static int begin();
+  static int waitFor(StartupPhase phase, k_timeout_t timeout = K_FOREVER);
+  static void markPhase(StartupPhase phase);
+  static void expect(StartupPhase phase);
+  static bool reached(StartupPhase phase);
+  static uint64_t phaseUs(StartupPhase phase);
+  static uint64_t bootToDiscoverableUs() {
+    return phaseUs(StartupPhase::FIRST_ADVERTISING);
+  }
+  static void logTimeline();
+
+private:
+  static void btReady(int err);
+  static void logIfComplete();
+
+  static struct k_event events;
+  static uint64_t timestamps[(size_t)StartupPhase::COUNT];
+  static int btError;
+  static atomic_t expected; // Phase bits the topology will reach
+  static atomic_t logged;
+};
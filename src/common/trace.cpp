@@ -0,0 +1,113 @@
+#include "trace.hpp"
+
+extern "C" {
+#include <zephyr/sys/printk.h>
+#include <zephyr/sys/util.h>
+#ifdef CONFIG_SHELL
+#include <zephyr/shell/shell.h>
+#endif
+}
+
+BUILD_ASSERT(IS_POWER_OF_TWO(TRACE_RECORDS),
+             "Trace ring size must be a power of two");
+BUILD_ASSERT(sizeof(struct trace_record) == 12, "Trace record layout");
+
+struct trace_ring Trace::_rings[TRACE_CPUS] = {};
+
+void Trace::emit(TraceEvent event, uint8_t arg0, uint16_t arg1,
+                 uint32_t arg2) {
+  // Rings are per CPU, so only local interrupts can interleave
+  unsigned int key = arch_irq_lock();
+  struct trace_ring &ring = _rings[arch_curr_cpu()->id];
+  struct trace_record &record =
+      ring.records[ring.head & (TRACE_RECORDS - 1)];
+  ring.head++;
+
+  record.cycles = k_cycle_get_32();
+  record.event = (uint8_t)event;
+  record.arg0 = arg0;
+  record.arg1 = arg1;
+  record.arg2 = arg2;
+  arch_irq_unlock(key);
+}
+
+void Trace::dump() {
+  for (uint8_t cpu = 0; cpu < TRACE_CPUS; cpu++) {
+    const struct trace_ring &ring = _rings[cpu];
+    uint32_t head = ring.head;
+    uint32_t count = MIN(head, (uint32_t)TRACE_RECORDS);
+
+    // Printed rather than logged, so log level overrides cannot hide it
+    printk("TRACE_BEGIN cpu=%u hz=%u count=%u overwritten=%u\n", cpu,
+           sys_clock_hw_cycles_per_sec(), count, head - count);
+
+    // Oldest first, one record per line
+    char hex[2 * sizeof(struct trace_record) + 1];
+    for (uint32_t i = head - count; i != head; i++) {
+      const struct trace_record &record =
+          ring.records[i & (TRACE_RECORDS - 1)];
+      bin2hex((const uint8_t *)&record, sizeof(record), hex, sizeof(hex));
+      printk("TRACE %s\n", hex);
+    }
+
+    printk("TRACE_END cpu=%u\n", cpu);
+  }
+}
+
+uint8_t Trace::read(uint8_t cpu, uint32_t start,
+                    struct trace_record *records, uint8_t max,
+                    uint32_t *first, uint32_t *head) {
+  // A page is a handful of records, short enough to hold off local emits
+  unsigned int key = arch_irq_lock();
+  const struct trace_ring &ring = _rings[cpu];
+  uint32_t end = ring.head;
+  uint32_t oldest = end - MIN(end, (uint32_t)TRACE_RECORDS);
+  uint32_t from = CLAMP(start, oldest, end);
+
+  uint8_t count = (uint8_t)MIN(end - from, (uint32_t)max);
+  for (uint8_t i = 0; i < count; i++) {
+    records[i] = ring.records[(from + i) & (TRACE_RECORDS - 1)];
+  }
+  arch_irq_unlock(key);
+
+  *first = from;
+  *head = end;
+  return count;
+}
+
+void Trace::clear() {
+  for (struct trace_ring &ring : _rings) {
+    unsigned int key = arch_irq_lock();
+    ring.head = 0;
+    arch_irq_unlock(key);
+  }
+}
+
+#ifdef CONFIG_SHELL
+static int cmdTraceDump(const struct shell *sh, size_t argc, char **argv) {
+  ARG_UNUSED(sh);
+  ARG_UNUSED(argc);
+  ARG_UNUSED(argv);
+
+  Trace::dump();
+  return 0;
+}
+
+static int cmdTraceClear(const struct shell *sh, size_t argc, char **argv) {
+  ARG_UNUSED(argc);
+  ARG_UNUSED(argv);
+
+  Trace::clear();
+  shell_print(sh, "Trace cleared");
+  return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+    trace_cmds,
+    SHELL_CMD(dump, NULL, "Print the trace rings for trace_decode.py",
+              cmdTraceDump),
+    SHELL_CMD(clear, NULL, "Drop all trace records", cmdTraceClear),
+    SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(trace, &trace_cmds, "Binary hot-path trace", NULL);
+#endif
@@ -0,0 +1,91 @@
+#pragma once
+
+extern "C" {
+#include <zephyr/kernel.h>
+}
+
+#ifdef CONFIG_BLUESIM_TRACE_RECORDS
+#define TRACE_RECORDS CONFIG_BLUESIM_TRACE_RECORDS
+#else
+#define TRACE_RECORDS 256
+#endif
+
+#ifdef CONFIG_MP_MAX_NUM_CPUS
+#define TRACE_CPUS CONFIG_MP_MAX_NUM_CPUS
+#else
+#define TRACE_CPUS 1
+#endif
+
+// Hot-path events. Values are part of the dump format, append only and keep
+// scripts/trace_decode.py in sync.
+enum class TraceEvent : uint8_t {
+  NONE = 0,
+  // arg0 central, arg1 rssi, arg2 low address bytes
+  SCAN_MATCH = 1,
+  SCAN_ALREADY_CONNECTED = 2, // arg0 central
+  STACK_SCAN_STARTED = 3,
+  STACK_SCAN_STOPPED = 4,
+  STACK_SCAN_ALREADY_ACTIVE = 5,
+  STACK_SCAN_NOT_ACTIVE = 6,
+  FILTER_GROUP_ADDED = 7,     // arg0 group
+  FILTER_CRITERION_ADDED = 8, // arg0 group, arg1 type, arg2 pattern prefix
+  FILTER_CRITERION_REJECTED = 9, // arg0 TraceReject reason
+  // arg0 central, arg1 slot, arg2 count | max << 8
+  CONNECTION_ADDED = 10,
+  CONNECTION_REMOVED = 11,
+  CONNECTION_SLOT_FULL = 12, // arg0 central
+  CONNECTION_NOT_FOUND = 13, // arg0 central
+  GATT_READ_DEFAULT = 14,    // arg1 attribute handle, arg2 len | offset << 16
+  GATT_WRITE_DEFAULT = 15,   // arg1 attribute handle, arg2 len | offset << 16
+  // arg0 connection index
+  CONN_PARAM_UPDATED = 16,    // arg1 interval, arg2 latency | timeout << 16
+  CONN_PHY_UPDATED = 17,      // arg1 tx phy | rx phy << 8
+  CONN_DATA_LEN_UPDATED = 18, // arg1 tx max len, arg2 rx max len
+  CONN_SECURITY_CHANGED = 19, // arg1 level, arg2 bt_security_err
+  STACK_SCAN_REJECTED = 20,   // arg0 StackScanState, arg1 requested state
+};
+
+enum class TraceReject : uint8_t {
+  NULL_PATTERN = 1,
+  PATTERN_TOO_LONG = 2,
+  INVALID_PATTERN = 3,
+  NO_GROUP = 4,
+  GROUP_FULL = 5,
+};
+
+// 12 bytes, dumped little endian as 24 hex digits
+struct trace_record {
+  uint32_t cycles; // k_cycle_get_32()
+  uint8_t event;
+  uint8_t arg0;
+  uint16_t arg1;
+  uint32_t arg2;
+};
+
+struct trace_ring {
+  struct trace_record records[TRACE_RECORDS];
+  uint32_t head; // Records written since the last clear
+};
+
+// Binary event trace for paths that run on the Bluetooth RX thread or in
+// GATT callbacks, where formatting a log line costs more than the work
+// itself. Each CPU writes its own ring with local interrupts locked and old
+// records are overwritten. "trace dump" prints the rings on the console and
+// the TRACE_DUMP RPC pages them out with read(), the host decodes either with
+// scripts/trace_decode.py.
+class Trace {
+public:
+  static void emit(TraceEvent event, uint8_t arg0 = 0, uint16_t arg1 = 0,
+                   uint32_t arg2 = 0);
+  static void dump();
+  // Copies up to max records of one CPU, oldest first, from record index
+  // start or the oldest one still in the ring. Returns the number copied,
+  // first is the index of the first copied record and head the ring's head.
+  static uint8_t read(uint8_t cpu, uint32_t start,
+                      struct trace_record *records, uint8_t max,
+                      uint32_t *first, uint32_t *head);
+  static void clear();
+
+private:
+  static struct trace_ring _rings[TRACE_CPUS];
+};
@@ -0,0 +1,373 @@
+#include "uart_stream.hpp"
+#include "../central/capture_format.hpp"
+#include <zephyr/logging/log.h>
+
+extern "C" {
+#include <zephyr/sys/byteorder.h>
+}
+
+LOG_MODULE_REGISTER(UART_STREAM, LOG_LEVEL_INF);
+
+const struct device *UartStream::_device = nullptr;
+struct k_spinlock UartStream::_lock = {};
+uint8_t UartStream::_buffers[2][STREAM_BUFFER_SIZE];
+size_t UartStream::_fill[2] = {0, 0};
+uint8_t UartStream::_active = 0;
+bool UartStream::_txBusy = false;
+uint8_t UartStream::_sequence = 0;
+int64_t UartStream::_lastReportUs = 0;
+bool UartStream::_scanReports = true;
+struct stream_stats UartStream::_stats = {};
+struct queued_work UartStream::_flushWork = {};
+struct queued_work UartStream::_statsWork = {};
+StreamReceiver UartStream::_receiver = nullptr;
+struct queued_work UartStream::_rxPollWork = {};
+#ifdef CONFIG_UART_ASYNC_API
+uint8_t UartStream::_rxBuffers[2][STREAM_RX_CHUNK];
+uint8_t UartStream::_rxNext = 0;
+#endif
+
+int UartStream::init() {
+  const struct device *device = DEVICE_DT_GET(DT_NODELABEL(uart1));
+  if (!device_is_ready(device)) {
+    LOG_ERR("Stream UART not ready");
+    return -ENODEV;
+  }
+
+#ifdef CONFIG_UART_ASYNC_API
+  int err = uart_callback_set(device, UartStream::uartCallback, nullptr);
+  if (err < 0) {
+    LOG_ERR("Failed to set stream UART callback (err %d)", err);
+    return err;
+  }
+#endif
+
+  WorkQueue::data.initWork(&_flushWork, flushAction);
+  WorkQueue::data.initWork(&_statsWork, statsAction);
+  WorkQueue::data.initWork(&_rxPollWork, rxPollAction);
+  _lastReportUs = k_ticks_to_us_floor64(k_uptime_ticks());
+  _device = device;
+
+  WorkQueue::data.schedule(&_statsWork, K_MSEC(STREAM_STATS_PERIOD_MS));
+  LOG_INF("Streaming on %s (%s)", device->name,
+          IS_ENABLED(CONFIG_UART_ASYNC_API) ? "async" : "polled");
+  return 0;
+}
+
+int UartStream::sendScanReport(const bt_addr_le_t *addr, int8_t rssi,
+                               uint8_t adv_type,
+                               const struct net_buf_simple *buf) {
+  if (!_device) {
+    return -ENODEV;
+  }
+
+  // Live reports from the RX thread and replayed ones from WorkQueue::data
+  // both get here, so the record is encoded straight into this call's frame
+  int64_t now = k_ticks_to_us_floor64(k_uptime_ticks());
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  int64_t elapsed = now - _lastReportUs;
+  _lastReportUs = now;
+  k_spin_unlock(&_lock, key);
+
+  struct capture_record record = {};
+  record.delta_us = (uint32_t)CLAMP(elapsed, 0, (int64_t)UINT32_MAX);
+  bt_addr_le_copy(&record.addr, addr);
+  record.rssi = rssi;
+  record.adv_type = adv_type;
+  record.ad_length = MIN(buf->len, CAPTURE_MAX_AD_LENGTH);
+  record.ad = buf->data;
+
+  uint8_t frame[STREAM_MAX_FRAME];
+  frame[0] = (uint8_t)StreamFrame::SCAN_REPORT;
+  size_t len = CaptureFormat::encode(record, &frame[2], sizeof(frame) - 2);
+  return enqueue(frame, len + 2);
+}
+
+int UartStream::sendNotification(uint16_t conn_handle, uint16_t attr_handle,
+                                 const void *data, uint16_t len) {
+  uint8_t header[4];
+  sys_put_le16(conn_handle, &header[0]);
+  sys_put_le16(attr_handle, &header[2]);
+
+  // Long values are truncated rather than dropped
+  size_t room = STREAM_MAX_FRAME - 2 - sizeof(header);
+  return sendParts(StreamFrame::GATT_NOTIFICATION, header, sizeof(header),
+                   (const uint8_t *)data, MIN(len, room));
+}
+
+int UartStream::send(StreamFrame type, const uint8_t *payload, size_t len) {
+  return sendParts(type, payload, len, nullptr, 0);
+}
+
+int UartStream::sendParts(StreamFrame type, const uint8_t *head,
+                          size_t head_len, const uint8_t *body,
+                          size_t body_len) {
+  if (!_device) {
+    return -ENODEV;
+  }
+
+  if (head_len + body_len + 2 > STREAM_MAX_FRAME) {
+    return -EMSGSIZE;
+  }
+
+  uint8_t frame[STREAM_MAX_FRAME];
+  frame[0] = (uint8_t)type;
+  memcpy(&frame[2], head, head_len);
+  if (body_len) {
+    memcpy(&frame[2 + head_len], body, body_len);
+  }
+  return enqueue(frame, head_len + body_len + 2);
+}
+
+// Stamps the sequence number into frame[1] and appends the encoded frame to
+// the active batch. The frame lives on the caller's stack, so producers on
+// different threads never share an encode buffer.
+int UartStream::enqueue(uint8_t *frame, size_t frameLen) {
+  // COBS overhead plus the delimiter
+  size_t worstCase = frameLen + frameLen / 254 + 2;
+
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+
+  // Dropped frames still take a sequence number so the host sees the gap
+  frame[1] = _sequence++;
+
+  size_t &fill = _fill[_active];
+  if (fill + worstCase > STREAM_BUFFER_SIZE) {
+    _stats.dropped++;
+    k_spin_unlock(&_lock, key);
+    return -ENOBUFS;
+  }
+
+  bool firstInBatch = fill == 0;
+  uint8_t *out = &_buffers[_active][fill];
+  size_t encoded = cobsEncode(frame, frameLen, out);
+  out[encoded++] = 0x00;
+  fill += encoded;
+  _stats.frames++;
+
+  // Half a buffer is worth a transfer right away
+  if (!_txBusy && fill >= STREAM_BUFFER_SIZE / 2) {
+    startTx();
+  }
+  k_spin_unlock(&_lock, key);
+
+  // Anything smaller goes out after STREAM_FLUSH_MS
+  if (firstInBatch) {
+    WorkQueue::data.schedule(&_flushWork, K_MSEC(STREAM_FLUSH_MS));
+  }
+
+  return 0;
+}
+
+int UartStream::setReceiver(StreamReceiver receiver) {
+  if (!_device) {
+    return -ENODEV;
+  }
+  if (_receiver) {
+    return -EALREADY;
+  }
+  _receiver = receiver;
+
+#ifdef CONFIG_UART_ASYNC_API
+  // The driver asks for the second buffer before the first one fills up
+  _rxNext = 1;
+  int err = uart_rx_enable(_device, _rxBuffers[0], STREAM_RX_CHUNK,
+                           STREAM_RX_TIMEOUT_US);
+  if (err < 0) {
+    LOG_ERR("Failed to enable stream UART receiver (err %d)", err);
+    _receiver = nullptr;
+    return err;
+  }
+#else
+  WorkQueue::data.schedule(&_rxPollWork, K_MSEC(STREAM_RX_POLL_MS));
+#endif
+  return 0;
+}
+
+struct stream_stats UartStream::stats() {
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  struct stream_stats stats = _stats;
+  k_spin_unlock(&_lock, key);
+  return stats;
+}
+
+// Hands the active batch to the UART and lets producers fill the other one.
+// Called with _lock held.
+void UartStream::startTx() {
+  if (_fill[_active] == 0) {
+    return;
+  }
+
+  _txBusy = true;
+  _active ^= 1;
+
+#ifdef CONFIG_UART_ASYNC_API
+  uint8_t tx = _active ^ 1;
+  int err = uart_tx(_device, _buffers[tx], _fill[tx], SYS_FOREVER_US);
+  if (err < 0) {
+    _stats.tx_errors++;
+    _fill[tx] = 0;
+    _txBusy = false;
+  }
+#else
+  WorkQueue::data.schedule(&_flushWork, K_NO_WAIT);
+#endif
+}
+
+// Releases the batch that was on the wire. Called with _lock held.
+void UartStream::txDone() {
+  uint8_t tx = _active ^ 1;
+  _stats.bytes += _fill[tx];
+  _stats.batches++;
+  _fill[tx] = 0;
+  _txBusy = false;
+
+  // Whatever piled up during the transfer goes next
+  startTx();
+}
+
+#ifdef CONFIG_UART_ASYNC_API
+void UartStream::uartCallback(const struct device *dev,
+                              struct uart_event *evt, void *user_data) {
+  ARG_UNUSED(user_data);
+
+  switch (evt->type) {
+  case UART_TX_ABORTED:
+  case UART_TX_DONE: {
+    k_spinlock_key_t key = k_spin_lock(&_lock);
+    if (evt->type == UART_TX_ABORTED) {
+      _stats.tx_errors++;
+    }
+    txDone();
+    k_spin_unlock(&_lock, key);
+    break;
+  }
+  case UART_RX_RDY:
+    _receiver(&evt->data.rx.buf[evt->data.rx.offset], evt->data.rx.len);
+    break;
+  case UART_RX_BUF_REQUEST:
+    uart_rx_buf_rsp(dev, _rxBuffers[_rxNext], STREAM_RX_CHUNK);
+    _rxNext ^= 1;
+    break;
+  case UART_RX_DISABLED:
+    // Line errors stop the receiver, host requests must keep flowing
+    _rxNext = 1;
+    uart_rx_enable(dev, _rxBuffers[0], STREAM_RX_CHUNK, STREAM_RX_TIMEOUT_US);
+    break;
+  default:
+    break;
+  }
+}
+#endif
+
+void UartStream::flushAction(struct k_work *work) {
+  ARG_UNUSED(work);
+
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  if (!_txBusy) {
+    startTx();
+  }
+
+#ifdef CONFIG_UART_ASYNC_API
+  k_spin_unlock(&_lock, key);
+#else
+  // Polled UART: this work item is the transfer
+  if (!_txBusy) {
+    k_spin_unlock(&_lock, key);
+    return;
+  }
+
+  uint8_t tx = _active ^ 1;
+  size_t len = _fill[tx];
+  k_spin_unlock(&_lock, key);
+
+  for (size_t i = 0; i < len; i++) {
+    uart_poll_out(_device, _buffers[tx][i]);
+  }
+
+  key = k_spin_lock(&_lock);
+  txDone();
+  k_spin_unlock(&_lock, key);
+#endif
+}
+
+void UartStream::statsAction(struct k_work *work) {
+  ARG_UNUSED(work);
+
+  struct stream_stats current = stats();
+  uint8_t payload[sizeof(current)];
+  sys_put_le32(current.frames, &payload[0]);
+  sys_put_le32(current.bytes, &payload[4]);
+  sys_put_le32(current.dropped, &payload[8]);
+  sys_put_le32(current.batches, &payload[12]);
+  sys_put_le32(current.tx_errors, &payload[16]);
+  send(StreamFrame::STATS, payload, sizeof(payload));
+
+  WorkQueue::data.schedule(&_statsWork, K_MSEC(STREAM_STATS_PERIOD_MS));
+}
+
+void UartStream::rxPollAction(struct k_work *work) {
+  ARG_UNUSED(work);
+
+  uint8_t chunk[STREAM_RX_CHUNK];
+  size_t len = 0;
+  while (uart_poll_in(_device, &chunk[len]) == 0) {
+    if (++len == sizeof(chunk)) {
+      _receiver(chunk, len);
+      len = 0;
+    }
+  }
+  if (len) {
+    _receiver(chunk, len);
+  }
+
+  WorkQueue::data.schedule(&_rxPollWork, K_MSEC(STREAM_RX_POLL_MS));
+}
+
+size_t UartStream::cobsEncode(const uint8_t *in, size_t len, uint8_t *out) {
+  size_t codeIndex = 0;
+  size_t outIndex = 1;
+  uint8_t code = 1;
+
+  for (size_t i = 0; i < len; i++) {
+    if (in[i] == 0) {
+      out[codeIndex] = code;
+      codeIndex = outIndex++;
+      code = 1;
+      continue;
+    }
+
+    out[outIndex++] = in[i];
+    if (++code == 0xFF) {
+      out[codeIndex] = code;
+      codeIndex = outIndex++;
+      code = 1;
+    }
+  }
+
+  out[codeIndex] = code;
+  return outIndex;
+}
+
+// Decodes one frame without its delimiter, returns 0 on malformed input.
+// The output never exceeds the input length.
+size_t UartStream::cobsDecode(const uint8_t *in, size_t len, uint8_t *out) {
+  size_t outIndex = 0;
+  size_t i = 0;
+
+  while (i < len) {
+    uint8_t code = in[i];
+    if (code == 0 || i + code > len) {
+      return 0;
+    }
+
+    memcpy(&out[outIndex], &in[i + 1], code - 1);
+    outIndex += code - 1;
+    i += code;
+    if (code < 0xFF && i < len) {
+      out[outIndex++] = 0x00;
+    }
+  }
+
+  return outIndex;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "work_queue.hpp"
+
+extern "C" {
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/uart.h>
+#include <zephyr/kernel.h>
+#include <zephyr/net/buf.h>
+}
+
+#ifdef CONFIG_BLUESIM_STREAM_BUFFER_SIZE
+#define STREAM_BUFFER_SIZE CONFIG_BLUESIM_STREAM_BUFFER_SIZE
+#else
+#define STREAM_BUFFER_SIZE 2048
+#endif
+
+#ifdef CONFIG_BLUESIM_STREAM_FLUSH_MS
+#define STREAM_FLUSH_MS CONFIG_BLUESIM_STREAM_FLUSH_MS
+#else
+#define STREAM_FLUSH_MS 5
+#endif
+
+// Host to device bytes arrive in chunks of this size
+#define STREAM_RX_CHUNK 64
+#define STREAM_RX_TIMEOUT_US 1000
+#define STREAM_RX_POLL_MS 2
+
+// Largest frame before COBS encoding: type, sequence and payload
+#define STREAM_MAX_FRAME 258
+#define STREAM_STATS_PERIOD_MS 1000
+
+// First byte of every decoded frame, keep scripts/stream_decode.py in sync
+enum class StreamFrame : uint8_t {
+  SCAN_REPORT = 1,       // capture_format.hpp record
+  GATT_NOTIFICATION = 2, // conn handle (2), attr handle (2), value
+  STATS = 3,             // struct stream_stats, little endian
+  RPC_RESPONSE = 4,      // rpc.hpp response
+  RPC_REQUEST = 0x80,    // Host to device, rpc.hpp request
+};
+
+// Receives raw host to device bytes: from the UART ISR with the async API,
+// from WorkQueue::data when polled
+using StreamReceiver = void (*)(const uint8_t *data, size_t len);
+
+struct stream_stats {
+  uint32_t frames;
+  uint32_t bytes; // Encoded bytes handed to the UART
+  uint32_t dropped;
+  uint32_t batches;
+  uint32_t tx_errors;
+};
+
+// Sniffer output on uart1: frames are COBS encoded and 0x00 delimited, so a
+// host can resynchronise at any byte. Producers append to one of two batch
+// buffers while the other is on the wire through the async (DMA) UART API. A
+// frame that does not fit is dropped and counted, producers never block.
+// Boards without async UART support (native_sim) drain the same batches with
+// polled output from WorkQueue::data. The receive direction carries host
+// requests to a single registered receiver.
+class UartStream {
+public:
+  static int init();
+  static bool isReady() { return _device != nullptr; }
+
+  static int sendScanReport(const bt_addr_le_t *addr, int8_t rssi,
+                            uint8_t adv_type, const struct net_buf_simple *buf);
+  static int sendNotification(uint16_t conn_handle, uint16_t attr_handle,
+                              const void *data, uint16_t len);
+  static int send(StreamFrame type, const uint8_t *payload, size_t len);
+  static struct stream_stats stats();
+
+  // Scan reports can be muted at runtime, e.g. to keep the link free for
+  // host requests
+  static void setScanReports(bool enabled) { _scanReports = enabled; }
+  static bool scanReports() { return _scanReports; }
+
+  static int setReceiver(StreamReceiver receiver);
+  static size_t cobsDecode(const uint8_t *in, size_t len, uint8_t *out);
+
+  static void flushAction(struct k_work *work);
+  static void statsAction(struct k_work *work);
+  static void rxPollAction(struct k_work *work);
+
+private:
+  static int sendParts(StreamFrame type, const uint8_t *head, size_t head_len,
+                       const uint8_t *body, size_t body_len);
+  static int enqueue(uint8_t *frame, size_t frameLen);
+  static void startTx();
+  static void txDone();
+  static size_t cobsEncode(const uint8_t *in, size_t len, uint8_t *out);
+#ifdef CONFIG_UART_ASYNC_API
+  static void uartCallback(const struct device *dev, struct uart_event *evt,
+                           void *user_data);
+#endif
+
+  static const struct device *_device;
+  static struct k_spinlock _lock;
+  static uint8_t _buffers[2][STREAM_BUFFER_SIZE];
+  static size_t _fill[2];
+  static uint8_t _active; // Buffer producers append to
+  static bool _txBusy;
+  static uint8_t _sequence;
+  static int64_t _lastReportUs; // Guarded by _lock
+  static bool _scanReports;
+  static struct stream_stats _stats;
+  static struct queued_work _flushWork;
+  static struct queued_work _statsWork;
+  static StreamReceiver _receiver;
+  static struct queued_work _rxPollWork;
+#ifdef CONFIG_UART_ASYNC_API
+  static uint8_t _rxBuffers[2][STREAM_RX_CHUNK];
+  static uint8_t _rxNext;
+#endif
+};
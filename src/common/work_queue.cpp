@@ -0,0 +1,166 @@
+#include "work_queue.hpp"
+#include <zephyr/logging/log.h>
+
+extern "C" {
+#ifdef CONFIG_SHELL
+#include <zephyr/shell/shell.h>
+#endif
+}
+
+LOG_MODULE_REGISTER(WORK_QUEUE, LOG_LEVEL_INF);
+
+K_THREAD_STACK_DEFINE(radio_workq_stack, RADIO_WORKQ_STACK_SIZE);
+K_THREAD_STACK_DEFINE(data_workq_stack, DATA_WORKQ_STACK_SIZE);
+
+WorkQueue WorkQueue::radio("bluesim_radio", RADIO_WORKQ_PRIORITY);
+WorkQueue WorkQueue::data("bluesim_data", DATA_WORKQ_PRIORITY);
+
+WorkQueue::WorkQueue(const char *name, int priority)
+    : _name(name), _priority(priority), _executed(ATOMIC_INIT(0)),
+      _backlog(ATOMIC_INIT(0)), _maxBacklog(ATOMIC_INIT(0)),
+      _lastLatencyUs(0), _maxLatencyUs(0), _totalLatencyUs(0) {}
+
+void WorkQueue::startAll() {
+  WorkQueue::radio.start(radio_workq_stack,
+                         K_THREAD_STACK_SIZEOF(radio_workq_stack));
+  WorkQueue::data.start(data_workq_stack,
+                        K_THREAD_STACK_SIZEOF(data_workq_stack));
+}
+
+void WorkQueue::start(k_thread_stack_t *stack, size_t stack_size) {
+  struct k_work_queue_config config = {
+      .name = _name,
+      .no_yield = false,
+  };
+
+  k_work_queue_init(&_queue);
+  k_work_queue_start(&_queue, stack, stack_size, _priority, &config);
+  LOG_INF("Work queue %s started (priority %d)", _name, _priority);
+}
+
+void WorkQueue::initWork(struct queued_work *work, k_work_handler_t handler) {
+  k_work_init_delayable(&work->dwork, WorkQueue::trampoline);
+  work->handler = handler;
+  work->queue = this;
+  work->due_ticks = 0;
+  atomic_set(&work->pending, 0);
+}
+
+static int64_t dueTicks(k_timeout_t delay) {
+  return k_uptime_ticks() +
+         (K_TIMEOUT_EQ(delay, K_NO_WAIT) ? 0 : (int64_t)delay.ticks);
+}
+
+void WorkQueue::countPending() {
+  atomic_val_t backlog = atomic_inc(&_backlog) + 1;
+  if (backlog > atomic_get(&_maxBacklog)) {
+    atomic_set(&_maxBacklog, backlog);
+  }
+}
+
+int WorkQueue::schedule(struct queued_work *work, k_timeout_t delay) {
+  work->due_ticks = dueTicks(delay);
+
+  // Rescheduling an item that is already pending does not grow the backlog.
+  // Marked before submitting, the queue thread may preempt the caller.
+  if (!atomic_test_and_set_bit(&work->pending, 0)) {
+    countPending();
+  }
+
+  int err = k_work_reschedule_for_queue(&_queue, &work->dwork, delay);
+  if (err < 0 && atomic_test_and_clear_bit(&work->pending, 0)) {
+    atomic_dec(&_backlog);
+  }
+
+  return err;
+}
+
+int WorkQueue::scheduleIfIdle(struct queued_work *work, k_timeout_t delay) {
+  // Only the caller that flips the bit submits, so producers racing on the
+  // same item submit it once
+  if (atomic_test_and_set_bit(&work->pending, 0)) {
+    return 0;
+  }
+  countPending();
+
+  work->due_ticks = dueTicks(delay);
+  int err = k_work_schedule_for_queue(&_queue, &work->dwork, delay);
+  if (err < 0 && atomic_test_and_clear_bit(&work->pending, 0)) {
+    atomic_dec(&_backlog);
+  }
+
+  return err;
+}
+
+int WorkQueue::cancel(struct queued_work *work) {
+  int err = k_work_cancel_delayable(&work->dwork);
+  if (atomic_test_and_clear_bit(&work->pending, 0)) {
+    atomic_dec(&_backlog);
+  }
+  return err;
+}
+
+int WorkQueue::cancelSync(struct queued_work *work) {
+  struct k_work_sync sync;
+  bool busy = k_work_cancel_delayable_sync(&work->dwork, &sync);
+  if (atomic_test_and_clear_bit(&work->pending, 0)) {
+    atomic_dec(&_backlog);
+  }
+  return busy ? 1 : 0;
+}
+
+struct work_queue_stats WorkQueue::stats() const {
+  struct work_queue_stats stats = {
+      .executed = (uint32_t)atomic_get(&_executed),
+      .backlog = (uint32_t)atomic_get(&_backlog),
+      .max_backlog = (uint32_t)atomic_get(&_maxBacklog),
+      .last_latency_us = _lastLatencyUs,
+      .max_latency_us = _maxLatencyUs,
+      .total_latency_us = _totalLatencyUs,
+  };
+  return stats;
+}
+
+void WorkQueue::trampoline(struct k_work *work) {
+  struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+  struct queued_work *self = CONTAINER_OF(dwork, struct queued_work, dwork);
+  WorkQueue *queue = self->queue;
+
+  // Latency and counters are only written from the queue's own thread
+  int64_t late = k_uptime_ticks() - self->due_ticks;
+  uint32_t latency = late > 0 ? (uint32_t)k_ticks_to_us_floor64(late) : 0;
+  queue->_lastLatencyUs = latency;
+  queue->_maxLatencyUs = MAX(queue->_maxLatencyUs, latency);
+  queue->_totalLatencyUs += latency;
+  atomic_inc(&queue->_executed);
+
+  if (atomic_test_and_clear_bit(&self->pending, 0)) {
+    atomic_dec(&queue->_backlog);
+  }
+
+  self->handler(work);
+}
+
+#ifdef CONFIG_SHELL
+static void printStats(const struct shell *sh, const WorkQueue &queue) {
+  struct work_queue_stats s = queue.stats();
+  uint32_t avg = s.executed ? (uint32_t)(s.total_latency_us / s.executed) : 0;
+  shell_print(sh,
+              "%s: executed %u, backlog %u (max %u), latency avg %u us, "
+              "max %u us",
+              queue.name(), s.executed, s.backlog, s.max_backlog, avg,
+              s.max_latency_us);
+}
+
+static int cmdWorkqStats(const struct shell *sh, size_t argc, char **argv) {
+  ARG_UNUSED(argc);
+  ARG_UNUSED(argv);
+
+  printStats(sh, WorkQueue::radio);
+  printStats(sh, WorkQueue::data);
+  return 0;
+}
+
+SHELL_CMD_REGISTER(workq, NULL, "Work queue backlog and scheduling latency",
+                   cmdWorkqStats);
+#endif
@@ -0,0 +1,72 @@
+#pragma once
+
+extern "C" {
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+}
+
+#define RADIO_WORKQ_STACK_SIZE 2048
+#define RADIO_WORKQ_PRIORITY K_PRIO_COOP(7)
+#define DATA_WORKQ_STACK_SIZE 2048
+#define DATA_WORKQ_PRIORITY K_PRIO_PREEMPT(5)
+
+class WorkQueue;
+
+// Delayable work item bound to a BlueSim work queue. The handler receives the
+// k_work of the embedded delayable, so CONTAINER_OF on a queued_work member
+// works exactly as it does on a k_work_delayable.
+struct queued_work {
+  struct k_work_delayable dwork;
+  k_work_handler_t handler;
+  WorkQueue *queue;
+  int64_t due_ticks;
+  atomic_t pending;
+};
+
+struct work_queue_stats {
+  uint32_t executed;
+  uint32_t backlog;     // Items scheduled but not yet run
+  uint32_t max_backlog;
+  uint32_t last_latency_us; // Due time to start of the handler
+  uint32_t max_latency_us;
+  uint64_t total_latency_us;
+};
+
+class WorkQueue {
+public:
+  WorkQueue(const char *name, int priority);
+
+  void start(k_thread_stack_t *stack, size_t stack_size);
+  void initWork(struct queued_work *work, k_work_handler_t handler);
+  int schedule(struct queued_work *work, k_timeout_t delay);
+  // Leaves an item that is already pending, and its deadline, alone. 1 when
+  // this call submitted it.
+  int scheduleIfIdle(struct queued_work *work, k_timeout_t delay);
+  int cancel(struct queued_work *work);
+  // Also waits for a handler already running, for owners going away. Never
+  // from the item's own handler. 1 when the item was pending or running.
+  int cancelSync(struct queued_work *work);
+
+  struct work_queue_stats stats() const;
+  const char *name() const { return _name; }
+
+  // Scan and advertising transitions
+  static WorkQueue radio;
+  // Application data (generators, notifications, host requests)
+  static WorkQueue data;
+  static void startAll();
+
+private:
+  static void trampoline(struct k_work *work);
+  void countPending();
+
+  const char *_name;
+  int _priority;
+  struct k_work_q _queue;
+  atomic_t _executed;
+  atomic_t _backlog;
+  atomic_t _maxBacklog;
+  uint32_t _lastLatencyUs;
+  uint32_t _maxLatencyUs;
+  uint64_t _totalLatencyUs;
+};
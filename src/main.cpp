@@ -1,167 +1,151 @@
 #include "central/central.hpp"
+#include "bench/gatt_bench.hpp"
+#include "bench/scale_bench.hpp"
 #include "central/filter.hpp"
+#include "central/link_latency.hpp"
+#include "central/scan_capture.hpp"
+#include "common/coc_channel.hpp"
+#include "common/connection_bus.hpp"
+#include "common/link_scheduler.hpp"
+#include "common/memory_budget.hpp"
+#include "common/pairing.hpp"
+#include "common/startup.hpp"
+#include "common/uart_stream.hpp"
+#include "common/work_queue.hpp"
 #include "peripheral/advertisement.hpp"
 #include "peripheral/characteristic.hpp"
+#include "peripheral/identity_pool.hpp"
 #include "peripheral/peripheral.hpp"
 #include "peripheral/service.hpp"
+#include "roles/role_pools.hpp"
+#include "rpc/rpc.hpp"
+#include "scenario/scenario.hpp"
 #include <zephyr/logging/log.h>
 
 extern "C" {
 #include <zephyr/bluetooth/bluetooth.h>
 #include <zephyr/bluetooth/conn.h>
+#include <zephyr/settings/settings.h>
 }
 
 LOG_MODULE_REGISTER(MAIN, LOG_LEVEL_DBG);
 
-// Global connection callbacks that dispatch to appropriate instances
-static void global_bt_conn_cb_connected(struct bt_conn *conn, uint8_t err) {
-  struct bt_conn_info info;
-  if (bt_conn_get_info(conn, &info) == 0) {
-    if (info.role == BT_CONN_ROLE_PERIPHERAL) {
-      for (uint8_t i = 0; i < MAX_PERIPHERALS; i++) {
-        if (Peripheral::registry[i]) {
-          if (Peripheral::registry[i]->_advertisement->_id == info.id) {
-            Peripheral::registry[i]->onConnected(conn, err);
-            return;
-          }
-        }
-
-        LOG_WRN("No available peripheral found for connection %d", info.id);
-      }
-    } else if (info.role == BT_CONN_ROLE_CENTRAL) {
-      for (uint8_t i = 0; i < MAX_CENTRALS; i++) {
-        if (Central::registry[i]) {
-          if (Central::fromConn(conn) == Central::registry[i]) {
-            Central::registry[i]->onConnected(conn, err);
-            return;
-          }
-        }
-      }
-
-      LOG_WRN("No available central found for connection");
-    }
+int main() {
+  // BlueSim work runs on its own queues instead of the system workqueue
+  WorkQueue::startAll();
+
+  if (IS_ENABLED(CONFIG_BLUESIM_LINK_LATENCY)) {
+    LinkLatency::init();
   }
-}
 
-static void global_bt_conn_cb_disconnected(struct bt_conn *conn,
-                                           uint8_t reason) {
-  struct bt_conn_info info;
-  if (bt_conn_get_info(conn, &info) == 0) {
-    if (info.role == BT_CONN_ROLE_PERIPHERAL) {
-      Peripheral *peripheral = Peripheral::fromConn(conn);
-      if (peripheral) {
-        peripheral->onDisconnected(conn, reason);
-      } else {
-        LOG_ERR("Disconnected connection not associated with any peripheral");
-      }
-    } else if (info.role == BT_CONN_ROLE_CENTRAL) {
-      Central *central = Central::fromConn(conn);
-      if (central) {
-        if (Central::fromConn(conn) == central) {
-          central->onDisconnected(conn, reason);
-          return;
-        }
-      } else {
-        LOG_ERR("Disconnected connection not associated with any central");
-      }
-    }
+  if (IS_ENABLED(CONFIG_BLUESIM_STREAM)) {
+    UartStream::init();
   }
-}
 
-static struct bt_conn_cb global_conn_cb = {
-    .connected = global_bt_conn_cb_connected,
-    .disconnected = global_bt_conn_cb_disconnected,
-};
+  if (IS_ENABLED(CONFIG_BLUESIM_RPC)) {
+    Rpc::init();
+  }
 
-int main() {
-  int err = bt_enable(nullptr);
+  if (IS_ENABLED(CONFIG_BLUESIM_NOTIFY_SINK)) {
+    NotificationSink::init();
+  }
+
+  int err = Startup::begin();
+  if (err < 0) {
+    return err;
+  }
+
+  // Event-driven: continues as soon as bt_enable() reports ready
+  err = Startup::waitFor(StartupPhase::BT_READY);
+  if (err < 0) {
+    return err;
+  }
+
+  // Restore stored identities and their device mapping before any
+  // advertisement acquires one
+  err = IdentityPool::init();
+  if (err < 0) {
+    return err;
+  }
+
+  err = settings_load();
   if (err < 0) {
-    LOG_ERR("Bluetooth init failed (err %d)", err);
+    LOG_ERR("Settings load failed (err %d)", err);
     return err;
   }
+  Startup::markPhase(StartupPhase::SETTINGS_LOADED);
 
-  // Register global connection callbacks
-  bt_conn_cb_register(&global_conn_cb);
+  // One bt_conn_cb for every role, events go to the connection's owner
+  ConnectionBus::init();
+  if (IS_ENABLED(CONFIG_BLUESIM_LINK_SCHEDULER)) {
+    LinkScheduler::init();
+  }
+  if (IS_ENABLED(CONFIG_BLUESIM_PAIRING)) {
+    // Bonds came in with settings_load above
+    Pairing::init();
+  }
+
+  if (IS_ENABLED(CONFIG_BLUESIM_L2CAP_COC)) {
+    CocChannels::init();
+    Peripheral::listenCoc(COC_PSM,
+                          IS_ENABLED(CONFIG_BLUESIM_L2CAP_SERVER_SOURCE)
+                              ? CocMode::SOURCE
+                              : CocMode::SINK);
+  }
 
   LOG_INF("Bluetooth initialized");
 
-  // Wait for BLE stack to be fully ready
-  k_sleep(K_MSEC(100));
+  if (IS_ENABLED(CONFIG_BLUESIM_BENCH_SCALE)) {
+    // The benchmark builds its own topology
+    Startup::markPhase(StartupPhase::ROLES_READY);
+    return ScaleBench::run();
+  }
 
-  // Peripheral p1;
-  Central c1;
-  Central c2;
+  if (IS_ENABLED(CONFIG_BLUESIM_BENCH_GATT)) {
+    Startup::markPhase(StartupPhase::ROLES_READY);
+    return GattBench::run();
+  }
+
+  // Replay has to be running before the scanners start so the controller is
+  // left alone
+  if (IS_ENABLED(CONFIG_BLUESIM_SCAN_CAPTURE_BOOT_RECORD)) {
+    ScanCapture::start();
+  } else if (IS_ENABLED(CONFIG_BLUESIM_SCAN_CAPTURE_BOOT_REPLAY)) {
+    ScanReplay::start(CAPTURE_REPLAY_SPEED);
+  }
+
+  // Scenario objects live in static storage, main has nothing to keep alive
+  if (IS_ENABLED(CONFIG_BLUESIM_SCENARIO) &&
+      Scenario::loadFromPartition() == 0) {
+    Startup::markPhase(StartupPhase::ROLES_READY);
+    MemoryBudget::printReport();
+    return 0;
+  }
+
+  Central *c1 = RolePools::centrals.emplace();
+  Central *c2 = RolePools::centrals.emplace();
+  if (!c1 || !c2) {
+    LOG_ERR("Central pool exhausted");
+    return -ENOMEM;
+  }
 
   Filter filter1;
   filter1.addGroup();
   filter1.addCriterion(FilterCriterionType::LOCAL_NAME, "Mikael1");
-  c1.addFilter(filter1);
+  c1->addFilter(filter1);
 
   Filter filter2;
   filter2.addGroup();
   filter2.addCriterion(FilterCriterionType::LOCAL_NAME, "Mikael2");
-  c2.addFilter(filter2);
-
-  c1.scheduleScanningStart();
-  c2.scheduleScanningStart();
-
-  // // Initialize advertisement
-  // Advertisement advertisement;
-  // int init_result = advertisement.init("Simulator");
-  // if (init_result) {
-  //   LOG_ERR("Failed to initialize advertisement (err %d)", init_result);
-  //   return init_result;
-  // }
-
-  // Service service;
-  // Characteristic readChar, writeChar;
-
-  // bt_uuid_128 service_uuid = BT_UUID_INIT_128(
-  //     BT_UUID_128_ENCODE(0x6e2f84f2, 0x6f5a, 0x48c4, 0x9873,
-  //     0xc77acce33964));
-  // bt_uuid_128 read_uuid = BT_UUID_INIT_128(
-  //     BT_UUID_128_ENCODE(0x03ba1869, 0xeb49, 0x48de, 0x9213,
-  //     0x508d2304e80b));
-  // bt_uuid_128 write_uuid = BT_UUID_INIT_128(
-  //     BT_UUID_128_ENCODE(0x4bb53da6, 0x42bc, 0x430f, 0x95fa,
-  //     0xc99a44b38e14));
-
-  // service.init(&service_uuid.uuid, "Custom Service 1");
-  // readChar.init(&read_uuid.uuid, CharProperty::READ | CharProperty::NOTIFY,
-  //               CharPermission::PERM_READ, "Read-notify characteristic");
-  // writeChar.init(&write_uuid.uuid, CharProperty::WRITE,
-  //                CharPermission::PERM_WRITE, "Write-only characteristic");
-
-  // int result = service.addCharacteristic(&readChar);
-  // if (result != 1) {
-  //   LOG_ERR("Failed to add read characteristic (err %d)", result);
-  //   return -1;
-  // }
-
-  // result = service.addCharacteristic(&writeChar);
-  // if (result != 1) {
-  //   LOG_ERR("Failed to add write characteristic (err %d)", result);
-  //   return -1;
-  // }
-
-  // // Build the service before registering
-  // result = service.buildService();
-  // if (result != 0) {
-  //   LOG_ERR("Failed to build service (err %d)", result);
-  //   return -1;
-  // }
-
-  // // Add services and the advertisement to the peripheral
-  // p1.addAdvertisement(&advertisement);
-  // p1.addService(&service);
-  // p1.registerServices();
-
-  // // Start advertising
-  // int advertising_result = advertisement.startAdvertising();
-  // if (advertising_result) {
-  //   LOG_ERR("Failed to start advertising (err %d)", advertising_result);
-  //   return advertising_result;
-  // }
+  c2->addFilter(filter2);
+  Startup::markPhase(StartupPhase::ROLES_READY);
+  MemoryBudget::printReport();
+
+  c1->scheduleScanningStart();
+  c2->scheduleScanningStart();
+
+  // Peripheral topologies are described by scenario images, see
+  // scenarios/default.json
 
   // Main loop (Zephyr threads will handle advertising & connections)
   while (true) {
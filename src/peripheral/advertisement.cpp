@@ -1,4 +1,6 @@
 #include "advertisement.hpp"
+#include "../common/startup.hpp"
+#include "identity_pool.hpp"
 #include <zephyr/logging/log.h>
 
 LOG_MODULE_REGISTER(ADVERTISEMENT, LOG_LEVEL_INF);
@@ -6,12 +8,23 @@ LOG_MODULE_REGISTER(ADVERTISEMENT, LOG_LEVEL_INF);
 Advertisement *Advertisement::registry[MAX_ADVERTISEMENTS] = {nullptr};
 struct bt_le_ext_adv_cb Advertisement::_extendedAdvCb = {};
 
-// Advertisement startup delay
-constexpr int kAdvStartDelayMs = 50;
+// Retry delay when the stack rejects a restart for a transient reason
+constexpr int kAdvRetryDelayMs = 5;
 
-Advertisement::Advertisement() : _index(0), _id(0), _isAdvertising(false) {
+// Bits of _events, set by the stack callbacks and handled on the radio queue
+enum {
+  ADV_EVENT_CONNECTED, // The set stopped for a new link
+  ADV_EVENT_FINISHED,  // Limited advertising ran to completion
+};
+
+static uint64_t nowUs() { return k_ticks_to_us_floor64(k_uptime_ticks()); }
+
+Advertisement::Advertisement() : _index(0), _id(0) {
+  Startup::expect(StartupPhase::FIRST_ADVERTISING);
   memset(_localName, 0, sizeof(_localName));
   memset(&_advert, 0, sizeof(_advert));
+  memset(&_stats, 0, sizeof(_stats));
+  memset(_periodicPayload, 0, sizeof(_periodicPayload));
 
   for (uint8_t i = 0; i < MAX_ADVERTISEMENTS; ++i) {
     if (!Advertisement::registry[i]) {
@@ -27,15 +40,29 @@ Advertisement::Advertisement() : _index(0), _id(0), _isAdvertising(false) {
 }
 
 Advertisement::~Advertisement() {
-  if (_isAdvertising) {
+  if (_isPeriodicAdvertising) {
+    stopPeriodic();
+  }
+  if (state() != AdvState::IDLE) {
     stopAdvertising();
   }
-}
 
-int Advertisement::init(const char *advertiser_name) {
-  // Generate a simple ID based on memory address for uniqueness
-  _id = bt_id_create(NULL, NULL);
+  // Free the advertising set and hand the identity back to the pool
+  if (_advert.adv) {
+    bt_le_ext_adv_delete(_advert.adv);
+    _advert.adv = nullptr;
+    IdentityPool::release(_id);
+  }
+
+  // After the set is gone, so no stack event can schedule it again. The
+  // work item only exists once init() got an identity.
+  if (_advert.work.queue) {
+    WorkQueue::radio.cancelSync(&_advert.work);
+  }
+  Advertisement::registry[_index] = nullptr;
+}
 
+int Advertisement::init(const char *advertiser_name, bool connectable) {
   if (advertiser_name && strlen(advertiser_name) > 0) {
     strncpy(_localName, advertiser_name, sizeof(_localName) - 1);
     _localName[sizeof(_localName) - 1] = '\0';
@@ -44,21 +71,38 @@ int Advertisement::init(const char *advertiser_name) {
     _localName[sizeof(_localName) - 1] = '\0';
   }
 
-  // Initialize the work item
-  k_work_init_delayable(&_advert.work, workAction);
+  // The local name identifies the simulated device, so it keeps its
+  // identity (and address) across re-creation and reboots
+  int id = IdentityPool::acquire(_localName);
+  if (id < 0) {
+    LOG_ERR("Advertisement %d failed to acquire an identity (err %d)", _index,
+            id);
+    return id;
+  }
+  _id = id;
+
+  // Advertising transitions run on the radio control queue
+  WorkQueue::radio.initWork(&_advert.work, workAction);
 
   // Fill by field
   _advParam.id = BT_ID_DEFAULT;
   _advParam.sid = 0;
   _advParam.secondary_max_skip = 0;
-  _advParam.options = BT_LE_ADV_OPT_EXT_ADV | BT_LE_ADV_OPT_CONNECTABLE;
+  // Periodic advertising requires a non-connectable, non-scannable set
+  _isConnectable = connectable;
+  _advParam.options = BT_LE_ADV_OPT_EXT_ADV;
+  if (_isConnectable) {
+    _advParam.options |= BT_LE_ADV_OPT_CONNECTABLE;
+  }
   _advParam.interval_min = BT_GAP_ADV_FAST_INT_MIN_2;
   _advParam.interval_max = BT_GAP_ADV_FAST_INT_MAX_2;
   _advParam.peer = NULL;
   _advParam.id = _id;
 
   Advertisement::_extendedAdvCb = {
+      .sent = extAdvSentCb,
       .connected = extAdvConnectedCb,
+      .scanned = extAdvScannedCb,
   };
 
   // Create the extended advertisement
@@ -66,6 +110,7 @@ int Advertisement::init(const char *advertiser_name) {
                                  &_advert.adv);
   if (err < 0) {
     LOG_ERR("Failed to create adv for id %d (err %d)", _index, err);
+    IdentityPool::release(_id);
     return err;
   }
   LOG_INF("Advertisement %d created adv %p", _index, _advert.adv);
@@ -77,6 +122,9 @@ int Advertisement::init(const char *advertiser_name) {
   err = bt_le_ext_adv_set_data(_advert.adv, _advert.adv_data, 1, nullptr, 0);
   if (err < 0) {
     LOG_ERR("Advertisement %d failed to set adv data (err %d)", _index, err);
+    bt_le_ext_adv_delete(_advert.adv);
+    _advert.adv = nullptr;
+    IdentityPool::release(_id);
     return err;
   }
 
@@ -86,21 +134,23 @@ int Advertisement::init(const char *advertiser_name) {
 }
 
 int Advertisement::startAdvertising() {
-  // Schedule the work item to handle advertising after delay
-  int err = k_work_reschedule(&_advert.work, K_MSEC(kAdvStartDelayMs));
-  if (err < 0) {
-    LOG_ERR("Advertisement %d failed to schedule work item (err %d)", _index,
-            err);
-    return err;
+  atomic_set(&_shouldAdvertise, 1);
+  if (state() == AdvState::ADVERTISING) {
+    LOG_INF("Advertisement %d is already advertising", _index);
+    return 0;
   }
 
-  LOG_INF("Advertiser %d work item scheduled for %dms", _index,
-          kAdvStartDelayMs);
-  return 0;
+  // Start right away, the state machine takes care of retries
+  return resumeAdvertising();
 }
 
 int Advertisement::stopAdvertising() {
-  if (!_isAdvertising) {
+  atomic_clear(&_shouldAdvertise);
+  WorkQueue::radio.cancel(&_advert.work);
+
+  if (state() != AdvState::ADVERTISING) {
+    // The stack already stopped the set, just drop the pending resume
+    enterState(AdvState::IDLE);
     LOG_INF("Advertisement %d is not advertising", _index);
     return 0;
   }
@@ -111,35 +161,182 @@ int Advertisement::stopAdvertising() {
             err);
     return err;
   }
-  _isAdvertising = false;
+  enterState(AdvState::IDLE);
   LOG_INF("Advertisement %d stopped advertising", _index);
 
   return 0;
 }
 
-bool Advertisement::isAdvertising() const { return _isAdvertising; }
+void Advertisement::scheduleStart() {
+  atomic_set(&_shouldAdvertise, 1);
+  WorkQueue::radio.schedule(&_advert.work, K_NO_WAIT);
+}
 
-void Advertisement::workAction(struct k_work *work) {
-  // Recover the Advertisement instance from the k_work pointer
-  Advertisement *self = CONTAINER_OF(work, Advertisement, _advert.work);
+void Advertisement::scheduleStop() {
+  atomic_clear(&_shouldAdvertise);
+  WorkQueue::radio.schedule(&_advert.work, K_NO_WAIT);
+}
 
-  if (self->_isAdvertising) {
-    LOG_INF("Advertisement %d is already advertising", self->_index);
-    return;
-  }
+bool Advertisement::isAdvertising() const {
+  return state() == AdvState::ADVERTISING;
+}
 
+int Advertisement::resumeAdvertising() {
   // Stack param: BT_LE_EXT_ADV_START_DEFAULT is a C compound-literal pointer
   // (invalid in C++).
   struct bt_le_ext_adv_start_param start_param =
       BT_LE_EXT_ADV_START_PARAM_INIT(0, 0);
-  int err = bt_le_ext_adv_start(self->_advert.adv, &start_param);
+  int err = bt_le_ext_adv_start(_advert.adv, &start_param);
+
+  if (err == 0 || err == -EALREADY) {
+    enterState(AdvState::ADVERTISING);
+    Startup::markPhase(StartupPhase::FIRST_ADVERTISING);
+    LOG_INF("Advertisement %d started advertising successfully", _index);
+    return 0;
+  }
+
+  if (err == -ENOMEM) {
+    // No free connection object, resumed from onConnectionRecycled()
+    enterState(AdvState::WAITING_FOR_SLOT);
+    LOG_INF("Advertisement %d waiting for a free connection slot", _index);
+    return 0;
+  }
+
+  enterState(AdvState::SUSPENDED);
+  LOG_WRN("Advertisement %d failed to start advertising (err %d), retrying",
+          _index, err);
+  WorkQueue::radio.schedule(&_advert.work, K_MSEC(kAdvRetryDelayMs));
+  return err;
+}
 
+void Advertisement::enterState(AdvState state) {
+  AdvState current = this->state();
+  bool wasOff = current == AdvState::SUSPENDED ||
+                current == AdvState::WAITING_FOR_SLOT;
+  bool isOff =
+      state == AdvState::SUSPENDED || state == AdvState::WAITING_FOR_SLOT;
+
+  if (!wasOff && isOff) {
+    _gapStartUs = nowUs();
+  } else if (wasOff && state == AdvState::ADVERTISING) {
+    uint32_t gap = (uint32_t)(nowUs() - _gapStartUs);
+    _stats.gap_count++;
+    _stats.last_gap_us = gap;
+    _stats.max_gap_us = MAX(_stats.max_gap_us, gap);
+    _stats.total_gap_us += gap;
+  }
+
+  atomic_set(&_state, (atomic_val_t)state);
+}
+
+int Advertisement::initPeriodic(uint16_t interval_min, uint16_t interval_max) {
+  if (!_advert.adv) {
+    LOG_ERR("Advertisement %d must be initialized before periodic setup",
+            _index);
+    return -EINVAL;
+  }
+
+  if (_isConnectable) {
+    LOG_ERR("Advertisement %d is connectable, periodic advertising requires a "
+            "non-connectable set",
+            _index);
+    return -EINVAL;
+  }
+
+  struct bt_le_per_adv_param per_param = BT_LE_PER_ADV_PARAM_INIT(
+      interval_min, interval_max, BT_LE_PER_ADV_OPT_NONE);
+  int err = bt_le_per_adv_set_param(_advert.adv, &per_param);
   if (err < 0) {
-    LOG_ERR("Advertisement %d failed to start advertising (err %d)",
-            self->_index, err);
-  } else {
-    self->_isAdvertising = true;
-    LOG_INF("Advertisement %d started advertising successfully", self->_index);
+    LOG_ERR("Advertisement %d failed to set periodic params (err %d)", _index,
+            err);
+    return err;
+  }
+
+  LOG_INF("Advertisement %d periodic train configured (%u-%u)", _index,
+          interval_min, interval_max);
+  return 0;
+}
+
+int Advertisement::setPeriodicData(const uint8_t *data, uint8_t len) {
+  if (!data || len > sizeof(_periodicPayload)) {
+    LOG_ERR("Advertisement %d invalid periodic payload (len %u)", _index, len);
+    return -EINVAL;
+  }
+
+  // The stack copies the data into the controller, so the payload can be
+  // updated at any time while the train is running
+  memcpy(_periodicPayload, data, len);
+  _advert.per_adv_data[0] =
+      BT_DATA(BT_DATA_MANUFACTURER_DATA, _periodicPayload, len);
+
+  int err = bt_le_per_adv_set_data(_advert.adv, _advert.per_adv_data, 1);
+  if (err < 0) {
+    LOG_ERR("Advertisement %d failed to set periodic data (err %d)", _index,
+            err);
+    return err;
+  }
+
+  return 0;
+}
+
+int Advertisement::startPeriodic() {
+  if (_isPeriodicAdvertising) {
+    LOG_INF("Advertisement %d is already periodic advertising", _index);
+    return 0;
+  }
+
+  int err = bt_le_per_adv_start(_advert.adv);
+  if (err < 0) {
+    LOG_ERR("Advertisement %d failed to start periodic advertising (err %d)",
+            _index, err);
+    return err;
+  }
+
+  _isPeriodicAdvertising = true;
+  LOG_INF("Advertisement %d started periodic advertising", _index);
+
+  // The periodic train is only discoverable through the extended advertising
+  // set that carries its SyncInfo
+  return startAdvertising();
+}
+
+int Advertisement::stopPeriodic() {
+  if (!_isPeriodicAdvertising) {
+    LOG_INF("Advertisement %d is not periodic advertising", _index);
+    return 0;
+  }
+
+  int err = bt_le_per_adv_stop(_advert.adv);
+  if (err < 0) {
+    LOG_ERR("Advertisement %d failed to stop periodic advertising (err %d)",
+            _index, err);
+    return err;
+  }
+
+  _isPeriodicAdvertising = false;
+  LOG_INF("Advertisement %d stopped periodic advertising", _index);
+  return 0;
+}
+
+void Advertisement::workAction(struct k_work *work) {
+  // Recover the Advertisement instance from the k_work pointer
+  Advertisement *self = CONTAINER_OF(work, Advertisement, _advert.work);
+
+  // The stack stopped the set on its own, catch the state up first
+  if (atomic_test_and_clear_bit(&self->_events, ADV_EVENT_FINISHED)) {
+    self->enterState(AdvState::IDLE);
+  }
+  if (atomic_test_and_clear_bit(&self->_events, ADV_EVENT_CONNECTED) &&
+      self->state() == AdvState::ADVERTISING) {
+    self->enterState(AdvState::SUSPENDED);
+  }
+
+  // Settle on the last request, retries of a failed resume come through
+  // here as well
+  if (!atomic_get(&self->_shouldAdvertise)) {
+    self->stopAdvertising();
+  } else if (self->state() != AdvState::ADVERTISING) {
+    self->resumeAdvertising();
   }
 }
 
@@ -150,8 +347,50 @@ void Advertisement::extAdvConnectedCb(
     return;
   }
 
-  // Update the isAdvertising flag
-  advertisement->_isAdvertising = false;
+  advertisement->_stats.connected_events++;
+
+  // The controller stopped the set when the link was established, the radio
+  // queue marks it suspended and resumes it. If the Peripheral ran out of
+  // slots it asked for a stop before this callback, and the set stays down.
+  atomic_set_bit(&advertisement->_events, ADV_EVENT_CONNECTED);
+  WorkQueue::radio.schedule(&advertisement->_advert.work, K_NO_WAIT);
+}
+
+void Advertisement::extAdvSentCb(struct bt_le_ext_adv *adv,
+                                 struct bt_le_ext_adv_sent_info *info) {
+  Advertisement *advertisement = Advertisement::fromAdv(adv);
+  if (!advertisement) {
+    return;
+  }
+
+  // Limited advertising (timeout or event count) ran to completion, a
+  // start asked for after this still wins
+  advertisement->_stats.sent_events++;
+  atomic_clear(&advertisement->_shouldAdvertise);
+  atomic_set_bit(&advertisement->_events, ADV_EVENT_FINISHED);
+  WorkQueue::radio.schedule(&advertisement->_advert.work, K_NO_WAIT);
+  LOG_INF("Advertisement %d finished after %u events", advertisement->_index,
+          info->num_sent);
+}
+
+void Advertisement::extAdvScannedCb(struct bt_le_ext_adv *adv,
+                                    struct bt_le_ext_adv_scanned_info *info) {
+  Advertisement *advertisement = Advertisement::fromAdv(adv);
+  if (!advertisement) {
+    return;
+  }
+
+  advertisement->_stats.scanned_events++;
+}
+
+void Advertisement::onConnectionRecycled() {
+  // A connection object was freed, resume the sets that ran out of them
+  for (Advertisement *advertisement : Advertisement::registry) {
+    if (advertisement &&
+        advertisement->state() == AdvState::WAITING_FOR_SLOT) {
+      WorkQueue::radio.schedule(&advertisement->_advert.work, K_NO_WAIT);
+    }
+  }
 }
 
 Advertisement *Advertisement::fromAdv(bt_le_ext_adv *adv) {
@@ -168,3 +407,12 @@ Advertisement *Advertisement::fromAdv(bt_le_ext_adv *adv) {
   LOG_WRN("Failed to find Advertisement for bt_le_ext_adv %p", adv);
   return nullptr;
 }
+
+Advertisement *Advertisement::fromId(uint8_t id) {
+  for (Advertisement *advertisement : Advertisement::registry) {
+    if (advertisement && advertisement->_id == id) {
+      return advertisement;
+    }
+  }
+  return nullptr;
+}
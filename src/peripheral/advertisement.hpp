@@ -1,5 +1,7 @@
 #pragma once
 
+#include "../common/connection_bus.hpp"
+#include "../common/work_queue.hpp"
 #include <zephyr/logging/log.h>
 
 extern "C" {
@@ -9,14 +11,37 @@ extern "C" {
 #include <zephyr/bluetooth/gatt.h>
 #include <zephyr/bluetooth/uuid.h>
 #include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
 }
 
 #define MAX_ADVERTISEMENTS CONFIG_BT_EXT_ADV_MAX_ADV_SET
+#define MAX_PERIODIC_DATA_LENGTH 200
+
+// Advertising state machine, driven by bt_le_ext_adv_cb events and
+// connection slot availability
+enum class AdvState {
+  IDLE,             // Not requested to advertise
+  ADVERTISING,      // Running in the controller
+  SUSPENDED,        // Stopped by the stack, resume in progress
+  WAITING_FOR_SLOT, // Stopped by the stack, no free connection object
+};
+
+// Time spent non-advertising while advertising was requested
+struct advertising_stats {
+  uint32_t gap_count;
+  uint32_t last_gap_us;
+  uint32_t max_gap_us;
+  uint64_t total_gap_us;
+  uint32_t connected_events;
+  uint32_t sent_events;
+  uint32_t scanned_events;
+};
 
 struct advertiser_info {
-  struct k_work_delayable work;
+  struct queued_work work;
   struct bt_le_ext_adv *adv;
   struct bt_data adv_data[1];
+  struct bt_data per_adv_data[1];
 };
 
 class Advertisement {
@@ -24,24 +49,58 @@ public:
   Advertisement();
   ~Advertisement();
 
-  int init(const char *advertiser_name = nullptr);
+  int init(const char *advertiser_name = nullptr, bool connectable = true);
   int startAdvertising();
   int stopAdvertising();
+  // Same transitions from any thread, run on WorkQueue::radio
+  void scheduleStart();
+  void scheduleStop();
   bool isAdvertising() const;
+  AdvState state() const { return (AdvState)atomic_get(&_state); }
+  const struct advertising_stats &stats() const { return _stats; }
+
+  // Periodic advertising train, only valid on a non-connectable set
+  int initPeriodic(uint16_t interval_min = BT_GAP_PER_ADV_SLOW_INT_MIN,
+                   uint16_t interval_max = BT_GAP_PER_ADV_SLOW_INT_MAX);
+  int setPeriodicData(const uint8_t *data, uint8_t len);
+  int startPeriodic();
+  int stopPeriodic();
+  bool isPeriodicAdvertising() const { return _isPeriodicAdvertising; }
 
   static void workAction(struct k_work *work);
   static void extAdvConnectedCb(struct bt_le_ext_adv *adv,
                                 struct bt_le_ext_adv_connected_info *info);
+  static void extAdvSentCb(struct bt_le_ext_adv *adv,
+                           struct bt_le_ext_adv_sent_info *info);
+  static void extAdvScannedCb(struct bt_le_ext_adv *adv,
+                              struct bt_le_ext_adv_scanned_info *info);
+  static void onConnectionRecycled();
   static Advertisement *fromAdv(struct bt_le_ext_adv *adv);
+  // The set advertising on local identity id, each set has its own
+  static Advertisement *fromId(uint8_t id);
 
   uint8_t _index; // Order in the registry
   uint8_t _id;    // Unique ID for advertising set
+  ConnectionListener *_owner = nullptr; // Claims the set's connections
   struct advertiser_info _advert;
   char _localName[32];
   struct bt_le_adv_param _advParam;
-  bool _isAdvertising = false;
+  // Written on WorkQueue::radio (and by the direct start and stop calls
+  // during setup), read from any thread
+  atomic_t _state = ATOMIC_INIT((atomic_val_t)AdvState::IDLE);
+  struct advertising_stats _stats;
+  uint64_t _gapStartUs = 0;
+  atomic_t _shouldAdvertise = ATOMIC_INIT(0); // Last start or stop asked for
+  atomic_t _events = ATOMIC_INIT(0); // Stack events for WorkQueue::radio
+  bool _isConnectable = true;
+  bool _isPeriodicAdvertising = false;
+  uint8_t _periodicPayload[MAX_PERIODIC_DATA_LENGTH];
 
   // Static attributes
   static struct bt_le_ext_adv_cb _extendedAdvCb;
   static Advertisement *registry[MAX_ADVERTISEMENTS];
+
+private:
+  int resumeAdvertising();
+  void enterState(AdvState state);
 };
\ No newline at end of file
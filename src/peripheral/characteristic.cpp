@@ -1,4 +1,5 @@
 #include "characteristic.hpp"
+#include "../common/trace.hpp"
 #include "peripheral.hpp"
 #include "service.hpp"
 #include <zephyr/logging/log.h>
@@ -14,6 +15,28 @@ void Characteristic::init(const bt_uuid *uuid, uint8_t properties,
   _name[sizeof(_name) - 1] = '\0';
 }
 
+int Characteristic::setValue(const void *data, uint16_t len) {
+  if (len > sizeof(_value)) {
+    return -EMSGSIZE;
+  }
+
+  memcpy(_value, data, len);
+  _valueLength = len;
+  _readCallback = nullptr;
+
+  if (!_notificationsEnabled || !_valueAttr) {
+    return 0;
+  }
+
+  // All subscribed connections
+  int err = bt_gatt_notify(nullptr, _valueAttr, _value, _valueLength);
+  if (err < 0 && err != -ENOTCONN) {
+    LOG_ERR("Failed to notify '%s' (err %d)", _name, err);
+    return err;
+  }
+  return 0;
+}
+
 // Definitions of static functions
 ssize_t Characteristic::_readDispatcher(struct bt_conn *conn,
                                         const struct bt_gatt_attr *attr,
@@ -29,9 +52,12 @@ ssize_t Characteristic::_readDispatcher(struct bt_conn *conn,
   if (self->_readCallback) {
     return self->_readCallback(conn, attr, buf, len, offset);
   } else {
-    LOG_INF("This is the default READ callback - returning empty data");
-    // Return 0 to indicate no data to read, but don't write to buf
-    return 0;
+    // Default READ callback, serves the value set at runtime (empty until
+    // then)
+    Trace::emit(TraceEvent::GATT_READ_DEFAULT, 0, attr->handle,
+                len | ((uint32_t)offset << 16));
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, self->_value,
+                             self->_valueLength);
   }
 }
 
@@ -49,7 +75,8 @@ ssize_t Characteristic::_writeDispatcher(struct bt_conn *conn,
   if (self->_writeCallback) {
     return self->_writeCallback(conn, attr, buf, len, offset, flags);
   } else {
-    LOG_INF("This is the default WRITE callback");
+    Trace::emit(TraceEvent::GATT_WRITE_DEFAULT, 0, attr->handle,
+                len | ((uint32_t)offset << 16));
   }
 
   return len;
@@ -19,6 +19,9 @@ using WriteCallback = ssize_t (*)(struct bt_conn *conn,
 // Matches struct _bt_gatt_ccc::cfg_changed in Zephyr's gatt.h
 using CCCCallback = void (*)(const struct bt_gatt_attr *attr, uint16_t value);
 
+// Value served by the default READ callback, set at runtime
+#define MAX_CHARACTERISTIC_VALUE_LENGTH 20
+
 // Characteristic properties
 enum CharProperty : uint8_t {
   READ = BT_GATT_CHRC_READ,
@@ -52,6 +55,10 @@ public:
   WriteCallback _writeCallback = nullptr;
   CCCCallback _cccCallback = nullptr;
 
+  // Replaces the served value and notifies subscribers. Takes over from a
+  // read callback installed earlier.
+  int setValue(const void *data, uint16_t len);
+
   // int notify(struct bt_conn *conn, const void *data, uint16_t len);
   // int indicate(struct bt_conn *conn, const void *data, uint16_t len);
 
@@ -69,6 +76,9 @@ public:
   char _name[32];
   uint16_t _permissions = 0;
   void *_userData = nullptr;
+  const struct bt_gatt_attr *_valueAttr = nullptr; // Set by Service
+  uint8_t _value[MAX_CHARACTERISTIC_VALUE_LENGTH];
+  uint16_t _valueLength = 0;
   bool _notificationsEnabled = false;
   bool _indicationsEnabled = false;
 };
\ No newline at end of file
@@ -0,0 +1,167 @@
+#include "identity_pool.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(IDENTITY_POOL, LOG_LEVEL_INF);
+
+struct identity_slot IdentityPool::slots[MAX_POOL_IDENTITIES] = {};
+struct settings_handler IdentityPool::settingsHandler = {};
+
+int IdentityPool::init() {
+  int err = settings_subsys_init();
+  if (err < 0) {
+    LOG_ERR("Failed to initialize settings (err %d)", err);
+    return err;
+  }
+
+  IdentityPool::settingsHandler.name = "bluesim/id";
+  IdentityPool::settingsHandler.h_set = IdentityPool::settingsSet;
+
+  err = settings_register(&IdentityPool::settingsHandler);
+  if (err < 0) {
+    LOG_ERR("Failed to register identity settings handler (err %d)", err);
+    return err;
+  }
+
+  return 0;
+}
+
+int IdentityPool::acquire(const char *device) {
+  if (!device || strlen(device) == 0 ||
+      strlen(device) >= MAX_DEVICE_KEY_LENGTH) {
+    LOG_ERR("Invalid device key");
+    return -EINVAL;
+  }
+
+  size_t existing = IdentityPool::stackIdentityCount();
+  struct identity_slot *unmapped = nullptr;
+  struct identity_slot *reclaimable = nullptr;
+
+  for (uint8_t i = 0; i < MAX_POOL_IDENTITIES; i++) {
+    struct identity_slot &slot = IdentityPool::slots[i];
+    uint8_t id = i + FIRST_POOL_IDENTITY;
+
+    if (strcmp(slot.device, device) == 0) {
+      if (slot.in_use) {
+        LOG_ERR("Identity %d is already used by '%s'", id, device);
+        return -EALREADY;
+      }
+
+      // Stored mapping whose identity was lost, e.g. after a settings wipe
+      if (id >= existing) {
+        unmapped = &slot;
+        break;
+      }
+
+      slot.in_use = true;
+      LOG_INF("Reusing identity %d for '%s'", id, device);
+      return id;
+    }
+
+    if (slot.device[0] == '\0' && !unmapped) {
+      unmapped = &slot;
+    } else if (!slot.in_use && !reclaimable) {
+      reclaimable = &slot;
+    }
+  }
+
+  if (unmapped) {
+    uint8_t id = (unmapped - IdentityPool::slots) + FIRST_POOL_IDENTITY;
+
+    // Identities are allocated in order, create them up to the slot
+    while (id >= IdentityPool::stackIdentityCount()) {
+      int err = bt_id_create(NULL, NULL);
+      if (err < 0) {
+        LOG_ERR("Failed to create identity (err %d)", err);
+        return err;
+      }
+    }
+
+    strncpy(unmapped->device, device, MAX_DEVICE_KEY_LENGTH - 1);
+    unmapped->in_use = true;
+    IdentityPool::persist(id);
+    LOG_INF("Allocated identity %d for '%s'", id, device);
+    return id;
+  }
+
+  if (reclaimable) {
+    uint8_t id = (reclaimable - IdentityPool::slots) + FIRST_POOL_IDENTITY;
+
+    // Hand over a released identity with a fresh address, so centrals do not
+    // confuse the new device with the previous owner
+    int err = bt_id_reset(id, NULL, NULL);
+    if (err < 0) {
+      LOG_ERR("Failed to reset identity %d (err %d)", id, err);
+      return err;
+    }
+
+    LOG_INF("Reclaimed identity %d from '%s' for '%s'", id,
+            reclaimable->device, device);
+    memset(reclaimable->device, 0, sizeof(reclaimable->device));
+    strncpy(reclaimable->device, device, MAX_DEVICE_KEY_LENGTH - 1);
+    reclaimable->in_use = true;
+    IdentityPool::persist(id);
+    return id;
+  }
+
+  LOG_ERR("Identity pool is full! Maximum %d identities allowed.",
+          MAX_POOL_IDENTITIES);
+  return -ENOMEM;
+}
+
+void IdentityPool::release(uint8_t id) {
+  if (id < FIRST_POOL_IDENTITY ||
+      id >= FIRST_POOL_IDENTITY + MAX_POOL_IDENTITIES) {
+    return;
+  }
+
+  // Keep the mapping so the device gets the same identity back
+  IdentityPool::slots[id - FIRST_POOL_IDENTITY].in_use = false;
+}
+
+int IdentityPool::settingsSet(const char *key, size_t len,
+                              settings_read_cb read_cb, void *cb_arg) {
+  if (!key) {
+    return -ENOENT;
+  }
+
+  unsigned long id = strtoul(key, nullptr, 10);
+  if (id < FIRST_POOL_IDENTITY ||
+      id >= FIRST_POOL_IDENTITY + MAX_POOL_IDENTITIES ||
+      len > MAX_DEVICE_KEY_LENGTH) {
+    LOG_WRN("Ignoring stored identity mapping '%s'", key);
+    return 0;
+  }
+
+  struct identity_slot &slot = IdentityPool::slots[id - FIRST_POOL_IDENTITY];
+  memset(slot.device, 0, sizeof(slot.device));
+
+  ssize_t bytes = read_cb(cb_arg, slot.device, len);
+  if (bytes < 0) {
+    LOG_ERR("Failed to read identity mapping %lu (err %d)", id, (int)bytes);
+    return bytes;
+  }
+
+  slot.device[MAX_DEVICE_KEY_LENGTH - 1] = '\0';
+  LOG_INF("Restored identity %lu for '%s'", id, slot.device);
+  return 0;
+}
+
+int IdentityPool::persist(uint8_t id) {
+  char key[sizeof("bluesim/id/") + 3];
+  snprintf(key, sizeof(key), "bluesim/id/%u", id);
+
+  const char *device = IdentityPool::slots[id - FIRST_POOL_IDENTITY].device;
+  int err = settings_save_one(key, device, strlen(device) + 1);
+  if (err < 0) {
+    LOG_ERR("Failed to persist identity %d (err %d)", id, err);
+  }
+  return err;
+}
+
+size_t IdentityPool::stackIdentityCount() {
+  size_t count = CONFIG_BT_ID_MAX;
+  bt_id_get(NULL, &count);
+  return count;
+}
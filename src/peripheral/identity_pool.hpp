@@ -0,0 +1,42 @@
+#pragma once
+
+extern "C" {
+#include <string.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/kernel.h>
+#include <zephyr/settings/settings.h>
+}
+
+// Identity 0 (BT_ID_DEFAULT) is left to the stack and the Central role
+#define FIRST_POOL_IDENTITY 1
+#define MAX_POOL_IDENTITIES (CONFIG_BT_ID_MAX - FIRST_POOL_IDENTITY)
+#define MAX_DEVICE_KEY_LENGTH 32
+
+struct identity_slot {
+  char device[MAX_DEVICE_KEY_LENGTH]; // Logical device owning the identity
+  bool in_use;
+};
+
+// Maps logical simulated devices to Bluetooth identities so a device keeps
+// the same address across re-creation and reboots. The mapping is persisted
+// with Zephyr settings under "bluesim/id/<id>", the identities themselves by
+// the Bluetooth stack.
+class IdentityPool {
+public:
+  // Must be called after bt_enable() and before settings_load()
+  static int init();
+
+  static int acquire(const char *device);
+  static void release(uint8_t id);
+
+  static int settingsSet(const char *key, size_t len,
+                         settings_read_cb read_cb, void *cb_arg);
+
+  static struct identity_slot slots[MAX_POOL_IDENTITIES];
+
+private:
+  static int persist(uint8_t id);
+  static size_t stackIdentityCount();
+
+  static struct settings_handler settingsHandler;
+};
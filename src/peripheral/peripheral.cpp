@@ -1,14 +1,21 @@
 #include "peripheral.hpp"
+#include "../common/pairing.hpp"
 #include "service.hpp"
 #include <zephyr/logging/log.h>
 
 LOG_MODULE_REGISTER(PERIPHERAL, LOG_LEVEL_DBG);
 
+#ifdef CONFIG_BT_CTLR_SDC_PERIPHERAL_COUNT
+BUILD_ASSERT(CONFIG_BLUESIM_PERIPHERAL_CONNECTIONS <=
+                 CONFIG_BT_CTLR_SDC_PERIPHERAL_COUNT,
+             "More peripheral links than the SoftDevice Controller provides");
+#endif
+
 Peripheral *Peripheral::registry[MAX_PERIPHERALS] = {nullptr};
 
 Peripheral::Peripheral()
     : _index(0), _serviceCount(0), _connectionCount(0),
-      _advertisement(nullptr) {
+      _advertisement(nullptr), _security(PAIRING_SECURITY_LEVEL) {
   memset(_services, 0, sizeof(_services));
 
   for (uint8_t i = 0; i < MAX_PERIPHERAL_CONNECTIONS; i++) {
@@ -29,6 +36,11 @@ Peripheral::Peripheral()
 }
 
 Peripheral::~Peripheral() {
+  // The advertisement may outlive its owner, stop routing its links here
+  if (_advertisement && _advertisement->_owner == this) {
+    _advertisement->_owner = nullptr;
+  }
+  ConnectionBus::unbind(this);
   Peripheral::registry[_index] = nullptr;
   for (uint8_t i = 0; i < MAX_PERIPHERAL_CONNECTIONS; i++) {
     if (_connections[i]) {
@@ -44,6 +56,7 @@ void Peripheral::addAdvertisement(Advertisement *advertisement) {
     return;
   }
   _advertisement = advertisement;
+  advertisement->_owner = this;
 }
 
 void Peripheral::addService(Service *service) {
@@ -106,19 +119,37 @@ void Peripheral::removeConnection(struct bt_conn *conn) {
   LOG_WRN("No connection found for peripheral %d", _index);
 }
 
+int Peripheral::listenCoc(uint16_t psm, CocMode mode) {
+  if (!IS_ENABLED(CONFIG_BLUESIM_L2CAP_COC)) {
+    return -ENOTSUP;
+  }
+  return CocChannels::listen(psm, mode);
+}
+
+const struct advertising_stats *Peripheral::advertisingStats() const {
+  if (!_advertisement) {
+    return nullptr;
+  }
+  return &_advertisement->stats();
+}
+
 void Peripheral::onConnected(struct bt_conn *conn, uint8_t err) {
   LOG_DBG("Peripheral %d connected! conn=%p\n", _index, conn);
   addConnection(conn);
 
+  if (IS_ENABLED(CONFIG_BLUESIM_PAIRING)) {
+    Pairing::secure(conn, _security);
+  }
+
   if (_connectionCount >= MAX_PERIPHERAL_CONNECTIONS) {
-    _advertisement->stopAdvertising();
+    _advertisement->scheduleStop();
     LOG_INF("Peripheral %d reached maximum number of connections %d ", _index,
             MAX_PERIPHERAL_CONNECTIONS);
     return;
   }
 
-  // Restart advertising
-  _advertisement->startAdvertising();
+  // Keep advertising, this is a no-op if the set already resumed itself
+  _advertisement->scheduleStart();
 }
 
 void Peripheral::onDisconnected(struct bt_conn *conn, uint8_t reason) {
@@ -126,7 +157,7 @@ void Peripheral::onDisconnected(struct bt_conn *conn, uint8_t reason) {
   removeConnection(conn);
 
   // Restart advertising
-  _advertisement->startAdvertising();
+  _advertisement->scheduleStart();
 }
 
 Peripheral *Peripheral::fromConn(struct bt_conn *conn) {
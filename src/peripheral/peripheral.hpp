@@ -1,5 +1,7 @@
 #pragma once
 
+#include "../common/coc_channel.hpp"
+#include "../common/connection_bus.hpp"
 #include "advertisement.hpp"
 
 extern "C" {
@@ -7,20 +9,25 @@ extern "C" {
 #include <zephyr/bluetooth/conn.h>
 }
 
-#define MAX_PERIPHERALS (CONFIG_BT_CTLR_SDC_PERIPHERAL_COUNT / 2)
-#define MAX_PERIPHERAL_CONNECTIONS ((CONFIG_BT_MAX_CONN / 2) / MAX_PERIPHERALS)
+#define MAX_PERIPHERALS (CONFIG_BLUESIM_PERIPHERAL_CONNECTIONS / 2)
+#define MAX_PERIPHERAL_CONNECTIONS                                             \
+  (MAX_PERIPHERALS > 0 ? (CONFIG_BT_MAX_CONN / 2) / MAX_PERIPHERALS : 0)
+
+BUILD_ASSERT(MAX_PERIPHERALS >= 1,
+             "BLUESIM_PERIPHERAL_CONNECTIONS must be at least 2");
+BUILD_ASSERT(MAX_PERIPHERAL_CONNECTIONS >= 1, "Peripherals without a link");
 #define MAX_SERVICES_PER_PERIPHERAL 3
 
 class Service;
 class Advertisement;
 
-class Peripheral {
+class Peripheral : public ConnectionListener {
 public:
   Peripheral();
   virtual ~Peripheral();
 
-  virtual void onConnected(struct bt_conn *conn, uint8_t err);
-  virtual void onDisconnected(struct bt_conn *conn, uint8_t reason);
+  void onConnected(struct bt_conn *conn, uint8_t err) override;
+  void onDisconnected(struct bt_conn *conn, uint8_t reason) override;
 
   void addAdvertisement(Advertisement *advertisement);
   void addService(Service *service);
@@ -28,6 +35,16 @@ public:
   void addConnection(struct bt_conn *conn);
   void removeConnection(struct bt_conn *conn);
 
+  // One L2CAP server serves every peripheral, channels it accepts run in
+  // the given mode
+  static int listenCoc(uint16_t psm, CocMode mode);
+
+  // Level asked for on every new link when pairing is enabled
+  void setSecurity(bt_security_t level) { _security = level; }
+
+  // Time spent undiscoverable while the peripheral had free slots
+  const struct advertising_stats *advertisingStats() const;
+
   static Peripheral *registry[MAX_PERIPHERALS];
 
   // Map bt_conn back to Peripheral
@@ -39,4 +56,5 @@ public:
   struct bt_conn *_connections[MAX_PERIPHERAL_CONNECTIONS];
   Service *_services[MAX_SERVICES_PER_PERIPHERAL];
   Advertisement *_advertisement;
+  bt_security_t _security;
 };
@@ -33,7 +33,7 @@ int Service::init(const struct bt_uuid *uuid, const char *name) {
   _attrs[_attrCount].uuid = &uuid_gatt_primary.uuid;
   _attrs[_attrCount].read = bt_gatt_attr_read_service;
   _attrs[_attrCount].write = NULL;
-  _attrs[_attrCount].user_data = &_uuid;
+  _attrs[_attrCount].user_data = (void *)_uuid;
   _attrs[_attrCount].perm = BT_GATT_PERM_READ;
   _attrCount++;
 
@@ -63,6 +63,7 @@ int Service::addCharacteristic(Characteristic *characteristic) {
   _attrs[_attrCount].read = Characteristic::_readDispatcher;
   _attrs[_attrCount].write = Characteristic::_writeDispatcher;
   _attrs[_attrCount].user_data = characteristic;
+  characteristic->_valueAttr = &_attrs[_attrCount];
   _attrCount++;
 
   // Optional CCC
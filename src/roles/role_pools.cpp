@@ -0,0 +1,15 @@
+#include "role_pools.hpp"
+
+// Every role object can fill its slots at the same time
+BUILD_ASSERT(MAX_CENTRALS * MAX_CENTRAL_CONNECTIONS +
+                     MAX_PERIPHERALS * MAX_PERIPHERAL_CONNECTIONS <=
+                 CONFIG_BT_MAX_CONN,
+             "Role slots exceed CONFIG_BT_MAX_CONN");
+
+ObjectPool<Central, MAX_CENTRALS> RolePools::centrals("Central");
+ObjectPool<Peripheral, MAX_PERIPHERALS> RolePools::peripherals("Peripheral");
+ObjectPool<Advertisement, MAX_ADVERTISEMENTS>
+    RolePools::advertisements("Advertisement");
+ObjectPool<Service, MAX_POOL_SERVICES> RolePools::services("Service");
+ObjectPool<Characteristic, MAX_POOL_CHARACTERISTICS>
+    RolePools::characteristics("Characteristic");
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "../central/central.hpp"
+#include "../common/object_pool.hpp"
+#include "../peripheral/advertisement.hpp"
+#include "../peripheral/characteristic.hpp"
+#include "../peripheral/peripheral.hpp"
+#include "../peripheral/service.hpp"
+
+#define MAX_POOL_SERVICES (MAX_PERIPHERALS * MAX_SERVICES_PER_PERIPHERAL)
+#define MAX_POOL_CHARACTERISTICS                                               \
+  (MAX_POOL_SERVICES * MAX_CHARACTERISTICS_PER_SERVICE)
+
+// Static storage for every role object, sized by the same limits as the
+// registries. Objects still register themselves on construction, the pools
+// only decide where they live. A Scanner is embedded in its Central.
+class RolePools {
+public:
+  static ObjectPool<Central, MAX_CENTRALS> centrals;
+  static ObjectPool<Peripheral, MAX_PERIPHERALS> peripherals;
+  static ObjectPool<Advertisement, MAX_ADVERTISEMENTS> advertisements;
+  static ObjectPool<Service, MAX_POOL_SERVICES> services;
+  static ObjectPool<Characteristic, MAX_POOL_CHARACTERISTICS> characteristics;
+};
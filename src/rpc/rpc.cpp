@@ -0,0 +1,497 @@
+#include "rpc.hpp"
+#include "../central/central.hpp"
+#include "../common/trace.hpp"
+#include "../peripheral/advertisement.hpp"
+#include "../peripheral/characteristic.hpp"
+#include "../peripheral/peripheral.hpp"
+#include "../peripheral/service.hpp"
+#ifdef CONFIG_BLUESIM_RPA_CACHE
+#include "../central/rpa_cache.hpp"
+#endif
+#include <new>
+#include <zephyr/logging/log.h>
+
+extern "C" {
+#include <zephyr/sys/byteorder.h>
+}
+
+LOG_MODULE_REGISTER(RPC, LOG_LEVEL_INF);
+
+RING_BUF_DECLARE(rpc_rx_ring, RPC_RX_RING_SIZE);
+
+struct k_spinlock Rpc::_lock = {};
+struct rpc_stats Rpc::_stats = {};
+struct queued_work Rpc::_work = {};
+uint8_t Rpc::_encoded[RPC_MAX_REQUEST + 4];
+size_t Rpc::_encodedLength = 0;
+bool Rpc::_discarding = false;
+
+// Arrival of the newest receive chunk, close enough to the delimiter of the
+// request it completes
+static uint32_t rxCycles = 0;
+
+// Handlers run one at a time, so the scratch state can be shared
+static uint8_t decoded[RPC_MAX_REQUEST + 4];
+static uint8_t response[RPC_RESPONSE_HEADER_SIZE + RPC_MAX_RESULT];
+static Filter filterScratch;
+
+using RpcHandler = int (*)(const uint8_t *args, size_t len, uint8_t *result,
+                           size_t *result_len);
+
+struct rpc_handler_entry {
+  RpcOp op;
+  uint8_t min_args;
+  RpcHandler handler;
+};
+
+static Central *centralAt(uint8_t index) {
+  return index < MAX_CENTRALS ? Central::registry[index] : nullptr;
+}
+
+static Advertisement *advertisementAt(uint8_t index) {
+  return index < MAX_ADVERTISEMENTS ? Advertisement::registry[index]
+                                    : nullptr;
+}
+
+static int ping(const uint8_t *args, size_t len, uint8_t *result,
+                size_t *result_len) {
+  *result_len = MIN(len, (size_t)RPC_MAX_RESULT);
+  memcpy(result, args, *result_len);
+  return 0;
+}
+
+static int rpcStats(const uint8_t *args, size_t len, uint8_t *result,
+                    size_t *result_len) {
+  struct rpc_stats current = Rpc::stats();
+  sys_put_le32(current.calls, &result[0]);
+  sys_put_le32(current.errors, &result[4]);
+  sys_put_le32(current.bad_frames, &result[8]);
+  sys_put_le32(current.rx_dropped, &result[12]);
+  sys_put_le32(current.last_service_us, &result[16]);
+  sys_put_le32(current.max_service_us, &result[20]);
+  sys_put_le64(current.total_service_us, &result[24]);
+  *result_len = 32;
+  return 0;
+}
+
+static int workqStats(const uint8_t *args, size_t len, uint8_t *result,
+                      size_t *result_len) {
+  if (args[0] > 1) {
+    return -ENOENT;
+  }
+
+  struct work_queue_stats stats =
+      args[0] == 0 ? WorkQueue::radio.stats() : WorkQueue::data.stats();
+  sys_put_le32(stats.executed, &result[0]);
+  sys_put_le32(stats.backlog, &result[4]);
+  sys_put_le32(stats.max_backlog, &result[8]);
+  sys_put_le32(stats.last_latency_us, &result[12]);
+  sys_put_le32(stats.max_latency_us, &result[16]);
+  sys_put_le64(stats.total_latency_us, &result[20]);
+  *result_len = 28;
+  return 0;
+}
+
+static int traceDump(const uint8_t *args, size_t len, uint8_t *result,
+                     size_t *result_len) {
+  if (args[0] >= TRACE_CPUS) {
+    return -ENOENT;
+  }
+
+  // Records go back in the response, the host pages through the ring
+  constexpr size_t header = 13;
+  struct trace_record records[(RPC_MAX_RESULT - header) /
+                              sizeof(struct trace_record)];
+  uint32_t first;
+  uint32_t head;
+  uint8_t count = Trace::read(args[0], sys_get_le32(&args[1]), records,
+                              ARRAY_SIZE(records), &first, &head);
+
+  result[0] = TRACE_CPUS;
+  sys_put_le32(sys_clock_hw_cycles_per_sec(), &result[1]);
+  sys_put_le32(head, &result[5]);
+  sys_put_le32(first, &result[9]);
+  memcpy(&result[header], records, count * sizeof(struct trace_record));
+  *result_len = header + count * sizeof(struct trace_record);
+  return 0;
+}
+
+static int traceClear(const uint8_t *args, size_t len, uint8_t *result,
+                      size_t *result_len) {
+  Trace::clear();
+  return 0;
+}
+
+static int centralScanStart(const uint8_t *args, size_t len, uint8_t *result,
+                            size_t *result_len) {
+  Central *central = centralAt(args[0]);
+  if (!central) {
+    return -ENOENT;
+  }
+  central->scheduleScanningStart();
+  return 0;
+}
+
+static int centralScanStop(const uint8_t *args, size_t len, uint8_t *result,
+                           size_t *result_len) {
+  Central *central = centralAt(args[0]);
+  if (!central) {
+    return -ENOENT;
+  }
+  central->scheduleScanningStop();
+  return 0;
+}
+
+static int centralStatus(const uint8_t *args, size_t len, uint8_t *result,
+                         size_t *result_len) {
+  Central *central = centralAt(args[0]);
+  if (!central) {
+    return -ENOENT;
+  }
+  result[0] = central->_connectionCount;
+  result[1] = central->maxConnections();
+  result[2] = central->isScanning();
+  *result_len = 3;
+  return 0;
+}
+
+static int scannerStatus(const uint8_t *args, size_t len, uint8_t *result,
+                         size_t *result_len) {
+  Scanner *scanner = args[0] < MAX_SCANNERS ? Scanner::registry[args[0]]
+                                            : nullptr;
+  if (!scanner) {
+    return -ENOENT;
+  }
+
+  uint8_t syncs = 0;
+  for (const struct periodic_sync_info &entry : Scanner::periodicSyncs) {
+    if (entry.sync && entry.owner == scanner) {
+      syncs++;
+    }
+  }
+
+  result[0] = scanner->isActive();
+  result[1] = StackScan::isScanning();
+  result[2] = syncs;
+  result[3] = (uint8_t)scanner->selectionPolicy();
+  *result_len = 4;
+  return 0;
+}
+
+static int scannerPolicy(const uint8_t *args, size_t len, uint8_t *result,
+                         size_t *result_len) {
+  Scanner *scanner = args[0] < MAX_SCANNERS ? Scanner::registry[args[0]]
+                                            : nullptr;
+  if (!scanner) {
+    return -ENOENT;
+  }
+  if (args[1] > (uint8_t)SelectionPolicy::ROUND_ROBIN) {
+    return -EINVAL;
+  }
+
+  scanner->setSelectionPolicy((SelectionPolicy)args[1]);
+  return 0;
+}
+
+// Groups are OR-ed, criteria inside a group combine with the group's operator.
+// No groups means match everything.
+static int filterSet(const uint8_t *args, size_t len, uint8_t *result,
+                     size_t *result_len) {
+  Central *central = centralAt(args[0]);
+  if (!central) {
+    return -ENOENT;
+  }
+
+  // Too large for the data queue stack
+  new (&filterScratch) Filter();
+
+  size_t offset = 1;
+  uint8_t groups = 0;
+  while (offset < len) {
+    if (offset + 2 > len || ++groups > MAX_FILTER_GROUPS) {
+      return -EINVAL;
+    }
+    uint8_t op = args[offset];
+    uint8_t count = args[offset + 1];
+    offset += 2;
+    if (op > (uint8_t)FilterOperator::OR || count > MAX_CRITERIA_PER_GROUP) {
+      return -EINVAL;
+    }
+
+    filterScratch.addGroup();
+    filterScratch.setGroupOperator((FilterOperator)op);
+
+    for (uint8_t i = 0; i < count; i++) {
+      if (offset + 2 > len) {
+        return -EINVAL;
+      }
+      uint8_t type = args[offset];
+      uint8_t patternLength = args[offset + 1];
+      offset += 2;
+      if (type > (uint8_t)FilterCriterionType::IDENTITY ||
+          patternLength >= MAX_PATTERN_LENGTH || offset + patternLength > len) {
+        return -EINVAL;
+      }
+
+      char pattern[MAX_PATTERN_LENGTH];
+      memcpy(pattern, &args[offset], patternLength);
+      pattern[patternLength] = '\0';
+      offset += patternLength;
+      if (!filterScratch.validatePattern(pattern)) {
+        return -EINVAL;
+      }
+      filterScratch.addCriterion((FilterCriterionType)type, pattern);
+    }
+  }
+
+  // Copied into the standby filter, the RX thread switches at its next match
+  central->addFilter(filterScratch);
+  return 0;
+}
+
+static int advStart(const uint8_t *args, size_t len, uint8_t *result,
+                    size_t *result_len) {
+  Advertisement *advertisement = advertisementAt(args[0]);
+  if (!advertisement) {
+    return -ENOENT;
+  }
+  advertisement->scheduleStart();
+  return 0;
+}
+
+static int advStop(const uint8_t *args, size_t len, uint8_t *result,
+                   size_t *result_len) {
+  Advertisement *advertisement = advertisementAt(args[0]);
+  if (!advertisement) {
+    return -ENOENT;
+  }
+  advertisement->scheduleStop();
+  return 0;
+}
+
+// Returns the bytes written
+static size_t putAdvertisingStats(const struct advertising_stats &stats,
+                                  uint8_t *out) {
+  sys_put_le32(stats.gap_count, &out[0]);
+  sys_put_le32(stats.last_gap_us, &out[4]);
+  sys_put_le32(stats.max_gap_us, &out[8]);
+  sys_put_le64(stats.total_gap_us, &out[12]);
+  sys_put_le32(stats.connected_events, &out[20]);
+  sys_put_le32(stats.sent_events, &out[24]);
+  sys_put_le32(stats.scanned_events, &out[28]);
+  return 32;
+}
+
+static int advStatus(const uint8_t *args, size_t len, uint8_t *result,
+                     size_t *result_len) {
+  Advertisement *advertisement = advertisementAt(args[0]);
+  if (!advertisement) {
+    return -ENOENT;
+  }
+
+  result[0] = (uint8_t)advertisement->state();
+  *result_len = 1 + putAdvertisingStats(advertisement->stats(), &result[1]);
+  return 0;
+}
+
+static int peripheralStatus(const uint8_t *args, size_t len, uint8_t *result,
+                            size_t *result_len) {
+  Peripheral *peripheral =
+      args[0] < MAX_PERIPHERALS ? Peripheral::registry[args[0]] : nullptr;
+  if (!peripheral) {
+    return -ENOENT;
+  }
+
+  // A peripheral without an advertisement reports zeroed stats
+  static const struct advertising_stats none = {};
+  const struct advertising_stats *stats = peripheral->advertisingStats();
+  result[0] = peripheral->_connectionCount;
+  result[1] = MAX_PERIPHERAL_CONNECTIONS;
+  *result_len = 2 + putAdvertisingStats(stats ? *stats : none, &result[2]);
+  return 0;
+}
+
+static int charSetValue(const uint8_t *args, size_t len, uint8_t *result,
+                        size_t *result_len) {
+  Peripheral *peripheral =
+      args[0] < MAX_PERIPHERALS ? Peripheral::registry[args[0]] : nullptr;
+  if (!peripheral || args[1] >= peripheral->_serviceCount) {
+    return -ENOENT;
+  }
+
+  Service *service = peripheral->_services[args[1]];
+  if (!service || args[2] >= service->_chrcCount) {
+    return -ENOENT;
+  }
+
+  return service->_characteristics[args[2]]->setValue(&args[3], len - 3);
+}
+
+static int streamReports(const uint8_t *args, size_t len, uint8_t *result,
+                         size_t *result_len) {
+  UartStream::setScanReports(args[0] != 0);
+  return 0;
+}
+
+// The host's way to load IRKs of peers without a bond, "rpa add" needs the
+// shell
+static int rpaAdd(const uint8_t *args, size_t len, uint8_t *result,
+                  size_t *result_len) {
+#ifdef CONFIG_BLUESIM_RPA_CACHE
+  if (len != 1 + sizeof(bt_addr_t) + 16 || args[0] > BT_ADDR_LE_RANDOM) {
+    return -EINVAL;
+  }
+
+  bt_addr_le_t identity;
+  identity.type = args[0];
+  memcpy(identity.a.val, &args[1], sizeof(identity.a.val));
+  return RpaCache::addIrk(&identity, &args[1 + sizeof(bt_addr_t)]);
+#else
+  return -ENOTSUP;
+#endif
+}
+
+static const struct rpc_handler_entry handlers[] = {
+    {RpcOp::PING, 0, ping},
+    {RpcOp::STATS, 0, rpcStats},
+    {RpcOp::WORKQ_STATS, 1, workqStats},
+    {RpcOp::TRACE_DUMP, 5, traceDump},
+    {RpcOp::TRACE_CLEAR, 0, traceClear},
+    {RpcOp::CENTRAL_SCAN_START, 1, centralScanStart},
+    {RpcOp::CENTRAL_SCAN_STOP, 1, centralScanStop},
+    {RpcOp::CENTRAL_STATUS, 1, centralStatus},
+    {RpcOp::SCANNER_STATUS, 1, scannerStatus},
+    {RpcOp::SCANNER_POLICY, 2, scannerPolicy},
+    {RpcOp::FILTER_SET, 1, filterSet},
+    {RpcOp::ADV_START, 1, advStart},
+    {RpcOp::ADV_STOP, 1, advStop},
+    {RpcOp::ADV_STATUS, 1, advStatus},
+    {RpcOp::PERIPHERAL_STATUS, 1, peripheralStatus},
+    {RpcOp::CHAR_SET_VALUE, 3, charSetValue},
+    {RpcOp::STREAM_REPORTS, 1, streamReports},
+    {RpcOp::RPA_ADD, 1, rpaAdd},
+};
+
+int Rpc::init() {
+  WorkQueue::data.initWork(&_work, workAction);
+
+  int err = UartStream::setReceiver(Rpc::receive);
+  if (err < 0) {
+    LOG_ERR("Failed to attach to the stream UART (err %d)", err);
+    return err;
+  }
+
+  LOG_INF("RPC ready, %u operations", (unsigned int)ARRAY_SIZE(handlers));
+  return 0;
+}
+
+struct rpc_stats Rpc::stats() {
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  struct rpc_stats stats = _stats;
+  k_spin_unlock(&_lock, key);
+  return stats;
+}
+
+void Rpc::receive(const uint8_t *data, size_t len) {
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  uint32_t stored = ring_buf_put(&rpc_rx_ring, data, len);
+  _stats.rx_dropped += len - stored;
+  rxCycles = k_cycle_get_32();
+  k_spin_unlock(&_lock, key);
+
+  WorkQueue::data.schedule(&_work, K_NO_WAIT);
+}
+
+void Rpc::workAction(struct k_work *work) {
+  ARG_UNUSED(work);
+
+  uint8_t chunk[STREAM_RX_CHUNK];
+  while (true) {
+    k_spinlock_key_t key = k_spin_lock(&_lock);
+    uint32_t len = ring_buf_get(&rpc_rx_ring, chunk, sizeof(chunk));
+    uint32_t received = rxCycles;
+    k_spin_unlock(&_lock, key);
+
+    if (len == 0) {
+      return;
+    }
+
+    for (uint32_t i = 0; i < len; i++) {
+      if (chunk[i] != 0x00) {
+        if (_encodedLength < sizeof(_encoded)) {
+          _encoded[_encodedLength++] = chunk[i];
+        } else {
+          _discarding = true;
+        }
+        continue;
+      }
+
+      // Delimiter, a frame is complete
+      if (_discarding) {
+        countBadFrame();
+      } else if (_encodedLength) {
+        handleFrame(_encoded, _encodedLength, received);
+      }
+      _encodedLength = 0;
+      _discarding = false;
+    }
+  }
+}
+
+void Rpc::countBadFrame() {
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  _stats.bad_frames++;
+  k_spin_unlock(&_lock, key);
+}
+
+void Rpc::handleFrame(const uint8_t *encoded, size_t len,
+                      uint32_t received_cycles) {
+  size_t frameLength = UartStream::cobsDecode(encoded, len, decoded);
+
+  // Stream type and sequence, then the request header
+  if (frameLength < 2 + RPC_REQUEST_HEADER_SIZE ||
+      decoded[0] != (uint8_t)StreamFrame::RPC_REQUEST) {
+    countBadFrame();
+    return;
+  }
+
+  const uint8_t *request = &decoded[2];
+  size_t argsLength = frameLength - 2 - RPC_REQUEST_HEADER_SIZE;
+  RpcOp op = (RpcOp)request[2];
+
+  int status = -ENOTSUP;
+  size_t resultLength = 0;
+  uint8_t *result = &response[RPC_RESPONSE_HEADER_SIZE];
+  for (const struct rpc_handler_entry &entry : handlers) {
+    if (entry.op != op) {
+      continue;
+    }
+    status = argsLength < entry.min_args
+                 ? -EINVAL
+                 : entry.handler(&request[RPC_REQUEST_HEADER_SIZE],
+                                 argsLength, result, &resultLength);
+    break;
+  }
+
+  if (status < 0) {
+    resultLength = 0;
+  }
+
+  uint32_t serviceUs = k_cyc_to_us_floor32(k_cycle_get_32() - received_cycles);
+  memcpy(&response[0], &request[0], 2); // Request id, as sent
+  response[2] = (uint8_t)op;
+  sys_put_le16((uint16_t)(int16_t)status, &response[3]);
+  sys_put_le32(serviceUs, &response[5]);
+
+  k_spinlock_key_t key = k_spin_lock(&_lock);
+  _stats.calls++;
+  _stats.errors += status < 0;
+  _stats.last_service_us = serviceUs;
+  _stats.max_service_us = MAX(_stats.max_service_us, serviceUs);
+  _stats.total_service_us += serviceUs;
+  k_spin_unlock(&_lock, key);
+
+  // A dropped response shows up as a timeout on the host
+  UartStream::send(StreamFrame::RPC_RESPONSE, response,
+                   RPC_RESPONSE_HEADER_SIZE + resultLength);
+}
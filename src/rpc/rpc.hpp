@@ -0,0 +1,84 @@
+#pragma once
+
+#include "../common/uart_stream.hpp"
+
+extern "C" {
+#include <zephyr/kernel.h>
+#include <zephyr/sys/ring_buffer.h>
+}
+
+#ifdef CONFIG_BLUESIM_RPC_RX_RING_SIZE
+#define RPC_RX_RING_SIZE CONFIG_BLUESIM_RPC_RX_RING_SIZE
+#else
+#define RPC_RX_RING_SIZE 512
+#endif
+
+// Largest request payload, the stream frame type and sequence come on top
+#define RPC_MAX_REQUEST 250
+#define RPC_MAX_RESULT 64
+#define RPC_REQUEST_HEADER_SIZE 3  // id (2), op
+#define RPC_RESPONSE_HEADER_SIZE 9 // id (2), op, status (2), service time (4)
+
+// Operations, keep scripts/bluesim_rpc.py in sync. Arguments start with the
+// registry index of the target object.
+enum class RpcOp : uint8_t {
+  PING = 0x00,               // Echoes the arguments
+  STATS = 0x01,              // -> struct rpc_stats
+  WORKQ_STATS = 0x02,        // queue (0 radio, 1 data) -> work_queue_stats
+  TRACE_DUMP = 0x03,         // cpu, start (le32) -> cpus, hz, head, first
+                             // (le32 each), up to 4 trace records
+  TRACE_CLEAR = 0x04,
+  CENTRAL_SCAN_START = 0x10, // central
+  CENTRAL_SCAN_STOP = 0x11,  // central
+  CENTRAL_STATUS = 0x12,     // central -> connections, max, scanning
+  SCANNER_STATUS = 0x20,     // scanner -> scanning, stack scanning, syncs,
+                             // selection policy
+  SCANNER_POLICY = 0x21,     // scanner, SelectionPolicy
+  FILTER_SET = 0x30,         // central, groups: op, count, (type, len, pattern)
+  ADV_START = 0x40,          // advertisement
+  ADV_STOP = 0x41,           // advertisement
+  ADV_STATUS = 0x42,         // advertisement -> state, struct advertising_stats
+  PERIPHERAL_STATUS = 0x43,  // peripheral -> connections, max, adv stats
+  CHAR_SET_VALUE = 0x50,     // peripheral, service, characteristic, value
+  STREAM_REPORTS = 0x60,     // enabled
+  RPA_ADD = 0x70,            // identity type, identity (6), IRK (16), both
+                             // little endian
+};
+
+struct rpc_stats {
+  uint32_t calls;
+  uint32_t errors;      // Calls that returned a negative status
+  uint32_t bad_frames;  // Undecodable or oversized requests
+  uint32_t rx_dropped;  // Bytes lost to a full receive ring
+  uint32_t last_service_us;
+  uint32_t max_service_us;
+  uint64_t total_service_us;
+};
+
+// Control plane for host test runners, sharing uart1 with the stream. Each
+// RPC_REQUEST frame is answered by one RPC_RESPONSE frame carrying the
+// request id, a negative errno status and the time from the request's
+// delimiter to the response being queued. Handlers run one at a time on
+// WorkQueue::data and only read the registries directly. State owned by
+// another context is handed over: advertising transitions are scheduled on
+// WorkQueue::radio and filters go into the scanner's standby copy.
+class Rpc {
+public:
+  static int init();
+  static struct rpc_stats stats();
+
+  static void receive(const uint8_t *data, size_t len);
+  static void workAction(struct k_work *work);
+
+private:
+  static void handleFrame(const uint8_t *encoded, size_t len,
+                          uint32_t received_cycles);
+  static void countBadFrame();
+
+  static struct k_spinlock _lock;
+  static struct rpc_stats _stats;
+  static struct queued_work _work;
+  static uint8_t _encoded[RPC_MAX_REQUEST + 4];
+  static size_t _encodedLength;
+  static bool _discarding; // Oversized frame, skip to the next delimiter
+};
@@ -0,0 +1,372 @@
+#include "scenario.hpp"
+#include "../peripheral/advertisement.hpp"
+#include "../roles/role_pools.hpp"
+#include <zephyr/logging/log.h>
+
+extern "C" {
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+}
+
+LOG_MODULE_REGISTER(SCENARIO, LOG_LEVEL_INF);
+
+namespace {
+
+// Role objects come from RolePools, only the value descriptors are scenario
+// specific
+ObjectPool<scenario_value, MAX_SCENARIO_CHARACTERISTICS>
+    values("scenario_value");
+
+// NUL terminated string at offset inside a record, nullptr if it overruns
+const char *stringAt(const uint8_t *payload, uint8_t len, size_t offset) {
+  if (offset >= len || !memchr(&payload[offset], '\0', len - offset)) {
+    return nullptr;
+  }
+  return (const char *)&payload[offset];
+}
+
+} // namespace
+
+bool Scenario::_isLoaded = false;
+Peripheral *Scenario::_peripheral = nullptr;
+Service *Scenario::_service = nullptr;
+Central *Scenario::_central = nullptr;
+Filter Scenario::_filter;
+uint8_t Scenario::_filterGroups = 0;
+uint8_t Scenario::_filterCriteria = 0;
+
+int Scenario::loadFromPartition() {
+#if FIXED_PARTITION_EXISTS(scenario_partition)
+  // Internal flash is memory mapped, the image is used where it is stored
+  const uint8_t *image = (const uint8_t *)(CONFIG_FLASH_BASE_ADDRESS +
+                                           FIXED_PARTITION_OFFSET(
+                                               scenario_partition));
+  return load(image, FIXED_PARTITION_SIZE(scenario_partition));
+#else
+  LOG_INF("No scenario partition on this board");
+  return -ENOENT;
+#endif
+}
+
+int Scenario::load(const uint8_t *image, size_t len) {
+  if (_isLoaded) {
+    return -EALREADY;
+  }
+
+  if (len < SCENARIO_HEADER_SIZE || memcmp(image, "BSSC", 4) != 0) {
+    LOG_INF("No scenario image");
+    return -ENOENT;
+  }
+
+  if (image[4] != SCENARIO_VERSION) {
+    LOG_ERR("Unsupported scenario version %u", image[4]);
+    return -ENOTSUP;
+  }
+
+  uint16_t bodyLength = sys_get_le16(&image[6]);
+  if (bodyLength > len - SCENARIO_HEADER_SIZE) {
+    LOG_ERR("Scenario body exceeds the partition (%u bytes)", bodyLength);
+    return -EINVAL;
+  }
+
+  const uint8_t *body = &image[SCENARIO_HEADER_SIZE];
+  if (crc32_ieee(body, bodyLength) != sys_get_le32(&image[8])) {
+    LOG_ERR("Scenario checksum mismatch");
+    return -EBADMSG;
+  }
+
+  int err = apply(body, bodyLength);
+  if (err < 0) {
+    LOG_ERR("Failed to apply scenario (err %d)", err);
+    return err;
+  }
+
+  _isLoaded = true;
+  LOG_INF("Scenario loaded (%u bytes)", bodyLength);
+  return 0;
+}
+
+int Scenario::apply(const uint8_t *body, size_t len) {
+  size_t offset = 0;
+  while (offset + 2 <= len) {
+    ScenarioRecord type = (ScenarioRecord)body[offset];
+    uint8_t recordLength = body[offset + 1];
+    const uint8_t *payload = &body[offset + 2];
+
+    if (offset + 2 + recordLength > len) {
+      LOG_ERR("Truncated scenario record at %u", offset);
+      return -EINVAL;
+    }
+
+    int err = 0;
+    switch (type) {
+    case ScenarioRecord::END:
+      offset = len;
+      continue;
+    case ScenarioRecord::PERIPHERAL:
+      err = addPeripheral(payload, recordLength);
+      break;
+    case ScenarioRecord::SERVICE:
+      err = addService(payload, recordLength);
+      break;
+    case ScenarioRecord::CHARACTERISTIC:
+      err = addCharacteristic(payload, recordLength);
+      break;
+    case ScenarioRecord::CENTRAL:
+      err = addCentral(payload, recordLength);
+      break;
+    case ScenarioRecord::FILTER_GROUP:
+      err = addFilterGroup(payload, recordLength);
+      break;
+    case ScenarioRecord::FILTER_CRITERION:
+      err = addFilterCriterion(payload, recordLength);
+      break;
+    default:
+      LOG_WRN("Skipping unknown scenario record %u", (uint8_t)type);
+      break;
+    }
+
+    if (err < 0) {
+      LOG_ERR("Scenario record %u at %u rejected", (uint8_t)type, offset);
+      return err;
+    }
+
+    offset += 2 + recordLength;
+  }
+
+  int err = finishPeripheral();
+  if (err < 0) {
+    return err;
+  }
+  return finishCentral();
+}
+
+int Scenario::addPeripheral(const uint8_t *payload, uint8_t len) {
+  const char *name = stringAt(payload, len, 1);
+  if (!name) {
+    return -EINVAL;
+  }
+
+  int err = finishPeripheral();
+  if (err < 0) {
+    return err;
+  }
+
+  struct pool_handle peripheralHandle = RolePools::peripherals.create();
+  struct pool_handle advertisementHandle = RolePools::advertisements.create();
+  Peripheral *peripheral = RolePools::peripherals.get(peripheralHandle);
+  Advertisement *advertisement =
+      RolePools::advertisements.get(advertisementHandle);
+  if (!peripheral || !advertisement) {
+    LOG_ERR("Scenario has more than %d peripherals", MAX_SCENARIO_PERIPHERALS);
+    err = -ENOMEM;
+  } else {
+    err = advertisement->init(name,
+                              payload[0] & SCENARIO_PERIPHERAL_CONNECTABLE);
+  }
+
+  if (err < 0) {
+    // Release whichever half was claimed so the slots stay usable
+    RolePools::advertisements.destroy(advertisementHandle);
+    RolePools::peripherals.destroy(peripheralHandle);
+    return err;
+  }
+
+  peripheral->addAdvertisement(advertisement);
+  _peripheral = peripheral;
+  _service = nullptr;
+  return 0;
+}
+
+int Scenario::addService(const uint8_t *payload, uint8_t len) {
+  const char *name = stringAt(payload, len, SCENARIO_UUID_SIZE);
+  if (!name || !_peripheral) {
+    return -EINVAL;
+  }
+
+  if (_peripheral->_serviceCount >= MAX_SERVICES_PER_PERIPHERAL) {
+    return -ENOMEM;
+  }
+
+  Service *service = RolePools::services.emplace();
+  if (!service) {
+    return -ENOMEM;
+  }
+
+  service->init((const struct bt_uuid *)payload, name);
+  _peripheral->addService(service);
+  _service = service;
+  return 0;
+}
+
+int Scenario::addCharacteristic(const uint8_t *payload, uint8_t len) {
+  // uuid, properties, permissions, generator, value length
+  constexpr size_t fixed = SCENARIO_UUID_SIZE + 5;
+  if (len < fixed || !_service) {
+    return -EINVAL;
+  }
+
+  uint8_t valueLength = payload[fixed - 1];
+  const char *name = stringAt(payload, len, fixed + valueLength);
+  if (!name) {
+    return -EINVAL;
+  }
+
+  uint8_t generator = payload[SCENARIO_UUID_SIZE + 3];
+  if (generator > (uint8_t)ScenarioGenerator::COUNTER) {
+    return -EINVAL;
+  }
+
+  if (_service->_chrcCount >= MAX_CHARACTERISTICS_PER_SERVICE) {
+    return -ENOMEM;
+  }
+
+  Characteristic *characteristic = RolePools::characteristics.emplace();
+  scenario_value *value = values.emplace();
+  if (!characteristic || !value) {
+    return -ENOMEM;
+  }
+
+  value->data = &payload[fixed];
+  value->length = valueLength;
+  value->generator = (ScenarioGenerator)generator;
+  value->counter = 0;
+  if (value->generator == ScenarioGenerator::COUNTER) {
+    uint8_t start[4] = {0};
+    memcpy(start, value->data, MIN(valueLength, sizeof(start)));
+    value->counter = sys_get_le32(start);
+  }
+
+  characteristic->init((const struct bt_uuid *)payload,
+                       payload[SCENARIO_UUID_SIZE],
+                       sys_get_le16(&payload[SCENARIO_UUID_SIZE + 1]), name);
+  characteristic->_userData = value;
+  characteristic->_readCallback = Scenario::readValue;
+  _service->addCharacteristic(characteristic);
+  return 0;
+}
+
+int Scenario::addCentral(const uint8_t *payload, uint8_t len) {
+  if (len < 1) {
+    return -EINVAL;
+  }
+
+  int err = finishCentral();
+  if (err < 0) {
+    return err;
+  }
+
+  if (payload[0] > MAX_CENTRAL_CONNECTIONS) {
+    LOG_ERR("Scenario central wants %u connections, at most %d fit",
+            payload[0], MAX_CENTRAL_CONNECTIONS);
+    return -EINVAL;
+  }
+
+  uint8_t maxConnections = payload[0] ? payload[0] : MAX_CENTRAL_CONNECTIONS;
+  Central *central = RolePools::centrals.emplace(maxConnections);
+  if (!central) {
+    LOG_ERR("Scenario has more than %d centrals", MAX_CENTRALS);
+    return -ENOMEM;
+  }
+
+  _filter = Filter();
+  _filterGroups = 0;
+  _filterCriteria = 0;
+  _central = central;
+  return 0;
+}
+
+int Scenario::addFilterGroup(const uint8_t *payload, uint8_t len) {
+  if (len < 1 || !_central || payload[0] > (uint8_t)FilterOperator::OR) {
+    return -EINVAL;
+  }
+
+  if (_filterGroups >= MAX_FILTER_GROUPS) {
+    LOG_ERR("Scenario filter has more than %d groups", MAX_FILTER_GROUPS);
+    return -EINVAL;
+  }
+
+  _filter.addGroup();
+  _filter.setGroupOperator((FilterOperator)payload[0]);
+  _filterGroups++;
+  _filterCriteria = 0;
+  return 0;
+}
+
+int Scenario::addFilterCriterion(const uint8_t *payload, uint8_t len) {
+  const char *pattern = stringAt(payload, len, 1);
+  if (!pattern || !_central ||
+      payload[0] > (uint8_t)FilterCriterionType::IDENTITY) {
+    return -EINVAL;
+  }
+
+  // Same limits as the FILTER_SET RPC, Filter itself only warns and drops
+  if (!_filterGroups || _filterCriteria >= MAX_CRITERIA_PER_GROUP ||
+      strlen(pattern) >= MAX_PATTERN_LENGTH ||
+      !_filter.validatePattern(pattern)) {
+    LOG_ERR("Scenario filter criterion \"%s\" rejected", pattern);
+    return -EINVAL;
+  }
+
+  _filter.addCriterion((FilterCriterionType)payload[0], pattern);
+  _filterCriteria++;
+  return 0;
+}
+
+int Scenario::finishPeripheral() {
+  if (!_peripheral) {
+    return 0;
+  }
+
+  for (uint8_t i = 0; i < _peripheral->_serviceCount; i++) {
+    int err = _peripheral->_services[i]->buildService();
+    if (err < 0) {
+      LOG_ERR("Peripheral %d failed to build service %u (err %d)",
+              _peripheral->_index, i, err);
+      return err;
+    }
+  }
+  _peripheral->registerServices();
+
+  int err = _peripheral->_advertisement->startAdvertising();
+  if (err < 0) {
+    LOG_ERR("Peripheral %d failed to start advertising (err %d)",
+            _peripheral->_index, err);
+    return err;
+  }
+
+  _peripheral = nullptr;
+  _service = nullptr;
+  return 0;
+}
+
+int Scenario::finishCentral() {
+  if (!_central) {
+    return 0;
+  }
+
+  _central->addFilter(_filter);
+  _central->scheduleScanningStart();
+  _central = nullptr;
+  return 0;
+}
+
+ssize_t Scenario::readValue(struct bt_conn *conn,
+                            const struct bt_gatt_attr *attr, void *buf,
+                            uint16_t len, uint16_t offset) {
+  Characteristic *self = static_cast<Characteristic *>(attr->user_data);
+  scenario_value *value = static_cast<scenario_value *>(self->_userData);
+
+  if (value->generator == ScenarioGenerator::COUNTER) {
+    // A read at offset 0 takes the next value, long reads continue it
+    uint32_t current = offset == 0 ? value->counter++ : value->counter - 1;
+    uint8_t counter[4];
+    sys_put_le32(current, counter);
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, counter,
+                             sizeof(counter));
+  }
+
+  return bt_gatt_attr_read(conn, attr, buf, len, offset, value->data,
+                           value->length);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "../central/central.hpp"
+#include "../peripheral/characteristic.hpp"
+#include "../peripheral/peripheral.hpp"
+#include "../peripheral/service.hpp"
+#include "scenario_format.hpp"
+
+extern "C" {
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/kernel.h>
+}
+
+#define MAX_SCENARIO_PERIPHERALS MIN(MAX_PERIPHERALS, MAX_ADVERTISEMENTS)
+#define MAX_SCENARIO_SERVICES                                                  \
+  (MAX_SCENARIO_PERIPHERALS * MAX_SERVICES_PER_PERIPHERAL)
+#define MAX_SCENARIO_CHARACTERISTICS                                           \
+  (MAX_SCENARIO_SERVICES * MAX_CHARACTERISTICS_PER_SERVICE)
+
+// Characteristic::_userData of scenario characteristics
+struct scenario_value {
+  const uint8_t *data; // Points into the image
+  uint8_t length;
+  ScenarioGenerator generator;
+  uint32_t counter;
+};
+
+// Builds the topology from a scenario image instead of main(). The image is
+// walked in place: names and patterns are copied by the objects that own
+// them, UUIDs and static values are referenced where they lie. Objects are
+// constructed into static storage, a scenario is loaded once per boot.
+class Scenario {
+public:
+  static int loadFromPartition();
+  static int load(const uint8_t *image, size_t len);
+  static bool isLoaded() { return _isLoaded; }
+
+  static ssize_t readValue(struct bt_conn *conn,
+                           const struct bt_gatt_attr *attr, void *buf,
+                           uint16_t len, uint16_t offset);
+
+private:
+  static int apply(const uint8_t *body, size_t len);
+  static int addPeripheral(const uint8_t *payload, uint8_t len);
+  static int addService(const uint8_t *payload, uint8_t len);
+  static int addCharacteristic(const uint8_t *payload, uint8_t len);
+  static int addCentral(const uint8_t *payload, uint8_t len);
+  static int addFilterGroup(const uint8_t *payload, uint8_t len);
+  static int addFilterCriterion(const uint8_t *payload, uint8_t len);
+  static int finishPeripheral();
+  static int finishCentral();
+
+  static bool _isLoaded;
+  static Peripheral *_peripheral;
+  static Service *_service;
+  static Central *_central;
+  static Filter _filter;
+  static uint8_t _filterGroups;
+  static uint8_t _filterCriteria;
+};
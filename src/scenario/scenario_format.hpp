@@ -0,0 +1,39 @@
+#pragma once
+
+// Binary scenario image produced by scripts/scenario_compile.py.
+//
+// Layout (little endian):
+//   header:  "BSSC" | version (1) | reserved (1) | body length (2) |
+//            crc32_ieee of the body (4)
+//   body:    records of type (1) | length (1) | payload (length)
+// Records apply to the most recent PERIPHERAL/SERVICE/CENTRAL before them.
+// Strings are NUL terminated inside their record. UUIDs are stored as a
+// struct bt_uuid_128 (type byte then 16 value bytes) so the GATT database
+// can point straight into the image.
+
+extern "C" {
+#include <stdint.h>
+}
+
+#define SCENARIO_VERSION 1
+#define SCENARIO_HEADER_SIZE 12
+#define SCENARIO_UUID_SIZE 17
+
+enum class ScenarioRecord : uint8_t {
+  END = 0,
+  PERIPHERAL = 1,       // flags (1) | name
+  SERVICE = 2,          // uuid (17) | name
+  CHARACTERISTIC = 3,   // uuid (17) | properties (1) | permissions (2) |
+                        // generator (1) | value length (1) | value | name
+  CENTRAL = 4,          // max connections (1), 0 for the default
+  FILTER_GROUP = 5,     // FilterOperator (1)
+  FILTER_CRITERION = 6, // FilterCriterionType (1) | pattern
+};
+
+#define SCENARIO_PERIPHERAL_CONNECTABLE 0x01
+
+// How a characteristic value is produced on read
+enum class ScenarioGenerator : uint8_t {
+  STATIC = 0,  // The value bytes in the image
+  COUNTER = 1, // 32-bit counter starting at the value, +1 per read
+};